@@ -13,33 +13,89 @@ $(shell mkdir -p $(SPECIAL_OUTDIRS) )
 # Assembly song compilation
 $(SONG_BUILDDIR)/%.o: $(SONG_SUBDIR)/%.s
 	$(AS) $(ASFLAGS) -I sound -o $@ $<
-$(MID_BUILDDIR)/%.o: $(MID_ASM_DIR)/%.s
-	$(AS) $(ASFLAGS) -I sound -o $@ $<
 
 # Compressed cries
-$(CRY_BIN_DIR)/%.bin: $(CRY_SUBDIR)/%.aif 
-	$(AIF) $< $@ --compress
+# The cries are rebuilt when OPTIMIZE_CRIES changes, which the file records.
+CRY_OPTIMIZE_FILE := $(CRY_BIN_DIR)/optimize_cries.txt
+$(shell echo $(OPTIMIZE_CRIES) | cmp -s - $(CRY_OPTIMIZE_FILE) || echo $(OPTIMIZE_CRIES) > $(CRY_OPTIMIZE_FILE))
+
+ifeq ($(OPTIMIZE_CRIES),1)
+  CRY_COMPRESS_ARGS := --compress --optimize
+else
+  CRY_COMPRESS_ARGS := --compress
+endif
+
+# aif2pcm converts every cry that changed since the last run in one batch, or all of
+# them when OPTIMIZE_CRIES changed. It only rewrites the .bin files whose contents
+# changed, so the stamp records when the run happened. Like the other stamps, it is
+# brought up to date by the `generated` run before the build, so that make sees the
+# new times of the files that changed.
+CRY_AIFS := $(wildcard $(CRY_SUBDIR)/*.aif)
+CRY_STAMP := $(CRY_BIN_DIR)/cries.stamp
+AUTO_GEN_TARGETS += $(CRY_STAMP)
+
+$(CRY_STAMP): $(CRY_AIFS) $(CRY_OPTIMIZE_FILE)
+	$(AIF) --batch $(CRY_COMPRESS_ARGS) $(if $(filter $(CRY_OPTIMIZE_FILE),$?),$(CRY_AIFS),$(filter %.aif,$?))
+	@touch $@
+
+# The stamp tracks the .aif files, so an existing .bin is up to date once the stamp is,
+# and only a deleted one is regenerated here on its own.
+$(CRY_BIN_DIR)/%.bin: | $(CRY_STAMP)
+	@test -f $@ || $(AIF) $(CRY_SUBDIR)/$*.aif $@ $(CRY_COMPRESS_ARGS)
+
+# Uncompressed samples, converted in one batch the same way
+SAMPLE_SUBDIR := sound/direct_sound_samples
+SAMPLE_AIFS := $(wildcard $(SAMPLE_SUBDIR)/*.aif)
+SAMPLE_STAMP := $(SOUND_BIN_DIR)/direct_sound_samples/samples.stamp
+AUTO_GEN_TARGETS += $(SAMPLE_STAMP)
+
+$(SAMPLE_STAMP): $(SAMPLE_AIFS)
+	$(AIF) --batch $?
+	@touch $@
+
+$(SOUND_BIN_DIR)/direct_sound_samples/%.bin: | $(SAMPLE_STAMP)
+	@test -f $@ || $(AIF) $(SAMPLE_SUBDIR)/$*.aif $@
 
 # Uncompressed sounds
 $(SOUND_BIN_DIR)/%.bin: sound/%.aif 
 	$(AIF) $< $@
 
-# For each line in midi.cfg, we do some trickery to convert it into a make rule for the `.mid` file described on the line
-# Data following the colon in said file corresponds to arguments passed into mid2agb
+# mid2agb reads midi.cfg itself and converts every song whose .mid is newer than the
+# stamp, or all of them when midi.cfg is, in one run using the options on the song's
+# line. It only rewrites the files whose contents changed, so the stamp records when
+# the run happened, and mid2agb compares the .mid files against it.
 MID_CFG_PATH := $(MID_SUBDIR)/midi.cfg
 
-# $1: Source path no extension, $2 Options
-define MID_RULE
-$(MID_ASM_DIR)/$1.s: $(MID_SUBDIR)/$1.mid $(MID_CFG_PATH)
-	$(MID) $$< $$@ $2
-endef
-#                            source path,                             remaining text (options)
-define MID_EXPANSION
-	$(eval $(call MID_RULE,$(basename $(patsubst %:,%,$(word 1,$1))),$(wordlist 2,999,$1)))
-endef
+ifeq ($(MID_OBJECTS),1)
+# The songs' objects are written straight into the build directory.
+MID_STAMP := $(MID_BUILDDIR)/midi.stamp
+AUTO_GEN_TARGETS += $(MID_STAMP)
+
+$(MID_STAMP): $(MID_CFG_PATH) $(wildcard $(MID_SUBDIR)/*.mid)
+	$(MID) -C $(MID_CFG_PATH) -D $(MID_BUILDDIR) -O -U -S $@
+	@touch $@
+
+# An existing object is up to date once the stamp is, so only a deleted one runs mid2agb
+# again, which converts the songs whose output is missing.
+# Warn users building without a .cfg - build will fail at link time
+$(MID_BUILDDIR)/%.o: | $(MID_STAMP)
+	$(if $(shell grep -s "^$*.mid:" $(MID_CFG_PATH)),,$(warning $(MID_SUBDIR)/$*.mid does not have an associated entry in midi.cfg! It cannot be built))
+	@test -f $@ || $(MID) -C $(MID_CFG_PATH) -D $(MID_BUILDDIR) -O -U -S $(MID_STAMP)
+else
+MID_STAMP := $(MID_ASM_DIR)/midi.stamp
+AUTO_GEN_TARGETS += $(MID_STAMP)
+
+$(MID_BUILDDIR)/%.o: $(MID_ASM_DIR)/%.s
+	$(AS) $(ASFLAGS) -I sound -o $@ $<
 
-$(foreach line,$(shell cat $(MID_CFG_PATH) | sed "s/ /__SPACE__/g"),$(call MID_EXPANSION,$(subst __SPACE__, ,$(line))))
+$(MID_STAMP): $(MID_CFG_PATH) $(wildcard $(MID_SUBDIR)/*.mid)
+	$(MID) -C $(MID_CFG_PATH) -U -S $@
+	@touch $@
 
+# An existing .s is up to date once the stamp is, so only a deleted one runs mid2agb
+# again, which converts the songs whose output is missing.
 # Warn users building without a .cfg - build will fail at link time
-$(MID_ASM_DIR)/%.s: $(MID_SUBDIR)/%.mid
-	$(warning $< does not have an associated entry in midi.cfg! It cannot be built)
+$(MID_ASM_DIR)/%.s: | $(MID_STAMP)
+	$(if $(shell grep -s "^$*.mid:" $(MID_CFG_PATH)),,$(warning $(MID_SUBDIR)/$*.mid does not have an associated entry in midi.cfg! It cannot be built))
+	@test -f $@ || $(MID) -C $(MID_CFG_PATH) -U -S $(MID_STAMP)
+endif
@@ -11,6 +11,20 @@ COMPARE       ?= 0
 
 KEEP_TEMPS    ?= 0
 
+# Has mid2agb write the songs in sound/songs/midi as object files directly instead of
+# .s files for as to assemble. The ROM comes out the same either way.
+MID_OBJECTS ?= 0
+
+# Compresses each cry with the deltas that keep the whole of each 64-sample block closest
+# to the .aif, instead of the closest delta sample by sample. Cries the original encoding
+# already stores exactly come out the same, but edited ones sound better at the same
+# size. This can change the ROM.
+OPTIMIZE_CRIES ?= 0
+
+# Stores each map layout's blockdata LZ77-compressed (lz) or run-length-encoded (rl)
+# instead of raw (none), and decompresses it when the map is loaded. This changes the ROM.
+MAP_BLOCKDATA_COMPRESSION ?= none
+
 ifeq (modern,$(MAKECMDGOALS))
   MODERN := 1
 endif
@@ -458,6 +458,13 @@
 #define GOOD_ROD  1
 #define SUPER_ROD 2
 
+// Item type IDs (used to determine the exit callback)
+#define ITEM_TYPE_MAIL       0
+#define ITEM_TYPE_PARTY_MENU 1
+#define ITEM_TYPE_FIELD      2
+#define ITEM_TYPE_UNUSED     3 // Used for Pokeblock case in RSE
+#define ITEM_TYPE_BAG_MENU   4 // No exit callback, stays in bag menu
+
 // Check if the item is one that can be used on a Pokemon.
 #define IS_POKEMON_ITEM(item) ((item) >= ITEM_POTION && (item) <= MAX_BERRY_INDEX)
 
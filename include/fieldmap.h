@@ -46,6 +46,11 @@ bool8 CameraMove(s32 x, s32 y);
 void CopyMapTilesetsToVram(struct MapLayout const * mapLayout);
 void LoadMapTilesetPalettes(struct MapLayout const * mapLayout);
 void InitMap(void);
+#if COMPRESSED_MAP_BLOCKDATA
+const u16 *GetMapLayoutBlockdata(const struct MapLayout *mapLayout);
+#else
+#define GetMapLayoutBlockdata(mapLayout) ((mapLayout)->map)
+#endif
 void CopySecondaryTilesetToVramUsingHeap(const struct MapLayout * mapLayout);
 void LoadSecondaryTilesetPalette(const struct MapLayout * mapLayout);
 void InitMapFromSavedGame(void);
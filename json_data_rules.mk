@@ -2,21 +2,19 @@
 # based on an Inja template. https://github.com/pantor/inja
 
 AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/wild_encounters.h
-$(DATA_SRC_SUBDIR)/wild_encounters.h: $(DATA_SRC_SUBDIR)/wild_encounters.json $(DATA_SRC_SUBDIR)/wild_encounters.json.txt
-	$(JSONPROC) $^ $@
+$(DATA_SRC_SUBDIR)/wild_encounters.h: $(DATA_SRC_SUBDIR)/wild_encounters.json $(DATA_SRC_SUBDIR)/wild_encounters.json.txt $(DATA_SRC_SUBDIR)/wild_encounters.rates.json.txt
+	$(JSONPROC) $< $(word 2,$^) $@
 
 $(C_BUILDDIR)/wild_encounter.o: c_dep += $(DATA_SRC_SUBDIR)/wild_encounters.h
 
+# Both region map headers come from one jsonproc run so that region_map_sections.json is only parsed once.
+# (A pattern rule, because those build all of their targets with a single run of the recipe.)
 AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/region_map/region_map_entries.h
-$(DATA_SRC_SUBDIR)/region_map/region_map_entries.h: $(DATA_SRC_SUBDIR)/region_map/region_map_sections.json $(DATA_SRC_SUBDIR)/region_map/region_map_sections.entries.json.txt
-	$(JSONPROC) $^ $@
-
-$(C_BUILDDIR)/region_map.o: c_dep += $(DATA_SRC_SUBDIR)/region_map/region_map_entries.h
-
 AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/region_map/region_map_entry_strings.h
-$(DATA_SRC_SUBDIR)/region_map/region_map_entry_strings.h: $(DATA_SRC_SUBDIR)/region_map/region_map_sections.json $(DATA_SRC_SUBDIR)/region_map/region_map_sections.strings.json.txt
-	$(JSONPROC) $^ $@
+%/region_map_entries.h %/region_map_entry_strings.h: %/region_map_sections.json %/region_map_sections.entries.json.txt %/region_map_sections.strings.json.txt
+	$(JSONPROC) $< $(word 2,$^) $*/region_map_entries.h $< $(word 3,$^) $*/region_map_entry_strings.h
 
+$(C_BUILDDIR)/region_map.o: c_dep += $(DATA_SRC_SUBDIR)/region_map/region_map_entries.h
 $(C_BUILDDIR)/region_map.o: c_dep += $(DATA_SRC_SUBDIR)/region_map/region_map_entry_strings.h
 
 AUTO_GEN_TARGETS += $(DATA_SRC_SUBDIR)/items.h
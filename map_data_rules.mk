@@ -12,21 +12,53 @@ INCLUDECONSTS_OUTDIR := include/constants
 AUTO_GEN_TARGETS += $(INCLUDECONSTS_OUTDIR)/map_groups.h
 AUTO_GEN_TARGETS += $(INCLUDECONSTS_OUTDIR)/layouts.h
 
-MAP_DIRS := $(dir $(wildcard $(MAPS_DIR)/*/map.json))
+MAP_JSONS := $(wildcard $(MAPS_DIR)/*/map.json)
+MAP_DIRS := $(dir $(MAP_JSONS))
 MAP_CONNECTIONS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/connections.inc,$(MAP_DIRS))
 MAP_EVENTS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/events.inc,$(MAP_DIRS))
 MAP_HEADERS := $(patsubst $(MAPS_DIR)/%/,$(MAPS_DIR)/%/header.inc,$(MAP_DIRS))
 
-$(DATA_ASM_BUILDDIR)/maps.o: $(DATA_ASM_SUBDIR)/maps.s $(LAYOUTS_DIR)/layouts.inc $(LAYOUTS_DIR)/layouts_table.inc $(MAPS_DIR)/headers.inc $(MAPS_DIR)/groups.inc $(MAPS_DIR)/connections.inc $(MAP_CONNECTIONS) $(MAP_HEADERS)
+# With MAP_BLOCKDATA_COMPRESSION, layouts.inc includes gbagfx's compressed copy of each
+# map.bin, and mapjson checks their headers and reports the ROM saved. The setting is
+# recorded in a file that only changes with it, so that changing it regenerates layouts.inc.
+LAYOUTS_COMPRESSION_FILE := $(LAYOUTS_OUTDIR)/blockdata_compression.txt
+$(shell echo $(MAP_BLOCKDATA_COMPRESSION) | cmp -s - $(LAYOUTS_COMPRESSION_FILE) || echo $(MAP_BLOCKDATA_COMPRESSION) > $(LAYOUTS_COMPRESSION_FILE))
+
+ifneq ($(MAP_BLOCKDATA_COMPRESSION),none)
+  LAYOUT_BLOCKDATA := $(patsubst %,%.$(MAP_BLOCKDATA_COMPRESSION),$(wildcard $(LAYOUTS_DIR)/*/map.bin))
+  LAYOUTS_COMPRESSION_ARG := $(MAP_BLOCKDATA_COMPRESSION)
+endif
+
+$(DATA_ASM_BUILDDIR)/maps.o: $(DATA_ASM_SUBDIR)/maps.s $(LAYOUTS_DIR)/layouts.inc $(LAYOUTS_DIR)/layouts_table.inc $(MAPS_DIR)/headers.inc $(MAPS_DIR)/groups.inc $(MAPS_DIR)/connections.inc $(MAP_CONNECTIONS) $(MAP_HEADERS) $(LAYOUT_BLOCKDATA)
 	$(PREPROC) $< charmap.txt | $(CPP) -I include -nostdinc -undef -Wno-unicode - | $(PREPROC) -ie $< charmap.txt | $(AS) $(ASFLAGS) -o $@
 $(DATA_ASM_BUILDDIR)/map_events.o: $(DATA_ASM_SUBDIR)/map_events.s $(MAPS_DIR)/events.inc $(MAP_EVENTS)
 	$(PREPROC) $< charmap.txt | $(CPP) -I include -nostdinc -undef -Wno-unicode - | $(PREPROC) -ie $< charmap.txt | $(AS) $(ASFLAGS) -o $@
 
-$(MAPS_OUTDIR)/%/header.inc $(MAPS_OUTDIR)/%/events.inc $(MAPS_OUTDIR)/%/connections.inc: $(MAPS_DIR)/%/map.json
-	$(MAPJSON) map firered $< $(LAYOUTS_DIR)/layouts.json $(@D)
+# Every map, layout, warp and connection is cross-checked before anything is generated from them,
+# so that a dangling reference is reported here rather than by the assembler or linker.
+MAPS_VALID_STAMP := $(MAPS_OUTDIR)/validate.stamp
+
+$(MAPS_VALID_STAMP): $(MAP_JSONS) $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json
+	$(MAPJSON) validate firered $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json
+	@touch $@
+
+# All of the map data is generated by one mapjson run, which only rewrites the files whose
+# contents changed. The stamp is brought up to date by the `generated` run before the build,
+# so that make sees the new times of the files that changed.
+MAPS_STAMP := $(MAPS_OUTDIR)/maps.stamp
+AUTO_GEN_TARGETS += $(MAPS_STAMP)
+
+$(MAPS_STAMP): $(MAP_JSONS) $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json $(LAYOUTS_COMPRESSION_FILE) | $(LAYOUT_BLOCKDATA) $(MAPS_VALID_STAMP)
+	$(MAPJSON) all firered $(MAPS_DIR)/map_groups.json $(LAYOUTS_DIR)/layouts.json $(MAPS_OUTDIR) $(LAYOUTS_OUTDIR) $(INCLUDECONSTS_OUTDIR) $(LAYOUTS_COMPRESSION_ARG)
+	@touch $@
+
+# An existing output is up to date once the stamp is, so only a deleted one is regenerated here
+# by the mode that writes it.
+$(MAP_HEADERS) $(MAP_EVENTS) $(MAP_CONNECTIONS): | $(MAPS_STAMP)
+	@test -f $@ || $(MAPJSON) map firered $(@D)/map.json $(LAYOUTS_DIR)/layouts.json $(@D)
 
-$(MAPS_OUTDIR)/connections.inc $(MAPS_OUTDIR)/groups.inc $(MAPS_OUTDIR)/events.inc $(MAPS_OUTDIR)/headers.inc $(INCLUDECONSTS_OUTDIR)/map_groups.h: $(MAPS_DIR)/map_groups.json
-	$(MAPJSON) groups firered $< $(MAPS_OUTDIR) $(INCLUDECONSTS_OUTDIR)
+$(MAPS_OUTDIR)/connections.inc $(MAPS_OUTDIR)/groups.inc $(MAPS_OUTDIR)/events.inc $(MAPS_OUTDIR)/headers.inc $(INCLUDECONSTS_OUTDIR)/map_groups.h: | $(MAPS_STAMP)
+	@test -f $@ || $(MAPJSON) groups firered $(MAPS_DIR)/map_groups.json $(MAPS_OUTDIR) $(INCLUDECONSTS_OUTDIR)
 
-$(LAYOUTS_OUTDIR)/layouts.inc $(LAYOUTS_OUTDIR)/layouts_table.inc $(INCLUDECONSTS_OUTDIR)/layouts.h: $(LAYOUTS_DIR)/layouts.json
-	$(MAPJSON) layouts firered $< $(LAYOUTS_OUTDIR) $(INCLUDECONSTS_OUTDIR)
+$(LAYOUTS_OUTDIR)/layouts.inc $(LAYOUTS_OUTDIR)/layouts_table.inc $(INCLUDECONSTS_OUTDIR)/layouts.h: | $(MAPS_STAMP)
+	@test -f $@ || $(MAPJSON) layouts firered $(LAYOUTS_DIR)/layouts.json $(LAYOUTS_OUTDIR) $(INCLUDECONSTS_OUTDIR) $(LAYOUTS_COMPRESSION_ARG)
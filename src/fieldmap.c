@@ -4,6 +4,7 @@
 #include "script.h"
 #include "new_menu_helpers.h"
 #include "quest_log.h"
+#include "decompress.h"
 #include "fieldmap.h"
 
 struct ConnectionFlags
@@ -19,6 +20,9 @@ EWRAM_DATA u16 gBackupMapData[VIRTUAL_MAP_SIZE] = {};
 EWRAM_DATA struct MapHeader gMapHeader = {};
 EWRAM_DATA struct Camera gCamera = {};
 static EWRAM_DATA struct ConnectionFlags gMapConnectionFlags = {};
+#if COMPRESSED_MAP_BLOCKDATA
+static EWRAM_DATA const struct MapLayout *sDecompressedLayout = NULL;
+#endif
 EWRAM_DATA u8 gGlobalFieldTintMode = QL_TINT_NONE;
 
 static const struct ConnectionFlags sDummyConnectionFlags = {};
@@ -108,10 +112,47 @@ static void InitMapLayoutData(struct MapHeader * mapHeader)
     VMap.Xsize = mapLayout->width + MAP_OFFSET_W;
     VMap.Ysize = mapLayout->height + MAP_OFFSET_H;
     AGB_ASSERT_EX(VMap.Xsize * VMap.Ysize <= VIRTUAL_MAP_SIZE, ABSPATH("fieldmap.c"), 158);
-    InitBackupMapLayoutData(mapLayout->map, mapLayout->width, mapLayout->height);
+    InitBackupMapLayoutData(GetMapLayoutBlockdata(mapLayout), mapLayout->width, mapLayout->height);
+#if COMPRESSED_MAP_BLOCKDATA
+    sDecompressedLayout = mapLayout;
+#endif
     InitBackupMapLayoutConnections(mapHeader);
 }
 
+#if COMPRESSED_MAP_BLOCKDATA
+// mapjson stores the blockdata behind the BIOS compression header, whose low byte
+// says whether it's LZ77 (0x10) or run-length (0x30) data. It's decompressed into
+// gDecompressionBuffer, so the result is only good until that is next used.
+const u16 *GetMapLayoutBlockdata(const struct MapLayout *mapLayout)
+{
+    u32 header = *(const u32 *)mapLayout->map;
+
+    AGB_ASSERT((header >> 8) <= sizeof(gDecompressionBuffer));
+    if ((header & 0xF0) == 0x30)
+        RLUnCompWram(mapLayout->map, gDecompressionBuffer);
+    else
+        LZ77UnCompWram(mapLayout->map, gDecompressionBuffer);
+    return (const u16 *)gDecompressionBuffer;
+}
+
+// A connection only copies a strip at most 8 blocks deep, but the BIOS can only
+// decompress a connected map whole, which costs about as much as loading it. Up to
+// four maps are decompressed per load this way, so a map that is already in
+// gDecompressionBuffer (the map being loaded, or one connected on two sides) is
+// used from there. `mapjson loadcost` measures what this costs for every map.
+static const u16 *GetConnectedMapBlockdata(const struct MapLayout *mapLayout)
+{
+    if (mapLayout != sDecompressedLayout)
+    {
+        sDecompressedLayout = mapLayout;
+        return GetMapLayoutBlockdata(mapLayout);
+    }
+    return (const u16 *)gDecompressionBuffer;
+}
+#else
+#define GetConnectedMapBlockdata(mapLayout) ((mapLayout)->map)
+#endif
+
 static void InitBackupMapLayoutData(const u16 *map, u16 width, u16 height)
 {
     s32 y;
@@ -178,7 +219,7 @@ static void FillConnection(s32 x, s32 y, const struct MapHeader *connectedMapHea
     s32 mapWidth;
 
     mapWidth = connectedMapHeader->mapLayout->width;
-    src = &connectedMapHeader->mapLayout->map[mapWidth * y2 + x2];
+    src = &GetConnectedMapBlockdata(connectedMapHeader->mapLayout)[mapWidth * y2 + x2];
     dest = &VMap.map[VMap.Xsize * y + x];
 
     for (i = 0; i < height; i++)
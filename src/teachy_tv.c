@@ -1225,6 +1225,9 @@ static void TeachyTvLoadBg3Map(u16 *buffer)
     void *palIndicesBuffer;
     u16 numMapTilesRows = 0;
     const struct MapLayout *layout = &Route1_Layout;
+#if COMPRESSED_MAP_BLOCKDATA
+    const u16 *blockdata;
+#endif
     u16 * blockIndicesBuffer = AllocZeroed(0x800);
     tilesetsBuffer = AllocZeroed(NUM_TILES_TOTAL * TILE_SIZE_4BPP);
     palIndicesBuffer = Alloc(16);
@@ -1232,12 +1235,19 @@ static void TeachyTvLoadBg3Map(u16 *buffer)
 
     TeachyTvLoadMapTilesetToBuffer(layout->primaryTileset, tilesetsBuffer, NUM_TILES_IN_PRIMARY);
     TeachyTvLoadMapTilesetToBuffer(layout->secondaryTileset, tilesetsBuffer + NUM_TILES_IN_PRIMARY * TILE_SIZE_4BPP, NUM_TILES_TOTAL - NUM_TILES_IN_PRIMARY);
+#if COMPRESSED_MAP_BLOCKDATA
+    blockdata = GetMapLayoutBlockdata(layout);
+#endif
 
     for (i = 0; i < 9; i++)
     {
         for (j = 0; j < 16; j++)
         {
+#if COMPRESSED_MAP_BLOCKDATA
+            currentBlockIdx = blockdata[8 + (i + 6) * layout->width + j] & 0x3FF;
+#else
             currentBlockIdx = layout->map[8 + (i + 6) * layout->width + j] & 0x3FF;
+#endif
             for (k = 0; k < (i << 4) + j; k++)
             {
                 if (blockIndicesBuffer[k] == 0)
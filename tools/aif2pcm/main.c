@@ -18,12 +18,24 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* extended.c */
 void ieee754_write_extended (double, uint8_t*);
@@ -112,6 +124,76 @@ void free_bytearray(struct Bytes *bytes)
 	free(bytes);
 }
 
+// Maps a file into memory read-only instead of copying it into a buffer.
+// Free it with unmap_bytearray.
+struct Bytes *map_bytearray(const char *filename)
+{
+#ifdef _WIN32
+	return read_bytearray(filename);
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		FATAL_ERROR("Failed to open '%s' for reading!\n", filename);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		FATAL_ERROR("Failed to read data from '%s'!\n", filename);
+	}
+	struct Bytes *bytes = malloc(sizeof(struct Bytes));
+	bytes->length = st.st_size;
+	void *data = mmap(NULL, bytes->length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		FATAL_ERROR("Failed to map '%s'!\n", filename);
+	}
+	bytes->data = data;
+	return bytes;
+#endif
+}
+
+void unmap_bytearray(struct Bytes *bytes)
+{
+#ifdef _WIN32
+	free_bytearray(bytes);
+#else
+	munmap(bytes->data, bytes->length);
+	free(bytes);
+#endif
+}
+
+// Writes the bytes unless the file already holds exactly them, so that whatever is
+// built from an unchanged file isn't rebuilt. Returns whether the file was written.
+bool write_bytearray_if_changed(const char *filename, struct Bytes *bytes)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f)
+	{
+		bool same = fseek(f, 0, SEEK_END) == 0 && (unsigned long)ftell(f) == bytes->length;
+		if (same)
+		{
+			uint8_t buffer[0x10000];
+			unsigned long pos = 0;
+			fseek(f, 0, SEEK_SET);
+			while (same && pos < bytes->length)
+			{
+				size_t count = fread(buffer, 1, sizeof(buffer), f);
+				same = count > 0 && memcmp(buffer, bytes->data + pos, count) == 0;
+				pos += count;
+			}
+		}
+		fclose(f);
+		if (same)
+		{
+			return false;
+		}
+	}
+	write_bytearray(filename, bytes);
+	return true;
+}
+
 char *get_file_extension(char *filename)
 {
 	char *index = strrchr(filename, '.');
@@ -482,7 +564,193 @@ int get_delta_index(uint8_t sample, uint8_t prev_sample)
 	return best_index;
 }
 
-struct Bytes *delta_compress(struct Bytes *pcm)
+// get_delta_index for every (prev_sample, sample) pair, so that the encoder
+// doesn't search the delta table for each sample.
+static uint8_t sDeltaIndexTable[256][256];
+static bool sDeltaIndexTableReady;
+
+static void init_delta_index_table(void)
+{
+	if (sDeltaIndexTableReady)
+	{
+		return;
+	}
+
+	for (int prev_sample = 0; prev_sample < 256; prev_sample++)
+	{
+		for (int sample = 0; sample < 256; sample++)
+		{
+			sDeltaIndexTable[prev_sample][sample] = get_delta_index(sample, prev_sample);
+		}
+	}
+
+	sDeltaIndexTableReady = true;
+}
+
+// Encodes pairs of samples as deltas from base, two to a byte, high nibble first.
+static inline uint8_t *encode_delta_pairs(uint8_t *dest, const uint8_t *samples, int num_pairs, uint8_t base)
+{
+	for (int k = 0; k < num_pairs; k++)
+	{
+		uint8_t hi = sDeltaIndexTable[base][samples[0]];
+		base += gDeltaEncodingTable[hi];
+		uint8_t lo = sDeltaIndexTable[base][samples[1]];
+		base += gDeltaEncodingTable[lo];
+		*dest++ = (hi << 4) | lo;
+		samples += 2;
+	}
+
+	return dest;
+}
+
+// The number of candidate samples the optimized encoder keeps after each delta.
+#define TRELLIS_WIDTH 32
+
+struct TrellisState {
+	uint32_t error;
+	uint8_t sample;
+};
+
+static void swap_trellis_states(struct TrellisState *a, struct TrellisState *b)
+{
+	struct TrellisState temp = *a;
+	*a = *b;
+	*b = temp;
+}
+
+// Partially sorts states so that the first keep of them have the least error.
+static void select_trellis_states(struct TrellisState *states, int count, int keep)
+{
+	int left = 0;
+	int right = count - 1;
+
+	while (left < right)
+	{
+		uint32_t pivot = states[(left + right) / 2].error;
+		int i = left;
+		int j = right;
+
+		while (i <= j)
+		{
+			while (states[i].error < pivot)
+				i++;
+			while (states[j].error > pivot)
+				j--;
+			if (i <= j)
+				swap_trellis_states(&states[i++], &states[j--]);
+		}
+
+		if (keep - 1 <= j)
+			right = j;
+		else if (keep - 1 >= i)
+			left = i;
+		else
+			break;
+	}
+}
+
+// Picks the deltas for one block by searching every sequence of them for the one
+// whose decoded samples have the least total squared error, instead of taking the
+// closest delta one sample at a time. Each step keeps only the TRELLIS_WIDTH decoded
+// samples with the least error so far, which finds the same deltas as keeping all
+// 256 for our cries. Blocks the greedy choice already encodes exactly are left as is.
+static void find_optimal_deltas(const uint8_t *samples, int num_deltas, uint8_t *delta_indices)
+{
+	uint8_t base = samples[0];
+	bool exact = true;
+
+	for (int t = 1; t <= num_deltas && exact; t++)
+	{
+		delta_indices[t - 1] = sDeltaIndexTable[base][samples[t]];
+		base += gDeltaEncodingTable[delta_indices[t - 1]];
+		exact = (base == samples[t]);
+	}
+
+	if (exact)
+	{
+		return;
+	}
+
+	uint8_t prev_sample[64][256];
+	uint8_t delta_index[64][256];
+	struct TrellisState states[TRELLIS_WIDTH * 16];
+	uint32_t best_error[256];
+	int num_states = 1;
+
+	states[0].error = 0;
+	states[0].sample = samples[0];
+
+	for (int i = 0; i < 256; i++)
+	{
+		best_error[i] = UINT32_MAX;
+	}
+
+	for (int t = 1; t <= num_deltas; t++)
+	{
+		struct TrellisState next[TRELLIS_WIDTH * 16];
+		int num_next = 0;
+		int target = U8_TO_S8(samples[t]);
+
+		for (int s = 0; s < num_states; s++)
+		{
+			for (int d = 0; d < 16; d++)
+			{
+				uint8_t sample = states[s].sample + gDeltaEncodingTable[d];
+				int diff = U8_TO_S8(sample) - target;
+				uint32_t error = states[s].error + diff * diff;
+
+				if (best_error[sample] == UINT32_MAX)
+				{
+					next[num_next].sample = sample;
+					num_next++;
+				}
+				else if (error >= best_error[sample])
+				{
+					continue;
+				}
+
+				best_error[sample] = error;
+				prev_sample[t][sample] = states[s].sample;
+				delta_index[t][sample] = d;
+			}
+		}
+
+		for (int n = 0; n < num_next; n++)
+		{
+			next[n].error = best_error[next[n].sample];
+			best_error[next[n].sample] = UINT32_MAX;
+		}
+
+		if (num_next > TRELLIS_WIDTH)
+		{
+			select_trellis_states(next, num_next, TRELLIS_WIDTH);
+			num_next = TRELLIS_WIDTH;
+		}
+
+		memcpy(states, next, num_next * sizeof(struct TrellisState));
+		num_states = num_next;
+	}
+
+	int best = 0;
+	for (int s = 1; s < num_states; s++)
+	{
+		if (states[s].error < states[best].error)
+			best = s;
+	}
+
+	uint8_t sample = states[best].sample;
+	for (int t = num_deltas; t >= 1; t--)
+	{
+		delta_indices[t - 1] = delta_index[t][sample];
+		sample = prev_sample[t][sample];
+	}
+}
+
+// Each block of 64 samples is stored in 33 bytes: the first sample as is, the
+// delta to the second in the low nibble of the next byte, and then the deltas to
+// the other 62 two to a byte. The last block is cut short where the samples end,
+// leaving out an odd sample at the very end.
+struct Bytes *delta_compress(struct Bytes *pcm, bool optimize)
 {
 	struct Bytes *delta = malloc(sizeof(struct Bytes));
 	// estimate the length so we can malloc
@@ -507,46 +775,45 @@ struct Bytes *delta_compress(struct Bytes *pcm)
 
 	delta->data = malloc(delta->length + 33);
 
-	unsigned int i = 0;
-	unsigned int j = 0;
-	int k;
+	init_delta_index_table();
+
+	const uint8_t *src = pcm->data;
+	const uint8_t *end = pcm->data + pcm->length;
+	uint8_t *dest = delta->data;
 	uint8_t base;
-	int delta_index;
 
-	while (i < pcm->length)
+	while (src < end)
 	{
-		base = pcm->data[i++];
-		delta->data[j++] = base;
+		int count = end - src < 64 ? end - src : 64;
 
-		if (i >= pcm->length)
-		{
-			break;
-		}
-		delta_index = get_delta_index(pcm->data[i++], base);
-		base += gDeltaEncodingTable[delta_index];
-		delta->data[j++] = delta_index;
+		base = *src;
+		*dest++ = base;
 
-		for (k = 0; k < 31; k++)
+		if (count > 1 && optimize)
 		{
-			if (i >= pcm->length)
-			{
-				break;
-			}
-			delta_index = get_delta_index(pcm->data[i++], base);
-			base += gDeltaEncodingTable[delta_index];
-			delta->data[j] = (delta_index << 4);
+			uint8_t delta_indices[63];
+			int num_pairs = (count - 2) / 2;
+
+			find_optimal_deltas(src, 1 + num_pairs * 2, delta_indices);
+			*dest++ = delta_indices[0];
 
-			if (i >= pcm->length)
+			for (int k = 0; k < num_pairs; k++)
 			{
-				break;
+				*dest++ = (delta_indices[1 + k * 2] << 4) | delta_indices[2 + k * 2];
 			}
-			delta_index = get_delta_index(pcm->data[i++], base);
+		}
+		else if (count > 1)
+		{
+			uint8_t delta_index = sDeltaIndexTable[base][src[1]];
 			base += gDeltaEncodingTable[delta_index];
-			delta->data[j++] |= delta_index;
+			*dest++ = delta_index;
+			dest = encode_delta_pairs(dest, src + 2, (count - 2) / 2, base);
 		}
+
+		src += count;
 	}
 
-	delta->length = j;
+	delta->length = dest - delta->data;
 
 	return delta;
 }
@@ -567,10 +834,33 @@ do { \
 	(var) |= (*((src) + 3) << 24); \
 } while (0)
 
-// Reads an .aif file and produces a .pcm file containing an array of 8-bit samples.
-void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
+// Prints the signal-to-noise ratio of the samples the engine will decode from the
+// compressed data, compared to the original ones.
+void print_snr(const char *aif_filename, struct Bytes *samples, struct Bytes *delta)
+{
+	struct Bytes *decoded = delta_decompress(delta, samples->length);
+	double signal = 0;
+	double noise = 0;
+
+	for (unsigned long i = 0; i < decoded->length; i++)
+	{
+		int original = U8_TO_S8(samples->data[i]);
+		int diff = U8_TO_S8(decoded->data[i]) - original;
+		signal += original * original;
+		noise += diff * diff;
+	}
+
+	if (noise == 0)
+		printf("%s: SNR lossless\n", aif_filename);
+	else
+		printf("%s: SNR %.2f dB\n", aif_filename, 10 * log10(signal / noise));
+
+	free_bytearray(decoded);
+}
+
+// Converts the contents of an .aif file to those of a .pcm file containing an array of 8-bit samples.
+struct Bytes *convert_aif(const char *aif_filename, struct Bytes *aif, bool compress, bool optimize, bool report_snr)
 {
-	struct Bytes *aif = read_bytearray(aif_filename);
 	AifData aif_data = {0};
 	read_aif(aif, &aif_data);
 
@@ -589,14 +879,16 @@ void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
 
 	int header_size = 0x10;
 	struct Bytes *pcm;
-	struct Bytes output = {0,0};
+	struct Bytes *output = malloc(sizeof(struct Bytes));
 
 	if (compress)
 	{
 		struct Bytes *input = malloc(sizeof(struct Bytes));
 		input->data = aif_data.samples8;
 		input->length = aif_data.real_num_samples;
-		pcm = delta_compress(input);
+		pcm = delta_compress(input, optimize);
+		if (report_snr)
+			print_snr(aif_filename, input, pcm);
 		free(input);
 	}
 	else
@@ -605,8 +897,8 @@ void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
 		pcm->data = aif_data.samples8;
 		pcm->length = aif_data.real_num_samples;
 	}
-	output.length = header_size + pcm->length;
-	output.data = malloc(output.length);
+	output->length = header_size + pcm->length;
+	output->data = malloc(output->length);
 
 	uint32_t pitch_adjust = (uint32_t)(aif_data.sample_rate * 1024);
 	uint32_t loop_offset = (uint32_t)(aif_data.loop_offset);
@@ -614,18 +906,120 @@ void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
 	uint32_t flags = 0;
 	if (aif_data.has_loop) flags |= 0x40000000;
 	if (compress) flags |= 1;
-	STORE_U32_LE(output.data + 0, flags);
-	STORE_U32_LE(output.data + 4, pitch_adjust);
-	STORE_U32_LE(output.data + 8, loop_offset);
-	STORE_U32_LE(output.data + 12, adjusted_num_samples);
-	memcpy(&output.data[header_size], pcm->data, pcm->length);
-	write_bytearray(pcm_filename, &output);
+	STORE_U32_LE(output->data + 0, flags);
+	STORE_U32_LE(output->data + 4, pitch_adjust);
+	STORE_U32_LE(output->data + 8, loop_offset);
+	STORE_U32_LE(output->data + 12, adjusted_num_samples);
+	memcpy(&output->data[header_size], pcm->data, pcm->length);
 
-	free(aif->data);
-	free(aif);
+	if (compress)
+	{
+		free(pcm->data);
+	}
 	free(pcm);
-	free(output.data);
 	free(aif_data.samples8);
+	return output;
+}
+
+// Reads an .aif file and produces a .pcm file containing an array of 8-bit samples.
+void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress, bool optimize, bool report_snr)
+{
+	struct Bytes *aif = read_bytearray(aif_filename);
+	struct Bytes *output = convert_aif(aif_filename, aif, compress, optimize, report_snr);
+	write_bytearray(pcm_filename, output);
+
+	free_bytearray(aif);
+	free_bytearray(output);
+}
+
+struct BatchJob {
+	const char *aif_filename;
+	char *pcm_filename;
+	bool written;
+};
+
+struct Batch {
+	struct BatchJob *jobs;
+	int num_jobs;
+	atomic_int next_job;
+	bool compress;
+	bool optimize;
+	bool report_snr;
+};
+
+static void *batch_worker(void *arg)
+{
+	struct Batch *batch = arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&batch->next_job, 1)) < batch->num_jobs)
+	{
+		struct BatchJob *job = &batch->jobs[i];
+		struct Bytes *aif = map_bytearray(job->aif_filename);
+		struct Bytes *output = convert_aif(job->aif_filename, aif, batch->compress, batch->optimize, batch->report_snr);
+		job->written = write_bytearray_if_changed(job->pcm_filename, output);
+		unmap_bytearray(aif);
+		free_bytearray(output);
+	}
+
+	return NULL;
+}
+
+// Converts each .aif file to a .bin file beside it on one thread per core, only
+// rewriting the .bin files whose contents change.
+void aif2pcm_batch(char **aif_filenames, int count, bool compress, bool optimize, bool report_snr)
+{
+	struct Batch batch;
+	batch.jobs = calloc(count, sizeof(struct BatchJob));
+	batch.num_jobs = count;
+	atomic_init(&batch.next_job, 0);
+	batch.compress = compress;
+	batch.optimize = optimize;
+	batch.report_snr = report_snr;
+
+	for (int i = 0; i < count; i++)
+	{
+		batch.jobs[i].aif_filename = aif_filenames[i];
+		batch.jobs[i].pcm_filename = new_file_extension(aif_filenames[i], "bin");
+	}
+
+	// Filled in up front, as the workers share it.
+	init_delta_index_table();
+
+	long num_threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (num_threads > count)
+		num_threads = count;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+	for (long i = 1; i < num_threads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, batch_worker, &batch) != 0)
+		{
+			FATAL_ERROR("Failed to start a thread!\n");
+		}
+	}
+	batch_worker(&batch);
+	for (long i = 1; i < num_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	int num_written = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (batch.jobs[i].written)
+			num_written++;
+		free(batch.jobs[i].pcm_filename);
+	}
+	free(batch.jobs);
+
+	printf("aif2pcm: %d files converted, %d updated\n", count, num_written);
 }
 
 // Reads a .pcm file containing an array of 8-bit samples and produces an .aif file.
@@ -881,7 +1275,14 @@ void pcm2aif(const char *pcm_filename, const char *aif_filename, uint32_t base_n
 void usage(void)
 {
 	fprintf(stderr, "Usage: aif2pcm bin_file [aif_file]\n");
-	fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress]\n");
+	fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress [--optimize] [--snr]]\n");
+	fprintf(stderr, "       aif2pcm --batch [--compress [--optimize] [--snr]] aif_file...\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "--batch     convert each aif_file to a bin_file beside it, only rewriting\n");
+	fprintf(stderr, "            the ones that change\n");
+	fprintf(stderr, "--optimize  choose the compressed deltas for the least total error in each block\n");
+	fprintf(stderr, "            instead of sample by sample (doesn't match the original cries)\n");
+	fprintf(stderr, "--snr       print the signal-to-noise ratio of the compressed samples\n");
 }
 
 int main(int argc, char **argv)
@@ -892,10 +1293,50 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (strcmp(argv[1], "--batch") == 0)
+	{
+		bool compressed = false;
+		bool optimize = false;
+		bool report_snr = false;
+		char **aif_files = malloc(argc * sizeof(char *));
+		int num_aif_files = 0;
+
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--compress") == 0)
+			{
+				compressed = true;
+			}
+			else if (strcmp(argv[i], "--optimize") == 0)
+			{
+				optimize = true;
+			}
+			else if (strcmp(argv[i], "--snr") == 0)
+			{
+				report_snr = true;
+			}
+			else
+			{
+				char *extension = get_file_extension(argv[i]);
+				if (!extension || (strcmp(extension, "aif") != 0 && strcmp(extension, "aiff") != 0))
+				{
+					FATAL_ERROR("Input file must be .aif: '%s'\n", argv[i]);
+				}
+				aif_files[num_aif_files++] = argv[i];
+			}
+		}
+
+		aif2pcm_batch(aif_files, num_aif_files, compressed, optimize, report_snr);
+		free(aif_files);
+		return 0;
+	}
+
 	char *input_file = argv[1];
 	char *extension = get_file_extension(input_file);
 	char *output_file;
 	bool compressed = false;
+	bool optimize = false;
+	bool report_snr = false;
 
 	if (argc > 3)
 	{
@@ -905,6 +1346,14 @@ int main(int argc, char **argv)
 			{
 				compressed = true;
 			}
+			else if (strcmp(argv[i], "--optimize") == 0)
+			{
+				optimize = true;
+			}
+			else if (strcmp(argv[i], "--snr") == 0)
+			{
+				report_snr = true;
+			}
 		}
 	}
 
@@ -913,12 +1362,12 @@ int main(int argc, char **argv)
 		if (argc >= 3)
 		{
 			output_file = argv[2];
-			aif2pcm(input_file, output_file, compressed);
+			aif2pcm(input_file, output_file, compressed, optimize, report_snr);
 		}
 		else
 		{
 			output_file = new_file_extension(input_file, "bin");
-			aif2pcm(input_file, output_file, compressed);
+			aif2pcm(input_file, output_file, compressed, optimize, report_snr);
 			free(output_file);
 		}
 	}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "global.h"
+#include "comp_report.h"
+#include "util.h"
+#include "lz.h"
+#include "rl.h"
+#include "huff.h"
+
+/*
+ * Estimated CPU cycles spent by the BIOS decompression routines, per unit of
+ * work in their inner loops, including the cartridge ROM reads at the default
+ * 3/1 wait states. These are approximations meant for ranking codecs against
+ * each other, not cycle-exact figures; calibrate them against hardware
+ * measurements before trusting absolute numbers.
+ */
+#define COPY_CYCLES_PER_WORD          6  // CpuFastSet / DMA from ROM
+
+#define LZ_CYCLES_PER_FLAG_BYTE      12
+#define LZ_CYCLES_PER_LITERAL        14
+#define LZ_CYCLES_PER_MATCH          24
+#define LZ_CYCLES_PER_MATCH_BYTE     10
+
+#define RL_CYCLES_PER_RUN            20
+#define RL_CYCLES_PER_LITERAL_BYTE   10
+#define RL_CYCLES_PER_REPEATED_BYTE   6
+
+#define HUFF_CYCLES_PER_BIT          14
+#define HUFF_CYCLES_PER_WORD         24
+
+enum Codec {
+    CODEC_NONE,
+    CODEC_LZ,
+    CODEC_RL,
+    CODEC_HUFF4,
+    CODEC_HUFF8,
+    NUM_CODECS,
+};
+
+static const char *sCodecNames[NUM_CODECS] = {
+    [CODEC_NONE]  = "none",
+    [CODEC_LZ]    = "lz",
+    [CODEC_RL]    = "rl",
+    [CODEC_HUFF4] = "huff4",
+    [CODEC_HUFF8] = "huff8",
+};
+
+struct CodecResult {
+    enum Codec codec;
+    int size;
+    uint64_t cycles;
+};
+
+struct AssetReport {
+    char *path;
+    int rawSize;
+    struct CodecResult results[NUM_CODECS];
+};
+
+static uint64_t EstimateLZCycles(unsigned char *data, int size)
+{
+    int destSize = (data[3] << 16) | (data[2] << 8) | data[1];
+    int srcPos = 4;
+    int destPos = 0;
+    uint64_t cycles = 0;
+
+    while (destPos < destSize && srcPos < size) {
+        unsigned char flags = data[srcPos++];
+        cycles += LZ_CYCLES_PER_FLAG_BYTE;
+
+        for (int i = 0; i < 8 && destPos < destSize && srcPos < size; i++) {
+            if (flags & (0x80 >> i)) {
+                int blockSize = (data[srcPos] >> 4) + 3;
+                srcPos += 2;
+                destPos += blockSize;
+                cycles += LZ_CYCLES_PER_MATCH + LZ_CYCLES_PER_MATCH_BYTE * blockSize;
+            } else {
+                srcPos++;
+                destPos++;
+                cycles += LZ_CYCLES_PER_LITERAL;
+            }
+        }
+    }
+
+    return cycles;
+}
+
+static uint64_t EstimateRLCycles(unsigned char *data, int size)
+{
+    int destSize = (data[3] << 16) | (data[2] << 8) | data[1];
+    int srcPos = 4;
+    int destPos = 0;
+    uint64_t cycles = 0;
+
+    while (destPos < destSize && srcPos < size) {
+        unsigned char flag = data[srcPos++];
+        cycles += RL_CYCLES_PER_RUN;
+
+        if (flag & 0x80) {
+            int length = (flag & 0x7F) + 3;
+            srcPos++;
+            destPos += length;
+            cycles += RL_CYCLES_PER_REPEATED_BYTE * length;
+        } else {
+            int length = (flag & 0x7F) + 1;
+            srcPos += length;
+            destPos += length;
+            cycles += RL_CYCLES_PER_LITERAL_BYTE * length;
+        }
+    }
+
+    return cycles;
+}
+
+static uint64_t EstimateHuffCycles(unsigned char *data, int size)
+{
+    int destSize = (data[3] << 16) | (data[2] << 8) | data[1];
+    int bitstreamStart = 4 + (data[4] + 1) * 2;
+    uint64_t bits = (uint64_t)(size - bitstreamStart) * 8;
+
+    // The BIOS walks the tree one bit at a time and stores one word at a time.
+    return bits * HUFF_CYCLES_PER_BIT + ((destSize + 3) / 4) * HUFF_CYCLES_PER_WORD;
+}
+
+static void AnalyzeAsset(struct AssetReport *report)
+{
+    int size;
+    unsigned char *buffer = ReadWholeFile(report->path, &size);
+    int compressedSize;
+    unsigned char *compressed;
+
+    report->rawSize = size;
+
+    // The compressors can't represent empty files.
+    if (size == 0) {
+        free(buffer);
+        return;
+    }
+
+    report->results[CODEC_NONE].codec = CODEC_NONE;
+    report->results[CODEC_NONE].size = size;
+    report->results[CODEC_NONE].cycles = (uint64_t)((size + 3) / 4) * COPY_CYCLES_PER_WORD;
+
+    compressed = LZCompress(buffer, size, &compressedSize, 2);
+    report->results[CODEC_LZ].codec = CODEC_LZ;
+    report->results[CODEC_LZ].size = compressedSize;
+    report->results[CODEC_LZ].cycles = EstimateLZCycles(compressed, compressedSize);
+    free(compressed);
+
+    compressed = RLCompress(buffer, size, &compressedSize);
+    report->results[CODEC_RL].codec = CODEC_RL;
+    report->results[CODEC_RL].size = compressedSize;
+    report->results[CODEC_RL].cycles = EstimateRLCycles(compressed, compressedSize);
+    free(compressed);
+
+    compressed = HuffCompress(buffer, size, &compressedSize, 4);
+    report->results[CODEC_HUFF4].codec = CODEC_HUFF4;
+    report->results[CODEC_HUFF4].size = compressedSize;
+    report->results[CODEC_HUFF4].cycles = EstimateHuffCycles(compressed, compressedSize);
+    free(compressed);
+
+    compressed = HuffCompress(buffer, size, &compressedSize, 8);
+    report->results[CODEC_HUFF8].codec = CODEC_HUFF8;
+    report->results[CODEC_HUFF8].size = compressedSize;
+    report->results[CODEC_HUFF8].cycles = EstimateHuffCycles(compressed, compressedSize);
+    free(compressed);
+
+    free(buffer);
+}
+
+// ROM bytes a codec saves over storing the asset raw, per 1000 cycles it adds to
+// loading it. A codec that saves ROM without adding cycles counts as adding one.
+static double SavingsPerKilocycle(const struct CodecResult *result, const struct CodecResult *baseline)
+{
+    int saved = baseline->size - result->size;
+    int64_t extraCycles = (int64_t)result->cycles - (int64_t)baseline->cycles;
+
+    if (saved <= 0)
+        return 0.0;
+    if (extraCycles < 1)
+        extraCycles = 1;
+    return saved * 1000.0 / extraCycles;
+}
+
+static const struct CodecResult *sBaseline;
+
+// Ranks the compressed codecs by ROM saved per extra cycle over the uncompressed
+// baseline. Codecs that don't save any ROM come last, smallest first.
+static int CompareResults(const void *a0, const void *b0)
+{
+    const struct CodecResult *a = a0;
+    const struct CodecResult *b = b0;
+    double rateA = SavingsPerKilocycle(a, sBaseline);
+    double rateB = SavingsPerKilocycle(b, sBaseline);
+
+    if (rateA != rateB)
+        return rateA > rateB ? -1 : 1;
+    if (a->size != b->size)
+        return a->size - b->size;
+    return a->codec - b->codec;
+}
+
+void WriteCompressionReport(char **paths, int numPaths, char *outputPath)
+{
+    struct AssetReport report;
+    uint64_t totalSize[NUM_CODECS] = {0};
+    uint64_t totalCycles[NUM_CODECS] = {0};
+    uint64_t smallestSize = 0;
+    uint64_t smallestCycles = 0;
+    uint64_t bestSize = 0;
+    uint64_t bestCycles = 0;
+    int numAssets = 0;
+
+    FILE *fp = fopen(outputPath, "w");
+
+    if (fp == NULL)
+        FATAL_ERROR("Failed to open \"%s\" for writing.\n", outputPath);
+
+    fprintf(fp, "# Per asset, the uncompressed baseline, then the compressed codecs ranked by ROM bytes\n");
+    fprintf(fp, "# saved per 1000 extra estimated BIOS decompression cycles.\n");
+    fprintf(fp, "# asset\traw_size\tnone:size:cycles\t[codec:size:cycles:saved_per_kcycle]...\n");
+
+    for (int i = 0; i < numPaths; i++) {
+        report.path = paths[i];
+        AnalyzeAsset(&report);
+
+        if (report.rawSize == 0)
+            continue;
+
+        numAssets++;
+
+        int smallest = CODEC_NONE;
+        for (int j = 0; j < NUM_CODECS; j++) {
+            totalSize[j] += report.results[j].size;
+            totalCycles[j] += report.results[j].cycles;
+            if (report.results[j].size < report.results[smallest].size)
+                smallest = j;
+        }
+        smallestSize += report.results[smallest].size;
+        smallestCycles += report.results[smallest].cycles;
+
+        struct CodecResult *baseline = &report.results[CODEC_NONE];
+        struct CodecResult *compressed = &report.results[CODEC_NONE + 1];
+        int numCompressed = NUM_CODECS - 1;
+
+        sBaseline = baseline;
+        qsort(compressed, numCompressed, sizeof(struct CodecResult), CompareResults);
+
+        // The best codec is only worth using if it saves any ROM at all.
+        struct CodecResult *best = compressed[0].size < baseline->size ? &compressed[0] : baseline;
+        bestSize += best->size;
+        bestCycles += best->cycles;
+
+        fprintf(fp, "%s\t%d\t%s:%d:%llu", report.path, report.rawSize,
+                sCodecNames[CODEC_NONE], baseline->size, (unsigned long long)baseline->cycles);
+        for (int j = 0; j < numCompressed; j++) {
+            struct CodecResult *result = &compressed[j];
+            fprintf(fp, "\t%s:%d:%llu:%.1f", sCodecNames[result->codec], result->size, (unsigned long long)result->cycles,
+                    SavingsPerKilocycle(result, baseline));
+        }
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "\n# Totals over %d assets if every asset used the same codec.\n", numAssets);
+    for (int j = 0; j < NUM_CODECS; j++)
+        fprintf(fp, "# %s\t%llu bytes\t%llu cycles\n", sCodecNames[j], (unsigned long long)totalSize[j], (unsigned long long)totalCycles[j]);
+    fprintf(fp, "# smallest per asset\t%llu bytes\t%llu cycles\n", (unsigned long long)smallestSize, (unsigned long long)smallestCycles);
+    fprintf(fp, "# best ranked per asset\t%llu bytes\t%llu cycles\n", (unsigned long long)bestSize, (unsigned long long)bestCycles);
+
+    fclose(fp);
+}
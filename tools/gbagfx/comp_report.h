@@ -0,0 +1,6 @@
+#ifndef COMP_REPORT_H
+#define COMP_REPORT_H
+
+void WriteCompressionReport(char **paths, int numPaths, char *outputPath);
+
+#endif // COMP_REPORT_H
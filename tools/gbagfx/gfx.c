@@ -479,6 +479,183 @@ void WriteTileImage(char *path, enum NumTilesMode numTilesMode, int numTiles, in
 	free(buffer);
 }
 
+#define TILE_HASH_SIZE 4096 // power of two, larger than the 1024 tiles a tilemap can index
+
+static uint32_t HashTile(const unsigned char *tile)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < 64; i++)
+        hash = (hash ^ tile[i]) * 16777619u;
+
+    return hash;
+}
+
+// Flips an 8x8 tile stored as one byte per pixel.
+static void FlipTile8x8(const unsigned char *src, unsigned char *dest, bool hflip, bool vflip)
+{
+    for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 8; x++)
+            dest[y * 8 + x] = src[(vflip ? 7 - y : y) * 8 + (hflip ? 7 - x : x)];
+}
+
+static int FindTile(const unsigned char *tiles, const int *hashTable, const unsigned char *tile)
+{
+    uint32_t slot = HashTile(tile) & (TILE_HASH_SIZE - 1);
+
+    while (hashTable[slot] != -1) {
+        if (memcmp(&tiles[hashTable[slot] * 64], tile, 64) == 0)
+            return hashTable[slot];
+        slot = (slot + 1) & (TILE_HASH_SIZE - 1);
+    }
+
+    return -1;
+}
+
+static void InsertTile(int *hashTable, const unsigned char *tile, int index)
+{
+    uint32_t slot = HashTile(tile) & (TILE_HASH_SIZE - 1);
+
+    while (hashTable[slot] != -1)
+        slot = (slot + 1) & (TILE_HASH_SIZE - 1);
+
+    hashTable[slot] = index;
+}
+
+// Splits an 8bpp image into tiles, merges tiles that are identical or flipped
+// copies of each other, and writes the unique tiles plus a non-affine tilemap.
+// For 4bpp output, an image with more than 16 colors is treated as the
+// combined-palette layout ReadTileImage produces from a tilemap, where the
+// high nybble of each pixel encodes 15 - palno.
+void WriteDedupedTileImage(char *path, char *tilemapPath, struct Image *image, int bitDepth, bool invertColors)
+{
+    if (bitDepth != 4 && bitDepth != 8)
+        FATAL_ERROR("Tilemaps can only be generated for 4bpp or 8bpp images.\n");
+
+    if (image->width % 8 != 0)
+        FATAL_ERROR("The width in pixels (%d) isn't a multiple of 8.\n", image->width);
+
+    if (image->height % 8 != 0)
+        FATAL_ERROR("The height in pixels (%d) isn't a multiple of 8.\n", image->height);
+
+    int tilesWidth = image->width / 8;
+    int numTiles = tilesWidth * (image->height / 8);
+    int tileSize = bitDepth * 8;
+    int pixelMask = bitDepth == 4 ? 0xF : 0xFF;
+    bool hasPalnos = false;
+
+    // Only treat the high nybble as a palette number if every tile sticks to a
+    // single one. Otherwise, truncate pixels like the regular conversion does.
+    if (bitDepth == 4) {
+        bool isUniform = true;
+
+        for (int i = 0; i < numTiles && isUniform; i++) {
+            unsigned char *tile = &image->pixels[(i / tilesWidth) * 8 * image->width + (i % tilesWidth) * 8];
+
+            for (int y = 0; y < 8 && isUniform; y++) {
+                for (int x = 0; x < 8; x++) {
+                    unsigned char pixel = tile[y * image->width + x];
+
+                    if (pixel > 0xF)
+                        hasPalnos = true;
+                    if ((pixel >> 4) != (tile[0] >> 4)) {
+                        isUniform = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        hasPalnos = hasPalnos && isUniform;
+    }
+
+    unsigned char *uniqueTiles = malloc(numTiles * 64);
+    struct NonAffineTile *tilemap = calloc(numTiles, sizeof(struct NonAffineTile));
+    int *hashTable = malloc(TILE_HASH_SIZE * sizeof(int));
+
+    if (uniqueTiles == NULL || tilemap == NULL || hashTable == NULL)
+        FATAL_ERROR("Failed to allocate memory for tilemap.\n");
+
+    for (int i = 0; i < TILE_HASH_SIZE; i++)
+        hashTable[i] = -1;
+
+    int numUniqueTiles = 0;
+
+    for (int i = 0; i < numTiles; i++) {
+        unsigned char tile[64];
+        int tileX = (i % tilesWidth) * 8;
+        int tileY = (i / tilesWidth) * 8;
+        int palno = 0;
+
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                unsigned char pixel = image->pixels[(tileY + y) * image->width + tileX + x];
+
+                if (hasPalnos)
+                    palno = 15 - (pixel >> 4);
+
+                pixel &= pixelMask;
+                if (invertColors)
+                    pixel = pixelMask - pixel;
+                tile[y * 8 + x] = pixel;
+            }
+        }
+
+        int index = -1;
+        bool hflip = false;
+        bool vflip = false;
+
+        for (int flip = 0; flip < 4 && index == -1; flip++) {
+            unsigned char flipped[64];
+            hflip = flip & 1;
+            vflip = flip >> 1;
+            FlipTile8x8(tile, flipped, hflip, vflip);
+            index = FindTile(uniqueTiles, hashTable, flipped);
+        }
+
+        if (index == -1) {
+            index = numUniqueTiles++;
+            hflip = vflip = false;
+            memcpy(&uniqueTiles[index * 64], tile, 64);
+            InsertTile(hashTable, tile, index);
+        }
+
+        if (index > 0x3FF)
+            FATAL_ERROR("The image has more than 1024 unique tiles.\n");
+
+        tilemap[i].index = index;
+        tilemap[i].hflip = hflip;
+        tilemap[i].vflip = vflip;
+        tilemap[i].palno = palno;
+    }
+
+    unsigned char *buffer = malloc(numUniqueTiles * tileSize);
+
+    if (buffer == NULL)
+        FATAL_ERROR("Failed to allocate memory for pixels.\n");
+
+    for (int i = 0; i < numUniqueTiles * 64; i++) {
+        if (bitDepth == 8)
+            buffer[i] = uniqueTiles[i];
+        else if (i & 1)
+            buffer[i / 2] |= uniqueTiles[i] << 4;
+        else
+            buffer[i / 2] = uniqueTiles[i];
+    }
+
+    WriteWholeFile(path, buffer, numUniqueTiles * tileSize);
+    WriteWholeFile(tilemapPath, tilemap, numTiles * sizeof(struct NonAffineTile));
+
+    int vramSaved = (numTiles - numUniqueTiles) * tileSize;
+    printf("%s: %d tiles, %d unique, %d bytes of VRAM saved, %d bytes of ROM saved\n",
+        path, numTiles, numUniqueTiles, vramSaved, vramSaved - numTiles * (int)sizeof(struct NonAffineTile));
+
+    free(buffer);
+    free(hashTable);
+    free(tilemap);
+    free(uniqueTiles);
+}
+
 void ReadPlainImage(char *path, int dataWidth, struct Image *image, bool invertColors)
 {
 	int fileSize;
@@ -1,215 +1,241 @@
 #include <stdbool.h>
 #include <string.h>
-#include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
 #include "global.h"
 #include "huff.h"
 
-static int cmp_tree(const void *a0, const void *b0) {
-    return ((struct HuffData *)a0)->value - ((struct HuffData *)b0)->value;
+/*
+ * The GBA BIOS HuffUnComp format:
+ *
+ *   header:  u8 (0x20 | bitDepth), u24 decompressed size
+ *   tree:    u8 treeSize (tree bytes / 2 - 1), followed by the nodes.
+ *            The root node sits right after the size byte. Each branch node
+ *            holds a 6-bit offset to its child pair, located at
+ *            (nodeAddr & ~1) + offset * 2 + 2, and flags in bits 7 and 6
+ *            saying whether child 0 / child 1 is a leaf holding a symbol.
+ *   data:    32-bit little endian words, consumed from bit 31 downward.
+ *            A 0 bit selects child 0, a 1 bit selects child 1.
+ *
+ * The encoder builds canonical codes, so the code table and the tree can be
+ * generated straight from the code lengths, and encoding is a single table
+ * lookup per symbol. The decoder resolves several bits per lookup.
+ */
+
+#define HUFF_MAX_CODE_LENGTH 32
+#define HUFF_LOOKUP_BITS 8
+
+struct HuffSymbol {
+    uint32_t freq;
+    int symbol;
+};
+
+static int cmp_symbols(const void *a0, const void *b0) {
+    const struct HuffSymbol *a = a0;
+    const struct HuffSymbol *b = b0;
+
+    if (a->freq != b->freq)
+        return a->freq < b->freq ? -1 : 1;
+    return a->symbol - b->symbol;
 }
 
-typedef int (*cmpfun)(const void *, const void *);
-
-int msort_r(void *data, size_t count, size_t size, cmpfun cmp, void *buffer) {
-    /*
-     * Out-of-place mergesort (stable sort)
-     * Returns 1 on success, 0 on failure
-     */
-    void *leftPtr;
-    void *rightPtr;
-    void *leftEnd;
-    void *rightEnd;
-    int i;
-
-    switch (count) {
-    case 0:
-        // Should never be here
-        return 0;
-
-    case 1:
-        // Nothing to do here
-        break;
-
-    case 2:
-        // Swap the two entries if the right one compares higher.
-        if (cmp(data, data + size) > 0) {
-            memcpy(buffer, data, size);
-            memcpy(data, data + size, size);
-            memcpy(data + size, buffer, size);
+/*
+ * Computes the Huffman code length of each symbol with nonzero frequency.
+ * Uses the two-queue method over the frequency-sorted leaves, which is
+ * linear after the sort.
+ */
+static void compute_code_lengths(const uint32_t * freqs, int nsymbols, unsigned char * lengths) {
+    struct HuffSymbol leaves[256];
+    uint64_t weights[511];
+    int parents[511];
+    int nleaves = 0;
+
+    for (int i = 0; i < nsymbols; i++) {
+        lengths[i] = 0;
+        if (freqs[i] != 0) {
+            leaves[nleaves].freq = freqs[i];
+            leaves[nleaves].symbol = i;
+            nleaves++;
         }
-        break;
-    default:
-        // Merge sort out-of-place.
-        leftPtr = data;
-        leftEnd = rightPtr = data + count / 2 * size;
-        rightEnd = data + count * size;
-
-        // Sort the left half
-        if (!msort_r(leftPtr, count / 2, size, cmp, buffer))
-            return 0;
-
-        // Sort the right half
-        if (!msort_r(rightPtr, count / 2 + (count & 1), size, cmp, buffer))
-            return 0;
-
-        // Merge the sorted halves out of place
-        i = 0;
-        do {
-            if (cmp(leftPtr, rightPtr) <= 0) {
-                memcpy(buffer + i * size, leftPtr, size);
-                leftPtr += size;
-            } else {
-                memcpy(buffer + i * size, rightPtr, size);
-                rightPtr += size;
-            }
+    }
+
+    // Pad to two symbols so the root is always a branch node, as the BIOS requires.
+    for (int i = 0; nleaves < 2; i++) {
+        if (freqs[i] == 0) {
+            leaves[nleaves].freq = 0;
+            leaves[nleaves].symbol = i;
+            nleaves++;
+        }
+    }
 
-        } while (++i < count && leftPtr < leftEnd && rightPtr < rightEnd);
+    qsort(leaves, nleaves, sizeof(struct HuffSymbol), cmp_symbols);
 
-        // Copy the remainder
-        if (i < count) {
-            if (leftPtr < leftEnd) {
-                memcpy(buffer + i * size, leftPtr, leftEnd - leftPtr);
-            }
-            else {
-                memcpy(buffer + i * size, rightPtr, rightEnd - rightPtr);
-            }
+    for (int i = 0; i < nleaves; i++)
+        weights[i] = leaves[i].freq;
+
+    // Nodes [0, nleaves) are the leaves, the rest are branches in creation order,
+    // which is also nondecreasing weight order.
+    int leafPos = 0;
+    int branchPos = nleaves;
+    int nnodes = nleaves;
+
+    while (nnodes < 2 * nleaves - 1) {
+        int picked[2];
+
+        for (int i = 0; i < 2; i++) {
+            if (leafPos < nleaves && (branchPos >= nnodes || weights[leafPos] <= weights[branchPos]))
+                picked[i] = leafPos++;
+            else
+                picked[i] = branchPos++;
         }
 
-        // Copy the merged data back
-        memcpy(data, buffer, count * size);
-        break;
+        weights[nnodes] = weights[picked[0]] + weights[picked[1]];
+        parents[picked[0]] = nnodes;
+        parents[picked[1]] = nnodes;
+        nnodes++;
     }
 
-    return 1;
+    // The root is the last node created. Depths follow from the parent links,
+    // which always point to a later node.
+    int depths[511];
+    depths[nnodes - 1] = 0;
+    for (int i = nnodes - 2; i >= 0; i--)
+        depths[i] = depths[parents[i]] + 1;
+
+    for (int i = 0; i < nleaves; i++) {
+        if (depths[i] > HUFF_MAX_CODE_LENGTH)
+            FATAL_ERROR("Fatal error while compressing Huff file: code length exceeds %d bits.\n", HUFF_MAX_CODE_LENGTH);
+        lengths[leaves[i].symbol] = depths[i];
+    }
 }
 
-int msort(void *data, size_t count, size_t size, cmpfun cmp) {
-    void *buffer = malloc(count * size);
-    if (buffer == NULL) return 0;
-    int result = msort_r(data, count, size, cmp, buffer);
-    free(buffer);
-    return result;
-}
+/*
+ * Assigns canonical codes from the code lengths and lays out the tree.
+ * Returns the number of bytes written for the tree, including the size
+ * byte and padding to a word boundary.
+ *
+ * The child pair of a branch must be placed between 1 and 64 pairs after
+ * the pair holding the branch. Child pairs are placed one at a time: the
+ * pending branch with the earliest deadline is taken whenever waiting any
+ * longer could miss a deadline, and otherwise the one with the smallest
+ * subtree, so the set of pending branches stays small.
+ */
+static int write_tree(unsigned char * dest, const unsigned char * lengths, int nsymbols, struct BitEncoding * encoding) {
+    int countPerLength[HUFF_MAX_CODE_LENGTH + 1] = {0};
+    int maxLength = 0;
+
+    for (int i = 0; i < nsymbols; i++) {
+        countPerLength[lengths[i]]++;
+        if (lengths[i] > maxLength)
+            maxLength = lengths[i];
+    }
+    countPerLength[0] = 0;
+
+    // Canonical code assignment: shorter codes first, ties broken by symbol value.
+    uint32_t nextCode[HUFF_MAX_CODE_LENGTH + 2];
+    uint32_t code = 0;
+    for (int len = 1; len <= maxLength; len++) {
+        code = (code + countPerLength[len - 1]) << 1;
+        nextCode[len] = code;
+    }
 
-static void write_tree(unsigned char * dest, HuffNode_t * tree, int nitems, struct BitEncoding * encoding) {
-    /*
-     * The example used to guide this function encodes the tree in a
-     * breadth-first manner.  We attempt to emulate that here.
-     */
-
-    int i, j, k;
-
-    // There are (2 * nitems - 1) nodes in the binary tree.  Allocate that.
-    HuffNode_t * traversal = calloc(2 * nitems - 1, sizeof(HuffNode_t));
-    if (traversal == NULL)
-        FATAL_ERROR("Fatal error while compressing Huff file.\n");
-
-    // The first node is the root of the tree.
-    traversal[0] = *tree;
-    i = 1;
-
-    // Copy the tree into a breadth-first ordering using brute force.
-    for (int depth = 1; i < 2 * nitems - 1; depth++) {
-        // Consider every possible path up to the current depth.
-        for (j = 0; i < 2 * nitems - 1 && j < 1 << depth; j++) {
-            // The index of the path is used to encode the path itself.
-            // Start from the most significant relevant bit and work our way down.
-            // Keep track of the current and previous nodes.
-            HuffNode_t * currNode = traversal;
-            HuffNode_t * parent = NULL;
-            for (k = 0; k < depth; k++) {
-                if (currNode->header.isLeaf)
-                    break;
-                parent = currNode;
-                if ((j >> (depth - k - 1)) & 1)
-                    currNode = currNode->branch.right;
-                else
-                    currNode = currNode->branch.left;
-            }
-            // Check that the length of the current path equals the current depth.
-            if (k == depth) {
-                // Make sure we can encode the current branch.
-                // Bail here if we cannot.
-                // This is only applicable for 8-bit encodings.
-                if (traversal + i - parent > 128)
-                    FATAL_ERROR("Fatal error while compressing Huff file: unable to encode binary tree.\n");
-                // Copy the current node, and update its parent.
-                traversal[i] = *currNode;
-                if (parent != NULL) {
-                    if ((j & 1) == 1)
-                        parent->branch.right = traversal + i;
-                    else
-                        parent->branch.left = traversal + i;
-                }
-                // Encode the path through the tree in the lookup table
-                if (traversal[i].header.isLeaf) {
-                    encoding[traversal[i].leaf.key].nbits = depth;
-                    encoding[traversal[i].leaf.key].bitstring = j;
-                }
-                i++;
+    // Rebuild the tree from the codes. Node 0 is the root.
+    int children[511][2];
+    int symbols[511];
+    int size[511];
+    int nnodes = 1;
+
+    children[0][0] = children[0][1] = -1;
+    symbols[0] = -1;
+
+    for (int i = 0; i < nsymbols; i++) {
+        encoding[i].nbits = lengths[i];
+        encoding[i].bitstring = lengths[i] != 0 ? nextCode[lengths[i]]++ : 0;
+
+        int node = 0;
+        for (int bit = lengths[i] - 1; bit >= 0; bit--) {
+            int dir = (encoding[i].bitstring >> bit) & 1;
+            if (children[node][dir] == -1) {
+                children[nnodes][0] = children[nnodes][1] = -1;
+                symbols[nnodes] = -1;
+                children[node][dir] = nnodes++;
             }
+            node = children[node][dir];
         }
+        symbols[node] = i;
     }
 
-    // Encode the size of the tree.
-    // This is used by the decompressor to skip the tree.
-    dest[4] = nitems - 1;
+    // Count the branches in each subtree. Children always come after their parent.
+    for (int i = nnodes - 1; i >= 0; i--) {
+        size[i] = 0;
+        if (symbols[i] == -1)
+            size[i] = 1 + size[children[i][0]] + size[children[i][1]];
+    }
 
-    // Encode each node in the tree.
-    for (i = 0; i < 2 * nitems - 1; i++) {
-        HuffNode_t * currNode = traversal + i;
-        if (currNode->header.isLeaf) {
-            dest[5 + i] = traversal[i].leaf.key;
-        } else {
-            dest[5 + i] = (((currNode->branch.right - traversal - i) / 2) - 1);
-            if (currNode->branch.left->header.isLeaf)
-                dest[5 + i] |= 0x80;
-            if (currNode->branch.right->header.isLeaf)
-                dest[5 + i] |= 0x40;
+    unsigned char *nodes = dest + 5;
+    int nodePos[511]; // index of each tree node within nodes
+    int pending[256];
+    int deadline[256];
+    int numPending = 1;
+    int numPairs = (nnodes - 1) / 2;
+
+    nodePos[0] = 0;
+    pending[0] = 0;
+    deadline[0] = 63;
+
+    for (int pair = 0; pair < numPairs; pair++) {
+        int pick = 0;
+        bool forced = false;
+
+        for (int k = 0; k < numPending; k++) {
+            if (pair + k > deadline[k])
+                FATAL_ERROR("Fatal error while compressing Huff file: unable to encode binary tree.\n");
+            if (pair + k == deadline[k])
+                forced = true;
         }
-    }
 
-    free(traversal);
-}
+        if (!forced) {
+            for (int k = 1; k < numPending; k++) {
+                if (size[pending[k]] < size[pending[pick]])
+                    pick = k;
+            }
+        }
 
-static inline void write_32_le(unsigned char * dest, int * destPos, uint32_t * buff, int * buffPos) {
-    dest[*destPos] = *buff;
-    dest[*destPos + 1] = *buff >> 8;
-    dest[*destPos + 2] = *buff >> 16;
-    dest[*destPos + 3] = *buff >> 24;
-    *destPos += 4;
-    *buff = 0;
-    *buffPos = 0;
-}
+        int node = pending[pick];
+        int parentPos = nodePos[node];
+        int parentPair = (parentPos - 1) >> 1;
 
-static inline void read_32_le(unsigned char * src, int * srcPos, uint32_t * buff) {
-    uint32_t tmp = src[*srcPos];
-    tmp |= src[*srcPos + 1] << 8;
-    tmp |= src[*srcPos + 2] << 16;
-    tmp |= src[*srcPos + 3] << 24;
-    *srcPos += 4;
-    *buff = tmp;
-}
+        numPending--;
+        for (int k = pick; k < numPending; k++) {
+            pending[k] = pending[k + 1];
+            deadline[k] = deadline[k + 1];
+        }
 
-static void write_bits(unsigned char * dest, int * destPos, struct BitEncoding * encoding, int value, uint32_t * buff, int * buffBits) {
-    int nbits = encoding[value].nbits;
-    uint32_t bitstring = encoding[value].bitstring;
-
-    if (*buffBits + nbits >= 32) {
-        int diff = *buffBits + nbits - 32;
-        *buff <<= nbits - diff;
-        *buff |= bitstring >> diff;
-        bitstring &= ~(1 << diff);
-        nbits = diff;
-        write_32_le(dest, destPos, buff, buffBits);
-    }
-    if (nbits != 0) {
-        *buff <<= nbits;
-        *buff |= bitstring;
-        *buffBits += nbits;
+        nodes[parentPos] = pair - parentPair - 1;
+
+        for (int dir = 0; dir < 2; dir++) {
+            int child = children[node][dir];
+            int childPos = 1 + pair * 2 + dir;
+
+            nodePos[child] = childPos;
+            if (symbols[child] != -1) {
+                nodes[childPos] = symbols[child];
+                nodes[parentPos] |= 0x80 >> dir;
+            } else {
+                pending[numPending] = child;
+                deadline[numPending] = pair + 64;
+                numPending++;
+            }
+        }
     }
+
+    // Node count plus the size byte, padded so the bitstream is word aligned.
+    int treeBytes = (nnodes + 1 + 3) & ~3;
+
+    memset(dest + 5 + nnodes, 0, treeBytes - nnodes - 1);
+    dest[4] = treeBytes / 2 - 1;
+
+    return treeBytes;
 }
 
 /*
@@ -222,128 +248,140 @@ unsigned char * HuffCompress(unsigned char * src, int srcSize, int * compressedS
     if (srcSize <= 0)
         goto fail;
 
-    int worstCaseDestSize = 4 + (2 << bitDepth) + srcSize * 3;
+    int nsymbols = 1 << bitDepth;
+    int mask = nsymbols - 1;
+    int symbolsPerWord = 32 / bitDepth;
+    int paddedSize = (srcSize + 3) & ~3;
+
+    // The bitstream is at most HUFF_MAX_CODE_LENGTH bits per symbol.
+    int worstCaseDestSize = 4 + 2 * nsymbols + 4 + (paddedSize * 8 / bitDepth) * (HUFF_MAX_CODE_LENGTH / 8);
 
     unsigned char *dest = malloc(worstCaseDestSize);
     if (dest == NULL)
         goto fail;
 
-    int nitems = 1 << bitDepth;
-
-    HuffNode_t * freqs = calloc(nitems, sizeof(HuffNode_t));
-    if (freqs == NULL)
-        goto fail;
-
-    struct BitEncoding * encoding = calloc(nitems, sizeof(struct BitEncoding));
-    if (encoding == NULL)
-        goto fail;
-
-    // Set up the frequencies table.  This will inform the tree.
-    for (int i = 0; i < nitems; i++) {
-        freqs[i].header.isLeaf = 1;
-        freqs[i].header.value = 0;
-        freqs[i].leaf.key = i;
-    }
-
     // Count each nybble or byte.
+    uint32_t freqs[256] = {0};
+
     for (int i = 0; i < srcSize; i++) {
         if (bitDepth == 8) {
-            freqs[src[i]].header.value++;
+            freqs[src[i]]++;
         } else {
-            freqs[src[i] >> 4].header.value++;
-            freqs[src[i] & 0xF].header.value++;
+            freqs[src[i] >> 4]++;
+            freqs[src[i] & 0xF]++;
         }
     }
 
+    // The decompressor works in whole words, so pad the input with zeros.
+    if (paddedSize != srcSize)
+        freqs[0] += (paddedSize - srcSize) * (8 / bitDepth);
+
 #ifdef DEBUG
-    for (int i = 0; i < nitems; i++) {
-        fprintf(stderr, "%d: %d\n", i, freqs[i].header.value);
+    for (int i = 0; i < nsymbols; i++) {
+        fprintf(stderr, "%d: %u\n", i, freqs[i]);
     }
 #endif // DEBUG
 
-    // Sort the frequency table.
-    if (!msort(freqs, nitems, sizeof(HuffNode_t), cmp_tree))
-        goto fail;
-
-    // Prune zero-frequency values.
-    for (int i = 0; i < nitems; i++) {
-        if (freqs[i].header.value != 0) {
-            if (i > 0) {
-                for (int j = i; j < nitems; j++) {
-                    freqs[j - i] = freqs[j];
-                }
-                nitems -= i;
+    unsigned char lengths[256];
+    struct BitEncoding encoding[256];
+
+    compute_code_lengths(freqs, nsymbols, lengths);
+    int destPos = 4 + write_tree(dest, lengths, nsymbols, encoding);
+
+    // Encode the data itself. Codes are at most 32 bits, so a 64-bit
+    // accumulator can always take one more code before it is flushed.
+    uint64_t bitBuf = 0;
+    int bitCount = 0;
+
+    for (int srcPos = 0; srcPos < paddedSize; srcPos += 4) {
+        uint32_t word = 0;
+        for (int i = 0; i < 4 && srcPos + i < srcSize; i++)
+            word |= (uint32_t)src[srcPos + i] << (i * 8);
+
+        for (int i = 0; i < symbolsPerWord; i++) {
+            const struct BitEncoding *enc = &encoding[word & mask];
+            bitBuf = (bitBuf << enc->nbits) | enc->bitstring;
+            bitCount += enc->nbits;
+            word >>= bitDepth;
+
+            if (bitCount >= 32) {
+                uint32_t out = bitBuf >> (bitCount - 32);
+                dest[destPos++] = out;
+                dest[destPos++] = out >> 8;
+                dest[destPos++] = out >> 16;
+                dest[destPos++] = out >> 24;
+                bitCount -= 32;
             }
-            break;
         }
-        // This should never happen:
-        if (i == nitems - 1)
-            goto fail;
     }
 
-    HuffNode_t * tree = calloc(nitems * 2 - 1, sizeof(HuffNode_t));
-    if (tree == NULL)
-        goto fail;
-
-    // Iteratively collapse the two least frequent nodes.
-    HuffNode_t * endptr = freqs + nitems - 2;
-
-    for (int i = 0; i < nitems - 1; i++) {
-        HuffNode_t * left = freqs;
-        HuffNode_t * right = freqs + 1;
-        tree[i * 2] = *right;
-        tree[i * 2 + 1] = *left;
-        for (int j = 0; j < nitems - i - 2; j++)
-            freqs[j] = freqs[j + 2];
-        endptr->header.isLeaf = 0;
-        endptr->header.value = tree[i * 2].header.value + tree[i * 2 + 1].header.value;
-        endptr->branch.left = tree + i * 2;
-        endptr->branch.right = tree + i * 2 + 1;
-        endptr--;
-        if (i < nitems - 2 && !msort(freqs, nitems - i - 1, sizeof(HuffNode_t), cmp_tree))
-            goto fail;
+    if (bitCount != 0) {
+        uint32_t out = (uint32_t)(bitBuf << (32 - bitCount));
+        dest[destPos++] = out;
+        dest[destPos++] = out >> 8;
+        dest[destPos++] = out >> 16;
+        dest[destPos++] = out >> 24;
     }
 
-    // Write the tree breadth-first, and create the path lookup table.
-    write_tree(dest, freqs, nitems, encoding);
-
-    free(tree);
-    free(freqs);
-
-    // Encode the data itself.
-    int destPos = 4 + nitems * 2;
-    uint32_t destBuf = 0;
-    uint32_t srcBuf = 0;
-    int destBitPos = 0;
-
-    for (int srcPos = 0; srcPos < srcSize;) {
-        read_32_le(src, &srcPos, &srcBuf);
-        for (int i = 0; i < 32 / bitDepth; i++) {
-            write_bits(dest, &destPos, encoding, srcBuf & (0xFF >> (8 - bitDepth)), &destBuf, &destBitPos);
-            srcBuf >>= bitDepth;
-        }
-    }
-
-    if (destBitPos != 0) {
-        write_32_le(dest, &destPos, &destBuf, &destBitPos);
-    }
-
-    free(encoding);
-
     // Write the header.
     dest[0] = bitDepth | 0x20;
     dest[1] = srcSize;
     dest[2] = srcSize >> 8;
     dest[3] = srcSize >> 16;
-    *compressedSize_p = (destPos + 3) & ~3;
+    *compressedSize_p = destPos;
     return dest;
 
 fail:
     FATAL_ERROR("Fatal error while compressing Huff file.\n");
 }
 
+/*
+ * Lookup table entry for decoding HUFF_LOOKUP_BITS bits at once. If a leaf
+ * is reached within those bits, symbol and nbits describe it. Otherwise
+ * nbits is HUFF_LOOKUP_BITS and node is the tree position to continue from.
+ */
+struct HuffLookup {
+    int node;
+    unsigned char symbol;
+    unsigned char nbits;
+    bool isLeaf;
+};
+
+static bool step_tree(unsigned char * src, int srcSize, int * treePos, int bit, bool * isLeaf) {
+    if (*treePos >= srcSize)
+        return false;
+
+    unsigned char treeView = src[*treePos];
+    *isLeaf = ((treeView << bit) & 0x80) != 0;
+    *treePos = (*treePos & ~1) + ((treeView & 0x3F) + 1) * 2 + bit;
+
+    return *treePos < srcSize;
+}
+
+static bool build_lookup(unsigned char * src, int srcSize, struct HuffLookup * lookup) {
+    for (int prefix = 0; prefix < (1 << HUFF_LOOKUP_BITS); prefix++) {
+        int treePos = 5;
+        bool isLeaf = false;
+        int nbits = 0;
+
+        while (nbits < HUFF_LOOKUP_BITS && !isLeaf) {
+            int bit = (prefix >> (HUFF_LOOKUP_BITS - 1 - nbits)) & 1;
+            if (!step_tree(src, srcSize, &treePos, bit, &isLeaf))
+                return false;
+            nbits++;
+        }
+
+        lookup[prefix].isLeaf = isLeaf;
+        lookup[prefix].nbits = nbits;
+        lookup[prefix].node = treePos;
+        lookup[prefix].symbol = isLeaf ? src[treePos] : 0;
+    }
+
+    return true;
+}
+
 unsigned char * HuffDecompress(unsigned char * src, int srcSize, int * uncompressedSize_p) {
-    if (srcSize < 4)
+    if (srcSize < 5)
         goto fail;
 
     int bitDepth = *src & 15;
@@ -351,48 +389,72 @@ unsigned char * HuffDecompress(unsigned char * src, int srcSize, int * uncompres
         goto fail;
 
     int destSize = (src[3] << 16) | (src[2] << 8) | src[1];
+    int numSymbols = destSize * 8 / bitDepth;
 
-    unsigned char *dest = malloc(destSize);
+    unsigned char *dest = calloc(destSize + 4, 1);
 
     if (dest == NULL)
         goto fail;
 
-    int treePos = 5;
-    int treeSize = (src[4] + 1) * 2;
-    int srcPos = 4 + treeSize;
-    int destPos = 0;
-    int curValPos = 0;
-    uint32_t destTmp = 0;
-    uint32_t window;
-
-    for (;;)
-    {
-        if (srcPos >= srcSize)
+    struct HuffLookup lookup[1 << HUFF_LOOKUP_BITS];
+
+    if (!build_lookup(src, srcSize, lookup))
+        goto fail;
+
+    int srcPos = 4 + (src[4] + 1) * 2;
+    uint64_t bitBuf = 0;
+    int bitCount = 0;
+
+    for (int i = 0; i < numSymbols; i++) {
+        // Keep at least 32 bits buffered, reading whole words as the BIOS does.
+        if (bitCount < 32 && srcPos + 4 <= srcSize) {
+            uint32_t word = src[srcPos] | (src[srcPos + 1] << 8) | (src[srcPos + 2] << 16) | ((uint32_t)src[srcPos + 3] << 24);
+            bitBuf |= (uint64_t)word << (32 - bitCount);
+            bitCount += 32;
+            srcPos += 4;
+        }
+
+        if (bitCount == 0)
             goto fail;
-        read_32_le(src, &srcPos, &window);
-        for (int i = 0; i < 32; i++) {
-            int curBit = (window >> 31) & 1;
-            unsigned char treeView = src[treePos];
-            bool isLeaf = ((treeView << curBit) & 0x80) != 0;
-            treePos &= ~1; // align
-            treePos += ((treeView & 0x3F) + 1) * 2 + curBit;
-            if (isLeaf) {
-                destTmp >>= bitDepth;
-                destTmp |= (src[treePos] << (32 - bitDepth));
-                curValPos++;
-                if (curValPos == 32 / bitDepth) {
-                    write_32_le(dest, &destPos, &destTmp, &curValPos);
-                    if (destPos == destSize) {
-                        *uncompressedSize_p = destSize;
-                        return dest;
-                    }
-                }
-                treePos = 5;
+
+        const struct HuffLookup *entry = &lookup[bitBuf >> (64 - HUFF_LOOKUP_BITS)];
+        int symbol;
+
+        if (entry->isLeaf) {
+            symbol = entry->symbol;
+            bitBuf <<= entry->nbits;
+            bitCount -= entry->nbits;
+        } else {
+            int treePos = entry->node;
+            bool isLeaf = false;
+
+            bitBuf <<= HUFF_LOOKUP_BITS;
+            bitCount -= HUFF_LOOKUP_BITS;
+
+            while (!isLeaf) {
+                if (bitCount <= 0)
+                    goto fail;
+                if (!step_tree(src, srcSize, &treePos, bitBuf >> 63, &isLeaf))
+                    goto fail;
+                bitBuf <<= 1;
+                bitCount--;
             }
-            window <<= 1;
+
+            symbol = src[treePos];
         }
+
+        if (bitCount < 0)
+            goto fail;
+
+        if (bitDepth == 8)
+            dest[i] = symbol;
+        else
+            dest[i / 2] |= (symbol & 0xF) << ((i & 1) * 4);
     }
 
+    *uncompressedSize_p = destSize;
+    return dest;
+
 fail:
     FATAL_ERROR("Fatal error while decompressing Huff file.\n");
 }
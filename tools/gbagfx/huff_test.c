@@ -0,0 +1,254 @@
+// Round-trip test for the Huffman compressor.
+//
+// Every input is compressed with HuffCompress, then decoded twice: once with
+// HuffDecompress and once with a bit-at-a-time decoder that walks the tree
+// exactly as the BIOS HuffUnComp routine does, so a tree whose child offsets
+// don't fit in the 6-bit field or a misaligned bitstream is caught even if
+// HuffDecompress would agree with it.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "huff.h"
+
+static uint32_t sRandomState = 0x2463534;
+
+static uint32_t Random(void) {
+    // xorshift32, so that a failure can be reproduced from the seed.
+    sRandomState ^= sRandomState << 13;
+    sRandomState ^= sRandomState >> 17;
+    sRandomState ^= sRandomState << 5;
+    return sRandomState;
+}
+
+static int sNumFailures;
+
+/*
+ * Decodes src as the BIOS does: the root is at offset 5, each branch's child
+ * pair is at (nodeAddr & ~1) + offset * 2 + 2, and the bitstream is read in
+ * 32-bit words from bit 31 downward, writing whole 32-bit words of output.
+ * Returns NULL if the stream walks outside the tree or the data.
+ */
+static unsigned char * BiosHuffUnComp(const unsigned char * src, int srcSize, int * destSize_p) {
+    int bitDepth = src[0] & 0xF;
+    int destSize = src[1] | (src[2] << 8) | (src[3] << 16);
+    int treeEnd = 4 + (src[4] + 1) * 2;
+    int paddedSize = (destSize + 3) & ~3;
+    unsigned char *dest = calloc(paddedSize + 4, 1);
+    int srcPos = treeEnd;
+    int destPos = 0;
+    int treePos = 5;
+    uint32_t outWord = 0;
+    int outBits = 0;
+
+    if ((src[0] & 0xF0) != 0x20 || (bitDepth != 4 && bitDepth != 8) || treeEnd > srcSize || (treeEnd & 3) != 0)
+        goto fail;
+
+    while (destPos < paddedSize) {
+        if (srcPos + 4 > srcSize)
+            goto fail;
+
+        uint32_t word = src[srcPos] | (src[srcPos + 1] << 8) | (src[srcPos + 2] << 16) | ((uint32_t)src[srcPos + 3] << 24);
+        srcPos += 4;
+
+        for (int bit = 31; bit >= 0 && destPos < paddedSize; bit--) {
+            int b = (word >> bit) & 1;
+            unsigned char node = src[treePos];
+            bool isLeaf = ((node << b) & 0x80) != 0;
+
+            treePos = (treePos & ~1) + (node & 0x3F) * 2 + 2 + b;
+            if (treePos <= 5 || treePos >= treeEnd)
+                goto fail;
+
+            if (isLeaf) {
+                outWord |= (uint32_t)(src[treePos] & ((1 << bitDepth) - 1)) << outBits;
+                outBits += bitDepth;
+                treePos = 5;
+
+                if (outBits == 32) {
+                    dest[destPos++] = outWord;
+                    dest[destPos++] = outWord >> 8;
+                    dest[destPos++] = outWord >> 16;
+                    dest[destPos++] = outWord >> 24;
+                    outWord = 0;
+                    outBits = 0;
+                }
+            }
+        }
+    }
+
+    *destSize_p = destSize;
+    return dest;
+
+fail:
+    free(dest);
+    return NULL;
+}
+
+static void Check(const char * name, unsigned char * src, int size, int bitDepth) {
+    int compressedSize;
+    unsigned char *compressed = HuffCompress(src, size, &compressedSize, bitDepth);
+
+    int biosSize;
+    unsigned char *bios = BiosHuffUnComp(compressed, compressedSize, &biosSize);
+
+    if (bios == NULL || biosSize != size || memcmp(bios, src, size) != 0) {
+        fprintf(stderr, "FAIL: %s (%d bytes, %d-bit): BIOS decode mismatch\n", name, size, bitDepth);
+        sNumFailures++;
+    }
+
+    // The padding the BIOS writes past the end of the data must be zero, as in the input.
+    for (int i = size; bios != NULL && i < ((size + 3) & ~3); i++) {
+        if (bios[i] != 0) {
+            fprintf(stderr, "FAIL: %s (%d bytes, %d-bit): nonzero padding\n", name, size, bitDepth);
+            sNumFailures++;
+            break;
+        }
+    }
+
+    int decompressedSize;
+    unsigned char *decompressed = HuffDecompress(compressed, compressedSize, &decompressedSize);
+
+    if (decompressedSize != size || memcmp(decompressed, src, size) != 0) {
+        fprintf(stderr, "FAIL: %s (%d bytes, %d-bit): HuffDecompress mismatch\n", name, size, bitDepth);
+        sNumFailures++;
+    }
+
+    free(bios);
+    free(decompressed);
+    free(compressed);
+}
+
+static void CheckBothDepths(const char * name, unsigned char * src, int size) {
+    Check(name, src, size, 4);
+    Check(name, src, size, 8);
+}
+
+// Fills buf with symbols drawn from weights, packing two nybbles per byte at 4 bits.
+static void FillWeighted(unsigned char * buf, int size, const uint32_t * weights, int nsymbols, int bitDepth) {
+    uint32_t total = 0;
+
+    for (int i = 0; i < nsymbols; i++)
+        total += weights[i];
+
+    for (int i = 0; i < size * 8 / bitDepth; i++) {
+        uint32_t r = Random() % total;
+        int symbol = 0;
+
+        while (r >= weights[symbol])
+            r -= weights[symbol++];
+
+        if (bitDepth == 8)
+            buf[i] = symbol;
+        else if (i & 1)
+            buf[i / 2] |= symbol << 4;
+        else
+            buf[i / 2] = symbol;
+    }
+}
+
+int main(int argc, char ** argv) {
+    static const int sizes[] = { 1, 2, 3, 4, 5, 6, 7, 8, 31, 33, 255, 1023, 4096, 32769 };
+    unsigned char *buf = malloc(0x10000);
+    char name[64];
+
+    if (argc > 1)
+        sRandomState = strtoul(argv[1], NULL, 0);
+
+    if (buf == NULL || sRandomState == 0)
+        FATAL_ERROR("Usage: huff_test [nonzero seed]\n");
+
+    // Uniformly random data, which uses every symbol at either depth once it's long enough.
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int j = 0; j < sizes[i]; j++)
+            buf[j] = Random();
+        snprintf(name, sizeof(name), "random %d", sizes[i]);
+        CheckBothDepths(name, buf, sizes[i]);
+    }
+
+    // A single symbol, with and without the zero padding adding a second one.
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        memset(buf, 0, sizes[i]);
+        snprintf(name, sizeof(name), "zeros %d", sizes[i]);
+        CheckBothDepths(name, buf, sizes[i]);
+
+        memset(buf, 0x77, sizes[i]);
+        snprintf(name, sizeof(name), "single symbol %d", sizes[i]);
+        CheckBothDepths(name, buf, sizes[i]);
+    }
+
+    // Every byte value exactly once, the widest possible 8-bit tree.
+    for (int i = 0; i < 256; i++)
+        buf[i] = i;
+    CheckBothDepths("all 256 bytes", buf, 256);
+    CheckBothDepths("all 256 bytes minus 1", buf + 1, 255);
+
+    // Fibonacci counts give the deepest tree for the number of bytes, one
+    // branch per level, and the other symbols once each widen its bottom levels.
+    int fib[2] = { 1, 1 };
+    int pos = 0;
+
+    for (int symbol = 0; symbol < 22; symbol++) {
+        memset(buf + pos, symbol, fib[0]);
+        pos += fib[0];
+        int next = fib[0] + fib[1];
+        fib[0] = fib[1];
+        fib[1] = next;
+    }
+    CheckBothDepths("fibonacci", buf, pos);
+    for (int symbol = 22; symbol < 256; symbol++)
+        buf[pos++] = symbol;
+    CheckBothDepths("fibonacci all symbols", buf, pos);
+
+    // Skewed random distributions over all 256 symbols give deep, lopsided trees,
+    // where the child pairs of the shallow branches end up furthest away.
+    uint32_t weights[256];
+
+    for (int shift = 1; shift <= 4; shift++) {
+        for (int i = 0; i < 256; i++)
+            weights[i] = 1 + (i < 24 * shift ? (1u << 24) >> (i / shift) : 0);
+
+        for (int depth = 4; depth <= 8; depth += 4) {
+            int nsymbols = 1 << depth;
+            for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+                FillWeighted(buf, sizes[i], weights, nsymbols, depth);
+                snprintf(name, sizeof(name), "skewed /%d %d", shift, sizes[i]);
+                Check(name, buf, sizes[i], depth);
+            }
+        }
+
+        // Guarantee that every one of the 256 symbols appears at least once.
+        FillWeighted(buf, 0x10000 - 256, weights, 256, 8);
+        for (int i = 0; i < 256; i++)
+            buf[0x10000 - 256 + i] = i;
+        snprintf(name, sizeof(name), "skewed /%d all symbols", shift);
+        Check(name, buf, 0x10000, 8);
+    }
+
+    // Random weights over random alphabet sizes.
+    for (int round = 0; round < 200; round++) {
+        int depth = (round & 1) ? 8 : 4;
+        int nsymbols = 1 + Random() % (1 << depth);
+        int size = 1 + Random() % 0x4000;
+
+        for (int i = 0; i < nsymbols; i++)
+            weights[i] = 1 + ((Random() & 0xFFFFF) >> (Random() % 20));
+
+        FillWeighted(buf, size, weights, nsymbols, depth);
+        snprintf(name, sizeof(name), "fuzz %d", round);
+        Check(name, buf, size, depth);
+    }
+
+    free(buf);
+
+    if (sNumFailures != 0) {
+        fprintf(stderr, "huff_test: %d failures\n", sNumFailures);
+        return 1;
+    }
+
+    printf("huff_test: OK\n");
+    return 0;
+}
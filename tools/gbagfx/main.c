@@ -13,6 +13,7 @@
 #include "rl.h"
 #include "font.h"
 #include "huff.h"
+#include "comp_report.h"
 
 struct CommandHandler
 {
@@ -81,6 +82,16 @@ void ConvertPngToGba(char *inputPath, char *outputPath, struct PngToGbaOptions *
     image.bitDepth = options->bitDepth;
     image.tilemap.data.affine = NULL; // initialize to NULL to avoid issues in FreeImage
 
+    if (options->tilemapFilePath != NULL)
+    {
+        // Read one byte per pixel so that the palette number of each tile is kept.
+        image.bitDepth = 8;
+        ReadPng(inputPath, &image);
+        WriteDedupedTileImage(outputPath, options->tilemapFilePath, &image, options->bitDepth, !image.hasPalette);
+        FreeImage(&image);
+        return;
+    }
+
     ReadPng(inputPath, &image);
 
     if (options->isTiled)
@@ -280,12 +291,22 @@ void HandlePngToGbaCommand(char *inputPath, char *outputPath, int argc, char **a
             if (options.dataWidth < 1)
                 FATAL_ERROR("Data width must be positive.\n");
         }
+        else if (strcmp(option, "-tilemap") == 0)
+        {
+            if (i + 1 >= argc)
+                FATAL_ERROR("No tilemap value following \"-tilemap\".\n");
+            i++;
+            options.tilemapFilePath = argv[i];
+        }
         else
         {
             FATAL_ERROR("Unrecognized option \"%s\".\n", option);
         }
     }
 
+    if (options.tilemapFilePath != NULL && (!options.isTiled || options.numTiles != 0 || options.metatileWidth != 1 || options.metatileHeight != 1))
+        FATAL_ERROR("\"-tilemap\" can't be combined with \"-plain\", \"-num_tiles\", \"-mwidth\" or \"-mheight\".\n");
+
     ConvertPngToGba(inputPath, outputPath, &options);
 }
 
@@ -586,6 +607,51 @@ void HandleHuffDecompressCommand(char *inputPath, char *outputPath, int argc UNU
     free(uncompressedData);
 }
 
+void HandleCompressionReportCommand(char *inputPath, char *outputPath, int argc, char **argv)
+{
+    bool isList = false;
+
+    for (int i = 3; i < argc; i++)
+    {
+        char *option = argv[i];
+
+        if (strcmp(option, "-list") == 0)
+        {
+            isList = true;
+        }
+        else
+        {
+            FATAL_ERROR("Unrecognized option \"%s\".\n", option);
+        }
+    }
+
+    if (!isList)
+    {
+        WriteCompressionReport(&inputPath, 1, outputPath);
+        return;
+    }
+
+    // The input is a text file listing one asset path per line.
+    int fileSize;
+    char *list = (char *)ReadWholeFileZeroPadded(inputPath, &fileSize, 1);
+    int numPaths = 0;
+    char **paths = malloc((fileSize + 1) * sizeof(char *));
+
+    if (paths == NULL)
+        FATAL_ERROR("Failed to allocate asset list.\n");
+
+    for (char *line = strtok(list, "\r\n"); line != NULL; line = strtok(NULL, "\r\n"))
+    {
+        if (*line != 0)
+            paths[numPaths++] = line;
+    }
+
+    WriteCompressionReport(paths, numPaths, outputPath);
+
+    free(paths);
+    free(list);
+}
+
 int main(int argc, char **argv)
 {
     char converted = 0;
@@ -617,6 +683,7 @@ int main(int argc, char **argv)
         { "lz", NULL, HandleLZDecompressCommand },
         { NULL, "rl", HandleRLCompressCommand },
         { "rl", NULL, HandleRLDecompressCommand },
+        { NULL, "compreport", HandleCompressionReportCommand },
         { NULL, NULL, NULL }
     };
 
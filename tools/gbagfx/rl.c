@@ -2,9 +2,90 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include "global.h"
 #include "rl.h"
 
+// Runs are found eight bytes at a time by comparing machine words. This relies
+// on a little-endian host to map the lowest differing bit to the lowest address;
+// other hosts fall back to comparing one byte at a time.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RL_WORD_SCAN
+#endif
+
+#define ONES_64  0x0101010101010101ULL
+#define HIGHS_64 0x8080808080808080ULL
+
+#ifdef RL_WORD_SCAN
+static inline uint64_t Load64(const unsigned char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+#endif
+
+// Returns the first position in [pos, end) that starts three equal bytes,
+// or end if there is none. Bytes at or past srcSize never take part in a match.
+static int FindRunStart(const unsigned char *src, int pos, int end, int srcSize)
+{
+#ifdef RL_WORD_SCAN
+    while (pos < end && pos + 10 <= srcSize)
+    {
+        // A zero byte in diff marks a position where src[i] == src[i + 1] == src[i + 2].
+        uint64_t a = Load64(src + pos);
+        uint64_t diff = (a ^ Load64(src + pos + 1)) | (a ^ Load64(src + pos + 2));
+        uint64_t zeros = (diff - ONES_64) & ~diff & HIGHS_64;
+
+        // The lowest flagged byte is always exact.
+        if (zeros != 0)
+        {
+            int match = pos + (__builtin_ctzll(zeros) >> 3);
+            return match < end ? match : end;
+        }
+
+        pos += 8;
+    }
+
+    if (pos > end)
+        pos = end;
+#endif
+
+    for (; pos < end; pos++)
+    {
+        if (pos + 2 < srcSize && src[pos] == src[pos + 1] && src[pos] == src[pos + 2])
+            return pos;
+    }
+
+    return end;
+}
+
+// Returns the number of bytes equal to data starting at pos, up to maxLength.
+static int GetRunLength(const unsigned char *src, int pos, int maxLength, unsigned char data)
+{
+    int length = 0;
+
+#ifdef RL_WORD_SCAN
+    uint64_t pattern = data * ONES_64;
+
+    while (length + 8 <= maxLength)
+    {
+        uint64_t diff = Load64(src + pos + length) ^ pattern;
+
+        if (diff != 0)
+            return length + (__builtin_ctzll(diff) >> 3);
+
+        length += 8;
+    }
+#endif
+
+    while (length < maxLength && src[pos + length] == data)
+        length++;
+
+    return length;
+}
+
 unsigned char *RLDecompress(unsigned char *src, int srcSize, int *uncompressedSize)
 {
     if (srcSize < 4)
@@ -31,23 +112,23 @@ unsigned char *RLDecompress(unsigned char *src, int srcSize, int *uncompressedSi
         if (compressed)
         {
             int length = (flags & 0x7F) + 3;
-            unsigned char data = src[srcPos++];
 
-            if (destPos + length > destSize)
+            if (srcPos >= srcSize || destPos + length > destSize)
                 goto fail;
 
-            for (int i = 0; i < length; i++)
-                dest[destPos++] = data;
+            memset(&dest[destPos], src[srcPos++], length);
+            destPos += length;
         }
         else
         {
             int length = (flags & 0x7F) + 1;
 
-            if (destPos + length > destSize)
+            if (srcPos + length > srcSize || destPos + length > destSize)
                 goto fail;
 
-            for (int i = 0; i < length; i++)
-                dest[destPos++] = src[srcPos++];
+            memcpy(&dest[destPos], &src[srcPos], length);
+            srcPos += length;
+            destPos += length;
         }
 
         if (destPos == destSize)
@@ -87,40 +168,35 @@ unsigned char *RLCompress(unsigned char *src, int srcSize, int *compressedSize)
 
     for (;;)
     {
-        bool compress = false;
+        // A literal block ends where a run of at least three bytes starts,
+        // or after 0x80 bytes, in which case the run is found on the next pass.
         int uncompressedStart = srcPos;
-        int uncompressedLength = 0;
+        int uncompressedEnd = srcPos + (0x7F + 1);
 
-        while (srcPos < srcSize && uncompressedLength < (0x7F + 1))
-        {
-            compress = (srcPos + 2 < srcSize && src[srcPos] == src[srcPos + 1] && src[srcPos] == src[srcPos + 2]);
+        if (uncompressedEnd > srcSize)
+            uncompressedEnd = srcSize;
 
-            if (compress)
-                break;
+        srcPos = FindRunStart(src, srcPos, uncompressedEnd, srcSize);
+
+        int uncompressedLength = srcPos - uncompressedStart;
+        bool compress = srcPos < uncompressedEnd;
 
-            srcPos++;
-            uncompressedLength++;
-        }
-        
         if (uncompressedLength > 0)
         {
             dest[destPos++] = uncompressedLength - 1;
-
-            for (int i = 0; i < uncompressedLength; i++)
-                dest[destPos++] = src[uncompressedStart + i];
+            memcpy(&dest[destPos], &src[uncompressedStart], uncompressedLength);
+            destPos += uncompressedLength;
         }
 
         if (compress)
         {
             unsigned char data = src[srcPos];
-            int compressedLength = 0;
+            int maxLength = 0x7F + 3;
 
-            while (compressedLength < (0x7F + 3)
-                && srcPos + compressedLength < srcSize
-                && src[srcPos + compressedLength] == data)
-            {
-                compressedLength++;
-            }
+            if (maxLength > srcSize - srcPos)
+                maxLength = srcSize - srcPos;
+
+            int compressedLength = GetRunLength(src, srcPos, maxLength, data);
 
             dest[destPos++] = 0x80 | (compressedLength - 3);
             dest[destPos++] = data;
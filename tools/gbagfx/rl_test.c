@@ -0,0 +1,266 @@
+// Tests for the run-length compressor. rl.c is included directly so that its
+// word-at-a-time FindRunStart and GetRunLength can be compared against plain
+// byte loops at every position. RLCompress must also produce exactly the same
+// output as the original byte-at-a-time compressor, and every result must
+// decompress back to its input. Finally the throughput of both compressors is
+// printed.
+
+#include <stdio.h>
+#include <time.h>
+#include "rl.c"
+
+static uint32_t sRandomState = 0x2463534;
+
+// xorshift32, so that a failure can be reproduced from the seed.
+static uint32_t Random(void)
+{
+    sRandomState ^= sRandomState << 13;
+    sRandomState ^= sRandomState >> 17;
+    sRandomState ^= sRandomState << 5;
+    return sRandomState;
+}
+
+static int sNumFailures;
+
+static int RefFindRunStart(const unsigned char *src, int pos, int end, int srcSize)
+{
+    for (; pos < end; pos++)
+    {
+        if (pos + 2 < srcSize && src[pos] == src[pos + 1] && src[pos] == src[pos + 2])
+            return pos;
+    }
+
+    return end;
+}
+
+static int RefGetRunLength(const unsigned char *src, int pos, int maxLength, unsigned char data)
+{
+    int length = 0;
+
+    while (length < maxLength && src[pos + length] == data)
+        length++;
+
+    return length;
+}
+
+// The compressor as it was before the word scan, kept as the reference output.
+static unsigned char *RefRLCompress(unsigned char *src, int srcSize, int *compressedSize)
+{
+    unsigned char *dest = malloc(((4 + srcSize * 2) + 3) & ~3);
+
+    if (dest == NULL)
+        FATAL_ERROR("Failed to allocate memory.\n");
+
+    dest[0] = 0x30;
+    dest[1] = (unsigned char)srcSize;
+    dest[2] = (unsigned char)(srcSize >> 8);
+    dest[3] = (unsigned char)(srcSize >> 16);
+
+    int srcPos = 0;
+    int destPos = 4;
+
+    for (;;)
+    {
+        bool compress = false;
+        int uncompressedStart = srcPos;
+        int uncompressedLength = 0;
+
+        while (srcPos < srcSize && uncompressedLength < (0x7F + 1))
+        {
+            compress = (srcPos + 2 < srcSize && src[srcPos] == src[srcPos + 1] && src[srcPos] == src[srcPos + 2]);
+
+            if (compress)
+                break;
+
+            srcPos++;
+            uncompressedLength++;
+        }
+
+        if (uncompressedLength > 0)
+        {
+            dest[destPos++] = uncompressedLength - 1;
+
+            for (int i = 0; i < uncompressedLength; i++)
+                dest[destPos++] = src[uncompressedStart + i];
+        }
+
+        if (compress)
+        {
+            unsigned char data = src[srcPos];
+            int compressedLength = 0;
+
+            while (compressedLength < (0x7F + 3)
+                && srcPos + compressedLength < srcSize
+                && src[srcPos + compressedLength] == data)
+            {
+                compressedLength++;
+            }
+
+            dest[destPos++] = 0x80 | (compressedLength - 3);
+            dest[destPos++] = data;
+
+            srcPos += compressedLength;
+        }
+
+        if (srcPos == srcSize)
+        {
+            while (destPos % 4 != 0)
+                dest[destPos++] = 0;
+
+            *compressedSize = destPos;
+            return dest;
+        }
+    }
+}
+
+// Fills buf with runs of random lengths, mostly short, drawn from a small alphabet
+// so that runs often border on equal bytes.
+static void FillRuns(unsigned char *buf, int size, int maxRun, int alphabet)
+{
+    int pos = 0;
+
+    while (pos < size)
+    {
+        int length = 1 + Random() % (1 + Random() % maxRun);
+        unsigned char data = Random() % alphabet;
+
+        for (int i = 0; i < length && pos < size; i++)
+            buf[pos++] = data;
+    }
+}
+
+static void CheckScans(const unsigned char *buf, int size)
+{
+    for (int pos = 0; pos <= size; pos++)
+    {
+        int end = pos + Random() % 140;
+
+        if (end > size)
+            end = size;
+
+        if (FindRunStart(buf, pos, end, size) != RefFindRunStart(buf, pos, end, size))
+        {
+            fprintf(stderr, "FAIL: FindRunStart(%d, %d) of %d bytes\n", pos, end, size);
+            sNumFailures++;
+        }
+
+        if (pos < size)
+        {
+            int maxLength = size - pos < 130 ? size - pos : 130;
+
+            if (GetRunLength(buf, pos, maxLength, buf[pos]) != RefGetRunLength(buf, pos, maxLength, buf[pos]))
+            {
+                fprintf(stderr, "FAIL: GetRunLength(%d, %d) of %d bytes\n", pos, maxLength, size);
+                sNumFailures++;
+            }
+        }
+    }
+}
+
+static void CheckCompress(unsigned char *buf, int size)
+{
+    int compressedSize, refSize, decompressedSize;
+    unsigned char *compressed = RLCompress(buf, size, &compressedSize);
+    unsigned char *ref = RefRLCompress(buf, size, &refSize);
+
+    if (compressedSize != refSize || memcmp(compressed, ref, refSize) != 0)
+    {
+        fprintf(stderr, "FAIL: RLCompress output differs for %d bytes\n", size);
+        sNumFailures++;
+    }
+
+    unsigned char *decompressed = RLDecompress(compressed, compressedSize, &decompressedSize);
+
+    if (decompressedSize != size || memcmp(decompressed, buf, size) != 0)
+    {
+        fprintf(stderr, "FAIL: round trip of %d bytes\n", size);
+        sNumFailures++;
+    }
+
+    free(decompressed);
+    free(ref);
+    free(compressed);
+}
+
+// Prints the throughput of both compressors over buf in MB/s.
+static void Benchmark(const char *name, unsigned char *buf, int size)
+{
+    double seconds[2];
+    int compressedSize;
+
+    for (int i = 0; i < 2; i++)
+    {
+        int iterations = 0;
+        clock_t start = clock();
+        clock_t elapsed;
+
+        do
+        {
+            free((i == 0 ? RefRLCompress : RLCompress)(buf, size, &compressedSize));
+            iterations++;
+            elapsed = clock() - start;
+        } while (elapsed < CLOCKS_PER_SEC / 4);
+
+        seconds[i] = (double)elapsed / CLOCKS_PER_SEC / iterations;
+    }
+
+    printf("%-12s %7.1f MB/s byte loop, %7.1f MB/s word scan (%.2fx), ratio %.3f\n",
+        name, size / seconds[0] / 1e6, size / seconds[1] / 1e6, seconds[0] / seconds[1],
+        (double)compressedSize / size);
+}
+
+int main(int argc, char **argv)
+{
+    int bufferSize = 0x20000;
+    unsigned char *buf = malloc(bufferSize);
+
+    if (argc > 1)
+        sRandomState = strtoul(argv[1], NULL, 0);
+
+    if (buf == NULL || sRandomState == 0)
+        FATAL_ERROR("Usage: rl_test [nonzero seed]\n");
+
+    // Every small size, where the word scan hands over to the byte loop near the end.
+    for (int size = 1; size <= 300; size++)
+    {
+        FillRuns(buf, size, 1 + size % 20, 1 + size % 4);
+        CheckScans(buf, size);
+        CheckCompress(buf, size);
+    }
+
+    // Runs shorter and longer than the 130-byte maximum and literal blocks longer than 128.
+    for (int round = 0; round < 300; round++)
+    {
+        int size = 1 + Random() % 5000;
+        int maxRun = (round % 3 == 0) ? 3 : (round % 3 == 1) ? 16 : 400;
+        int alphabet = 1 + Random() % (round & 1 ? 3 : 256);
+
+        FillRuns(buf, size, maxRun, alphabet);
+        CheckScans(buf, size);
+        CheckCompress(buf, size);
+    }
+
+    memset(buf, 0, bufferSize);
+    CheckCompress(buf, bufferSize);
+
+    if (sNumFailures != 0)
+    {
+        fprintf(stderr, "rl_test: %d failures\n", sNumFailures);
+        return 1;
+    }
+
+    printf("rl_test: OK\n");
+
+    for (int i = 0; i < bufferSize; i++)
+        buf[i] = Random();
+    Benchmark("random", buf, bufferSize);
+    FillRuns(buf, bufferSize, 4, 16);
+    Benchmark("short runs", buf, bufferSize);
+    FillRuns(buf, bufferSize, 64, 16);
+    Benchmark("mixed runs", buf, bufferSize);
+    memset(buf, 0, bufferSize);
+    Benchmark("zeros", buf, bufferSize);
+
+    free(buf);
+    return 0;
+}
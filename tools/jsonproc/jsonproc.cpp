@@ -6,115 +6,232 @@
 
 #include <map>
 
+#include <unordered_map>
+using std::unordered_map;
+
+#include <vector>
+using std::vector;
+
+#include <memory>
+using std::unique_ptr;
+
+#include <chrono>
+
 #include <string>
 using std::string; using std::to_string;
 
-#include <algorithm>
-using std::replace_if;
+#include <string_view>
+
+#include <cstring>
+using std::strcmp;
 
 #include <inja.hpp>
 using namespace inja;
 using json = nlohmann::json;
 
-std::map<string, string> customVars;
+unordered_map<string, string> customVars;
 
-void set_custom_var(string key, string value)
+// Inja would read the file through an istreambuf_iterator, which costs a virtual
+// call per character; nlohmann's FILE * reader buffers it instead.
+json load_json(const string &filepath)
 {
-    customVars[key] = value;
+    FILE *fp = fopen(filepath.c_str(), "rb");
+
+    if (fp == NULL)
+        FATAL_ERROR("Failed to open \"%s\" for reading.\n", filepath.c_str());
+
+    json data = json::parse(fp);
+    fclose(fp);
+    return data;
 }
 
-string get_custom_var(string key)
+// Writes text to filepath unless the file already holds exactly that text, so
+// that regenerating an unchanged file doesn't make everything built from it stale.
+void write_file_if_changed(const string &filepath, const string &text)
 {
-    return customVars[key];
+    FILE *fp = fopen(filepath.c_str(), "rb");
+
+    if (fp != NULL)
+    {
+        string existing;
+        char buffer[0x10000];
+        size_t count;
+
+        while (existing.size() <= text.size() && (count = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+            existing.append(buffer, count);
+
+        fclose(fp);
+
+        if (existing == text)
+            return;
+    }
+
+    fp = fopen(filepath.c_str(), "wb");
+
+    if (fp == NULL)
+        FATAL_ERROR("Failed to open \"%s\" for writing.\n", filepath.c_str());
+
+    if (fwrite(text.data(), 1, text.size(), fp) != text.size())
+        FATAL_ERROR("Failed to write \"%s\".\n", filepath.c_str());
+
+    fclose(fp);
+}
+
+// Views a string argument in place. Like get<string>(), this throws if the
+// argument isn't a string.
+std::string_view string_arg(Arguments& args, size_t i)
+{
+    return args.at(i)->get_ref<const json::string_t&>();
+}
+
+void set_custom_var(const string &key, string value)
+{
+    auto it = customVars.find(key);
+    if (it != customVars.end())
+        it->second = std::move(value);
+    else
+        customVars.emplace(key, std::move(value));
+}
+
+const string &get_custom_var(const string &key)
+{
+    static const string empty;
+    auto it = customVars.find(key);
+    return it != customVars.end() ? it->second : empty;
+}
+
+struct CallbackStats
+{
+    string name;
+    unsigned long calls = 0;
+    std::chrono::steady_clock::duration time{};
+};
+
+// Per-callback call counts and time, collected when running with -profile.
+vector<unique_ptr<CallbackStats>> callbackStats;
+
+void add_callback(Environment& env, bool profile, const string& name, int numArgs, const CallbackFunction& callback)
+{
+    if (!profile)
+    {
+        env.add_callback(name, numArgs, callback);
+        return;
+    }
+
+    callbackStats.emplace_back(new CallbackStats);
+    CallbackStats *stats = callbackStats.back().get();
+    stats->name = name;
+
+    env.add_callback(name, numArgs, [stats, callback](Arguments& args) {
+        auto start = std::chrono::steady_clock::now();
+        json result = callback(args);
+        stats->time += std::chrono::steady_clock::now() - start;
+        stats->calls++;
+        return result;
+    });
+}
+
+void print_callback_stats()
+{
+    fprintf(stderr, "%-20s %10s %12s\n", "callback", "calls", "time (ms)");
+    for (const auto& stats : callbackStats)
+    {
+        double ms = std::chrono::duration<double, std::milli>(stats->time).count();
+        fprintf(stderr, "%-20s %10lu %12.3f\n", stats->name.c_str(), stats->calls, ms);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
-        FATAL_ERROR("USAGE: jsonproc <json-filepath> <template-filepath> <output-filepath>\n");
+    bool profile = argc > 1 && strcmp(argv[1], "-profile") == 0;
+    int firstArg = profile ? 2 : 1;
 
-    string jsonfilepath = argv[1];
-    string templateFilepath = argv[2];
-    string outputFilepath = argv[3];
+    if (argc - firstArg < 3 || (argc - firstArg) % 3 != 0)
+        FATAL_ERROR("USAGE: jsonproc [-profile] <json-filepath> <template-filepath> <output-filepath> [<json-filepath> <template-filepath> <output-filepath>]...\n");
+
+    // The file names of the triple being rendered.
+    string jsonfilepath;
+    string templateFilepath;
 
     Environment env;
     env.set_trim_blocks(true);
 
     // Add custom command callbacks.
-    env.add_callback("doNotModifyHeader", 0, [jsonfilepath, templateFilepath](Arguments& args) {
+    // String arguments are viewed in place; only results are copied into new strings.
+    add_callback(env, profile, "doNotModifyHeader", 0, [&jsonfilepath, &templateFilepath](Arguments& args) {
         return "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from " + jsonfilepath +" and Inja template " + templateFilepath + "\n//\n";
     });
 
-    env.add_callback("contains", 2, [](Arguments& args) {
-        string word = args.at(0)->get<string>();
-        string check = args.at(1)->get<string>();
+    add_callback(env, profile, "contains", 2, [](Arguments& args) {
+        std::string_view word = string_arg(args, 0);
+        std::string_view check = string_arg(args, 1);
 
-        return word.find(check) != std::string::npos;
+        return word.find(check) != std::string_view::npos;
     });
 
-    env.add_callback("subtract", 2, [](Arguments& args) {
+    add_callback(env, profile, "subtract", 2, [](Arguments& args) {
         int minuend = args.at(0)->get<int>();
         int subtrahend = args.at(1)->get<int>();
 
         return minuend - subtrahend;
     });
 
-    env.add_callback("setVar", 2, [=](Arguments& args) {
-        string key = args.at(0)->get<string>();
-        string value = args.at(1)->get<string>();
-        set_custom_var(key, value);
+    add_callback(env, profile, "setVar", 2, [](Arguments& args) {
+        const string& key = args.at(0)->get_ref<const json::string_t&>();
+        set_custom_var(key, string(string_arg(args, 1)));
         return "";
     });
 
-    env.add_callback("setVarInt", 2, [=](Arguments& args) {
-        string key = args.at(0)->get<string>();
-        string value = to_string(args.at(1)->get<int>());
-        set_custom_var(key, value);
+    add_callback(env, profile, "setVarInt", 2, [](Arguments& args) {
+        const string& key = args.at(0)->get_ref<const json::string_t&>();
+        set_custom_var(key, to_string(args.at(1)->get<int>()));
         return "";
     });
 
-    env.add_callback("getVar", 1, [=](Arguments& args) {
-        string key = args.at(0)->get<string>();
+    add_callback(env, profile, "getVar", 1, [](Arguments& args) {
+        const string& key = args.at(0)->get_ref<const json::string_t&>();
         return get_custom_var(key);
     });
 
-    env.add_callback("concat", 2, [](Arguments& args) {
-        string first = args.at(0)->get<string>();
-        string second = args.at(1)->get<string>();
-        return first + second;
+    add_callback(env, profile, "concat", 2, [](Arguments& args) {
+        std::string_view first = string_arg(args, 0);
+        std::string_view second = string_arg(args, 1);
+        string result;
+        result.reserve(first.size() + second.size());
+        result.append(first).append(second);
+        return result;
     });
 
-    env.add_callback("removePrefix", 2, [](Arguments& args) {
-        string rawValue = args.at(0)->get<string>();
-        string prefix = args.at(1)->get<string>();
-        string::size_type i = rawValue.find(prefix);
-        if (i != 0)
-            return rawValue;
+    add_callback(env, profile, "removePrefix", 2, [](Arguments& args) {
+        std::string_view rawValue = string_arg(args, 0);
+        std::string_view prefix = string_arg(args, 1);
+        if (rawValue.compare(0, prefix.length(), prefix) != 0)
+            return string(rawValue);
 
-        return rawValue.erase(0, prefix.length());
+        return string(rawValue.substr(prefix.length()));
     });
 
-    env.add_callback("removeSuffix", 2, [](Arguments& args) {
-        string rawValue = args.at(0)->get<string>();
-        string suffix = args.at(1)->get<string>();
-        string::size_type i = rawValue.rfind(suffix);
-        if (i == string::npos)
-            return rawValue;
+    add_callback(env, profile, "removeSuffix", 2, [](Arguments& args) {
+        std::string_view rawValue = string_arg(args, 0);
+        std::string_view suffix = string_arg(args, 1);
+        std::string_view::size_type i = rawValue.rfind(suffix);
+        if (i == std::string_view::npos)
+            return string(rawValue);
 
-        return rawValue.substr(0, i);
+        return string(rawValue.substr(0, i));
     });
 
     // single argument is a json object
-    env.add_callback("isEmpty", 1, [](Arguments& args) {
+    add_callback(env, profile, "isEmpty", 1, [](Arguments& args) {
         return args.at(0)->empty();
     });
 
-    env.add_callback("isEmptyString", 1, [](Arguments& args) {
-        return args.at(0)->get<string>().empty();
+    add_callback(env, profile, "isEmptyString", 1, [](Arguments& args) {
+        return string_arg(args, 0).empty();
     });
 
-    env.add_callback("cleanString", 1, [](Arguments& args) {
-        string str = args.at(0)->get<string>();
+    add_callback(env, profile, "cleanString", 1, [](Arguments& args) {
+        string str(string_arg(args, 0));
         for (unsigned int i = 0; i < str.length(); i++) {
             // This code is not Unicode aware, so UTF-8 is not easily parsable without introducing
             // another library. Just filter out any non-alphanumeric characters for now.
@@ -127,14 +244,39 @@ int main(int argc, char *argv[])
         return str;
     });
 
-    try
-    {
-        env.write_with_json_file(templateFilepath, jsonfilepath, outputFilepath);
-    }
-    catch (const std::exception& e)
+    // Each JSON file and template is only parsed once, however many triples use it.
+    std::map<string, json> jsonCache;
+    std::map<string, unique_ptr<Template>> templateCache;
+
+    for (int i = firstArg; i < argc; i += 3)
     {
-        FATAL_ERROR("JSONPROC_ERROR: %s\n", e.what());
+        jsonfilepath = argv[i];
+        templateFilepath = argv[i + 1];
+        string outputFilepath = argv[i + 2];
+
+        // Variables don't carry over from one template to the next.
+        customVars.clear();
+
+        try
+        {
+            auto jsonIt = jsonCache.find(jsonfilepath);
+            if (jsonIt == jsonCache.end())
+                jsonIt = jsonCache.emplace(jsonfilepath, load_json(jsonfilepath)).first;
+
+            unique_ptr<Template> &tmpl = templateCache[templateFilepath];
+            if (!tmpl)
+                tmpl.reset(new Template(env.parse_template(templateFilepath)));
+
+            write_file_if_changed(outputFilepath, env.render(*tmpl, jsonIt->second));
+        }
+        catch (const std::exception& e)
+        {
+            FATAL_ERROR("JSONPROC_ERROR: %s\n", e.what());
+        }
     }
 
+    if (profile)
+        print_callback_stats();
+
     return 0;
 }
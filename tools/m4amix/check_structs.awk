@@ -0,0 +1,79 @@
+# check_structs.awk
+# Checks that the host structures in m4a.h have the same fields as the engine's in
+# include/gba/m4a_internal.h, apart from the ones listed below, so that a field added
+# to either one is noticed. Run as
+#     awk -f check_structs.awk ../../include/gba/m4a_internal.h m4a.h
+
+BEGIN {
+	split("ToneData SoundChannel SoundInfo MusicPlayerTrack MusicPlayerInfo", checked, " ")
+
+	# Fields the host leaves out: padding, and the CGB channels and function pointers
+	# that the host engine replaces with direct calls
+	omitted["SoundChannel"] = "dummy1 dummy2 dummy3 dummy4 xpc"
+	omitted["SoundInfo"] = "ident mode c15 maxLines gap cgbChans MPlayMainHead musicPlayerHead CgbSound CgbOscOff MidiKeyToCgbFreq MPlayJumpTable plynote ExtVolPit gap2"
+	omitted["MusicPlayerTrack"] = "gap"
+	omitted["MusicPlayerInfo"] = "unk_B gap ident MPlayMainNext musicPlayerNext"
+
+	# Fields only the host has
+	added["SoundChannel"] = "wavAddress"
+	added["SoundInfo"] = "decodingBuffer"
+	added["MusicPlayerInfo"] = "soundInfo stats"
+}
+
+FNR == 1 {
+	file++
+	path[file] = FILENAME
+}
+
+/^struct [A-Za-z0-9_]+$/ {
+	name = $2
+	next
+}
+
+name != "" && /^};/ {
+	name = ""
+	next
+}
+
+name != "" {
+	line = $0
+	sub(/\/\/.*/, "", line)
+	if (match(line, /[A-Za-z_][A-Za-z0-9_]*(\[[^]]*\])?;/)) {
+		field = substr(line, RSTART, RLENGTH)
+		sub(/[[;].*/, "", field)
+		fields[file, name, field] = 1
+	}
+}
+
+# Whether field is in the space-separated list
+function listed(list, field) {
+	return index(" " list " ", " " field " ") != 0
+}
+
+END {
+	errors = 0
+
+	for (i in checked) {
+		name = checked[i]
+
+		for (key in fields) {
+			split(key, parts, SUBSEP)
+			if (parts[2] != name)
+				continue
+
+			field = parts[3]
+
+			if (parts[1] == 1 && !((2, name, field) in fields) && !listed(omitted[name], field)) {
+				print path[2] ": struct " name " has no field " field " from " path[1] > "/dev/stderr"
+				errors++
+			}
+
+			if (parts[1] == 2 && !((1, name, field) in fields) && !listed(added[name], field)) {
+				print path[2] ": struct " name " has field " field ", which isn't in " path[1] > "/dev/stderr"
+				errors++
+			}
+		}
+	}
+
+	exit errors != 0
+}
@@ -0,0 +1,244 @@
+// m4a.h
+// Host versions of the m4a sound engine's structures from include/gba/m4a_internal.h.
+// check_structs.awk checks that they keep the same fields when either one changes.
+// Song data stays in the ROM image, so the pointers the game keeps into it are GBA
+// addresses here, or host pointers where the engine only walks them.
+
+#ifndef M4A_H
+#define M4A_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define C_V 0x40 // center value for PAN, BEND, and TUNE
+
+#define SOUND_MODE_REVERB_VAL   0x0000007F
+#define SOUND_MODE_REVERB_SET   0x00000080
+#define SOUND_MODE_MAXCHN       0x00000F00
+#define SOUND_MODE_MAXCHN_SHIFT 8
+#define SOUND_MODE_MASVOL       0x0000F000
+#define SOUND_MODE_MASVOL_SHIFT 12
+#define SOUND_MODE_FREQ_13379   0x00040000
+#define SOUND_MODE_FREQ         0x000F0000
+#define SOUND_MODE_FREQ_SHIFT   16
+#define SOUND_MODE_DA_BIT_8     0x00900000
+
+// The mode m4aSoundInit sets.
+#define SOUND_MODE_GAME (SOUND_MODE_DA_BIT_8 | SOUND_MODE_FREQ_13379 | (12 << SOUND_MODE_MASVOL_SHIFT) | (5 << SOUND_MODE_MAXCHN_SHIFT))
+
+#define WAVE_DATA_FLAG_LOOP 0xC0
+
+#define TONEDATA_TYPE_CGB 0x07
+#define TONEDATA_TYPE_FIX 0x08
+#define TONEDATA_TYPE_REV 0x10
+#define TONEDATA_TYPE_CMP 0x20
+#define TONEDATA_TYPE_SPL 0x40 // key split
+#define TONEDATA_TYPE_RHY 0x80 // rhythm
+
+#define TONEDATA_P_S_PAN 0xc0
+
+struct ToneData
+{
+	u8 type;
+	u8 key;
+	u8 length;
+	u8 pan_sweep;
+	u32 wav; // or the voice table of a key split or rhythm voice
+	u8 attack; // the key split table's address for key split voices
+	u8 decay;
+	u8 sustain;
+	u8 release;
+};
+
+#define SOUND_CHANNEL_SF_START       0x80
+#define SOUND_CHANNEL_SF_STOP        0x40
+#define SOUND_CHANNEL_SF_SPECIAL     0x20
+#define SOUND_CHANNEL_SF_LOOP        0x10
+#define SOUND_CHANNEL_SF_IEC         0x04
+#define SOUND_CHANNEL_SF_ENV         0x03
+#define SOUND_CHANNEL_SF_ENV_ATTACK  0x03
+#define SOUND_CHANNEL_SF_ENV_DECAY   0x02
+#define SOUND_CHANNEL_SF_ENV_SUSTAIN 0x01
+#define SOUND_CHANNEL_SF_ENV_RELEASE 0x00
+#define SOUND_CHANNEL_SF_ON (SOUND_CHANNEL_SF_START | SOUND_CHANNEL_SF_STOP | SOUND_CHANNEL_SF_IEC | SOUND_CHANNEL_SF_ENV)
+
+struct MusicPlayerTrack;
+
+struct SoundChannel
+{
+	u8 statusFlags;
+	u8 type;
+	u8 rightVolume;
+	u8 leftVolume;
+	u8 attack;
+	u8 decay;
+	u8 sustain;
+	u8 release;
+	u8 key; // midi key as it was translated into final pitch
+	u8 envelopeVolume;
+	u8 envelopeVolumeRight;
+	u8 envelopeVolumeLeft;
+	u8 pseudoEchoVolume;
+	u8 pseudoEchoLength;
+	u8 gateTime;
+	u8 midiKey; // midi key as it was used in the track data
+	u8 velocity;
+	u8 priority;
+	s8 rhythmPan;
+	u32 count;
+	u32 fw;
+	u32 frequency;
+	const u8 *wav; // the WaveData in the ROM image
+	u32 wavAddress;
+	u32 currentPointer; // index of the current sample in wav's data
+	struct MusicPlayerTrack *track;
+	struct SoundChannel *prevChannelPointer;
+	struct SoundChannel *nextChannelPointer;
+	u32 xpi; // block of compressed samples held in the decoding buffer
+};
+
+#define MAX_DIRECTSOUND_CHANNELS 12
+
+#define PCM_DMA_BUF_SIZE 1584 // size of Direct Sound buffer
+
+struct SoundInfo
+{
+	u8 pcmDmaCounter;
+	u8 reverb;
+	u8 maxChans;
+	u8 masterVolume;
+	u8 freq;
+	u8 pcmDmaPeriod; // number of V-blanks per PCM DMA
+	s32 pcmSamplesPerVBlank;
+	s32 pcmFreq;
+	s32 divFreq;
+	struct SoundChannel chans[MAX_DIRECTSOUND_CHANNELS];
+	s8 pcmBuffer[PCM_DMA_BUF_SIZE * 2]; // right channel, then left
+	s8 decodingBuffer[0x40]; // samples decoded from compressed DPCM
+};
+
+#define MPT_FLG_VOLSET 0x01
+#define MPT_FLG_VOLCHG 0x03
+#define MPT_FLG_PITSET 0x04
+#define MPT_FLG_PITCHG 0x0C
+#define MPT_FLG_START  0x40
+#define MPT_FLG_EXIST  0x80
+
+struct MusicPlayerTrack
+{
+	u8 flags;
+	u8 wait;
+	u8 patternLevel;
+	u8 repN;
+	u8 gateTime;
+	u8 key;
+	u8 velocity;
+	u8 runningStatus;
+	s8 keyM;
+	u8 pitM;
+	s8 keyShift;
+	s8 keyShiftX;
+	s8 tune;
+	u8 pitX;
+	s8 bend;
+	u8 bendRange;
+	u8 volMR;
+	u8 volML;
+	u8 vol;
+	u8 volX;
+	s8 pan;
+	s8 panX;
+	s8 modM;
+	u8 mod;
+	u8 modT;
+	u8 lfoSpeed;
+	u8 lfoSpeedC;
+	u8 lfoDelay;
+	u8 lfoDelayC;
+	u8 priority;
+	u8 pseudoEchoVolume;
+	u8 pseudoEchoLength;
+	struct SoundChannel *chan;
+	struct ToneData tone;
+	u16 unk_3A;
+	u32 unk_3C;
+	// Clear64byte clears everything above.
+	const u8 *cmdPtr;
+	const u8 *patternStack[3];
+};
+
+#define MUSICPLAYER_STATUS_TRACK 0x0000ffff
+#define MUSICPLAYER_STATUS_PAUSE 0x80000000
+
+#define MAX_MUSICPLAYER_TRACKS 16
+
+#define TEMPORARY_FADE  0x0001
+#define FADE_IN         0x0002
+#define FADE_VOL_MAX    64
+#define FADE_VOL_SHIFT  2
+
+// Running counts of the work MPlayMain has done, which the engine doesn't keep.
+struct SequencerStats
+{
+	u32 ticks;
+	u32 commands[0x80]; // indexed by command - 0x80
+	u32 maxTickCommands; // the most commands any track ran in one tick, summed over tracks
+	u32 lfoSteps;
+	u32 channelUpdates; // volume or pitch recalculations of playing channels
+	u32 notes;
+	u32 cgbNotes; // dropped because CGB voices aren't emulated
+	u32 lostNotes; // dropped for want of a channel
+};
+
+struct MusicPlayerInfo
+{
+	u32 songHeader;
+	u32 status;
+	u8 trackCount;
+	u8 priority;
+	u8 cmd;
+	u32 clock;
+	u8 *memAccArea;
+	u16 tempoD;
+	u16 tempoU;
+	u16 tempoI;
+	u16 tempoC;
+	u16 fadeOI;
+	u16 fadeOC;
+	u16 fadeOV;
+	struct MusicPlayerTrack *tracks;
+	u32 tone;
+	struct SoundInfo *soundInfo; // SOUND_INFO_PTR on hardware
+	struct SequencerStats stats;
+};
+
+// The size of a song table entry and of a music player table entry in the ROM
+#define SONG_SIZE 8
+#define MUSIC_PLAYER_SIZE 12
+
+extern const s8 gDeltaEncodingTable[];
+extern const u8 gScaleTable[];
+extern const u32 gFreqTable[];
+extern const u16 gPcmSamplesPerVBlankTable[];
+extern const u8 gClockTable[];
+
+// sequencer.c
+void SoundInit(struct SoundInfo *soundInfo);
+void m4aSoundMode(struct SoundInfo *soundInfo, u32 mode);
+void MPlayOpen(struct MusicPlayerInfo *mplayInfo, struct SoundInfo *soundInfo, struct MusicPlayerTrack *tracks, u8 trackCount, u8 *memAccArea);
+void MPlayStart(struct MusicPlayerInfo *mplayInfo, u32 songHeader);
+void MPlayMain(struct MusicPlayerInfo *mplayInfo);
+
+// mixer.c
+void m4aSoundVSync(struct SoundInfo *soundInfo);
+s8 *SoundMainRAM(struct SoundInfo *soundInfo);
+bool IsSoundPlaying(struct SoundInfo *soundInfo);
+
+#endif // M4A_H
@@ -0,0 +1,629 @@
+// main.c
+// Renders a song from the linked ELF through a host copy of the m4a engine's sequencer
+// and DirectSound mixer, or reports how much work the sequencer does for it. Only the
+// DirectSound voices are heard; notes on CGB voices are counted and dropped.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "global.h"
+#include "rom.h"
+#include "m4a.h"
+
+// LCD refresh rate 59.7275Hz
+#define FRAMES_PER_10000_SECONDS 597275
+
+struct Options
+{
+	const char *elfPath;
+	char **songs;
+	int numSongs;
+	const char *outputPath;
+	u32 mode;
+	double seconds;
+	int repeats;
+	bool stats;
+	const char *capturePath;
+	const char *comparePath;
+};
+
+struct Song
+{
+	const char *name;
+	u32 header;
+	u8 trackCount;
+};
+
+// The peaks of the per-frame counts in SequencerStats over a whole song. Every track
+// sets itself up in the first frame, so that frame is kept apart.
+struct SongStats
+{
+	u32 start; // work in the first frame
+	u32 ticks;
+	u32 commands;
+	u32 notes;
+	u32 work; // commands, LFO steps and channel updates
+	u32 workFrame;
+	u32 voices; // channels playing or about to start
+	u32 maxVoices;
+};
+
+struct Timing
+{
+	double sequencer;
+	double mixer;
+};
+
+static void PrintUsage(void)
+{
+	FATAL_ERROR(
+		"Usage: m4amix ELF_FILE SONG [OUTPUT_FILE] [options]\n"
+		"       m4amix ELF_FILE -s SONG... [options]\n"
+		"       m4amix ELF_FILE -c REFERENCE_FILE SONG... [options]\n"
+		"       m4amix ELF_FILE -r REFERENCE_FILE\n"
+		"\n"
+		"SONG is an index into gSongTable or the symbol of a song header. OUTPUT_FILE is\n"
+		"written as 8-bit stereo, a WAV file if it ends in .wav and otherwise raw signed\n"
+		"samples with the left channel first.\n"
+		"\n"
+		"options:\n"
+		"    -l SECONDS  stop after SECONDS if the song is still playing (default 120)\n"
+		"    -m MODE     m4aSoundMode argument in hex (default %X, as m4aSoundInit)\n"
+		"    -b REPEATS  render the song REPEATS times and print how long the sequencer\n"
+		"                and the mixer took\n"
+		"    -s          print the most sequencer work each song needs in a frame, and\n"
+		"                which commands it runs if there is only one song\n"
+		"    -c FILE     write a checksum of each song's output to FILE\n"
+		"    -r FILE     render the songs in FILE with the settings they were captured\n"
+		"                with, and fail if any output differs\n",
+		SOUND_MODE_GAME);
+}
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// gSongTable and gMPlayTable are sized with .size in sound/, so an index can be
+// checked against the tables rather than the end of the ROM.
+static void FindSong(const char *name, struct Song *song)
+{
+	song->name = name;
+
+	u32 songTable;
+	u32 songTableSize;
+	u32 mplayTable;
+	u32 mplayTableSize;
+	char *end;
+	unsigned long index = strtoul(name, &end, 0);
+
+	if (!FindSymbol("gSongTable", &songTable, &songTableSize) || !FindSymbol("gMPlayTable", &mplayTable, &mplayTableSize))
+		FATAL_ERROR("The ELF file has no gSongTable or gMPlayTable.\n");
+
+	u32 numSongs = songTableSize / SONG_SIZE;
+	u32 numPlayers = mplayTableSize / MUSIC_PLAYER_SIZE;
+
+	if (numSongs == 0 || numPlayers == 0)
+		FATAL_ERROR("gSongTable or gMPlayTable has no size in the ELF file.\n");
+
+	if (*name == 0 || *end != 0)
+	{
+		if (!FindSymbol(name, &song->header, NULL))
+			FATAL_ERROR("Song \"%s\" not found.\n", name);
+
+		// Look the song up anyway to find the music player it plays on.
+		for (index = 0; index < numSongs; index++)
+			if (Read32(RomPtr(songTable + index * SONG_SIZE, 4)) == song->header)
+				break;
+	}
+	else
+	{
+		if (index >= numSongs)
+			FATAL_ERROR("Song %lu is out of range; gSongTable has %u songs.\n", index, numSongs);
+
+		song->header = Read32(RomPtr(songTable + index * SONG_SIZE, 4));
+
+		if (FindSymbolName(song->header) != NULL)
+			song->name = FindSymbolName(song->header);
+	}
+
+	song->trackCount = RomPtr(song->header, 8)[0];
+
+	if (index < numSongs)
+	{
+		u32 player = Read16(RomPtr(songTable + index * SONG_SIZE + 4, 2));
+
+		if (player >= numPlayers)
+			FATAL_ERROR("Song %lu plays on music player %u, but gMPlayTable has %u.\n", index, player, numPlayers);
+
+		u8 playerTracks = RomPtr(mplayTable + player * MUSIC_PLAYER_SIZE, MUSIC_PLAYER_SIZE)[8];
+
+		if (song->trackCount > playerTracks)
+			song->trackCount = playerTracks;
+	}
+}
+
+static void WriteLE(FILE *fp, u32 value, int size)
+{
+	for (int i = 0; i < size; i++)
+		fputc((value >> (8 * i)) & 0xFF, fp);
+}
+
+static void WriteWavHeader(FILE *fp, u32 sampleRate, u32 dataSize)
+{
+	fwrite("RIFF", 4, 1, fp);
+	WriteLE(fp, 36 + dataSize, 4);
+	fwrite("WAVEfmt ", 8, 1, fp);
+	WriteLE(fp, 16, 4);
+	WriteLE(fp, 1, 2); // PCM
+	WriteLE(fp, 2, 2);
+	WriteLE(fp, sampleRate, 4);
+	WriteLE(fp, sampleRate * 2, 4);
+	WriteLE(fp, 2, 2);
+	WriteLE(fp, 8, 2);
+	fwrite("data", 4, 1, fp);
+	WriteLE(fp, dataSize, 4);
+}
+
+static void UpdateSongStats(struct SongStats *songStats, const struct SequencerStats *now, const struct SequencerStats *before, u32 frame)
+{
+	u32 commands = 0;
+
+	for (int i = 0; i < 0x80; i++)
+		commands += now->commands[i] - before->commands[i];
+
+	u32 ticks = now->ticks - before->ticks;
+	u32 notes = now->notes - before->notes;
+	u32 work = commands + now->lfoSteps - before->lfoSteps + now->channelUpdates - before->channelUpdates;
+
+	if (frame == 0)
+	{
+		songStats->start = work;
+		return;
+	}
+
+	if (ticks > songStats->ticks)
+		songStats->ticks = ticks;
+	if (commands > songStats->commands)
+		songStats->commands = commands;
+	if (notes > songStats->notes)
+		songStats->notes = notes;
+
+	if (work > songStats->work)
+	{
+		songStats->work = work;
+		songStats->workFrame = frame;
+	}
+}
+
+// Plays the song from the start one frame at a time, in the order the game runs the
+// VBlank interrupt and SoundMain. Returns the number of frames rendered.
+static u32 Render(const struct Options *options, const struct Song *song, FILE *fp, bool wav, u32 *hash, struct Timing *timing,
+                  struct SongStats *songStats, struct SequencerStats *sequencerStats)
+{
+	static struct SoundInfo soundInfo;
+	static struct MusicPlayerInfo mplayInfo;
+	static struct MusicPlayerTrack tracks[MAX_MUSICPLAYER_TRACKS];
+	static u8 memAccArea[0x100];
+	static u8 frameBuffer[PCM_DMA_BUF_SIZE * 2];
+	u32 maxFrames = options->seconds * FRAMES_PER_10000_SECONDS / 10000;
+	u32 frame;
+
+	if (sequencerStats != NULL)
+		memset(sequencerStats, 0, sizeof(*sequencerStats));
+
+	SoundInit(&soundInfo);
+	m4aSoundMode(&soundInfo, options->mode);
+	memset(memAccArea, 0, sizeof(memAccArea));
+	MPlayOpen(&mplayInfo, &soundInfo, tracks, song->trackCount, memAccArea);
+	MPlayStart(&mplayInfo, song->header);
+
+	for (frame = 0; frame < maxFrames; frame++)
+	{
+		double start = Now();
+
+		m4aSoundVSync(&soundInfo);
+		MPlayMain(&mplayInfo);
+
+		double mid = Now();
+
+		if (songStats != NULL)
+		{
+			u32 voices = 0;
+
+			for (s32 i = 0; i < soundInfo.maxChans; i++)
+				if (soundInfo.chans[i].statusFlags & SOUND_CHANNEL_SF_ON)
+					voices++;
+
+			if (voices > songStats->voices)
+				songStats->voices = voices;
+
+			UpdateSongStats(songStats, &mplayInfo.stats, sequencerStats, frame);
+
+			if (frame == 0)
+				mplayInfo.stats.maxTickCommands = 0;
+
+			*sequencerStats = mplayInfo.stats;
+		}
+
+		s8 *right = SoundMainRAM(&soundInfo);
+
+		timing->sequencer += mid - start;
+		timing->mixer += Now() - mid;
+
+		if (fp != NULL || hash != NULL)
+		{
+			s32 samples = soundInfo.pcmSamplesPerVBlank;
+			const s8 *left = right + PCM_DMA_BUF_SIZE;
+
+			for (s32 i = 0; i < samples; i++)
+			{
+				frameBuffer[i * 2] = left[i] + (wav ? 0x80 : 0);
+				frameBuffer[i * 2 + 1] = right[i] + (wav ? 0x80 : 0);
+			}
+
+			if (fp != NULL && fwrite(frameBuffer, samples * 2, 1, fp) != 1)
+				FATAL_ERROR("Failed to write \"%s\".\n", options->outputPath);
+
+			// FNV-1a
+			if (hash != NULL)
+				for (s32 i = 0; i < samples * 2; i++)
+					*hash = (*hash ^ frameBuffer[i]) * 16777619u;
+		}
+
+		if ((mplayInfo.status & MUSICPLAYER_STATUS_PAUSE) && !IsSoundPlaying(&soundInfo))
+		{
+			frame++;
+			break;
+		}
+	}
+
+	if (fp != NULL && wav)
+	{
+		rewind(fp);
+		WriteWavHeader(fp, soundInfo.pcmFreq, frame * soundInfo.pcmSamplesPerVBlank * 2);
+	}
+
+	if (mplayInfo.stats.cgbNotes != 0 && fp != NULL)
+		fprintf(stderr, "%u notes on CGB voices weren't rendered.\n", mplayInfo.stats.cgbNotes);
+
+	if (songStats != NULL)
+	{
+		songStats->maxVoices = soundInfo.maxChans;
+		*sequencerStats = mplayInfo.stats;
+	}
+
+	return frame;
+}
+
+// MPlayDef.s names of the commands from 0xB1 up to TIE
+static const char *const sCommandNames[] =
+{
+	"FINE", "GOTO", "PATT", "PEND", "REPT", NULL, NULL, NULL, "MEMACC", "PRIO",
+	"TEMPO", "KEYSH", "VOICE", "VOL", "PAN", "BEND", "BENDR", "LFOS", "LFODL", "MOD",
+	"MODT", NULL, NULL, "TUNE", NULL, NULL, NULL, "PORT", "XCMD", "EOT",
+	"TIE",
+};
+
+static void PrintStatsHeader(void)
+{
+	printf("%-32s %6s %5s %5s %9s %10s %5s %5s %8s %6s %5s %5s\n",
+	       "song", "frames", "start", "ticks", "cmds/tick", "cmds/frame", "notes", "work", "at", "voices", "lost", "cgb");
+}
+
+static void PrintStats(const struct Song *song, u32 frames, const struct SongStats *songStats, const struct SequencerStats *stats)
+{
+	double seconds = songStats->workFrame * 10000.0 / FRAMES_PER_10000_SECONDS;
+	char voices[16];
+
+	snprintf(voices, sizeof(voices), "%u/%u", songStats->voices, songStats->maxVoices);
+	printf("%-32s %6u %5u %5u %9u %10u %5u %5u %2d:%05.2f %6s %5u %5u\n",
+	       song->name, frames, songStats->start, songStats->ticks, stats->maxTickCommands, songStats->commands, songStats->notes,
+	       songStats->work, (int)seconds / 60, seconds - (int)seconds / 60 * 60, voices, stats->lostNotes, stats->cgbNotes);
+}
+
+static void PrintCommandCounts(const struct SequencerStats *stats)
+{
+	u32 waits = 0;
+	u32 notes = 0;
+
+	for (int i = 0; i < 0x31; i++)
+		waits += stats->commands[i];
+
+	for (int i = 0x50; i < 0x80; i++)
+		notes += stats->commands[i];
+
+	printf("\n%u ticks, %u LFO steps, %u channel updates\n", stats->ticks, stats->lfoSteps, stats->channelUpdates);
+	printf("%-8s %u\n", "Wxx", waits);
+	printf("%-8s %u\n", "Nxx", notes);
+
+	for (int i = 0; i < 0x1F; i++)
+	{
+		u32 count = stats->commands[0x31 + i];
+
+		if (count == 0)
+			continue;
+
+		if (sCommandNames[i] != NULL)
+			printf("%-8s %u\n", sCommandNames[i], count);
+		else
+			printf("0x%02X     %u\n", 0xB1 + i, count);
+	}
+}
+
+static void ParseOptions(int argc, char **argv, struct Options *options)
+{
+	options->mode = SOUND_MODE_GAME;
+	options->seconds = 120;
+	options->repeats = 0;
+	options->stats = false;
+	options->capturePath = NULL;
+	options->comparePath = NULL;
+	options->outputPath = NULL;
+	options->songs = malloc(argc * sizeof(char *));
+	options->numSongs = 0;
+
+	char **args = malloc(argc * sizeof(char *));
+	int numArgs = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *option = argv[i];
+
+		if (option[0] == '-' && option[1] != 0 && option[2] == 0)
+		{
+			if (option[1] == 's')
+			{
+				options->stats = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+				PrintUsage();
+
+			const char *arg = argv[++i];
+			char *end;
+
+			switch (option[1])
+			{
+			case 'l':
+				options->seconds = strtod(arg, &end);
+				if (*end != 0 || options->seconds < 0)
+					FATAL_ERROR("Invalid length \"%s\".\n", arg);
+				break;
+			case 'm':
+				options->mode = strtoul(arg, &end, 16);
+				if (*end != 0)
+					FATAL_ERROR("Invalid sound mode \"%s\".\n", arg);
+				break;
+			case 'b':
+				options->repeats = strtol(arg, &end, 10);
+				if (*end != 0 || options->repeats < 1)
+					FATAL_ERROR("Invalid repeat count \"%s\".\n", arg);
+				break;
+			case 'c':
+				options->capturePath = arg;
+				break;
+			case 'r':
+				options->comparePath = arg;
+				break;
+			default:
+				PrintUsage();
+			}
+		}
+		else
+		{
+			args[numArgs++] = argv[i];
+		}
+	}
+
+	if (numArgs < (options->comparePath != NULL ? 1 : 2))
+		PrintUsage();
+
+	options->elfPath = args[0];
+
+	if (options->comparePath != NULL)
+	{
+		if (numArgs > 1 || options->capturePath != NULL || options->stats)
+			PrintUsage();
+	}
+	else if (options->stats || options->capturePath != NULL)
+	{
+		if (options->stats && options->capturePath != NULL)
+			PrintUsage();
+
+		for (int i = 1; i < numArgs; i++)
+			options->songs[options->numSongs++] = args[i];
+	}
+	else
+	{
+		if (numArgs > 3)
+			PrintUsage();
+
+		options->songs[options->numSongs++] = args[1];
+
+		if (numArgs == 3)
+			options->outputPath = args[2];
+	}
+
+	free(args);
+}
+
+static void Analyze(const struct Options *options)
+{
+	struct Timing timing = { 0, 0 };
+
+	PrintStatsHeader();
+
+	for (int i = 0; i < options->numSongs; i++)
+	{
+		struct Song song;
+		struct SongStats songStats;
+		struct SequencerStats stats;
+
+		FindSong(options->songs[i], &song);
+		memset(&songStats, 0, sizeof(songStats));
+
+		u32 frames = Render(options, &song, NULL, false, NULL, &timing, &songStats, &stats);
+
+		PrintStats(&song, frames, &songStats, &stats);
+
+		if (options->numSongs == 1)
+			PrintCommandCounts(&stats);
+	}
+}
+
+// Writes one line per song with the settings it was rendered with and a checksum of
+// its output, which Compare checks a later build against.
+static void Capture(const struct Options *options)
+{
+	FILE *fp = fopen(options->capturePath, "w");
+
+	if (fp == NULL)
+		FATAL_ERROR("Failed to open \"%s\" for writing.\n", options->capturePath);
+
+	fprintf(fp, "# song mode seconds frames checksum\n");
+
+	for (int i = 0; i < options->numSongs; i++)
+	{
+		struct Song song;
+		struct Timing timing = { 0, 0 };
+		u32 hash = 2166136261u;
+
+		FindSong(options->songs[i], &song);
+
+		u32 frames = Render(options, &song, NULL, false, &hash, &timing, NULL, NULL);
+
+		fprintf(fp, "%s %X %g %u %08X\n", song.name, options->mode, options->seconds, frames, hash);
+	}
+
+	fclose(fp);
+}
+
+// Renders every song in a file written by Capture and reports the ones whose output
+// changed. Returns the number that did.
+static int Compare(const struct Options *options)
+{
+	FILE *fp = fopen(options->comparePath, "r");
+	char line[512];
+	int numSongs = 0;
+	int numChanged = 0;
+
+	if (fp == NULL)
+		FATAL_ERROR("Failed to open \"%s\" for reading.\n", options->comparePath);
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		struct Options songOptions = *options;
+		struct Song song;
+		struct Timing timing = { 0, 0 };
+		char name[256];
+		u32 expectedFrames;
+		u32 expectedHash;
+		u32 hash = 2166136261u;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%255s %X %lf %u %X", name, &songOptions.mode, &songOptions.seconds, &expectedFrames, &expectedHash) != 5)
+			FATAL_ERROR("Invalid line in \"%s\": %s", options->comparePath, line);
+
+		FindSong(name, &song);
+
+		u32 frames = Render(&songOptions, &song, NULL, false, &hash, &timing, NULL, NULL);
+
+		numSongs++;
+
+		if (frames != expectedFrames || hash != expectedHash)
+		{
+			printf("%s: %u frames, checksum %08X; expected %u frames, checksum %08X\n",
+			       name, frames, hash, expectedFrames, expectedHash);
+			numChanged++;
+		}
+	}
+
+	fclose(fp);
+	printf("%d of %d songs match %s\n", numSongs - numChanged, numSongs, options->comparePath);
+
+	return numChanged;
+}
+
+int main(int argc, char **argv)
+{
+	struct Options options;
+	struct Song song;
+	struct Timing timing = { 0, 0 };
+	FILE *fp = NULL;
+	bool wav = false;
+
+	ParseOptions(argc, argv, &options);
+	LoadRom(options.elfPath);
+
+	if (options.stats)
+	{
+		Analyze(&options);
+		free(options.songs);
+		return 0;
+	}
+
+	if (options.capturePath != NULL)
+	{
+		Capture(&options);
+		free(options.songs);
+		return 0;
+	}
+
+	if (options.comparePath != NULL)
+	{
+		free(options.songs);
+		return Compare(&options) != 0;
+	}
+
+	FindSong(options.songs[0], &song);
+	free(options.songs);
+
+	if (options.outputPath != NULL)
+	{
+		const char *extension = strrchr(options.outputPath, '.');
+
+		wav = extension != NULL && strcmp(extension, ".wav") == 0;
+		fp = fopen(options.outputPath, "wb");
+
+		if (fp == NULL)
+			FATAL_ERROR("Failed to open \"%s\" for writing.\n", options.outputPath);
+
+		if (wav)
+			WriteWavHeader(fp, 0, 0);
+	}
+
+	u32 frames = Render(&options, &song, fp, wav, NULL, &timing, NULL, NULL);
+
+	if (fp != NULL)
+		fclose(fp);
+
+	if (options.repeats == 0)
+		return 0;
+
+	timing.sequencer = timing.mixer = 0;
+
+	for (int i = 0; i < options.repeats; i++)
+		Render(&options, &song, NULL, false, NULL, &timing, NULL, NULL);
+
+	double framesRendered = (double)frames * options.repeats;
+	double sequencer = timing.sequencer / framesRendered * 1e6;
+	double mixer = timing.mixer / framesRendered * 1e6;
+	double frameTime = 1e6 * 10000 / FRAMES_PER_10000_SECONDS;
+
+	printf("%u frames, %d tracks\n", frames, song.trackCount);
+	printf("sequencer: %.3f us/frame\n", sequencer);
+	printf("mixer:     %.3f us/frame\n", mixer);
+	printf("%.0fx realtime\n", frameTime / (sequencer + mixer));
+
+	return 0;
+}
@@ -0,0 +1,393 @@
+// mixer.c
+// The DirectSound half of SoundMain: m4aSoundVSync's buffer counter, SoundMainRAM and
+// SoundMainRAM_Unk1/Unk2 from src/m4a_1.s. The arithmetic, including where it wraps, is
+// kept the same as the ARM code so the output matches the game's buffer byte for byte.
+
+#include <string.h>
+#include "global.h"
+#include "rom.h"
+#include "m4a.h"
+
+void m4aSoundVSync(struct SoundInfo *soundInfo)
+{
+	s32 counter = soundInfo->pcmDmaCounter - 1;
+
+	soundInfo->pcmDmaCounter = counter;
+
+	if (counter <= 0)
+		soundInfo->pcmDmaCounter = soundInfo->pcmDmaPeriod;
+}
+
+bool IsSoundPlaying(struct SoundInfo *soundInfo)
+{
+	for (s32 i = 0; i < soundInfo->maxChans; i++)
+		if (soundInfo->chans[i].statusFlags & SOUND_CHANNEL_SF_ON)
+			return true;
+
+	return false;
+}
+
+// The packed byte adds of the ARM code keep the high byte of the product.
+static inline void MixSample(s8 *right, s8 *left, s32 volumeRight, s32 volumeLeft, s32 sample)
+{
+	*right += (volumeRight * sample) >> 8;
+	*left += (volumeLeft * sample) >> 8;
+}
+
+static void DecodeBlock(struct SoundInfo *soundInfo, struct SoundChannel *chan, u32 block)
+{
+	u32 address = chan->wavAddress + 0x10 + 0x21 * block;
+
+	// Reversed samples read one block before the start, which is open bus on hardware.
+	if (!IsRomRange(address, 0x21))
+	{
+		memset(soundInfo->decodingBuffer, 0, sizeof(soundInfo->decodingBuffer));
+		return;
+	}
+
+	const u8 *src = RomPtr(address, 0x21);
+	s8 *dest = soundInfo->decodingBuffer;
+	u8 sample = *src++;
+
+	*dest++ = sample;
+	sample += gDeltaEncodingTable[*src++ & 0xF];
+	*dest++ = sample;
+
+	for (s32 i = 2; i < 0x40; i += 2)
+	{
+		sample += gDeltaEncodingTable[*src >> 4];
+		*dest++ = sample;
+		sample += gDeltaEncodingTable[*src++ & 0xF];
+		*dest++ = sample;
+	}
+}
+
+static inline s32 FetchSample(struct SoundInfo *soundInfo, struct SoundChannel *chan, s32 index, bool compressed)
+{
+	if (!compressed)
+		return ((const s8 *)chan->wav)[0x10 + index];
+
+	u32 block = (u32)index >> 6;
+
+	if (block != chan->xpi)
+	{
+		chan->xpi = block;
+		DecodeBlock(soundInfo, chan, block);
+	}
+
+	return soundInfo->decodingBuffer[index & 0x3F];
+}
+
+// Plays forward one sample per output sample.
+static void MixFixed(struct SoundChannel *chan, s8 *right, s8 *left, s32 samples, s32 volumeRight, s32 volumeLeft, u32 loopStart, u32 loopLength)
+{
+	const s8 *data = (const s8 *)chan->wav + 0x10;
+	u32 count = chan->count;
+	u32 pos = chan->currentPointer;
+
+	for (s32 i = 0; i < samples; i++)
+	{
+		MixSample(&right[i], &left[i], volumeRight, volumeLeft, data[pos++]);
+
+		if (--count == 0)
+		{
+			if (loopLength == 0)
+			{
+				chan->statusFlags = 0;
+				return;
+			}
+
+			count = loopLength;
+			pos = loopStart;
+		}
+	}
+
+	chan->count = count;
+	chan->currentPointer = pos;
+}
+
+// Plays forward with linear interpolation between samples. currentPointer is left at the
+// sample being interpolated from.
+static void MixForward(struct SoundInfo *soundInfo, struct SoundChannel *chan, s8 *right, s8 *left, s32 samples, s32 volumeRight, s32 volumeLeft,
+                       u32 step, u32 loopStart, u32 loopLength, bool compressed)
+{
+	u32 fw = chan->fw;
+	s32 count = chan->count;
+	s32 pos = chan->currentPointer;
+	s32 sample = FetchSample(soundInfo, chan, pos, compressed);
+	s32 delta = FetchSample(soundInfo, chan, ++pos, compressed) - sample;
+
+	for (s32 i = 0; i < samples; i++)
+	{
+		MixSample(&right[i], &left[i], volumeRight, volumeLeft, sample + ((s32)(fw * delta) >> 23));
+
+		fw += step;
+
+		s32 advance = fw >> 23;
+
+		if (advance == 0)
+			continue;
+
+		fw &= ~0x3F800000;
+		count -= advance;
+
+		if (count <= 0)
+		{
+			if (loopLength == 0)
+			{
+				chan->statusFlags = 0;
+				return;
+			}
+
+			s32 skip = -count;
+
+			while ((count += loopLength) <= 0)
+				skip -= loopLength;
+
+			pos = loopStart + skip;
+		}
+		else
+		{
+			pos += advance - 1;
+		}
+
+		sample = FetchSample(soundInfo, chan, pos, compressed);
+		delta = FetchSample(soundInfo, chan, ++pos, compressed) - sample;
+	}
+
+	chan->fw = fw;
+	chan->count = count;
+	chan->currentPointer = pos - 1;
+}
+
+// Plays backward with linear interpolation and stops at the start of the sample.
+// currentPointer is left one past the sample being interpolated from.
+static void MixReverse(struct SoundInfo *soundInfo, struct SoundChannel *chan, s8 *right, s8 *left, s32 samples, s32 volumeRight, s32 volumeLeft,
+                       u32 step, bool compressed)
+{
+	u32 fw = chan->fw;
+	s32 count = chan->count;
+	s32 pos = chan->currentPointer - 1;
+	s32 sample = FetchSample(soundInfo, chan, pos, compressed);
+	s32 delta = FetchSample(soundInfo, chan, pos - 1, compressed) - sample;
+
+	for (s32 i = 0; i < samples; i++)
+	{
+		MixSample(&right[i], &left[i], volumeRight, volumeLeft, sample + ((s32)(fw * delta) >> 23));
+
+		fw += step;
+
+		s32 advance = fw >> 23;
+
+		if (advance == 0)
+			continue;
+
+		fw &= ~0x3F800000;
+		count -= advance;
+
+		if (count <= 0)
+		{
+			chan->statusFlags = 0;
+			return;
+		}
+
+		pos -= advance;
+		sample = FetchSample(soundInfo, chan, pos, compressed);
+		delta = FetchSample(soundInfo, chan, pos - 1, compressed) - sample;
+	}
+
+	chan->fw = fw;
+	chan->count = count;
+	chan->currentPointer = pos + 1;
+}
+
+// SoundMainRAM_Unk1: compressed and reversed samples.
+static void MixSpecial(struct SoundInfo *soundInfo, struct SoundChannel *chan, s8 *right, s8 *left, s32 samples, s32 volumeRight, s32 volumeLeft,
+                       u32 loopStart, u32 loopLength)
+{
+	bool compressed = Read16(chan->wav) != 0;
+	u32 step;
+
+	if (!(chan->statusFlags & SOUND_CHANNEL_SF_SPECIAL))
+	{
+		chan->statusFlags |= SOUND_CHANNEL_SF_SPECIAL;
+
+		if (chan->type & TONEDATA_TYPE_REV)
+			chan->currentPointer = Read32(chan->wav + 12) - chan->currentPointer;
+	}
+
+	if (chan->type & TONEDATA_TYPE_FIX)
+		step = 0x800000;
+	else
+		step = soundInfo->divFreq * chan->frequency;
+
+	if (compressed)
+		chan->xpi = 0xFF000000;
+	else if (!(chan->type & TONEDATA_TYPE_REV))
+		return; // the engine has no path for uncompressed forward samples here
+
+	if (chan->type & TONEDATA_TYPE_REV)
+		MixReverse(soundInfo, chan, right, left, samples, volumeRight, volumeLeft, step, compressed);
+	else
+		MixForward(soundInfo, chan, right, left, samples, volumeRight, volumeLeft, step, loopStart, loopLength, true);
+}
+
+// Steps the channel's envelope. Returns false if the channel stopped.
+static bool UpdateEnvelope(struct SoundChannel *chan)
+{
+	u8 flags = chan->statusFlags;
+	s32 env = chan->envelopeVolume;
+	bool attack = false;
+	bool echo = false;
+
+	if (flags & SOUND_CHANNEL_SF_START)
+	{
+		if (flags & SOUND_CHANNEL_SF_STOP)
+		{
+			chan->statusFlags = 0;
+			return false;
+		}
+
+		flags = SOUND_CHANNEL_SF_ENV_ATTACK;
+		chan->currentPointer = chan->count;
+		chan->count = Read32(chan->wav + 12) - chan->count;
+		chan->fw = 0;
+		env = 0;
+
+		if (chan->wav[3] & WAVE_DATA_FLAG_LOOP)
+			flags |= SOUND_CHANNEL_SF_LOOP;
+
+		attack = true;
+	}
+	else if (flags & SOUND_CHANNEL_SF_IEC)
+	{
+		if (chan->pseudoEchoLength-- <= 1)
+		{
+			chan->statusFlags = 0;
+			return false;
+		}
+	}
+	else if (flags & SOUND_CHANNEL_SF_STOP)
+	{
+		env = (env * chan->release) >> 8;
+		echo = env <= chan->pseudoEchoVolume;
+	}
+	else if ((flags & SOUND_CHANNEL_SF_ENV) == SOUND_CHANNEL_SF_ENV_DECAY)
+	{
+		env = (env * chan->decay) >> 8;
+
+		if (env <= chan->sustain)
+		{
+			env = chan->sustain;
+
+			if (env == 0)
+				echo = true;
+			else
+				flags--;
+		}
+	}
+	else if ((flags & SOUND_CHANNEL_SF_ENV) == SOUND_CHANNEL_SF_ENV_ATTACK)
+	{
+		attack = true;
+	}
+
+	if (echo)
+	{
+		env = chan->pseudoEchoVolume;
+
+		if (env == 0)
+		{
+			chan->statusFlags = 0;
+			return false;
+		}
+
+		flags |= SOUND_CHANNEL_SF_IEC;
+	}
+
+	if (attack)
+	{
+		env += chan->attack;
+
+		if (env >= 0xFF)
+		{
+			env = 0xFF;
+			flags--;
+		}
+	}
+
+	chan->statusFlags = flags;
+	chan->envelopeVolume = env;
+	return true;
+}
+
+// Mixes the next slot of the PCM buffer and returns its right channel. The left channel
+// is PCM_DMA_BUF_SIZE bytes further on.
+s8 *SoundMainRAM(struct SoundInfo *soundInfo)
+{
+	s32 samples = soundInfo->pcmSamplesPerVBlank;
+	s8 *right = soundInfo->pcmBuffer;
+
+	if (soundInfo->pcmDmaCounter > 1)
+		right += samples * (soundInfo->pcmDmaPeriod - (soundInfo->pcmDmaCounter - 1));
+
+	s8 *left = right + PCM_DMA_BUF_SIZE;
+
+	if (soundInfo->reverb != 0)
+	{
+		// Feed back the slot the DMA is about to play, which was mixed a buffer ago.
+		const s8 *next = soundInfo->pcmDmaCounter == 2 ? soundInfo->pcmBuffer : right + samples;
+
+		for (s32 i = 0; i < samples; i++)
+		{
+			s32 sum = right[i] + left[i] + next[i] + next[i + PCM_DMA_BUF_SIZE];
+
+			sum = (sum * soundInfo->reverb) >> 9;
+
+			if (sum & 0x80)
+				sum++;
+
+			right[i] = sum;
+			left[i] = sum;
+		}
+	}
+	else
+	{
+		memset(right, 0, samples);
+		memset(left, 0, samples);
+	}
+
+	for (s32 i = 0; i < soundInfo->maxChans; i++)
+	{
+		struct SoundChannel *chan = &soundInfo->chans[i];
+
+		if (!(chan->statusFlags & SOUND_CHANNEL_SF_ON) || !UpdateEnvelope(chan))
+			continue;
+
+		s32 env = ((soundInfo->masterVolume + 1) * chan->envelopeVolume) >> 4;
+
+		chan->envelopeVolumeRight = (chan->rightVolume * env) >> 8;
+		chan->envelopeVolumeLeft = (chan->leftVolume * env) >> 8;
+
+		u32 loopStart = 0;
+		u32 loopLength = 0;
+
+		if (chan->statusFlags & SOUND_CHANNEL_SF_LOOP)
+		{
+			loopStart = Read32(chan->wav + 8);
+			loopLength = Read32(chan->wav + 12) - loopStart;
+		}
+
+		s32 volumeRight = chan->envelopeVolumeRight;
+		s32 volumeLeft = chan->envelopeVolumeLeft;
+
+		if (chan->type & (TONEDATA_TYPE_CMP | TONEDATA_TYPE_REV))
+			MixSpecial(soundInfo, chan, right, left, samples, volumeRight, volumeLeft, loopStart, loopLength);
+		else if (chan->type & TONEDATA_TYPE_FIX)
+			MixFixed(chan, right, left, samples, volumeRight, volumeLeft, loopStart, loopLength);
+		else
+			MixForward(soundInfo, chan, right, left, samples, volumeRight, volumeLeft,
+			           soundInfo->divFreq * chan->frequency, loopStart, loopLength, false);
+	}
+
+	return right;
+}
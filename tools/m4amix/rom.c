@@ -0,0 +1,154 @@
+// rom.c
+// Loads the ROM's contents and symbols from the linked ELF file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "rom.h"
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHF_ALLOC 2
+#define STB_GLOBAL 1
+
+static u8 *sElf;
+static long sElfSize;
+static u8 *sRom;
+static u32 sRomSize;
+static const u8 *sSymbols;
+static u32 sNumSymbols;
+static const char *sSymbolNames;
+static u32 sSymbolNamesSize;
+
+static const u8 *ElfPtr(u32 offset, u32 size)
+{
+	if (offset > (u32)sElfSize || size > (u32)sElfSize - offset)
+		FATAL_ERROR("The ELF file is truncated.\n");
+
+	return sElf + offset;
+}
+
+void LoadRom(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL)
+		FATAL_ERROR("Failed to open \"%s\" for reading.\n", path);
+
+	fseek(fp, 0, SEEK_END);
+	sElfSize = ftell(fp);
+	rewind(fp);
+
+	sElf = malloc(sElfSize);
+
+	if (sElf == NULL || fread(sElf, sElfSize, 1, fp) != 1)
+		FATAL_ERROR("Failed to read \"%s\".\n", path);
+
+	fclose(fp);
+
+	const u8 *header = ElfPtr(0, 0x34);
+
+	if (memcmp(header, "\x7F" "ELF", 4) != 0 || header[4] != 1 || header[5] != 1)
+		FATAL_ERROR("\"%s\" is not a 32-bit little-endian ELF file.\n", path);
+
+	u32 shoff = Read32(header + 0x20);
+	u32 shentsize = Read16(header + 0x2E);
+	u32 shnum = Read16(header + 0x30);
+
+	// The ROM image covers every allocated section linked into the ROM.
+	u32 romEnd = ROM_START;
+
+	for (u32 i = 0; i < shnum; i++)
+	{
+		const u8 *section = ElfPtr(shoff + i * shentsize, 0x28);
+		u32 addr = Read32(section + 0xC);
+		u32 size = Read32(section + 0x14);
+
+		if (Read32(section + 4) == SHT_PROGBITS && (Read32(section + 8) & SHF_ALLOC)
+		 && addr >= ROM_START && addr + size <= ROM_END && addr + size > romEnd)
+			romEnd = addr + size;
+	}
+
+	if (romEnd == ROM_START)
+		FATAL_ERROR("\"%s\" has nothing in ROM.\n", path);
+
+	// The mixer reads the sample after the last one, so leave some slack past the end.
+	sRomSize = romEnd - ROM_START;
+	sRom = calloc(sRomSize + 0x40, 1);
+
+	for (u32 i = 0; i < shnum; i++)
+	{
+		const u8 *section = ElfPtr(shoff + i * shentsize, 0x28);
+		u32 type = Read32(section + 4);
+		u32 addr = Read32(section + 0xC);
+		u32 size = Read32(section + 0x14);
+
+		if (type == SHT_PROGBITS && (Read32(section + 8) & SHF_ALLOC)
+		 && addr >= ROM_START && addr + size <= ROM_END)
+			memcpy(sRom + addr - ROM_START, ElfPtr(Read32(section + 0x10), size), size);
+
+		if (type == SHT_SYMTAB)
+		{
+			const u8 *strtab = ElfPtr(shoff + Read32(section + 0x18) * shentsize, 0x28);
+			sSymbolNamesSize = Read32(strtab + 0x14);
+			sSymbolNames = (const char *)ElfPtr(Read32(strtab + 0x10), sSymbolNamesSize);
+			sNumSymbols = size / 16;
+			sSymbols = ElfPtr(Read32(section + 0x10), sNumSymbols * 16);
+		}
+	}
+}
+
+// Finds a symbol's value, and its size if size isn't NULL. The size is 0 if the
+// symbol's source didn't give one.
+bool FindSymbol(const char *name, u32 *value, u32 *size)
+{
+	for (u32 i = 0; i < sNumSymbols; i++)
+	{
+		const u8 *symbol = sSymbols + i * 16;
+		u32 nameOffset = Read32(symbol);
+
+		if (nameOffset < sSymbolNamesSize
+		 && strncmp(sSymbolNames + nameOffset, name, sSymbolNamesSize - nameOffset) == 0)
+		{
+			*value = Read32(symbol + 4);
+
+			if (size != NULL)
+				*size = Read32(symbol + 8);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns the name of a global symbol at value, or NULL if there isn't one.
+const char *FindSymbolName(u32 value)
+{
+	for (u32 i = 0; i < sNumSymbols; i++)
+	{
+		const u8 *symbol = sSymbols + i * 16;
+		u32 nameOffset = Read32(symbol);
+
+		if (Read32(symbol + 4) == value && (symbol[12] >> 4) == STB_GLOBAL
+		 && nameOffset < sSymbolNamesSize && sSymbolNames[nameOffset] != 0
+		 && memchr(sSymbolNames + nameOffset, 0, sSymbolNamesSize - nameOffset) != NULL)
+			return sSymbolNames + nameOffset;
+	}
+
+	return NULL;
+}
+
+bool IsRomRange(u32 address, u32 size)
+{
+	return address >= ROM_START && address - ROM_START <= sRomSize && size <= sRomSize - (address - ROM_START);
+}
+
+const u8 *RomPtr(u32 address, u32 size)
+{
+	if (!IsRomRange(address, size))
+		FATAL_ERROR("Song data at 0x%08X is outside the ROM.\n", address);
+
+	return sRom + address - ROM_START;
+}
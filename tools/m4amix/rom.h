@@ -0,0 +1,28 @@
+// rom.h
+
+#ifndef ROM_H
+#define ROM_H
+
+#include <stdbool.h>
+#include "m4a.h"
+
+#define ROM_START 0x08000000
+#define ROM_END   0x0A000000
+
+void LoadRom(const char *path);
+bool FindSymbol(const char *name, u32 *value, u32 *size);
+const char *FindSymbolName(u32 value);
+bool IsRomRange(u32 address, u32 size);
+const u8 *RomPtr(u32 address, u32 size);
+
+static inline u32 Read32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline u16 Read16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+#endif // ROM_H
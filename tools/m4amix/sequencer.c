@@ -0,0 +1,1116 @@
+// sequencer.c
+// The track interpreter: MPlayMain and the ply_* command handlers from src/m4a.c and
+// src/m4a_1.s. CGB voices aren't emulated, so their notes are counted and dropped, as
+// the engine does when it has no CGB channels.
+
+#include <string.h>
+#include "global.h"
+#include "rom.h"
+#include "m4a.h"
+
+typedef void (*MPlayFunc)(struct MusicPlayerInfo *, struct MusicPlayerTrack *);
+
+static void ClearChain(struct SoundChannel *chan)
+{
+	struct MusicPlayerTrack *track = chan->track;
+
+	if (track == NULL)
+		return;
+
+	struct SoundChannel *next = chan->nextChannelPointer;
+	struct SoundChannel *prev = chan->prevChannelPointer;
+
+	if (prev != NULL)
+		prev->nextChannelPointer = next;
+	else
+		track->chan = next;
+
+	if (next != NULL)
+		next->prevChannelPointer = prev;
+
+	chan->track = NULL;
+}
+
+static void Clear64byte(struct MusicPlayerTrack *track)
+{
+	const u8 *cmdPtr = track->cmdPtr;
+	const u8 *patternStack[3];
+
+	memcpy(patternStack, track->patternStack, sizeof(patternStack));
+	memset(track, 0, sizeof(*track));
+	track->cmdPtr = cmdPtr;
+	memcpy(track->patternStack, patternStack, sizeof(patternStack));
+}
+
+static u32 umul3232H32(u32 multiplier, u32 multiplicand)
+{
+	return ((uint64_t)multiplier * multiplicand) >> 32;
+}
+
+static u32 MidiKeyToFreq(const u8 *wav, u8 key, u8 fineAdjust)
+{
+	u32 val1;
+	u32 val2;
+	u32 fineAdjustShifted = (u32)fineAdjust << 24;
+
+	if (key > 178)
+	{
+		key = 178;
+		fineAdjustShifted = 255u << 24;
+	}
+
+	val1 = gScaleTable[key];
+	val1 = gFreqTable[val1 & 0xF] >> (val1 >> 4);
+
+	val2 = gScaleTable[key + 1];
+	val2 = gFreqTable[val2 & 0xF] >> (val2 >> 4);
+
+	return umul3232H32(Read32(wav + 4), val1 + umul3232H32(val2 - val1, fineAdjustShifted));
+}
+
+static void TrackStop(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+
+	if (!(track->flags & MPT_FLG_EXIST))
+		return;
+
+	for (struct SoundChannel *chan = track->chan; chan != NULL; chan = chan->nextChannelPointer)
+	{
+		chan->statusFlags = 0;
+		chan->track = NULL;
+	}
+
+	track->chan = NULL;
+}
+
+static void TrkVolPitSet(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+
+	if (track->flags & MPT_FLG_VOLSET)
+	{
+		s32 x;
+		s32 y;
+
+		x = (u32)(track->vol * track->volX) >> 5;
+
+		if (track->modT == 1)
+			x = (u32)(x * (track->modM + 128)) >> 7;
+
+		y = 2 * track->pan + track->panX;
+
+		if (track->modT == 2)
+			y += track->modM;
+
+		if (y < -128)
+			y = -128;
+		else if (y > 127)
+			y = 127;
+
+		track->volMR = (u32)((y + 128) * x) >> 8;
+		track->volML = (u32)((127 - y) * x) >> 8;
+	}
+
+	if (track->flags & MPT_FLG_PITSET)
+	{
+		s32 bend = track->bend * track->bendRange;
+		s32 x = (track->tune + bend)
+		      * 4
+		      + track->keyShift * 256
+		      + track->keyShiftX * 256
+		      + track->pitX;
+
+		if (track->modT == 0)
+			x += 16 * track->modM;
+
+		track->keyM = x >> 8;
+		track->pitM = x;
+	}
+
+	track->flags &= ~(MPT_FLG_PITSET | MPT_FLG_VOLSET);
+}
+
+static void ChnVolSet(struct SoundChannel *chan, struct MusicPlayerTrack *track)
+{
+	s32 right = ((0x80 + chan->rhythmPan) * chan->velocity * track->volMR) >> 14;
+	s32 left = ((0x7F - chan->rhythmPan) * chan->velocity * track->volML) >> 14;
+
+	chan->rightVolume = (u32)right > 0xFF ? 0xFF : right;
+	chan->leftVolume = (u32)left > 0xFF ? 0xFF : left;
+}
+
+static void FadeOutBody(struct MusicPlayerInfo *mplayInfo)
+{
+	s32 i;
+	struct MusicPlayerTrack *track;
+
+	if (mplayInfo->fadeOI == 0)
+		return;
+	if (--mplayInfo->fadeOC != 0)
+		return;
+
+	mplayInfo->fadeOC = mplayInfo->fadeOI;
+
+	if (mplayInfo->fadeOV & FADE_IN)
+	{
+		if ((u16)(mplayInfo->fadeOV += (4 << FADE_VOL_SHIFT)) >= (64 << FADE_VOL_SHIFT))
+		{
+			mplayInfo->fadeOV = (64 << FADE_VOL_SHIFT);
+			mplayInfo->fadeOI = 0;
+		}
+	}
+	else
+	{
+		if ((s16)(mplayInfo->fadeOV -= (4 << FADE_VOL_SHIFT)) <= 0)
+		{
+			for (i = 0, track = mplayInfo->tracks; i < mplayInfo->trackCount; i++, track++)
+			{
+				TrackStop(mplayInfo, track);
+
+				if (!(mplayInfo->fadeOV & TEMPORARY_FADE))
+					track->flags = 0;
+			}
+
+			if (mplayInfo->fadeOV & TEMPORARY_FADE)
+				mplayInfo->status |= MUSICPLAYER_STATUS_PAUSE;
+			else
+				mplayInfo->status = MUSICPLAYER_STATUS_PAUSE;
+
+			mplayInfo->fadeOI = 0;
+			return;
+		}
+	}
+
+	for (i = 0, track = mplayInfo->tracks; i < mplayInfo->trackCount; i++, track++)
+	{
+		if (track->flags & MPT_FLG_EXIST)
+		{
+			track->volX = (mplayInfo->fadeOV >> FADE_VOL_SHIFT);
+			track->flags |= MPT_FLG_VOLCHG;
+		}
+	}
+}
+
+static u8 ReadCmdByte(struct MusicPlayerTrack *track)
+{
+	return *track->cmdPtr++;
+}
+
+static void ClearModM(struct MusicPlayerTrack *track)
+{
+	track->modM = 0;
+	track->lfoSpeedC = 0;
+
+	if (track->modT == 0)
+		track->flags |= MPT_FLG_PITCHG;
+	else
+		track->flags |= MPT_FLG_VOLCHG;
+}
+
+static void ply_fine(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+
+	for (struct SoundChannel *chan = track->chan; chan != NULL; chan = chan->nextChannelPointer)
+	{
+		if (chan->statusFlags & SOUND_CHANNEL_SF_ON)
+			chan->statusFlags |= SOUND_CHANNEL_SF_STOP;
+
+		ClearChain(chan);
+	}
+
+	track->flags = 0;
+}
+
+static void ply_goto(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->cmdPtr = RomPtr(Read32(track->cmdPtr), 1);
+}
+
+static void ply_patt(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	if (track->patternLevel >= 3)
+	{
+		ply_fine(mplayInfo, track);
+		return;
+	}
+
+	track->patternStack[track->patternLevel++] = track->cmdPtr + 4;
+	ply_goto(mplayInfo, track);
+}
+
+static void ply_pend(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+
+	if (track->patternLevel != 0)
+		track->cmdPtr = track->patternStack[--track->patternLevel];
+}
+
+static void ply_rept(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	if (*track->cmdPtr == 0)
+	{
+		track->cmdPtr++;
+		ply_goto(mplayInfo, track);
+		return;
+	}
+
+	if (++track->repN < ReadCmdByte(track))
+	{
+		ply_goto(mplayInfo, track);
+	}
+	else
+	{
+		track->repN = 0;
+		track->cmdPtr += 4;
+	}
+}
+
+static void ply_prio(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->priority = ReadCmdByte(track);
+}
+
+static void ply_tempo(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	mplayInfo->tempoD = ReadCmdByte(track) * 2;
+	mplayInfo->tempoI = (mplayInfo->tempoD * mplayInfo->tempoU) >> 8;
+}
+
+static void ply_keysh(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->keyShift = ReadCmdByte(track);
+	track->flags |= MPT_FLG_PITCHG;
+}
+
+static void ply_voice(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	const u8 *tone = RomPtr(mplayInfo->tone + ReadCmdByte(track) * 12, 12);
+
+	track->tone.type = tone[0];
+	track->tone.key = tone[1];
+	track->tone.length = tone[2];
+	track->tone.pan_sweep = tone[3];
+	track->tone.wav = Read32(tone + 4);
+	track->tone.attack = tone[8];
+	track->tone.decay = tone[9];
+	track->tone.sustain = tone[10];
+	track->tone.release = tone[11];
+}
+
+static void ply_vol(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->vol = ReadCmdByte(track);
+	track->flags |= MPT_FLG_VOLCHG;
+}
+
+static void ply_pan(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->pan = ReadCmdByte(track) - C_V;
+	track->flags |= MPT_FLG_VOLCHG;
+}
+
+static void ply_bend(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->bend = ReadCmdByte(track) - C_V;
+	track->flags |= MPT_FLG_PITCHG;
+}
+
+static void ply_bendr(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->bendRange = ReadCmdByte(track);
+	track->flags |= MPT_FLG_PITCHG;
+}
+
+static void ply_lfos(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->lfoSpeed = ReadCmdByte(track);
+
+	if (track->lfoSpeed == 0)
+		ClearModM(track);
+}
+
+static void ply_lfodl(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->lfoDelay = ReadCmdByte(track);
+}
+
+static void ply_mod(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->mod = ReadCmdByte(track);
+
+	if (track->mod == 0)
+		ClearModM(track);
+}
+
+static void ply_modt(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	u8 modT = ReadCmdByte(track);
+
+	if (track->modT != modT)
+	{
+		track->modT = modT;
+		track->flags |= MPT_FLG_VOLCHG | MPT_FLG_PITCHG;
+	}
+}
+
+static void ply_tune(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tune = ReadCmdByte(track) - C_V;
+	track->flags |= MPT_FLG_PITCHG;
+}
+
+// Writes a sound register, which only matters to the CGB channels.
+static void ply_port(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->cmdPtr += 2;
+}
+
+#define MEMACC_COND_JUMP(cond) \
+if (cond)                      \
+    goto cond_true;            \
+else                           \
+    goto cond_false;           \
+
+static void ply_memacc(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	u32 op;
+	u8 *addr;
+	u8 data;
+
+	op = ReadCmdByte(track);
+	addr = mplayInfo->memAccArea + ReadCmdByte(track);
+	data = ReadCmdByte(track);
+
+	switch (op)
+	{
+	case 0:
+		*addr = data;
+		return;
+	case 1:
+		*addr += data;
+		return;
+	case 2:
+		*addr -= data;
+		return;
+	case 3:
+		*addr = mplayInfo->memAccArea[data];
+		return;
+	case 4:
+		*addr += mplayInfo->memAccArea[data];
+		return;
+	case 5:
+		*addr -= mplayInfo->memAccArea[data];
+		return;
+	case 6:
+		MEMACC_COND_JUMP(*addr == data)
+	case 7:
+		MEMACC_COND_JUMP(*addr != data)
+	case 8:
+		MEMACC_COND_JUMP(*addr > data)
+	case 9:
+		MEMACC_COND_JUMP(*addr >= data)
+	case 10:
+		MEMACC_COND_JUMP(*addr <= data)
+	case 11:
+		MEMACC_COND_JUMP(*addr < data)
+	case 12:
+		MEMACC_COND_JUMP(*addr == mplayInfo->memAccArea[data])
+	case 13:
+		MEMACC_COND_JUMP(*addr != mplayInfo->memAccArea[data])
+	case 14:
+		MEMACC_COND_JUMP(*addr > mplayInfo->memAccArea[data])
+	case 15:
+		MEMACC_COND_JUMP(*addr >= mplayInfo->memAccArea[data])
+	case 16:
+		MEMACC_COND_JUMP(*addr <= mplayInfo->memAccArea[data])
+	case 17:
+		MEMACC_COND_JUMP(*addr < mplayInfo->memAccArea[data])
+	default:
+		return;
+	}
+
+cond_true:
+	ply_goto(mplayInfo, track);
+	return;
+
+cond_false:
+	track->cmdPtr += 4;
+}
+
+static void ply_xxx(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	ply_fine(mplayInfo, track);
+}
+
+static void ply_xwave(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.wav = Read32(track->cmdPtr);
+	track->cmdPtr += 4;
+}
+
+static void ply_xtype(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.type = ReadCmdByte(track);
+}
+
+static void ply_xatta(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.attack = ReadCmdByte(track);
+}
+
+static void ply_xdeca(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.decay = ReadCmdByte(track);
+}
+
+static void ply_xsust(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.sustain = ReadCmdByte(track);
+}
+
+static void ply_xrele(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.release = ReadCmdByte(track);
+}
+
+static void ply_xiecv(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->pseudoEchoVolume = ReadCmdByte(track);
+}
+
+static void ply_xiecl(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->pseudoEchoLength = ReadCmdByte(track);
+}
+
+static void ply_xleng(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.length = ReadCmdByte(track);
+}
+
+static void ply_xswee(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->tone.pan_sweep = ReadCmdByte(track);
+}
+
+static void ply_xcmd_0C(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	u16 unk = Read16(track->cmdPtr);
+
+	if (track->unk_3A < unk)
+	{
+		track->unk_3A++;
+		track->cmdPtr -= 2;
+		track->wait = 1;
+	}
+	else
+	{
+		track->unk_3A = 0;
+		track->cmdPtr += 2;
+	}
+}
+
+static void ply_xcmd_0D(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	track->unk_3C = Read32(track->cmdPtr);
+	track->cmdPtr += 4;
+}
+
+static const MPlayFunc sXcmdTable[] =
+{
+	ply_xxx,
+	ply_xwave,
+	ply_xtype,
+	ply_xxx,
+	ply_xatta,
+	ply_xdeca,
+	ply_xsust,
+	ply_xrele,
+	ply_xiecv,
+	ply_xiecl,
+	ply_xleng,
+	ply_xswee,
+	ply_xcmd_0C,
+	ply_xcmd_0D,
+};
+
+static void ply_xcmd(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	u32 n = ReadCmdByte(track);
+
+	if (n >= sizeof(sXcmdTable) / sizeof(sXcmdTable[0]))
+		FATAL_ERROR("Extended command %u is out of range.\n", n);
+
+	sXcmdTable[n](mplayInfo, track);
+}
+
+static void ply_endtie(struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	(void)mplayInfo;
+	u8 key;
+
+	if (*track->cmdPtr < 0x80)
+		track->key = ReadCmdByte(track);
+
+	key = track->key;
+
+	for (struct SoundChannel *chan = track->chan; chan != NULL; chan = chan->nextChannelPointer)
+	{
+		if ((chan->statusFlags & (SOUND_CHANNEL_SF_START | SOUND_CHANNEL_SF_ENV))
+		 && !(chan->statusFlags & SOUND_CHANNEL_SF_STOP)
+		 && chan->midiKey == key)
+		{
+			chan->statusFlags |= SOUND_CHANNEL_SF_STOP;
+			return;
+		}
+	}
+}
+
+// gMPlayJumpTable after MPlayExtender, indexed by command - 0xB1
+static const MPlayFunc sMPlayJumpTable[] =
+{
+	ply_fine,
+	ply_goto,
+	ply_patt,
+	ply_pend,
+	ply_rept,
+	ply_fine,
+	ply_fine,
+	ply_fine,
+	ply_memacc,
+	ply_prio,
+	ply_tempo,
+	ply_keysh,
+	ply_voice,
+	ply_vol,
+	ply_pan,
+	ply_bend,
+	ply_bendr,
+	ply_lfos,
+	ply_lfodl,
+	ply_mod,
+	ply_modt,
+	ply_fine,
+	ply_fine,
+	ply_tune,
+	ply_fine,
+	ply_fine,
+	ply_fine,
+	ply_port,
+	ply_xcmd,
+	ply_endtie,
+};
+
+// The mixer trusts the sample data's header, so make sure it stays inside the ROM image.
+static void CheckWaveData(const u8 *wav, const struct ToneData *tone, u32 offset)
+{
+	u32 size = Read32(wav + 12);
+	u32 loopStart = Read32(wav + 8);
+
+	if (Read16(wav) != 0)
+		RomPtr(tone->wav + 0x10, size / 64 * 33 + (size % 64 != 0 ? 33 : 0));
+	else
+		RomPtr(tone->wav + 0x10, size);
+
+	if (offset > size || ((wav[3] & WAVE_DATA_FLAG_LOOP) && loopStart > size))
+		FATAL_ERROR("The sample at 0x%08X starts or loops past its end.\n", tone->wav);
+}
+
+static void ply_note(u32 note_cmd, struct MusicPlayerInfo *mplayInfo, struct MusicPlayerTrack *track)
+{
+	struct SoundInfo *soundInfo = mplayInfo->soundInfo;
+	struct ToneData subTone;
+	const struct ToneData *tone = &track->tone;
+	s32 rhythmPan = 0;
+	u8 key;
+	u32 priority;
+
+	track->gateTime = gClockTable[note_cmd];
+
+	if (*track->cmdPtr < 0x80)
+	{
+		track->key = ReadCmdByte(track);
+
+		if (*track->cmdPtr < 0x80)
+		{
+			track->velocity = ReadCmdByte(track);
+
+			if (*track->cmdPtr < 0x80)
+				track->gateTime += ReadCmdByte(track);
+		}
+	}
+
+	key = track->key;
+
+	if (tone->type & (TONEDATA_TYPE_RHY | TONEDATA_TYPE_SPL))
+	{
+		u32 index = key;
+
+		if (tone->type & TONEDATA_TYPE_SPL)
+		{
+			u32 keySplitTable = tone->attack | (tone->decay << 8) | (tone->sustain << 16) | ((u32)tone->release << 24);
+			index = *RomPtr(keySplitTable + key, 1);
+		}
+
+		const u8 *data = RomPtr(tone->wav + index * 12, 12);
+
+		subTone.type = data[0];
+		subTone.key = data[1];
+		subTone.length = data[2];
+		subTone.pan_sweep = data[3];
+		subTone.wav = Read32(data + 4);
+		subTone.attack = data[8];
+		subTone.decay = data[9];
+		subTone.sustain = data[10];
+		subTone.release = data[11];
+
+		if (subTone.type & (TONEDATA_TYPE_SPL | TONEDATA_TYPE_RHY))
+			return;
+
+		if (tone->type & TONEDATA_TYPE_RHY)
+		{
+			if (subTone.pan_sweep & 0x80)
+				rhythmPan = (subTone.pan_sweep - TONEDATA_P_S_PAN) * 2;
+
+			key = subTone.key;
+		}
+
+		tone = &subTone;
+	}
+
+	priority = mplayInfo->priority + track->priority;
+
+	if (priority > 0xFF)
+		priority = 0xFF;
+
+	if (tone->type & TONEDATA_TYPE_CGB)
+	{
+		mplayInfo->stats.cgbNotes++;
+		return;
+	}
+
+	// Take a free channel, or else the lowest priority one, preferring those already
+	// releasing and then those of later tracks.
+	struct SoundChannel *chan = NULL;
+	struct SoundChannel *candidate = soundInfo->chans;
+	u32 bestPriority = priority;
+	struct MusicPlayerTrack *bestTrack = track;
+	bool foundStopping = false;
+
+	for (s32 i = soundInfo->maxChans; i > 0; i--, candidate++)
+	{
+		if (!(candidate->statusFlags & SOUND_CHANNEL_SF_ON))
+		{
+			chan = candidate;
+			break;
+		}
+
+		if (candidate->statusFlags & SOUND_CHANNEL_SF_STOP)
+		{
+			if (!foundStopping)
+			{
+				foundStopping = true;
+				bestPriority = candidate->priority;
+				bestTrack = candidate->track;
+				chan = candidate;
+				continue;
+			}
+		}
+		else if (foundStopping)
+		{
+			continue;
+		}
+
+		if (candidate->priority < bestPriority)
+		{
+			bestPriority = candidate->priority;
+			bestTrack = candidate->track;
+			chan = candidate;
+		}
+		else if (candidate->priority == bestPriority)
+		{
+			if (candidate->track > bestTrack)
+			{
+				bestTrack = candidate->track;
+				chan = candidate;
+			}
+			else if (candidate->track == bestTrack)
+			{
+				chan = candidate;
+			}
+		}
+	}
+
+	if (chan == NULL)
+	{
+		mplayInfo->stats.lostNotes++;
+		return;
+	}
+
+	mplayInfo->stats.notes++;
+	ClearChain(chan);
+	chan->prevChannelPointer = NULL;
+	chan->nextChannelPointer = track->chan;
+
+	if (track->chan != NULL)
+		track->chan->prevChannelPointer = chan;
+
+	track->chan = chan;
+	chan->track = track;
+
+	track->lfoDelayC = track->lfoDelay;
+
+	if (track->lfoDelay != 0)
+		ClearModM(track);
+
+	TrkVolPitSet(mplayInfo, track);
+
+	chan->gateTime = track->gateTime;
+	chan->midiKey = track->key;
+	chan->velocity = track->velocity;
+	chan->priority = priority;
+	chan->key = key;
+	chan->rhythmPan = rhythmPan;
+	chan->type = tone->type;
+	chan->wav = RomPtr(tone->wav, 0x10);
+	chan->wavAddress = tone->wav;
+	CheckWaveData(chan->wav, tone, track->unk_3C);
+	chan->attack = tone->attack;
+	chan->decay = tone->decay;
+	chan->sustain = tone->sustain;
+	chan->release = tone->release;
+	chan->pseudoEchoVolume = track->pseudoEchoVolume;
+	chan->pseudoEchoLength = track->pseudoEchoLength;
+	ChnVolSet(chan, track);
+
+	s32 finalKey = chan->key + track->keyM;
+
+	if (finalKey < 0)
+		finalKey = 0;
+
+	chan->count = track->unk_3C;
+	chan->frequency = MidiKeyToFreq(chan->wav, finalKey, track->pitM);
+	chan->statusFlags = SOUND_CHANNEL_SF_START;
+	track->flags &= 0xF0;
+}
+
+static void SampleFreqSet(struct SoundInfo *soundInfo, u32 freq)
+{
+	freq = (freq & 0xF0000) >> 16;
+	soundInfo->freq = freq;
+	soundInfo->pcmSamplesPerVBlank = gPcmSamplesPerVBlankTable[freq - 1];
+	soundInfo->pcmDmaPeriod = PCM_DMA_BUF_SIZE / soundInfo->pcmSamplesPerVBlank;
+
+	// LCD refresh rate 59.7275Hz
+	soundInfo->pcmFreq = (597275 * soundInfo->pcmSamplesPerVBlank + 5000) / 10000;
+
+	// CPU frequency 16.78Mhz
+	soundInfo->divFreq = (16777216 / soundInfo->pcmFreq + 1) >> 1;
+}
+
+void SoundInit(struct SoundInfo *soundInfo)
+{
+	memset(soundInfo, 0, sizeof(*soundInfo));
+
+	soundInfo->maxChans = 8;
+	soundInfo->masterVolume = 15;
+
+	SampleFreqSet(soundInfo, SOUND_MODE_FREQ_13379);
+}
+
+void m4aSoundMode(struct SoundInfo *soundInfo, u32 mode)
+{
+	u32 temp;
+
+	temp = mode & (SOUND_MODE_REVERB_SET | SOUND_MODE_REVERB_VAL);
+
+	if (temp)
+		soundInfo->reverb = temp & SOUND_MODE_REVERB_VAL;
+
+	temp = mode & SOUND_MODE_MAXCHN;
+
+	if (temp)
+	{
+		soundInfo->maxChans = temp >> SOUND_MODE_MAXCHN_SHIFT;
+
+		if (soundInfo->maxChans > MAX_DIRECTSOUND_CHANNELS)
+			FATAL_ERROR("The engine only has %d channels.\n", MAX_DIRECTSOUND_CHANNELS);
+
+		for (s32 i = 0; i < MAX_DIRECTSOUND_CHANNELS; i++)
+			soundInfo->chans[i].statusFlags = 0;
+	}
+
+	temp = mode & SOUND_MODE_MASVOL;
+
+	if (temp)
+		soundInfo->masterVolume = temp >> SOUND_MODE_MASVOL_SHIFT;
+
+	temp = mode & SOUND_MODE_FREQ;
+
+	if (temp)
+	{
+		if ((temp >> SOUND_MODE_FREQ_SHIFT) > 12)
+			FATAL_ERROR("Sample rate %u is out of range.\n", temp >> SOUND_MODE_FREQ_SHIFT);
+
+		soundInfo->pcmDmaCounter = 0;
+		SampleFreqSet(soundInfo, temp);
+	}
+}
+
+void MPlayOpen(struct MusicPlayerInfo *mplayInfo, struct SoundInfo *soundInfo, struct MusicPlayerTrack *tracks, u8 trackCount, u8 *memAccArea)
+{
+	if (trackCount > MAX_MUSICPLAYER_TRACKS)
+		trackCount = MAX_MUSICPLAYER_TRACKS;
+
+	memset(mplayInfo, 0, sizeof(*mplayInfo));
+
+	mplayInfo->tracks = tracks;
+	mplayInfo->trackCount = trackCount;
+	mplayInfo->status = MUSICPLAYER_STATUS_PAUSE;
+	mplayInfo->memAccArea = memAccArea;
+	mplayInfo->soundInfo = soundInfo;
+
+	for (s32 i = 0; i < trackCount; i++)
+		tracks[i].flags = 0;
+}
+
+void MPlayStart(struct MusicPlayerInfo *mplayInfo, u32 songHeader)
+{
+	const u8 *header = RomPtr(songHeader, 8);
+	s32 i;
+	struct MusicPlayerTrack *track;
+
+	mplayInfo->status = 0;
+	mplayInfo->songHeader = songHeader;
+	mplayInfo->tone = Read32(header + 4);
+	mplayInfo->priority = header[2];
+	mplayInfo->clock = 0;
+	mplayInfo->tempoD = 150;
+	mplayInfo->tempoI = 150;
+	mplayInfo->tempoU = 0x100;
+	mplayInfo->tempoC = 0;
+	mplayInfo->fadeOI = 0;
+
+	for (i = 0, track = mplayInfo->tracks; i < header[0] && i < mplayInfo->trackCount; i++, track++)
+	{
+		TrackStop(mplayInfo, track);
+		track->flags = MPT_FLG_EXIST | MPT_FLG_START;
+		track->chan = NULL;
+		track->cmdPtr = RomPtr(Read32(RomPtr(songHeader + 8 + i * 4, 4)), 1);
+	}
+
+	for (; i < mplayInfo->trackCount; i++, track++)
+	{
+		TrackStop(mplayInfo, track);
+		track->flags = 0;
+	}
+
+	if (header[3] & SOUND_MODE_REVERB_SET)
+		m4aSoundMode(mplayInfo->soundInfo, header[3]);
+}
+
+void MPlayMain(struct MusicPlayerInfo *mplayInfo)
+{
+	struct SoundChannel *chan;
+	struct MusicPlayerTrack *track;
+	s32 i;
+
+	if (mplayInfo->status & MUSICPLAYER_STATUS_PAUSE)
+		return;
+
+	FadeOutBody(mplayInfo);
+
+	if (mplayInfo->status & MUSICPLAYER_STATUS_PAUSE)
+		return;
+
+	for (mplayInfo->tempoC += mplayInfo->tempoI; mplayInfo->tempoC >= 150; mplayInfo->tempoC -= 150)
+	{
+		u32 bit = 1;
+		u32 activeTracks = 0;
+		u32 tickCommands = 0;
+
+		mplayInfo->stats.ticks++;
+
+		for (i = 0, track = mplayInfo->tracks; i < mplayInfo->trackCount; i++, track++, bit <<= 1)
+		{
+			if (!(track->flags & MPT_FLG_EXIST))
+				continue;
+
+			activeTracks |= bit;
+
+			for (chan = track->chan; chan != NULL; chan = chan->nextChannelPointer)
+			{
+				if (!(chan->statusFlags & SOUND_CHANNEL_SF_ON))
+					ClearChain(chan);
+				else if (chan->gateTime != 0 && --chan->gateTime == 0)
+					chan->statusFlags |= SOUND_CHANNEL_SF_STOP;
+			}
+
+			if (track->flags & MPT_FLG_START)
+			{
+				Clear64byte(track);
+				track->flags = MPT_FLG_EXIST;
+				track->bendRange = 2;
+				track->volX = 64;
+				track->lfoSpeed = 22;
+				track->tone.type = 1;
+			}
+
+			bool ended = false;
+
+			while (track->wait == 0)
+			{
+				u32 cmd = *track->cmdPtr;
+
+				if (cmd < 0x80)
+				{
+					cmd = track->runningStatus;
+
+					if (cmd < 0x80)
+						FATAL_ERROR("Track %d starts with running status.\n", i);
+				}
+				else
+				{
+					track->cmdPtr++;
+
+					if (cmd >= 0xBD)
+						track->runningStatus = cmd;
+				}
+
+				mplayInfo->stats.commands[cmd - 0x80]++;
+				tickCommands++;
+
+				if (cmd >= 0xCF)
+				{
+					ply_note(cmd - 0xCF, mplayInfo, track);
+				}
+				else if (cmd > 0xB0)
+				{
+					mplayInfo->cmd = cmd - 0xB1;
+					sMPlayJumpTable[mplayInfo->cmd](mplayInfo, track);
+
+					if (track->flags == 0)
+					{
+						ended = true;
+						break;
+					}
+				}
+				else
+				{
+					track->wait = gClockTable[cmd - 0x80];
+				}
+			}
+
+			if (ended)
+				continue;
+
+			track->wait--;
+
+			if (track->lfoSpeed == 0 || track->mod == 0)
+				continue;
+
+			if (track->lfoDelayC != 0)
+			{
+				track->lfoDelayC--;
+				continue;
+			}
+
+			track->lfoSpeedC += track->lfoSpeed;
+			mplayInfo->stats.lfoSteps++;
+
+			s32 lfo;
+
+			if ((s8)(track->lfoSpeedC - 0x40) < 0)
+				lfo = (s8)track->lfoSpeedC;
+			else
+				lfo = 0x80 - track->lfoSpeedC;
+
+			lfo = (track->mod * lfo) >> 6;
+
+			if ((u8)(track->modM ^ lfo) != 0)
+			{
+				track->modM = lfo;
+
+				if (track->modT == 0)
+					track->flags |= MPT_FLG_PITCHG;
+				else
+					track->flags |= MPT_FLG_VOLCHG;
+			}
+		}
+
+		mplayInfo->clock++;
+
+		if (tickCommands > mplayInfo->stats.maxTickCommands)
+			mplayInfo->stats.maxTickCommands = tickCommands;
+
+		if (activeTracks == 0)
+		{
+			mplayInfo->status = MUSICPLAYER_STATUS_PAUSE;
+			return;
+		}
+
+		mplayInfo->status = activeTracks;
+	}
+
+	for (i = 0, track = mplayInfo->tracks; i < mplayInfo->trackCount; i++, track++)
+	{
+		if (!(track->flags & MPT_FLG_EXIST) || !(track->flags & (MPT_FLG_VOLCHG | MPT_FLG_PITCHG)))
+			continue;
+
+		TrkVolPitSet(mplayInfo, track);
+
+		for (chan = track->chan; chan != NULL; chan = chan->nextChannelPointer)
+		{
+			if (!(chan->statusFlags & SOUND_CHANNEL_SF_ON))
+			{
+				ClearChain(chan);
+				continue;
+			}
+
+			mplayInfo->stats.channelUpdates++;
+
+			if (track->flags & MPT_FLG_VOLCHG)
+				ChnVolSet(chan, track);
+
+			if (track->flags & MPT_FLG_PITCHG)
+			{
+				s32 key = chan->key + track->keyM;
+
+				if (key < 0)
+					key = 0;
+
+				chan->frequency = MidiKeyToFreq(chan->wav, key, track->pitM);
+			}
+		}
+
+		track->flags &= 0xF0;
+	}
+}
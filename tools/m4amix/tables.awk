@@ -0,0 +1,42 @@
+# tables.awk
+# Copies the lookup tables the host engine uses out of src/m4a_tables.c, so that they
+# are always the game's. Run as
+#     awk -f tables.awk ../../src/m4a_tables.c > tables.c
+
+BEGIN {
+	wanted["gDeltaEncodingTable"] = 1
+	wanted["gScaleTable"] = 1
+	wanted["gFreqTable"] = 1
+	wanted["gPcmSamplesPerVBlankTable"] = 1
+	wanted["gClockTable"] = 1
+
+	print "// tables.c"
+	print "// Generated from src/m4a_tables.c by tables.awk. Do not edit."
+	print ""
+	print "#include \"m4a.h\""
+}
+
+/^const [A-Za-z0-9_]+ [A-Za-z0-9_]+\[\] *=?$/ {
+	name = $3
+	sub(/\[.*/, "", name)
+	if (name in wanted) {
+		copying = 1
+		found[name] = 1
+		print ""
+	}
+}
+
+copying {
+	print
+	if ($0 ~ /^};/)
+		copying = 0
+}
+
+END {
+	for (name in wanted) {
+		if (!(name in found)) {
+			print "tables.awk: " name " not found" > "/dev/stderr"
+			exit 1
+		}
+	}
+}
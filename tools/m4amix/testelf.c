@@ -0,0 +1,391 @@
+// testelf.c
+// Writes a small ELF file with a song table, a music player table, a voicegroup and
+// three songs that between them use every kind of DirectSound voice and most track
+// commands. `make check` renders it and compares the output with test_reference.txt,
+// so that changes to the sequencer or mixer that change their output are noticed
+// without a build of the game.
+
+#include <stdio.h>
+#include <string.h>
+#include "global.h"
+#include "m4a.h"
+
+#define ROM_START 0x08000000
+
+#define W06   0x86
+#define W12   0x8C
+#define W24   0x98
+#define W48   0xA0
+#define FINE  0xB1
+#define GOTO  0xB2
+#define PATT  0xB3
+#define PEND  0xB4
+#define MEMACC 0xB9
+#define TEMPO 0xBB
+#define KEYSH 0xBC
+#define VOICE 0xBD
+#define VOL   0xBE
+#define PAN   0xBF
+#define BEND  0xC0
+#define BENDR 0xC1
+#define LFOS  0xC2
+#define LFODL 0xC3
+#define MOD   0xC4
+#define MODT  0xC5
+#define TUNE  0xC8
+#define XCMD  0xCD
+#define EOT   0xCE
+#define TIE   0xCF
+#define N06   0xD5
+#define N12   0xDB
+#define N24   0xE7
+#define N48   0xEF
+
+#define xIECV 0x08
+#define xIECL 0x09
+
+struct Symbol
+{
+	const char *name;
+	u32 value;
+	u32 size;
+};
+
+static u8 sRom[0x4000];
+static u32 sRomSize;
+static struct Symbol sSymbols[8];
+static int sNumSymbols;
+
+static u32 Here(void)
+{
+	return ROM_START + sRomSize;
+}
+
+static void Emit8(u32 value)
+{
+	if (sRomSize >= sizeof(sRom))
+		FATAL_ERROR("The test ROM is full.\n");
+
+	sRom[sRomSize++] = value;
+}
+
+static void Emit16(u32 value)
+{
+	Emit8(value);
+	Emit8(value >> 8);
+}
+
+static void Emit32(u32 value)
+{
+	Emit16(value);
+	Emit16(value >> 16);
+}
+
+static void EmitBytes(const u8 *bytes, u32 size)
+{
+	for (u32 i = 0; i < size; i++)
+		Emit8(bytes[i]);
+}
+
+static void Align(void)
+{
+	while (sRomSize % 4 != 0)
+		Emit8(0);
+}
+
+static void Patch32(u32 address, u32 value)
+{
+	u8 *p = sRom + address - ROM_START;
+
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static void AddSymbol(const char *name, u32 value, u32 size)
+{
+	sSymbols[sNumSymbols].name = name;
+	sSymbols[sNumSymbols].value = value;
+	sSymbols[sNumSymbols].size = size;
+	sNumSymbols++;
+}
+
+static void EmitWaveHeader(u16 type, bool loop, u32 freq, u32 loopStart, u32 size)
+{
+	Align();
+	Emit16(type);
+	Emit16(loop ? WAVE_DATA_FLAG_LOOP << 8 : 0);
+	Emit32(freq);
+	Emit32(loopStart);
+	Emit32(size);
+}
+
+static void EmitTone(u8 type, u8 key, u8 panSweep, u32 wav, u32 adsr)
+{
+	Emit8(type);
+	Emit8(key);
+	Emit8(0);
+	Emit8(panSweep);
+	Emit32(wav);
+	Emit32(adsr);
+}
+
+static u32 ADSR(u8 attack, u8 decay, u8 sustain, u8 release)
+{
+	return attack | (decay << 8) | (sustain << 16) | ((u32)release << 24);
+}
+
+static u32 EmitSongHeader(u8 trackCount, u8 reverb, u32 voicegroup)
+{
+	Align();
+
+	u32 header = Here();
+
+	Emit8(trackCount);
+	Emit8(0);
+	Emit8(0);
+	Emit8(reverb);
+	Emit32(voicegroup);
+
+	for (int i = 0; i < trackCount; i++)
+		Emit32(0);
+
+	return header;
+}
+
+static void BuildRom(void)
+{
+	// A looping square wave
+	EmitWaveHeader(0, true, 8000 * 1024, 0, 64);
+	u32 square = Here() - 0x10;
+	for (int i = 0; i < 64; i++)
+		Emit8(i < 32 ? 0x40 : 0xC0);
+
+	// A falling sawtooth that doesn't loop, played reversed
+	EmitWaveHeader(0, false, 11025 * 1024, 0, 200);
+	u32 saw = Here() - 0x10;
+	for (int i = 0; i < 200; i++)
+		Emit8((u8)(100 - i));
+
+	// A looping sample in the compressed DPCM format, four blocks of 64 samples
+	EmitWaveHeader(1, true, 13379 * 1024, 64, 256);
+	u32 dpcm = Here() - 0x10;
+	u32 seed = 1;
+	for (int block = 0; block < 4; block++)
+	{
+		Emit8(block * 16);
+		for (int i = 0; i < 32; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			Emit8(seed >> 24);
+		}
+	}
+
+	// A drumkit with a voice for every key, spread across the stereo field
+	Align();
+	u32 drumkit = Here();
+	for (int key = 0; key < 128; key++)
+		EmitTone(0, 48 + key % 24, 0xB0 + key % 32, key % 2 ? saw : square, ADSR(255, 0, 255, 100));
+
+	Align();
+	u32 voicegroup = Here();
+	u32 keySplitTable = voicegroup + 6 * 12;
+	EmitTone(0, 60, 0, square, ADSR(255, 0, 255, 165));
+	EmitTone(0, 60, 0, dpcm, ADSR(200, 240, 180, 200));
+	EmitTone(TONEDATA_TYPE_RHY, 0, 0, drumkit, 0);
+	EmitTone(TONEDATA_TYPE_FIX, 60, 0, square, ADSR(255, 250, 128, 180));
+	EmitTone(TONEDATA_TYPE_REV, 60, 0, saw, ADSR(255, 0, 255, 0));
+	EmitTone(TONEDATA_TYPE_SPL, 0, 0, voicegroup, keySplitTable);
+
+	// Keys below Cn3 play voice 0 and the rest voice 3.
+	for (int key = 0; key < 128; key++)
+		Emit8(key < 60 ? 0 : 3);
+
+	// Notes, running status, key splits and a drum pattern played twice
+	u32 notes = EmitSongHeader(2, 0, voicegroup);
+
+	Patch32(notes + 8, Here());
+	static const u8 notesTrack0[] = {
+		TEMPO, 60, VOICE, 0, VOL, 100, PAN, 64,
+		N12, 60, 100, W12, 64, W12,
+		VOICE, 5, N24, 48, 90, W24, 72, W24,
+		VOICE, 3, N12, 60, W12,
+		TIE, 67, 80, W48, EOT, 67, W12,
+		FINE,
+	};
+	EmitBytes(notesTrack0, sizeof(notesTrack0));
+
+	Align();
+	u32 pattern = Here();
+	static const u8 drumPattern[] = {
+		N06, 36, 127, W06, 38, W06, N06, 42, 60, W12, PEND,
+	};
+	EmitBytes(drumPattern, sizeof(drumPattern));
+
+	Patch32(notes + 12, Here());
+	Emit8(VOICE); Emit8(2); Emit8(VOL); Emit8(110);
+	Emit8(PATT); Emit32(pattern);
+	Emit8(PATT); Emit32(pattern);
+	Emit8(FINE);
+
+	// Pitch bends, LFO on pitch, volume and pan, pseudo echo, reverb, the compressed
+	// and reversed samples, and a loop counted with MEMACC
+	u32 effects = EmitSongHeader(1, SOUND_MODE_REVERB_SET | 40, voicegroup);
+
+	Patch32(effects + 8, Here());
+	static const u8 effectsTrack0[] = {
+		TEMPO, 75, VOICE, 1, VOL, 127, BENDR, 12, LFOS, 40, LFODL, 4, MOD, 30,
+		XCMD, xIECV, 40, XCMD, xIECL, 4,
+		TIE, 60, 100, W24, BEND, 80, W24, MODT, 1, W24, MODT, 2, W24,
+		BEND, 64, KEYSH, 2, TUNE, 70, W24, EOT,
+		VOICE, 4, MOD, 0, N48, 60, 127, W48,
+	};
+	EmitBytes(effectsTrack0, sizeof(effectsTrack0));
+	u32 loop = Here();
+	static const u8 effectsLoop[] = {
+		N12, 60, 100, W12, MEMACC, 1, 0, 1, MEMACC, 7, 0, 2,
+	};
+	EmitBytes(effectsLoop, sizeof(effectsLoop));
+	Emit32(loop);
+	Emit8(FINE);
+
+	// A song that never ends, so that rendering stops at the time limit
+	u32 endless = EmitSongHeader(1, 0, voicegroup);
+
+	Patch32(endless + 8, Here());
+	Emit8(VOICE); Emit8(0); Emit8(VOL); Emit8(80);
+	loop = Here();
+	Emit8(N12); Emit8(60); Emit8(100); Emit8(W12);
+	Emit8(N12); Emit8(67); Emit8(W12);
+	Emit8(GOTO); Emit32(loop);
+
+	Align();
+	u32 mplayTable = Here();
+	Emit32(0x03000000);
+	Emit32(0x02000000);
+	Emit8(MAX_MUSICPLAYER_TRACKS);
+	Emit8(0);
+	Emit16(0);
+
+	u32 songTable = Here();
+	Emit32(notes); Emit16(0); Emit16(0);
+	Emit32(effects); Emit16(0); Emit16(0);
+	Emit32(endless); Emit16(0); Emit16(0);
+
+	AddSymbol("gMPlayTable", mplayTable, MUSIC_PLAYER_SIZE);
+	AddSymbol("gSongTable", songTable, 3 * SONG_SIZE);
+	AddSymbol("test_song_notes", notes, 16);
+	AddSymbol("test_song_effects", effects, 12);
+	AddSymbol("test_song_endless", endless, 12);
+}
+
+static void Write32(FILE *fp, u32 value)
+{
+	fputc(value, fp);
+	fputc(value >> 8, fp);
+	fputc(value >> 16, fp);
+	fputc(value >> 24, fp);
+}
+
+static void Write16(FILE *fp, u32 value)
+{
+	fputc(value, fp);
+	fputc(value >> 8, fp);
+}
+
+static void WriteSectionHeader(FILE *fp, u32 name, u32 type, u32 flags, u32 addr, u32 offset, u32 size, u32 link, u32 info, u32 entsize)
+{
+	Write32(fp, name);
+	Write32(fp, type);
+	Write32(fp, flags);
+	Write32(fp, addr);
+	Write32(fp, offset);
+	Write32(fp, size);
+	Write32(fp, link);
+	Write32(fp, info);
+	Write32(fp, 4);
+	Write32(fp, entsize);
+}
+
+static void WriteElf(const char *path)
+{
+	static const char sectionNames[] = "\0.rom\0.symtab\0.strtab\0.shstrtab";
+	char names[256] = "";
+	u32 nameOffsets[8];
+	u32 namesSize = 1;
+
+	for (int i = 0; i < sNumSymbols; i++)
+	{
+		nameOffsets[i] = namesSize;
+		strcpy(names + namesSize, sSymbols[i].name);
+		namesSize += strlen(sSymbols[i].name) + 1;
+	}
+
+	u32 romOffset = 0x34;
+	u32 symtabOffset = romOffset + sRomSize;
+	u32 symtabSize = (sNumSymbols + 1) * 16;
+	u32 strtabOffset = symtabOffset + symtabSize;
+	u32 shstrtabOffset = strtabOffset + namesSize;
+	u32 shoff = (shstrtabOffset + sizeof(sectionNames) + 3) & ~3;
+
+	FILE *fp = fopen(path, "wb");
+
+	if (fp == NULL)
+		FATAL_ERROR("Failed to open \"%s\" for writing.\n", path);
+
+	fwrite("\x7F" "ELF\x01\x01\x01\0\0\0\0\0\0\0\0\0", 16, 1, fp);
+	Write16(fp, 2); // ET_EXEC
+	Write16(fp, 40); // EM_ARM
+	Write32(fp, 1);
+	Write32(fp, ROM_START);
+	Write32(fp, 0);
+	Write32(fp, shoff);
+	Write32(fp, 0);
+	Write16(fp, 0x34);
+	Write16(fp, 0);
+	Write16(fp, 0);
+	Write16(fp, 40);
+	Write16(fp, 5);
+	Write16(fp, 4);
+
+	fwrite(sRom, sRomSize, 1, fp);
+
+	for (int i = 0; i < 16; i++)
+		fputc(0, fp);
+
+	for (int i = 0; i < sNumSymbols; i++)
+	{
+		Write32(fp, nameOffsets[i]);
+		Write32(fp, sSymbols[i].value);
+		Write32(fp, sSymbols[i].size);
+		fputc(0x11, fp); // STB_GLOBAL, STT_OBJECT
+		fputc(0, fp);
+		Write16(fp, 1);
+	}
+
+	fwrite(names, namesSize, 1, fp);
+	fwrite(sectionNames, sizeof(sectionNames), 1, fp);
+
+	while ((u32)ftell(fp) < shoff)
+		fputc(0, fp);
+
+	WriteSectionHeader(fp, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	WriteSectionHeader(fp, 1, 1, 6, ROM_START, romOffset, sRomSize, 0, 0, 0); // SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR
+	WriteSectionHeader(fp, 6, 2, 0, 0, symtabOffset, symtabSize, 3, 1, 16); // SHT_SYMTAB
+	WriteSectionHeader(fp, 14, 3, 0, 0, strtabOffset, namesSize, 0, 0, 0); // SHT_STRTAB
+	WriteSectionHeader(fp, 22, 3, 0, 0, shstrtabOffset, sizeof(sectionNames), 0, 0, 0);
+
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+		FATAL_ERROR("Usage: testelf OUTPUT_FILE\n");
+
+	BuildRom();
+	WriteElf(argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,423 @@
+// json_arena.cpp
+
+#include "json_arena.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+using std::string;
+using std::vector;
+
+const JsonValue &JsonValue::null_value() {
+    static const JsonValue value;
+    return value;
+}
+
+const JsonValue &JsonValue::get(const char *key, size_t key_len) const {
+    if (is_object()) {
+        for (size_t i = m_size; i-- > 0;) {
+            if (m_members[i].key.equals(key, key_len))
+                return m_members[i].value;
+        }
+    }
+
+    return null_value();
+}
+
+void *JsonDocument::allocate(size_t bytes) {
+    const size_t min_block_size = 0x10000;
+
+    bytes = (bytes + 7) & ~static_cast<size_t>(7);
+
+    if (m_blocks.empty() || m_block_size - m_block_used < bytes) {
+        size_t block_size = bytes > min_block_size ? bytes : min_block_size;
+        m_blocks.emplace_back(new char[block_size]);
+        m_block_size = block_size;
+        m_block_used = 0;
+    }
+
+    void *ptr = m_blocks.back().get() + m_block_used;
+    m_block_used += bytes;
+    return ptr;
+}
+
+// Recursive descent parser. Children are gathered on scratch stacks shared by
+// every nesting level, then copied into the document's arena in one piece once
+// their container closes, so each array and object ends up contiguous.
+class JsonParser {
+public:
+    JsonParser(JsonDocument &doc, char *text, size_t size)
+        : doc(doc), start(text), pos(text), end(text + size) {}
+
+    bool parse(JsonValue &root, string &err) {
+        if (parse_value(root, 0)) {
+            skip_whitespace();
+            if (pos != end)
+                fail("unexpected trailing " + describe(*pos));
+        }
+
+        if (!error.empty()) {
+            int line = 1;
+            for (const char *p = start; p < pos && p < end; p++) {
+                if (*p == '\n')
+                    line++;
+            }
+            err = error + " at line " + std::to_string(line);
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    static const int max_depth = 200;
+
+    JsonDocument &doc;
+    const char *start;
+    char *pos;
+    char *end;
+    string error;
+    vector<JsonValue> element_stack;
+    vector<JsonMember> member_stack;
+
+    bool fail(const string &msg) {
+        if (error.empty())
+            error = msg;
+        return false;
+    }
+
+    static string describe(char c) {
+        char buf[16];
+        if (static_cast<unsigned char>(c) >= 0x20 && c != 0x7F)
+            std::snprintf(buf, sizeof(buf), "'%c'", c);
+        else
+            std::snprintf(buf, sizeof(buf), "(%d)", c);
+        return buf;
+    }
+
+    void skip_whitespace() {
+        while (pos < end && (*pos == ' ' || *pos == '\r' || *pos == '\n' || *pos == '\t'))
+            pos++;
+    }
+
+    bool expect_literal(const char *literal) {
+        size_t len = std::strlen(literal);
+        if (static_cast<size_t>(end - pos) < len || std::memcmp(pos, literal, len) != 0)
+            return fail(string("expected '") + literal + "'");
+        pos += len;
+        return true;
+    }
+
+    static int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool read_hex4(const char *p, long &value) const {
+        if (end - p < 4)
+            return false;
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hex_value(p[i]);
+            if (digit < 0)
+                return false;
+            value = (value << 4) | digit;
+        }
+        return true;
+    }
+
+    static char *encode_utf8(long pt, char *out) {
+        if (pt < 0x80) {
+            *out++ = static_cast<char>(pt);
+        } else if (pt < 0x800) {
+            *out++ = static_cast<char>((pt >> 6) | 0xC0);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        } else if (pt < 0x10000) {
+            *out++ = static_cast<char>((pt >> 12) | 0xE0);
+            *out++ = static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        } else {
+            *out++ = static_cast<char>((pt >> 18) | 0xF0);
+            *out++ = static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+            *out++ = static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        }
+        return out;
+    }
+
+    // Parses the string whose opening quote has been consumed. Escapes are
+    // decoded over the source text, which never needs more room than the
+    // escape sequences it replaces.
+    bool parse_string(JsonString &out) {
+        char *str_start = pos;
+        char *dest = pos;
+
+        while (true) {
+            if (pos == end)
+                return fail("unexpected end of input in string");
+
+            char ch = *pos++;
+
+            if (ch == '"') {
+                out = JsonString(str_start, dest - str_start);
+                return true;
+            }
+
+            if (static_cast<unsigned char>(ch) < 0x20)
+                return fail("unescaped " + describe(ch) + " in string");
+
+            if (ch != '\\') {
+                *dest++ = ch;
+                continue;
+            }
+
+            if (pos == end)
+                return fail("unexpected end of input in string");
+
+            ch = *pos++;
+
+            switch (ch) {
+                case 'b': *dest++ = '\b'; break;
+                case 'f': *dest++ = '\f'; break;
+                case 'n': *dest++ = '\n'; break;
+                case 'r': *dest++ = '\r'; break;
+                case 't': *dest++ = '\t'; break;
+                case '"': case '\\': case '/': *dest++ = ch; break;
+                case 'u': {
+                    long pt;
+                    if (!read_hex4(pos, pt))
+                        return fail("bad \\u escape");
+                    pos += 4;
+
+                    // Combine a surrogate pair into one code point.
+                    long low;
+                    if (pt >= 0xD800 && pt <= 0xDBFF && end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u'
+                     && read_hex4(pos + 2, low) && low >= 0xDC00 && low <= 0xDFFF) {
+                        pt = (((pt - 0xD800) << 10) | (low - 0xDC00)) + 0x10000;
+                        pos += 6;
+                    }
+
+                    dest = encode_utf8(pt, dest);
+                    break;
+                }
+                default:
+                    return fail("invalid escape character " + describe(ch));
+            }
+        }
+    }
+
+    bool parse_number(JsonValue &value) {
+        char *num_start = pos;
+        bool is_integer = true;
+
+        if (pos < end && *pos == '-')
+            pos++;
+
+        if (pos < end && *pos == '0') {
+            pos++;
+            if (pos < end && *pos >= '0' && *pos <= '9')
+                return fail("leading 0s not permitted in numbers");
+        } else if (pos < end && *pos >= '1' && *pos <= '9') {
+            while (pos < end && *pos >= '0' && *pos <= '9')
+                pos++;
+        } else {
+            return fail("invalid number");
+        }
+
+        if (pos < end && *pos == '.') {
+            is_integer = false;
+            pos++;
+            if (pos == end || *pos < '0' || *pos > '9')
+                return fail("at least one digit required in fractional part");
+            while (pos < end && *pos >= '0' && *pos <= '9')
+                pos++;
+        }
+
+        if (pos < end && (*pos == 'e' || *pos == 'E')) {
+            is_integer = false;
+            pos++;
+            if (pos < end && (*pos == '+' || *pos == '-'))
+                pos++;
+            if (pos == end || *pos < '0' || *pos > '9')
+                return fail("at least one digit required in exponent");
+            while (pos < end && *pos >= '0' && *pos <= '9')
+                pos++;
+        }
+
+        value.m_type = JsonValue::Type::NUMBER;
+
+        // Short integers, which is nearly every number in the game's data,
+        // don't need to go through strtod.
+        if (is_integer && pos - num_start <= 10) {
+            const char *p = num_start;
+            bool negative = *p == '-';
+            long long n = 0;
+            if (negative)
+                p++;
+            for (; p < pos; p++)
+                n = n * 10 + (*p - '0');
+            value.m_number = static_cast<double>(negative ? -n : n);
+        } else {
+            // The text after the number is never a digit, so strtod stops at
+            // the same place the scan did.
+            value.m_number = std::strtod(num_start, nullptr);
+        }
+
+        return true;
+    }
+
+    bool parse_value(JsonValue &value, int depth) {
+        if (depth > max_depth)
+            return fail("exceeded maximum nesting depth");
+
+        skip_whitespace();
+        if (pos == end)
+            return fail("unexpected end of input");
+
+        char ch = *pos;
+
+        if (ch == '-' || (ch >= '0' && ch <= '9'))
+            return parse_number(value);
+
+        if (ch == 't') {
+            value.m_type = JsonValue::Type::BOOL;
+            value.m_boolean = true;
+            return expect_literal("true");
+        }
+
+        if (ch == 'f') {
+            value.m_type = JsonValue::Type::BOOL;
+            value.m_boolean = false;
+            return expect_literal("false");
+        }
+
+        if (ch == 'n') {
+            value = JsonValue();
+            return expect_literal("null");
+        }
+
+        pos++;
+
+        if (ch == '"') {
+            JsonString str;
+            if (!parse_string(str))
+                return false;
+            value.m_type = JsonValue::Type::STRING;
+            value.m_string = str.data();
+            value.m_size = static_cast<uint32_t>(str.size());
+            return true;
+        }
+
+        if (ch == '[')
+            return parse_array(value, depth);
+
+        if (ch == '{')
+            return parse_object(value, depth);
+
+        pos--;
+        return fail("expected value, got " + describe(ch));
+    }
+
+    bool parse_array(JsonValue &value, int depth) {
+        size_t base = element_stack.size();
+
+        skip_whitespace();
+        if (pos < end && *pos == ']') {
+            pos++;
+        } else {
+            while (true) {
+                JsonValue element;
+                if (!parse_value(element, depth + 1))
+                    return false;
+                element_stack.push_back(element);
+
+                skip_whitespace();
+                if (pos == end)
+                    return fail("unexpected end of input in array");
+                char ch = *pos++;
+                if (ch == ']')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in list, got " + describe(ch));
+            }
+        }
+
+        size_t count = element_stack.size() - base;
+        JsonValue *elements = static_cast<JsonValue *>(doc.allocate(count * sizeof(JsonValue)));
+        std::uninitialized_copy(element_stack.begin() + base, element_stack.end(), elements);
+        element_stack.resize(base);
+
+        value.m_type = JsonValue::Type::ARRAY;
+        value.m_elements = elements;
+        value.m_size = static_cast<uint32_t>(count);
+        return true;
+    }
+
+    bool parse_object(JsonValue &value, int depth) {
+        size_t base = member_stack.size();
+
+        skip_whitespace();
+        if (pos < end && *pos == '}') {
+            pos++;
+        } else {
+            while (true) {
+                skip_whitespace();
+                if (pos == end || *pos != '"')
+                    return fail("expected '\"' in object, got " + (pos == end ? string("end of input") : describe(*pos)));
+                pos++;
+
+                JsonMember member;
+                if (!parse_string(member.key))
+                    return false;
+
+                skip_whitespace();
+                if (pos == end || *pos != ':')
+                    return fail("expected ':' in object, got " + (pos == end ? string("end of input") : describe(*pos)));
+                pos++;
+
+                if (!parse_value(member.value, depth + 1))
+                    return false;
+                member_stack.push_back(member);
+
+                skip_whitespace();
+                if (pos == end)
+                    return fail("unexpected end of input in object");
+                char ch = *pos++;
+                if (ch == '}')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in object, got " + describe(ch));
+            }
+        }
+
+        size_t count = member_stack.size() - base;
+        JsonMember *members = static_cast<JsonMember *>(doc.allocate(count * sizeof(JsonMember)));
+        std::uninitialized_copy(member_stack.begin() + base, member_stack.end(), members);
+        member_stack.resize(base);
+
+        value.m_type = JsonValue::Type::OBJECT;
+        value.m_members = members;
+        value.m_size = static_cast<uint32_t>(count);
+        return true;
+    }
+};
+
+bool JsonDocument::parse(string text, string &err) {
+    m_text = std::move(text);
+    m_blocks.clear();
+    m_block_used = 0;
+    m_block_size = 0;
+    m_root = JsonValue();
+
+    JsonParser parser(*this, &m_text[0], m_text.size());
+    if (!parser.parse(m_root, err)) {
+        m_root = JsonValue();
+        return false;
+    }
+
+    return true;
+}
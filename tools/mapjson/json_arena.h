@@ -0,0 +1,149 @@
+// json_arena.h
+// A read-only JSON document. Strings are decoded in place in the document's
+// copy of the source text, and every value lives in a few large blocks owned by
+// the document, so a parse makes a handful of allocations whatever the size of
+// the input, instead of one or more per value.
+
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A view of string data owned by a JsonDocument.
+class JsonString {
+public:
+    JsonString() : ptr(""), len(0) {}
+    JsonString(const char *ptr, size_t len) : ptr(ptr), len(len) {}
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+
+    bool equals(const char *other, size_t other_len) const {
+        return len == other_len && std::memcmp(ptr, other, len) == 0;
+    }
+
+    bool operator==(const char *other) const {
+        return equals(other, std::strlen(other));
+    }
+
+    std::string str() const { return std::string(ptr, len); }
+
+private:
+    const char *ptr;
+    size_t len;
+};
+
+// A contiguous run of array elements or object members.
+template <typename T>
+class JsonRange {
+public:
+    JsonRange() : first(nullptr), count(0) {}
+    JsonRange(const T *first, size_t count) : first(first), count(count) {}
+
+    const T *begin() const { return first; }
+    const T *end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T &operator[](size_t i) const { return first[i]; }
+
+private:
+    const T *first;
+    size_t count;
+};
+
+struct JsonMember;
+
+class JsonValue {
+public:
+    enum class Type : uint8_t { NUL, NUMBER, BOOL, STRING, ARRAY, OBJECT };
+
+    typedef JsonRange<JsonValue> Array;
+    typedef JsonRange<JsonMember> Object;
+
+    JsonValue() : m_type(Type::NUL), m_size(0), m_number(0) {}
+
+    Type type() const { return m_type; }
+    bool is_null() const { return m_type == Type::NUL; }
+    bool is_number() const { return m_type == Type::NUMBER; }
+    bool is_bool() const { return m_type == Type::BOOL; }
+    bool is_string() const { return m_type == Type::STRING; }
+    bool is_array() const { return m_type == Type::ARRAY; }
+    bool is_object() const { return m_type == Type::OBJECT; }
+
+    // Accessors for a different type return an empty value.
+    double number_value() const { return is_number() ? m_number : 0; }
+    int int_value() const { return static_cast<int>(number_value()); }
+    bool bool_value() const { return is_bool() && m_boolean; }
+    JsonString string_value() const;
+    Array array_items() const;
+    Object object_items() const;
+
+    // Returns the member named key, or a null value if there isn't one or this
+    // isn't an object. When a key is repeated the last one wins.
+    const JsonValue &operator[](const char *key) const { return get(key, std::strlen(key)); }
+    const JsonValue &get(const char *key, size_t key_len) const;
+
+    static const JsonValue &null_value();
+
+private:
+    friend class JsonParser;
+
+    Type m_type;
+    uint32_t m_size;
+    union {
+        double m_number;
+        bool m_boolean;
+        const char *m_string;
+        const JsonValue *m_elements;
+        const JsonMember *m_members;
+    };
+};
+
+struct JsonMember {
+    JsonString key;
+    JsonValue value;
+};
+
+inline JsonString JsonValue::string_value() const {
+    return is_string() ? JsonString(m_string, m_size) : JsonString();
+}
+
+inline JsonValue::Array JsonValue::array_items() const {
+    return is_array() ? Array(m_elements, m_size) : Array();
+}
+
+inline JsonValue::Object JsonValue::object_items() const {
+    return is_object() ? Object(m_members, m_size) : Object();
+}
+
+class JsonDocument {
+public:
+    JsonDocument() : m_block_used(0), m_block_size(0) {}
+    JsonDocument(const JsonDocument &) = delete;
+    JsonDocument &operator=(const JsonDocument &) = delete;
+
+    // Parses text, taking ownership of it. On failure, returns false and
+    // describes the error in err.
+    bool parse(std::string text, std::string &err);
+
+    const JsonValue &root() const { return m_root; }
+
+private:
+    friend class JsonParser;
+
+    void *allocate(size_t bytes);
+
+    std::string m_text;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    size_t m_block_used;
+    size_t m_block_size;
+    JsonValue m_root;
+};
+
+#endif // JSON_ARENA_H
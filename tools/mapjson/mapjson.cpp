@@ -10,22 +10,49 @@ using std::string;
 using std::vector;
 
 #include <algorithm>
-using std::sort; using std::find;
+using std::sort;
 
 #include <map>
 using std::map;
 
+#include <unordered_map>
+using std::unordered_map;
+
+#include <thread>
+using std::thread;
+
+#include <atomic>
+using std::atomic;
+
+#include <functional>
+using std::function;
+
+#include <chrono>
+
+#include <unordered_set>
+using std::unordered_set;
+
 #include <fstream>
 using std::ofstream; using std::ifstream;
 
-#include <sstream>
-using std::ostringstream;
+#include <cstring>
+using std::strlen; using std::memcmp;
+
+#include <cstdio>
+using std::rename; using std::remove;
+
+#include <cstdint>
+using std::uint32_t;
+
+#include <type_traits>
 
 #include <limits>
 using std::numeric_limits;
 
-#include "json11.h"
-using json11::Json;
+#include <memory>
+using std::unique_ptr;
+
+#include "json_arena.h"
 
 #include "mapjson.h"
 
@@ -33,7 +60,7 @@ string version;
 // System directory separator
 string sep;
 
-string read_text_file(string filepath) {
+string read_text_file(const string &filepath) {
     ifstream in_file(filepath);
 
     if (!in_file.is_open())
@@ -52,7 +79,7 @@ string read_text_file(string filepath) {
     return text;
 }
 
-void write_text_file(string filepath, string text) {
+void write_text_file(const string &filepath, const string &text) {
     ofstream out_file(filepath, std::ofstream::binary);
 
     if (!out_file.is_open())
@@ -63,273 +90,534 @@ void write_text_file(string filepath, string text) {
     out_file.close();
 }
 
+bool file_holds_text(const string &filepath, const string &text) {
+    ifstream in_file(filepath, std::ifstream::binary);
+
+    if (!in_file.is_open())
+        return false;
+
+    in_file.seekg(0, std::ios::end);
+    std::streamoff size = in_file.tellg();
+    if (size != static_cast<std::streamoff>(text.size()))
+        return false;
+
+    string existing(text.size(), '\0');
+    in_file.seekg(0, std::ios::beg);
+    in_file.read(&existing[0], existing.size());
+    return in_file && existing == text;
+}
+
+// Leaves the file alone if it already holds the same text, so that make
+// doesn't rebuild anything that depends on it.
+bool write_text_file_if_changed(const string &filepath, const string &text) {
+    if (file_holds_text(filepath, text))
+        return false;
+
+    write_text_file(filepath, text);
+    return true;
+}
+
+struct GeneratedFile {
+    string filepath;
+    string text;
+};
+
+// The single writer for every file of the all mode. Like write_text_file_if_changed,
+// it leaves unchanged files alone. Changed text goes to a temporary file that is
+// then renamed over the old one, so that an interrupted run never leaves a partly
+// written file behind. Nothing is synced to disk: a build that loses a file to a
+// crash just generates it again.
+class OutputWriter {
+public:
+    OutputWriter() : num_files(0), num_changed(0) {}
+
+    void write(const GeneratedFile &file) {
+        num_files++;
+        if (file_holds_text(file.filepath, file.text))
+            return;
+
+        string temp_filepath = file.filepath + ".tmp";
+        write_text_file(temp_filepath, file.text);
+#ifdef _WIN32
+        // Windows won't rename over an existing file.
+        remove(file.filepath.c_str());
+#endif
+        if (rename(temp_filepath.c_str(), file.filepath.c_str()) != 0)
+            FATAL_ERROR("Cannot rename %s to %s.\n", temp_filepath.c_str(), file.filepath.c_str());
+        num_changed++;
+    }
+
+    size_t files() const { return num_files; }
+    size_t changed() const { return num_changed; }
+
+private:
+    atomic<size_t> num_files;
+    atomic<size_t> num_changed;
+};
+
+// Runs a batch of tasks on one thread per core, each thread taking the next
+// task that hasn't been started until there are none left.
+class TaskPool {
+public:
+    void add(function<void()> task) {
+        tasks.push_back(std::move(task));
+    }
+
+    void run() {
+        atomic<size_t> next_task(0);
+
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next_task++) < tasks.size())
+                tasks[i]();
+        };
+
+        size_t num_threads = thread::hardware_concurrency();
+        if (num_threads == 0)
+            num_threads = 1;
+        if (num_threads > tasks.size())
+            num_threads = tasks.size();
+
+        vector<thread> threads;
+        for (size_t i = 1; i < num_threads; i++)
+            threads.emplace_back(worker);
+        worker();
+        for (thread &t : threads)
+            t.join();
+
+        tasks.clear();
+    }
+
+private:
+    vector<function<void()>> tasks;
+};
+
+// A scalar JSON value as it appears in the generated text. Strings point into
+// the parsed document and numbers stay integers until they're emitted, so
+// reading a field never allocates.
+struct JsonText {
+    const char *str = "";
+    size_t len = 0;
+    bool is_number = false;
+    int number = 0;
+
+    bool empty() const {
+        return !is_number && len == 0;
+    }
+
+    bool operator==(const char *other) const;
+    bool operator!=(const char *other) const {
+        return !(*this == other);
+    }
+
+    string to_string() const;
+};
+
+// Writes the decimal digits of n ending just before end, and returns where they start.
+char *format_int(long long n, char *end) {
+    unsigned long long magnitude = n < 0 ? 0ULL - n : n;
+
+    do {
+        *--end = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (n < 0)
+        *--end = '-';
+
+    return end;
+}
+
+bool JsonText::operator==(const char *other) const {
+    char digits[24];
+    const char *text = str;
+    size_t length = len;
 
-string json_to_string(const Json &data, const string &field = "", bool silent = false) {
-    const Json value = !field.empty() ? data[field] : data;
-    string output = "";
+    if (is_number) {
+        text = format_int(number, digits + sizeof(digits));
+        length = digits + sizeof(digits) - text;
+    }
+
+    return strlen(other) == length && memcmp(text, other, length) == 0;
+}
+
+string JsonText::to_string() const {
+    return is_number ? std::to_string(number) : string(str, len);
+}
+
+// Generated files are built up in one buffer that is reused between files, so
+// once it has grown to fit the largest output, emitting text doesn't allocate.
+class TextBuffer {
+public:
+    explicit TextBuffer(size_t capacity = 0x10000) {
+        text.reserve(capacity);
+    }
+
+    void clear() {
+        text.clear();
+    }
+
+    const string &str() const {
+        return text;
+    }
+
+    TextBuffer &operator<<(const char *s) {
+        text.append(s);
+        return *this;
+    }
+
+    TextBuffer &operator<<(const string &s) {
+        text.append(s);
+        return *this;
+    }
+
+    TextBuffer &operator<<(char c) {
+        text.push_back(c);
+        return *this;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, TextBuffer &>::type operator<<(T n) {
+        char digits[24];
+        const char *start = format_int(static_cast<long long>(n), digits + sizeof(digits));
+        text.append(start, digits + sizeof(digits) - start);
+        return *this;
+    }
+
+    TextBuffer &operator<<(const JsonText &value) {
+        if (value.is_number)
+            return *this << value.number;
+        text.append(value.str, value.len);
+        return *this;
+    }
+
+    TextBuffer &pad(size_t count) {
+        text.append(count, ' ');
+        return *this;
+    }
+
+private:
+    string text;
+};
+
+bool has_field(const JsonValue &data, const char *field) {
+    return &data[field] != &JsonValue::null_value();
+}
+
+const JsonValue &json_field(const JsonValue &data, const char *field) {
+    return data[field];
+}
+
+const JsonValue &json_field(const JsonValue &data, const JsonText &field) {
+    return data.get(field.str, field.len);
+}
+
+bool is_empty_object(const JsonValue &value) {
+    return value.is_object() && value.object_items().empty();
+}
+
+JsonText json_text(const JsonValue &data, const char *field = nullptr, bool silent = false) {
+    const JsonValue &value = field ? json_field(data, field) : data;
+    JsonText text;
     switch (value.type()) {
-        case Json::Type::STRING:
-            output = value.string_value();
+        case JsonValue::Type::STRING:
+            text.str = value.string_value().data();
+            text.len = value.string_value().size();
             break;
-        case Json::Type::NUMBER:
-            output = std::to_string(value.int_value());
+        case JsonValue::Type::NUMBER:
+            text.is_number = true;
+            text.number = value.int_value();
             break;
-        case Json::Type::BOOL:
-            output = value.bool_value() ? "TRUE" : "FALSE";
+        case JsonValue::Type::BOOL:
+            text.str = value.bool_value() ? "TRUE" : "FALSE";
+            text.len = strlen(text.str);
             break;
-        case Json::Type::NUL:
-            output = "";
+        case JsonValue::Type::NUL:
             break;
         default:{
             if (!silent) {
-                string s = !field.empty() ? ("Value for '" + field + "'") : "JSON field";
+                string s = field ? ("Value for '" + string(field) + "'") : "JSON field";
                 FATAL_ERROR("%s is unexpected type; expected string, number, or bool.\n", s.c_str());
             }
         }
     }
 
-    if (!silent && output.empty()) {
-        string s = !field.empty() ? ("Value for '" + field + "'") : "JSON field";
+    if (!silent && text.empty()) {
+        string s = field ? ("Value for '" + string(field) + "'") : "JSON field";
         FATAL_ERROR("%s cannot be empty.\n", s.c_str());
     }
 
-    return output;
+    return text;
 }
 
-string generate_map_header_text(Json map_data, Json layouts_data) {
-    string map_layout_id = json_to_string(map_data, "layout");
+// A key that points at string data owned by a parsed document.
+struct StringRef {
+    const char *str;
+    size_t len;
 
-    vector<Json> matched;
-
-    for (auto &layout : layouts_data["layouts"].array_items()) {
-        if (map_layout_id == json_to_string(layout, "id", true))
-            matched.push_back(layout);
+    bool operator==(const StringRef &other) const {
+        return len == other.len && memcmp(str, other.str, len) == 0;
+    }
+};
+
+struct StringRefHash {
+    size_t operator()(const StringRef &ref) const {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < ref.len; i++)
+            hash = (hash ^ static_cast<unsigned char>(ref.str[i])) * 16777619u;
+        return hash;
+    }
+};
+
+// Maps layout ids to their entries in layouts.json.
+typedef unordered_map<StringRef, const JsonValue *, StringRefHash> LayoutIndex;
+
+LayoutIndex build_layout_index(const JsonValue &layouts_data) {
+    LayoutIndex index;
+
+    for (auto &layout : json_field(layouts_data, "layouts").array_items()) {
+        JsonText id = json_text(layout, "id", true);
+        if (id.empty() || id.is_number)
+            continue;
+        // A duplicated id can't be matched unambiguously, so it stays unmatched.
+        auto inserted = index.emplace(StringRef{id.str, id.len}, &layout);
+        if (!inserted.second)
+            inserted.first->second = nullptr;
     }
 
-    if (matched.size() != 1)
-        FATAL_ERROR("Failed to find matching layout for %s.\n", map_layout_id.c_str());
+    return index;
+}
 
-    Json layout = matched[0];
+const JsonValue &find_map_layout(const JsonValue &map_data, const LayoutIndex &layout_index) {
+    JsonText map_layout_id = json_text(map_data, "layout");
 
-    ostringstream text;
+    auto it = layout_index.find(StringRef{map_layout_id.str, map_layout_id.len});
+    if (map_layout_id.is_number || it == layout_index.end() || it->second == nullptr)
+        FATAL_ERROR("Failed to find matching layout for %s.\n", map_layout_id.to_string().c_str());
 
-    string mapName = json_to_string(map_data, "name");
+    return *it->second;
+}
+
+void generate_map_header_text(TextBuffer &text, const JsonValue &map_data, const JsonValue &layout) {
+    JsonText mapName = json_text(map_data, "name");
 
     text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/" << mapName << "/map.json\n@\n\n";
 
     text << mapName << ":\n"
-         << "\t.4byte " << json_to_string(layout, "name") << "\n";
+         << "\t.4byte " << json_text(layout, "name") << "\n";
 
-    if (map_data.object_items().find("shared_events_map") != map_data.object_items().end())
-        text << "\t.4byte " << json_to_string(map_data, "shared_events_map") << "_MapEvents\n";
+    if (has_field(map_data, "shared_events_map"))
+        text << "\t.4byte " << json_text(map_data, "shared_events_map") << "_MapEvents\n";
     else
         text << "\t.4byte " << mapName << "_MapEvents\n";
 
-    if (map_data.object_items().find("shared_scripts_map") != map_data.object_items().end())
-        text << "\t.4byte " << json_to_string(map_data, "shared_scripts_map") << "_MapScripts\n";
+    if (has_field(map_data, "shared_scripts_map"))
+        text << "\t.4byte " << json_text(map_data, "shared_scripts_map") << "_MapScripts\n";
     else
         text << "\t.4byte " << mapName << "_MapScripts\n";
 
-    if (map_data.object_items().find("connections") != map_data.object_items().end()
-     && map_data["connections"].array_items().size() > 0 && json_to_string(map_data, "connections_no_include", true) != "TRUE")
+    if (has_field(map_data, "connections")
+     && json_field(map_data, "connections").array_items().size() > 0 && json_text(map_data, "connections_no_include", true) != "TRUE")
         text << "\t.4byte " << mapName << "_MapConnections\n";
     else
         text << "\t.4byte NULL\n";
 
-    text << "\t.2byte " << json_to_string(map_data, "music") << "\n"
-         << "\t.2byte " << json_to_string(layout, "id") << "\n"
-         << "\t.byte "  << json_to_string(map_data, "region_map_section") << "\n"
-         << "\t.byte "  << json_to_string(map_data, "requires_flash") << "\n"
-         << "\t.byte "  << json_to_string(map_data, "weather") << "\n"
-         << "\t.byte "  << json_to_string(map_data, "map_type") << "\n";
+    text << "\t.2byte " << json_text(map_data, "music") << "\n"
+         << "\t.2byte " << json_text(layout, "id") << "\n"
+         << "\t.byte "  << json_text(map_data, "region_map_section") << "\n"
+         << "\t.byte "  << json_text(map_data, "requires_flash") << "\n"
+         << "\t.byte "  << json_text(map_data, "weather") << "\n"
+         << "\t.byte "  << json_text(map_data, "map_type") << "\n";
 
     if (version != "firered")
         text << "\t.2byte 0\n";
 
     if (version == "ruby")
-        text << "\t.byte " << json_to_string(map_data, "show_map_name") << "\n";
+        text << "\t.byte " << json_text(map_data, "show_map_name") << "\n";
     else if (version == "emerald" || version == "firered")
         text << "\tmap_header_flags "
-             << "allow_cycling=" << json_to_string(map_data, "allow_cycling") << ", "
-             << "allow_escaping=" << json_to_string(map_data, "allow_escaping") << ", "
-             << "allow_running=" << json_to_string(map_data, "allow_running") << ", "
-             << "show_map_name=" << json_to_string(map_data, "show_map_name") << "\n";
+             << "allow_cycling=" << json_text(map_data, "allow_cycling") << ", "
+             << "allow_escaping=" << json_text(map_data, "allow_escaping") << ", "
+             << "allow_running=" << json_text(map_data, "allow_running") << ", "
+             << "show_map_name=" << json_text(map_data, "show_map_name") << "\n";
 
     if (version == "firered")
-        text << "\t.byte " << json_to_string(map_data, "floor_number") << "\n";
-
-     text << "\t.byte " << json_to_string(map_data, "battle_scene") << "\n\n";
+        text << "\t.byte " << json_text(map_data, "floor_number") << "\n";
 
-    return text.str();
+     text << "\t.byte " << json_text(map_data, "battle_scene") << "\n\n";
 }
 
-string generate_map_connections_text(Json map_data) {
-    if (map_data["connections"] == Json())
-        return string("\n");
+void generate_map_connections_text(TextBuffer &text, const JsonValue &map_data) {
+    const JsonValue &connections = json_field(map_data, "connections");
 
-    ostringstream text;
+    if (connections.is_null()) {
+        text << "\n";
+        return;
+    }
 
-    string mapName = json_to_string(map_data, "name");
+    JsonText mapName = json_text(map_data, "name");
 
     text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/" << mapName << "/map.json\n@\n\n";
 
     text << mapName << "_MapConnectionsList:\n";
 
-    for (auto &connection : map_data["connections"].array_items()) {
+    for (auto &connection : connections.array_items()) {
         text << "\tconnection "
-             << json_to_string(connection, "direction") << ", "
-             << json_to_string(connection, "offset") << ", "
-             << json_to_string(connection, "map") << "\n";
+             << json_text(connection, "direction") << ", "
+             << json_text(connection, "offset") << ", "
+             << json_text(connection, "map") << "\n";
     }
 
     text << "\n" << mapName << "_MapConnections:\n"
-         << "\t.4byte " << map_data["connections"].array_items().size() << "\n"
+         << "\t.4byte " << connections.array_items().size() << "\n"
          << "\t.4byte " << mapName << "_MapConnectionsList\n\n";
-
-    return text.str();
 }
 
-string generate_map_events_text(Json map_data) {
-    if (map_data.object_items().find("shared_events_map") != map_data.object_items().end())
-        return string("\n");
+void emit_events_label(TextBuffer &text, const JsonText &mapName, const JsonValue::Array &events, const char *suffix) {
+    if (events.size() > 0)
+        text << mapName << suffix;
+    else
+        text << "NULL";
+}
 
-    ostringstream text;
+void generate_map_events_text(TextBuffer &text, const JsonValue &map_data) {
+    if (has_field(map_data, "shared_events_map")) {
+        text << "\n";
+        return;
+    }
 
-    string mapName = json_to_string(map_data, "name");
+    JsonText mapName = json_text(map_data, "name");
 
     text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/" << mapName << "/map.json\n@\n\n\t.align 2\n\n";
 
-    string objects_label, warps_label, coords_label, bgs_label;
+    const JsonValue::Array object_events = json_field(map_data, "object_events").array_items();
+    const JsonValue::Array warp_events = json_field(map_data, "warp_events").array_items();
+    const JsonValue::Array coord_events = json_field(map_data, "coord_events").array_items();
+    const JsonValue::Array bg_events = json_field(map_data, "bg_events").array_items();
 
-    if (map_data["object_events"].array_items().size() > 0) {
-        objects_label = mapName + "_ObjectEvents";
-        text << objects_label << ":\n";
-        for (unsigned int i = 0; i < map_data["object_events"].array_items().size(); i++) {
-            auto obj_event = map_data["object_events"].array_items()[i];
-            string type = json_to_string(obj_event, "type", true);
+    if (object_events.size() > 0) {
+        text << mapName << "_ObjectEvents:\n";
+        for (unsigned int i = 0; i < object_events.size(); i++) {
+            const JsonValue &obj_event = object_events[i];
+            JsonText type = json_text(obj_event, "type", true);
 
             // If no type field is present, assume it's a regular object event.
-            if (type == "" || type == "object") {
+            if (type.empty() || type == "object") {
                 text << "\tobject_event " << i + 1 << ", "
-                     << json_to_string(obj_event, "graphics_id") << ", "
-                     << json_to_string(obj_event, "x") << ", "
-                     << json_to_string(obj_event, "y") << ", "
-                     << json_to_string(obj_event, "elevation") << ", "
-                     << json_to_string(obj_event, "movement_type") << ", "
-                     << json_to_string(obj_event, "movement_range_x") << ", "
-                     << json_to_string(obj_event, "movement_range_y") << ", "
-                     << json_to_string(obj_event, "trainer_type") << ", "
-                     << json_to_string(obj_event, "trainer_sight_or_berry_tree_id") << ", "
-                     << json_to_string(obj_event, "script") << ", "
-                     << json_to_string(obj_event, "flag") << "\n";
+                     << json_text(obj_event, "graphics_id") << ", "
+                     << json_text(obj_event, "x") << ", "
+                     << json_text(obj_event, "y") << ", "
+                     << json_text(obj_event, "elevation") << ", "
+                     << json_text(obj_event, "movement_type") << ", "
+                     << json_text(obj_event, "movement_range_x") << ", "
+                     << json_text(obj_event, "movement_range_y") << ", "
+                     << json_text(obj_event, "trainer_type") << ", "
+                     << json_text(obj_event, "trainer_sight_or_berry_tree_id") << ", "
+                     << json_text(obj_event, "script") << ", "
+                     << json_text(obj_event, "flag") << "\n";
             } else if (type == "clone") {
                 text << "\tclone_event " << i + 1 << ", "
-                     << json_to_string(obj_event, "graphics_id") << ", "
-                     << json_to_string(obj_event, "x") << ", "
-                     << json_to_string(obj_event, "y") << ", "
-                     << json_to_string(obj_event, "target_local_id") << ", "
-                     << json_to_string(obj_event, "target_map") << "\n";
+                     << json_text(obj_event, "graphics_id") << ", "
+                     << json_text(obj_event, "x") << ", "
+                     << json_text(obj_event, "y") << ", "
+                     << json_text(obj_event, "target_local_id") << ", "
+                     << json_text(obj_event, "target_map") << "\n";
             } else {
-                FATAL_ERROR("Unknown object event type '%s'. Expected 'object' or 'clone'.\n", type.c_str());
+                FATAL_ERROR("Unknown object event type '%s'. Expected 'object' or 'clone'.\n", type.to_string().c_str());
             }
         }
         text << "\n";
-    } else {
-        objects_label = "NULL";
     }
 
-    if (map_data["warp_events"].array_items().size() > 0) {
-        warps_label = mapName + "_MapWarps";
-        text << warps_label << ":\n";
-        for (auto &warp_event : map_data["warp_events"].array_items()) {
+    if (warp_events.size() > 0) {
+        text << mapName << "_MapWarps:\n";
+        for (auto &warp_event : warp_events) {
             text << "\twarp_def "
-                 << json_to_string(warp_event, "x") << ", "
-                 << json_to_string(warp_event, "y") << ", "
-                 << json_to_string(warp_event, "elevation") << ", "
-                 << json_to_string(warp_event, "dest_warp_id") << ", "
-                 << json_to_string(warp_event, "dest_map") << "\n";
+                 << json_text(warp_event, "x") << ", "
+                 << json_text(warp_event, "y") << ", "
+                 << json_text(warp_event, "elevation") << ", "
+                 << json_text(warp_event, "dest_warp_id") << ", "
+                 << json_text(warp_event, "dest_map") << "\n";
         }
         text << "\n";
-    } else {
-        warps_label = "NULL";
     }
 
-    if (map_data["coord_events"].array_items().size() > 0) {
-        coords_label = mapName + "_MapCoordEvents";
-        text << coords_label << ":\n";
-        for (auto &coord_event : map_data["coord_events"].array_items()) {
-            string type = json_to_string(coord_event, "type");
+    if (coord_events.size() > 0) {
+        text << mapName << "_MapCoordEvents:\n";
+        for (auto &coord_event : coord_events) {
+            JsonText type = json_text(coord_event, "type");
             if (type == "trigger") {
                 text << "\tcoord_event "
-                     << json_to_string(coord_event, "x") << ", "
-                     << json_to_string(coord_event, "y") << ", "
-                     << json_to_string(coord_event, "elevation") << ", "
-                     << json_to_string(coord_event, "var") << ", "
-                     << json_to_string(coord_event, "var_value") << ", "
-                     << json_to_string(coord_event, "script") << "\n";
+                     << json_text(coord_event, "x") << ", "
+                     << json_text(coord_event, "y") << ", "
+                     << json_text(coord_event, "elevation") << ", "
+                     << json_text(coord_event, "var") << ", "
+                     << json_text(coord_event, "var_value") << ", "
+                     << json_text(coord_event, "script") << "\n";
             }
             else if (type == "weather") {
                 text << "\tcoord_weather_event "
-                     << json_to_string(coord_event, "x") << ", "
-                     << json_to_string(coord_event, "y") << ", "
-                     << json_to_string(coord_event, "elevation") << ", "
-                     << json_to_string(coord_event, "weather") << "\n";
+                     << json_text(coord_event, "x") << ", "
+                     << json_text(coord_event, "y") << ", "
+                     << json_text(coord_event, "elevation") << ", "
+                     << json_text(coord_event, "weather") << "\n";
             } else {
-                FATAL_ERROR("Unknown coord event type '%s'. Expected 'trigger' or 'weather'.\n", type.c_str());
+                FATAL_ERROR("Unknown coord event type '%s'. Expected 'trigger' or 'weather'.\n", type.to_string().c_str());
             }
         }
         text << "\n";
-    } else {
-        coords_label = "NULL";
     }
 
-    if (map_data["bg_events"].array_items().size() > 0) {
-        bgs_label = mapName + "_MapBGEvents";
-        text << bgs_label << ":\n";
-        for (auto &bg_event : map_data["bg_events"].array_items()) {
-            string type = json_to_string(bg_event, "type");
+    if (bg_events.size() > 0) {
+        text << mapName << "_MapBGEvents:\n";
+        for (auto &bg_event : bg_events) {
+            JsonText type = json_text(bg_event, "type");
             if (type == "sign") {
                 text << "\tbg_sign_event "
-                     << json_to_string(bg_event, "x") << ", "
-                     << json_to_string(bg_event, "y") << ", "
-                     << json_to_string(bg_event, "elevation") << ", "
-                     << json_to_string(bg_event, "player_facing_dir") << ", "
-                     << json_to_string(bg_event, "script") << "\n";
+                     << json_text(bg_event, "x") << ", "
+                     << json_text(bg_event, "y") << ", "
+                     << json_text(bg_event, "elevation") << ", "
+                     << json_text(bg_event, "player_facing_dir") << ", "
+                     << json_text(bg_event, "script") << "\n";
             }
             else if (type == "hidden_item") {
                 text << "\tbg_hidden_item_event "
-                     << json_to_string(bg_event, "x") << ", "
-                     << json_to_string(bg_event, "y") << ", "
-                     << json_to_string(bg_event, "elevation") << ", "
-                     << json_to_string(bg_event, "item") << ", "
-                     << json_to_string(bg_event, "flag");
+                     << json_text(bg_event, "x") << ", "
+                     << json_text(bg_event, "y") << ", "
+                     << json_text(bg_event, "elevation") << ", "
+                     << json_text(bg_event, "item") << ", "
+                     << json_text(bg_event, "flag");
                 if (version == "firered") {
                     text << ", "
-                         << json_to_string(bg_event, "quantity") << ", "
-                         << json_to_string(bg_event, "underfoot");
+                         << json_text(bg_event, "quantity") << ", "
+                         << json_text(bg_event, "underfoot");
                 }
                 text << "\n";
             }
             else if (type == "secret_base") {
                 text << "\tbg_secret_base_event "
-                     << json_to_string(bg_event, "x") << ", "
-                     << json_to_string(bg_event, "y") << ", "
-                     << json_to_string(bg_event, "elevation") << ", "
-                     << json_to_string(bg_event, "secret_base_id") << "\n";
+                     << json_text(bg_event, "x") << ", "
+                     << json_text(bg_event, "y") << ", "
+                     << json_text(bg_event, "elevation") << ", "
+                     << json_text(bg_event, "secret_base_id") << "\n";
             } else {
-                FATAL_ERROR("Unknown bg event type '%s'. Expected 'sign', 'hidden_item', or 'secret_base'.\n", type.c_str());
+                FATAL_ERROR("Unknown bg event type '%s'. Expected 'sign', 'hidden_item', or 'secret_base'.\n", type.to_string().c_str());
             }
         }
         text << "\n";
-    } else {
-        bgs_label = "NULL";
     }
 
     text << mapName << "_MapEvents::\n"
-         << "\tmap_events " << objects_label << ", " << warps_label << ", "
-         << coords_label << ", " << bgs_label << "\n\n";
-
-    return text.str();
+         << "\tmap_events ";
+    emit_events_label(text, mapName, object_events, "_ObjectEvents");
+    text << ", ";
+    emit_events_label(text, mapName, warp_events, "_MapWarps");
+    text << ", ";
+    emit_events_label(text, mapName, coord_events, "_MapCoordEvents");
+    text << ", ";
+    emit_events_label(text, mapName, bg_events, "_MapBGEvents");
+    text << "\n\n";
 }
 
 string strip_trailing_separator(string filename) {
@@ -347,160 +635,213 @@ string file_parent(string filename){
     return filename.substr(0, dir_pos + 1);
 }
 
-void process_map(string map_filepath, string layouts_filepath, string output_dir) {
-    string mapdata_err, layouts_err;
-
-    string mapdata_json_text = read_text_file(map_filepath);
-    string layouts_json_text = read_text_file(layouts_filepath);
-
-    Json map_data = Json::parse(mapdata_json_text, mapdata_err);
-    if (map_data == Json())
-        FATAL_ERROR("%s\n", mapdata_err.c_str());
-
-    Json layouts_data = Json::parse(layouts_json_text, layouts_err);
-    if (layouts_data == Json())
-        FATAL_ERROR("%s\n", layouts_err.c_str());
-
-    string header_text = generate_map_header_text(map_data, layouts_data);
-    string events_text = generate_map_events_text(map_data);
-    string connections_text = generate_map_connections_text(map_data);
-
-    string out_dir = strip_trailing_separator(output_dir).append(sep);
-    write_text_file(out_dir + "header.inc", header_text);
-    write_text_file(out_dir + "events.inc", events_text);
-    write_text_file(out_dir + "connections.inc", connections_text);
+void read_json_file(JsonDocument &doc, const string &filepath) {
+    string err;
+    if (!doc.parse(read_text_file(filepath), err))
+        FATAL_ERROR("%s: %s\n", filepath.c_str(), err.c_str());
 }
 
-string generate_groups_text(Json groups_data) {
-    ostringstream text;
-
-    text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
+// Generates a map's files one after another in text, calling output(filename)
+// once each is complete.
+void generate_map_texts(const JsonValue &map_data, const LayoutIndex &layout_index, TextBuffer &text, const function<void(const char *)> &output) {
+    const JsonValue &layout = find_map_layout(map_data, layout_index);
+
+    generate_map_header_text(text, map_data, layout);
+    output("header.inc");
+    text.clear();
+    generate_map_events_text(text, map_data);
+    output("events.inc");
+    text.clear();
+    generate_map_connections_text(text, map_data);
+    output("connections.inc");
+    text.clear();
+}
 
-    for (auto &key : groups_data["group_order"].array_items()) {
-        string group = json_to_string(key);
-        text << group << "::\n";
-        auto maps = groups_data[group].array_items();
-        for (Json &map_name : maps)
-            text << "\t.4byte " << json_to_string(map_name) << "\n";
-        text << "\n";
-    }
+// Returns the number of output files whose contents changed.
+int generate_map_files(const string &map_filepath, const LayoutIndex &layout_index, string output_dir, bool only_if_changed, TextBuffer &text) {
+    JsonDocument doc;
+    read_json_file(doc, map_filepath);
 
-    text << "\t.align 2\n" << "gMapGroups::\n";
-    for (auto &group : groups_data["group_order"].array_items())
-        text << "\t.4byte " << json_to_string(group) << "\n";
-    text << "\n";
+    string out_dir = strip_trailing_separator(output_dir).append(sep);
+    int num_changed = 0;
+
+    generate_map_texts(doc.root(), layout_index, text, [&](const char *filename) {
+        if (only_if_changed) {
+            num_changed += write_text_file_if_changed(out_dir + filename, text.str());
+        } else {
+            write_text_file(out_dir + filename, text.str());
+            num_changed++;
+        }
+    });
 
-    return text.str();
+    return num_changed;
 }
 
-string generate_connections_text(Json groups_data, string include_path) {
-    vector<Json> map_names;
-
-    for (auto &group : groups_data["group_order"].array_items())
-    for (auto map_name : groups_data[json_to_string(group)].array_items())
-        map_names.push_back(map_name);
+void process_map(string map_filepath, string layouts_filepath, string output_dir) {
+    JsonDocument layouts_doc;
+    read_json_file(layouts_doc, layouts_filepath);
+    const JsonValue &layouts_data = layouts_doc.root();
 
-    vector<Json> connections_include_order = groups_data["connections_include_order"].array_items();
+    TextBuffer text;
+    generate_map_files(map_filepath, build_layout_index(layouts_data), output_dir, false, text);
+}
 
-    if (connections_include_order.size() > 0)
-        sort(map_names.begin(), map_names.end(), [connections_include_order](const Json &a, const Json &b) {
-            auto iter_a = find(connections_include_order.begin(), connections_include_order.end(), a);
-            if (iter_a == connections_include_order.end())
-                iter_a = connections_include_order.begin() + numeric_limits<int>::max();
-            auto iter_b = find(connections_include_order.begin(), connections_include_order.end(), b);
-            if (iter_b == connections_include_order.end())
-                iter_b = connections_include_order.begin() + numeric_limits<int>::max();
-            return iter_a < iter_b;
+// Generates the files for every map next to its map.json, sharing one parse of
+// layouts.json between them. The maps are spread over one thread per core.
+void process_maps(string layouts_filepath, const vector<string> &map_filepaths) {
+    JsonDocument layouts_doc;
+    read_json_file(layouts_doc, layouts_filepath);
+    const JsonValue &layouts_data = layouts_doc.root();
+    const LayoutIndex layout_index = build_layout_index(layouts_data);
+
+    atomic<int> num_changed(0);
+    TaskPool pool;
+
+    for (const string &map_filepath : map_filepaths) {
+        pool.add([&]() {
+            thread_local TextBuffer text;
+            num_changed += generate_map_files(map_filepath, layout_index, file_parent(map_filepath), true, text);
         });
+    }
+    pool.run();
 
-    ostringstream text;
-
-    text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
-
-    for (Json map_name : map_names)
-        text << "\t.include \"" << include_path << "/" <<  json_to_string(map_name) << "/connections.inc\"\n";
-
-    return text.str();
+    cout << "mapjson: " << map_filepaths.size() << " maps, " << num_changed << " files updated" << endl;
 }
 
-string generate_headers_text(Json groups_data, string include_path) {
-    vector<string> map_names;
-
-    for (auto &group : groups_data["group_order"].array_items())
-    for (auto map_name : groups_data[json_to_string(group)].array_items())
-        map_names.push_back(json_to_string(map_name));
+// Maps each name in connections_include_order to its position in the list.
+typedef unordered_map<StringRef, size_t, StringRefHash> RankIndex;
 
-    ostringstream text;
+RankIndex build_rank_index(const JsonValue::Array &order) {
+    RankIndex ranks;
 
-    text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
-
-    for (string map_name : map_names)
-        text << "\t.include \"" << include_path << "/" << map_name << "/header.inc\"\n";
+    for (size_t i = 0; i < order.size(); i++) {
+        if (!order[i].is_string())
+            continue;
+        JsonString name = order[i].string_value();
+        // Like a linear search, a repeated name keeps its first position.
+        ranks.emplace(StringRef{name.data(), name.size()}, i);
+    }
 
-    return text.str();
+    return ranks;
 }
 
-string generate_events_text(Json groups_data, string include_path) {
-    vector<string> map_names;
-
-    for (auto &group : groups_data["group_order"].array_items())
-    for (auto map_name : groups_data[json_to_string(group)].array_items())
-        map_names.push_back(json_to_string(map_name));
-
-    ostringstream text;
-
-    text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from " << include_path << "/map_groups.json\n@\n\n";
-
-    for (string map_name : map_names)
-        text << "\t.include \"" << include_path << "/" << map_name << "/events.inc\"\n";
-
-    return text.str();
+size_t connection_rank(const RankIndex &ranks, const JsonValue &map_name) {
+    if (!map_name.is_string())
+        return numeric_limits<size_t>::max();
+    JsonString name = map_name.string_value();
+    auto it = ranks.find(StringRef{name.data(), name.size()});
+    return it != ranks.end() ? it->second : numeric_limits<size_t>::max();
 }
 
-string generate_map_constants_text(string groups_filepath, Json groups_data) {
+struct GroupsText {
+    TextBuffer groups;
+    TextBuffer connections;
+    TextBuffer headers;
+    TextBuffer events;
+    TextBuffer constants;
+};
+
+// Each map's parsed map.json, by the map's name.
+typedef unordered_map<string, const JsonValue *> MapRoots;
+
+// Generates groups.inc, connections.inc, headers.inc, events.inc and map_groups.h
+// in a single pass over the groups. The map ids come from map_roots when it has
+// already parsed a map, or else from the map's map.json.
+void generate_groups_files(GroupsText &out, const string &groups_filepath, const JsonValue &groups_data, const string &include_path, const MapRoots *map_roots = nullptr) {
+    const JsonValue::Array group_order = json_field(groups_data, "group_order").array_items();
     string file_dir = file_parent(groups_filepath) + sep;
 
-    ostringstream text;
+    out.groups << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
+    out.connections << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
+    out.headers << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n@\n\n";
+    out.events << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from " << include_path << "/map_groups.json\n@\n\n";
 
-    text << "#ifndef GUARD_CONSTANTS_MAP_GROUPS_H\n"
-         << "#define GUARD_CONSTANTS_MAP_GROUPS_H\n\n";
+    out.constants << "#ifndef GUARD_CONSTANTS_MAP_GROUPS_H\n"
+                  << "#define GUARD_CONSTANTS_MAP_GROUPS_H\n\n";
 
-    text << "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n//\n\n";
+    out.constants << "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from data/maps/map_groups.json\n//\n\n";
 
+    vector<const JsonValue *> connection_maps;
+    vector<string> map_ids;
     int group_num = 0;
 
-    for (auto &group : groups_data["group_order"].array_items()) {
-        string groupName = json_to_string(group);
-        text << "// " << groupName << "\n";
-        vector<string> map_ids;
+    for (auto &key : group_order) {
+        JsonText group = json_text(key);
+        out.groups << group << "::\n";
+        out.constants << "// " << group << "\n";
+        map_ids.clear();
         size_t max_length = 0;
 
-        for (auto &map_name : groups_data[groupName].array_items()) {
-            string map_filepath = file_dir + json_to_string(map_name) + sep + "map.json";
-            string err_str;
-            Json map_data = Json::parse(read_text_file(map_filepath), err_str);
-            if (map_data == Json())
-                FATAL_ERROR("%s: %s\n", map_filepath.c_str(), err_str.c_str());
-            string id = json_to_string(map_data, "id", true);
-            map_ids.push_back(id);
-            if (id.length() > max_length)
-                max_length = id.length();
+        for (auto &map_name_value : json_field(groups_data, group).array_items()) {
+            JsonText map_name = json_text(map_name_value);
+            out.groups << "\t.4byte " << map_name << "\n";
+            out.headers << "\t.include \"" << include_path << "/" << map_name << "/header.inc\"\n";
+            out.events << "\t.include \"" << include_path << "/" << map_name << "/events.inc\"\n";
+            connection_maps.push_back(&map_name_value);
+
+            auto root = map_roots ? map_roots->find(map_name.to_string()) : MapRoots::const_iterator();
+            if (map_roots && root != map_roots->end()) {
+                map_ids.push_back(json_text(*root->second, "id", true).to_string());
+            } else {
+                string map_filepath = file_dir + map_name.to_string() + sep + "map.json";
+                JsonDocument map_doc;
+                read_json_file(map_doc, map_filepath);
+                map_ids.push_back(json_text(map_doc.root(), "id", true).to_string());
+            }
+            if (map_ids.back().length() > max_length)
+                max_length = map_ids.back().length();
         }
+        out.groups << "\n";
 
         int map_id_num = 0;
-        for (string map_id : map_ids) {
-            text << "#define " << map_id << string((max_length - map_id.length() + 1), ' ')
-                 << "(" << map_id_num++ << " | (" << group_num << " << 8))\n";
+        for (const string &map_id : map_ids) {
+            out.constants << "#define " << map_id;
+            out.constants.pad(max_length - map_id.length() + 1)
+                          << "(" << map_id_num++ << " | (" << group_num << " << 8))\n";
         }
-        text << "\n";
+        out.constants << "\n";
 
         group_num++;
     }
 
-    text << "#define MAP_GROUPS_COUNT " << group_num << "\n\n";
-    text << "#endif // GUARD_CONSTANTS_MAP_GROUPS_H\n";
+    out.groups << "\t.align 2\n" << "gMapGroups::\n";
+    for (auto &group : group_order)
+        out.groups << "\t.4byte " << json_text(group) << "\n";
+    out.groups << "\n";
+
+    out.constants << "#define MAP_GROUPS_COUNT " << group_num << "\n\n";
+    out.constants << "#endif // GUARD_CONSTANTS_MAP_GROUPS_H\n";
+
+    // Maps missing from connections_include_order all rank last. The ranks are
+    // looked up once instead of searching the list on every comparison.
+    const JsonValue::Array connections_include_order = json_field(groups_data, "connections_include_order").array_items();
+
+    if (connections_include_order.size() > 0) {
+        RankIndex ranks = build_rank_index(connections_include_order);
+        vector<std::pair<size_t, const JsonValue *>> ranked;
+        ranked.reserve(connection_maps.size());
+        for (const JsonValue *map_name : connection_maps)
+            ranked.emplace_back(connection_rank(ranks, *map_name), map_name);
+        sort(ranked.begin(), ranked.end(), [](const std::pair<size_t, const JsonValue *> &a, const std::pair<size_t, const JsonValue *> &b) {
+            return a.first < b.first;
+        });
+        for (size_t i = 0; i < ranked.size(); i++)
+            connection_maps[i] = ranked[i].second;
+    }
 
-    return text.str();
+    for (const JsonValue *map_name : connection_maps)
+        out.connections << "\t.include \"" << include_path << "/" << json_text(*map_name) << "/connections.inc\"\n";
+}
+
+// Where each of the groups files goes, given output directories without trailing separators.
+vector<GeneratedFile> groups_output_files(const GroupsText &out, const string &output_asm, const string &output_c) {
+    return {
+        { output_asm + sep + "groups.inc", out.groups.str() },
+        { output_asm + sep + "connections.inc", out.connections.str() },
+        { output_asm + sep + "headers.inc", out.headers.str() },
+        { output_asm + sep + "events.inc", out.events.str() },
+        { output_c + sep + "map_groups.h", out.constants.str() },
+    };
 }
 
 // Output paths are directories with trailing path separators
@@ -508,112 +849,841 @@ void process_groups(string groups_filepath, string output_asm, string output_c)
     output_asm = strip_trailing_separator(output_asm); // Remove separator if existing.
     output_c = strip_trailing_separator(output_c);
 
-    string err;
-    Json groups_data = Json::parse(read_text_file(groups_filepath), err);
-
-    if (groups_data == Json())
-        FATAL_ERROR("%s\n", err.c_str());
+    JsonDocument groups_doc;
+    read_json_file(groups_doc, groups_filepath);
+    const JsonValue &groups_data = groups_doc.root();
 
-    string groups_text = generate_groups_text(groups_data);
-    string connections_text = generate_connections_text(groups_data, output_asm);
-    string headers_text = generate_headers_text(groups_data, output_asm);
-    string events_text = generate_events_text(groups_data, output_asm);
-    string map_header_text = generate_map_constants_text(groups_filepath, groups_data);
+    GroupsText out;
+    generate_groups_files(out, groups_filepath, groups_data, output_asm);
 
-    write_text_file(output_asm + sep + "groups.inc", groups_text);
-    write_text_file(output_asm + sep + "connections.inc", connections_text);
-    write_text_file(output_asm + sep + "headers.inc", headers_text);
-    write_text_file(output_asm + sep + "events.inc", events_text);
-    write_text_file(output_c + sep + "map_groups.h", map_header_text);
+    for (const GeneratedFile &file : groups_output_files(out, output_asm, output_c))
+        write_text_file(file.filepath, file.text);
 }
 
-string generate_layout_headers_text(Json layouts_data) {
-    ostringstream text;
-
+// compression is empty for raw blockdata, or the extension ("lz" or "rl") of the
+// compressed copies that gbagfx makes next to each map.bin. Those begin with the
+// BIOS header (format in bits 4-7, decompressed size in bits 8-31) and must be
+// word-aligned for the BIOS to read them.
+void generate_layout_headers_text(TextBuffer &text, const JsonValue &layouts_data, const string &compression) {
     text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/layouts/layouts.json\n@\n\n";
 
-    for (auto &layout : layouts_data["layouts"].array_items()) {
-        if (layout == Json::object()) continue;
-        string layoutName = json_to_string(layout, "name");
-        string border_label = layoutName + "_Border";
-        string blockdata_label = layoutName + "_Blockdata";
-        text << border_label << "::\n"
-             << "\t.incbin \"" << json_to_string(layout, "border_filepath") << "\"\n\n"
-             << blockdata_label << "::\n"
-             << "\t.incbin \"" << json_to_string(layout, "blockdata_filepath") << "\"\n\n"
-             << "\t.align 2\n"
+    for (auto &layout : json_field(layouts_data, "layouts").array_items()) {
+        if (is_empty_object(layout)) continue;
+        JsonText layoutName = json_text(layout, "name");
+        text << layoutName << "_Border::\n"
+             << "\t.incbin \"" << json_text(layout, "border_filepath") << "\"\n\n";
+        if (compression.empty()) {
+            text << layoutName << "_Blockdata::\n"
+                 << "\t.incbin \"" << json_text(layout, "blockdata_filepath") << "\"\n\n";
+        } else {
+            text << "\t.align 2\n"
+                 << layoutName << "_Blockdata::\n"
+                 << "\t.incbin \"" << json_text(layout, "blockdata_filepath") << "." << compression << "\"\n\n";
+        }
+        text << "\t.align 2\n"
              << layoutName << "::\n"
-             << "\t.4byte " << json_to_string(layout, "width") << "\n"
-             << "\t.4byte " << json_to_string(layout, "height") << "\n"
-             << "\t.4byte " << border_label << "\n"
-             << "\t.4byte " << blockdata_label << "\n"
-             << "\t.4byte " << json_to_string(layout, "primary_tileset") << "\n"
-             << "\t.4byte " << json_to_string(layout, "secondary_tileset") << "\n";
+             << "\t.4byte " << json_text(layout, "width") << "\n"
+             << "\t.4byte " << json_text(layout, "height") << "\n"
+             << "\t.4byte " << layoutName << "_Border\n"
+             << "\t.4byte " << layoutName << "_Blockdata\n"
+             << "\t.4byte " << json_text(layout, "primary_tileset") << "\n"
+             << "\t.4byte " << json_text(layout, "secondary_tileset") << "\n";
         if (version == "firered") {
-            text << "\t.byte " << json_to_string(layout, "border_width") << "\n"
-                 << "\t.byte " << json_to_string(layout, "border_height") << "\n"
+            text << "\t.byte " << json_text(layout, "border_width") << "\n"
+                 << "\t.byte " << json_text(layout, "border_height") << "\n"
                  << "\t.2byte 0\n";
         }
         text << "\n";
     }
-
-    return text.str();
 }
 
-string generate_layouts_table_text(Json layouts_data) {
-    ostringstream text;
-
+void generate_layouts_table_text(TextBuffer &text, const JsonValue &layouts_data) {
     text << "@\n@ DO NOT MODIFY THIS FILE! It is auto-generated from data/layouts/layouts.json\n@\n\n";
 
     text << "\t.align 2\n"
-         << json_to_string(layouts_data, "layouts_table_label") << "::\n";
-
-    for (auto &layout : layouts_data["layouts"].array_items()) {
-        string layout_name = json_to_string(layout, "name", true);
-        if (layout_name.empty()) layout_name = "NULL";
-        text << "\t.4byte " << layout_name << "\n";
+         << json_text(layouts_data, "layouts_table_label") << "::\n";
+
+    for (auto &layout : json_field(layouts_data, "layouts").array_items()) {
+        JsonText layout_name = json_text(layout, "name", true);
+        if (layout_name.empty())
+            text << "\t.4byte NULL\n";
+        else
+            text << "\t.4byte " << layout_name << "\n";
     }
-
-    return text.str();
 }
 
-string generate_layouts_constants_text(Json layouts_data) {
-    ostringstream text;
-
+void generate_layouts_constants_text(TextBuffer &text, const JsonValue &layouts_data) {
     text << "#ifndef GUARD_CONSTANTS_LAYOUTS_H\n"
          << "#define GUARD_CONSTANTS_LAYOUTS_H\n\n";
 
     text << "//\n// DO NOT MODIFY THIS FILE! It is auto-generated from data/layouts/layouts.json\n//\n\n";
 
     int i = 1;
-    for (auto &layout : layouts_data["layouts"].array_items()) {
-        if (layout != Json::object())
-            text << "#define " << json_to_string(layout, "id") << " " << i << "\n";
+    for (auto &layout : json_field(layouts_data, "layouts").array_items()) {
+        if (!is_empty_object(layout))
+            text << "#define " << json_text(layout, "id") << " " << i << "\n";
         i++;
     }
 
     text << "\n#endif // GUARD_CONSTANTS_LAYOUTS_H\n";
+}
+
+// The buffers of the map loader in fieldmap.c: gBackupMapData holds MAX_MAP_DATA_SIZE
+// blocks, and compressed blockdata is decompressed into gDecompressionBuffer.
+const size_t virtual_map_size = 0x2800;
+const size_t decompression_buffer_size = 0x4000;
+const int map_offset = 7;
 
-    return text.str();
+// The size of a file in bytes, and its first four bytes as a little-endian word.
+size_t read_file_size_and_header(const string &filepath, uint32_t &header) {
+    ifstream in_file(filepath, std::ifstream::binary);
+
+    if (!in_file.is_open())
+        FATAL_ERROR("Cannot open file %s for reading.\n", filepath.c_str());
+
+    unsigned char bytes[4] = {};
+    in_file.read(reinterpret_cast<char *>(bytes), sizeof(bytes));
+    header = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+
+    in_file.seekg(0, std::ios::end);
+    return static_cast<size_t>(in_file.tellg());
+}
+
+// Checks that every compressed blockdata file has the header the loader in
+// fieldmap.c expects and prints how much ROM compression saves.
+void report_compressed_blockdata(const JsonValue &layouts_data, const string &compression) {
+    const uint32_t format = compression == "rl" ? 0x30 : 0x10;
+    size_t raw_total = 0, compressed_total = 0;
+    int num_layouts = 0;
+
+    for (auto &layout : json_field(layouts_data, "layouts").array_items()) {
+        if (is_empty_object(layout)) continue;
+        string blockdata_filepath = json_field(layout, "blockdata_filepath").string_value().str();
+        string compressed_filepath = blockdata_filepath + "." + compression;
+        uint32_t header;
+        size_t raw_size = read_file_size_and_header(blockdata_filepath, header);
+        size_t compressed_size = read_file_size_and_header(compressed_filepath, header);
+        size_t map_size = 2 * json_field(layout, "width").int_value() * json_field(layout, "height").int_value();
+
+        // fieldmap.c decompresses the blockdata into gDecompressionBuffer.
+        if (map_size > decompression_buffer_size)
+            FATAL_ERROR("%s is %lu bytes decompressed, but the map loader only has room for %lu.\n",
+                        blockdata_filepath.c_str(), static_cast<unsigned long>(map_size),
+                        static_cast<unsigned long>(decompression_buffer_size));
+
+        if ((header & 0xF0) != format || (header >> 8) != map_size)
+            FATAL_ERROR("%s doesn't hold %lu bytes of %s-compressed blockdata.\n", compressed_filepath.c_str(),
+                        static_cast<unsigned long>(map_size), compression.c_str());
+
+        raw_total += raw_size;
+        compressed_total += (compressed_size + 3) & ~static_cast<size_t>(3);
+        num_layouts++;
+    }
+
+    fprintf(stderr, "mapjson: %d layouts' blockdata compressed from %lu to %lu bytes (%s), %ld bytes of ROM saved\n",
+            num_layouts, static_cast<unsigned long>(raw_total), static_cast<unsigned long>(compressed_total),
+            compression.c_str(), static_cast<long>(raw_total) - static_cast<long>(compressed_total));
 }
 
-void process_layouts(string layouts_filepath, string output_asm, string output_c) {
+// Output paths are directories with trailing path separators
+vector<GeneratedFile> generate_layouts_files(const JsonValue &layouts_data, const string &compression, const string &output_asm, const string &output_c) {
+    vector<GeneratedFile> files;
+    TextBuffer text;
+
+    if (!compression.empty())
+        report_compressed_blockdata(layouts_data, compression);
+
+    generate_layout_headers_text(text, layouts_data, compression);
+    files.push_back({ output_asm + "layouts.inc", text.str() });
+    text.clear();
+    generate_layouts_table_text(text, layouts_data);
+    files.push_back({ output_asm + "layouts_table.inc", text.str() });
+    text.clear();
+    generate_layouts_constants_text(text, layouts_data);
+    files.push_back({ output_c + "layouts.h", text.str() });
+
+    return files;
+}
+
+void process_layouts(string layouts_filepath, string output_asm, string output_c, const string &compression) {
     output_asm = strip_trailing_separator(output_asm).append(sep);
     output_c = strip_trailing_separator(output_c).append(sep);
 
-    string err;
-    Json layouts_data = Json::parse(read_text_file(layouts_filepath), err);
+    JsonDocument layouts_doc;
+    read_json_file(layouts_doc, layouts_filepath);
+
+    for (const GeneratedFile &file : generate_layouts_files(layouts_doc.root(), compression, output_asm, output_c))
+        write_text_file(file.filepath, file.text);
+}
+
+// A map, layout or other id, looked up by its name.
+typedef unordered_map<StringRef, size_t, StringRefHash> IdIndex;
+
+// The key for a string field, or an empty key if the field isn't a string.
+StringRef string_field(const JsonValue &data, const char *field) {
+    JsonString value = json_field(data, field).string_value();
+    return StringRef{value.data(), value.size()};
+}
 
-    if (layouts_data == Json())
-        FATAL_ERROR("%s\n", err.c_str());
+string ref_to_string(const StringRef &ref) {
+    return string(ref.str, ref.len);
+}
+
+struct MapEntry {
+    string name;
+    string filepath;
+    unique_ptr<JsonDocument> doc;
+};
+
+// Collects every problem found, so that they can all be reported at once.
+class ValidationReport {
+public:
+    void add(const string &filepath, const string &message) {
+        errors.push_back(filepath + ": " + message);
+    }
+
+    size_t size() const {
+        return errors.size();
+    }
+
+    void print() const {
+        for (const string &error : errors)
+            fprintf(stderr, "%s\n", error.c_str());
+    }
+
+private:
+    vector<string> errors;
+};
+
+bool is_warp_id_number(const JsonValue &value, long &warp_id) {
+    if (value.is_number()) {
+        warp_id = value.int_value();
+        return true;
+    }
 
-    string layout_headers_text = generate_layout_headers_text(layouts_data);
-    string layouts_table_text = generate_layouts_table_text(layouts_data);
-    string layouts_constants_text = generate_layouts_constants_text(layouts_data);
+    JsonString text = value.string_value();
+    if (text.empty())
+        return false;
 
-    write_text_file(output_asm + "layouts.inc", layout_headers_text);
-    write_text_file(output_asm + "layouts_table.inc", layouts_table_text);
-    write_text_file(output_c + "layouts.h", layouts_constants_text);
+    warp_id = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text.data()[i] < '0' || text.data()[i] > '9')
+            return false;
+        warp_id = warp_id * 10 + (text.data()[i] - '0');
+    }
+
+    return true;
+}
+
+// Indexes every layout in layouts.json and every map in map_groups.json, then
+// resolves each map's layout, warps, connections and shared maps against the
+// indexes. Returns the number of problems found, all of which are printed.
+size_t validate_map_data(string groups_filepath, string layouts_filepath) {
+    ValidationReport report;
+
+    JsonDocument layouts_doc;
+    read_json_file(layouts_doc, layouts_filepath);
+    const JsonValue::Array layouts = json_field(layouts_doc.root(), "layouts").array_items();
+
+    IdIndex layout_ids;
+    IdIndex layout_names;
+    size_t num_layouts = 0;
+
+    for (size_t i = 0; i < layouts.size(); i++) {
+        const JsonValue &layout = layouts[i];
+        if (is_empty_object(layout))
+            continue;
+
+        string where = layouts_filepath + " (layout " + std::to_string(i) + ")";
+        StringRef id = string_field(layout, "id");
+        StringRef name = string_field(layout, "name");
+
+        if (id.len == 0) {
+            report.add(where, "layout has no id");
+        } else {
+            auto inserted = layout_ids.emplace(id, i);
+            if (!inserted.second)
+                report.add(where, "duplicate layout id " + ref_to_string(id) + " (also layout " + std::to_string(inserted.first->second) + ")");
+        }
+
+        if (name.len == 0) {
+            report.add(where, "layout has no name");
+        } else {
+            auto inserted = layout_names.emplace(name, i);
+            if (!inserted.second)
+                report.add(where, "duplicate layout name " + ref_to_string(name) + " (also layout " + std::to_string(inserted.first->second) + ")");
+        }
+
+        num_layouts++;
+    }
+
+    JsonDocument groups_doc;
+    read_json_file(groups_doc, groups_filepath);
+    const JsonValue &groups_data = groups_doc.root();
+    string file_dir = file_parent(groups_filepath);
+
+    vector<MapEntry> maps;
+    IdIndex map_names;
+    IdIndex map_ids;
+
+    for (auto &group_value : json_field(groups_data, "group_order").array_items()) {
+        JsonText group = json_text(group_value, nullptr, true);
+        const JsonValue &group_maps = json_field(groups_data, group);
+
+        if (!group_maps.is_array()) {
+            report.add(groups_filepath, "group " + group.to_string() + " in group_order has no list of maps");
+            continue;
+        }
+
+        for (auto &map_name_value : group_maps.array_items()) {
+            JsonString map_name = map_name_value.string_value();
+            if (map_name.empty()) {
+                report.add(groups_filepath, "group " + group.to_string() + " has a map without a name");
+                continue;
+            }
+
+            MapEntry entry;
+            entry.name = map_name.str();
+            entry.filepath = file_dir + entry.name + sep + "map.json";
+
+            if (!map_names.emplace(StringRef{map_name.data(), map_name.size()}, maps.size()).second) {
+                report.add(groups_filepath, "map " + entry.name + " is listed more than once");
+                continue;
+            }
+
+            if (!ifstream(entry.filepath).is_open()) {
+                report.add(groups_filepath, "map " + entry.name + " has no " + entry.filepath);
+                maps.push_back(std::move(entry));
+                continue;
+            }
+
+            entry.doc.reset(new JsonDocument);
+            string err;
+            if (!entry.doc->parse(read_text_file(entry.filepath), err)) {
+                report.add(entry.filepath, err);
+                entry.doc.reset();
+            }
+
+            maps.push_back(std::move(entry));
+        }
+    }
+
+    // Map ids are only known once every map has been read.
+    for (size_t i = 0; i < maps.size(); i++) {
+        if (!maps[i].doc)
+            continue;
+        const JsonValue &map_data = maps[i].doc->root();
+        StringRef id = string_field(map_data, "id");
+
+        if (id.len == 0) {
+            report.add(maps[i].filepath, "map has no id");
+            continue;
+        }
+
+        auto inserted = map_ids.emplace(id, i);
+        if (!inserted.second)
+            report.add(maps[i].filepath, "duplicate map id " + ref_to_string(id) + " (also in " + maps[inserted.first->second].filepath + ")");
+    }
+
+    size_t num_warps = 0;
+    size_t num_connections = 0;
+
+    for (const MapEntry &entry : maps) {
+        if (!entry.doc)
+            continue;
+        const JsonValue &map_data = entry.doc->root();
+        const string &where = entry.filepath;
+
+        StringRef name = string_field(map_data, "name");
+        if (ref_to_string(name) != entry.name)
+            report.add(where, "name " + ref_to_string(name) + " doesn't match " + entry.name + " in " + groups_filepath);
+
+        StringRef layout = string_field(map_data, "layout");
+        if (layout_ids.find(layout) == layout_ids.end())
+            report.add(where, "unknown layout " + json_text(map_data, "layout", true).to_string());
+
+        static const char *const shared_fields[] = { "shared_events_map", "shared_scripts_map" };
+        for (const char *field : shared_fields) {
+            if (has_field(map_data, field) && map_names.find(string_field(map_data, field)) == map_names.end())
+                report.add(where, string(field) + " refers to unknown map " + json_text(map_data, field, true).to_string());
+        }
+
+        const JsonValue::Array warps = json_field(map_data, "warp_events").array_items();
+        for (size_t i = 0; i < warps.size(); i++) {
+            const JsonValue &warp = warps[i];
+            string warp_desc = "warp " + std::to_string(i);
+            StringRef dest_map = string_field(warp, "dest_map");
+            num_warps++;
+
+            if (ref_to_string(dest_map) == "MAP_DYNAMIC" || ref_to_string(dest_map) == "MAP_UNDEFINED")
+                continue;
+
+            auto dest = map_ids.find(dest_map);
+            if (dest == map_ids.end()) {
+                report.add(where, warp_desc + " goes to unknown map " + json_text(warp, "dest_map", true).to_string());
+                continue;
+            }
+
+            // Warp ids given as constants are left to the assembler.
+            long warp_id;
+            const MapEntry &dest_entry = maps[dest->second];
+            if (is_warp_id_number(json_field(warp, "dest_warp_id"), warp_id)) {
+                size_t num_dest_warps = json_field(dest_entry.doc->root(), "warp_events").array_items().size();
+                if (warp_id < 0 || static_cast<size_t>(warp_id) >= num_dest_warps)
+                    report.add(where, warp_desc + " goes to warp " + std::to_string(warp_id) + " of " + ref_to_string(dest_map)
+                                      + ", which has " + std::to_string(num_dest_warps) + " warps");
+            }
+        }
+
+        const JsonValue::Array connections = json_field(map_data, "connections").array_items();
+        for (size_t i = 0; i < connections.size(); i++) {
+            const JsonValue &connection = connections[i];
+            string connection_desc = "connection " + std::to_string(i);
+            num_connections++;
+
+            if (map_ids.find(string_field(connection, "map")) == map_ids.end())
+                report.add(where, connection_desc + " goes to unknown map " + json_text(connection, "map", true).to_string());
+
+            static const char *const directions[] = { "up", "down", "left", "right", "dive", "emerge" };
+            JsonText direction = json_text(connection, "direction", true);
+            bool valid_direction = false;
+            for (const char *valid : directions)
+                valid_direction = valid_direction || direction == valid;
+            if (!valid_direction)
+                report.add(where, connection_desc + " has unknown direction " + direction.to_string());
+        }
+    }
+
+    for (auto &map_name : json_field(groups_data, "connections_include_order").array_items()) {
+        JsonString name = map_name.string_value();
+        if (map_names.find(StringRef{name.data(), name.size()}) == map_names.end())
+            report.add(groups_filepath, "connections_include_order lists unknown map " + json_text(map_name, nullptr, true).to_string());
+    }
+
+    report.print();
+
+    if (report.size() == 0)
+        cout << "mapjson: " << maps.size() << " maps, " << num_layouts << " layouts, " << num_warps << " warps and "
+             << num_connections << " connections checked" << endl;
+
+    return report.size();
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Does the work of the layouts, groups and maps modes in one process. The maps
+// are the ones listed in map_groups.json, and each map.json is parsed only once
+// for both its own files and map_groups.h. Reading, generating and writing each
+// run as tasks on a TaskPool, and the time each phase took is printed.
+void process_all(string groups_filepath, string layouts_filepath, string maps_asm_dir, string layouts_asm_dir, string output_c, const string &compression) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    maps_asm_dir = strip_trailing_separator(maps_asm_dir);
+    layouts_asm_dir = strip_trailing_separator(layouts_asm_dir).append(sep);
+    output_c = strip_trailing_separator(output_c);
+
+    TaskPool pool;
+    JsonDocument layouts_doc;
+    JsonDocument groups_doc;
+
+    pool.add([&]() { read_json_file(layouts_doc, layouts_filepath); });
+    pool.add([&]() { read_json_file(groups_doc, groups_filepath); });
+    pool.run();
+
+    const JsonValue &layouts_data = layouts_doc.root();
+    const JsonValue &groups_data = groups_doc.root();
+    string file_dir = file_parent(groups_filepath);
+
+    vector<MapEntry> maps;
+    unordered_set<string> map_names;
+
+    for (auto &group : json_field(groups_data, "group_order").array_items()) {
+        for (auto &map_name : json_field(groups_data, json_text(group)).array_items()) {
+            MapEntry entry;
+            entry.name = json_text(map_name).to_string();
+            // A repeated map would otherwise have its files written twice at once.
+            if (!map_names.insert(entry.name).second)
+                continue;
+            entry.filepath = file_dir + entry.name + sep + "map.json";
+            entry.doc.reset(new JsonDocument);
+            maps.push_back(std::move(entry));
+        }
+    }
+
+    for (const MapEntry &entry : maps)
+        pool.add([&]() { read_json_file(*entry.doc, entry.filepath); });
+    pool.run();
+
+    Clock::time_point read_done = Clock::now();
+
+    const LayoutIndex layout_index = build_layout_index(layouts_data);
+    MapRoots map_roots;
+    for (const MapEntry &entry : maps)
+        map_roots.emplace(entry.name, &entry.doc->root());
+
+    // Each task fills its own slot, so the files come out in a fixed order.
+    vector<vector<GeneratedFile>> outputs(maps.size() + 2);
+
+    pool.add([&]() {
+        outputs[0] = generate_layouts_files(layouts_data, compression, layouts_asm_dir, output_c + sep);
+    });
+    pool.add([&]() {
+        GroupsText out;
+        generate_groups_files(out, groups_filepath, groups_data, maps_asm_dir, &map_roots);
+        outputs[1] = groups_output_files(out, maps_asm_dir, output_c);
+    });
+    for (size_t i = 0; i < maps.size(); i++) {
+        pool.add([&, i]() {
+            thread_local TextBuffer text;
+            string out_dir = file_parent(maps[i].filepath);
+            generate_map_texts(maps[i].doc->root(), layout_index, text, [&](const char *filename) {
+                outputs[i + 2].push_back({ out_dir + filename, text.str() });
+            });
+        });
+    }
+    pool.run();
+
+    Clock::time_point generate_done = Clock::now();
+
+    OutputWriter writer;
+    for (const vector<GeneratedFile> &files : outputs)
+        for (const GeneratedFile &file : files)
+            pool.add([&]() { writer.write(file); });
+    pool.run();
+
+    Clock::time_point write_done = Clock::now();
+
+    cout << "mapjson: " << maps.size() << " maps, " << json_field(layouts_data, "layouts").array_items().size() << " layouts, "
+         << writer.changed() << " of " << writer.files() << " files updated" << endl;
+    printf("mapjson: read %.1f ms, generate %.1f ms, write %.1f ms, total %.1f ms\n",
+            elapsed_ms(start, read_done), elapsed_ms(read_done, generate_done),
+            elapsed_ms(generate_done, write_done), elapsed_ms(start, write_done));
+}
+
+string read_binary_file(const string &filepath) {
+    ifstream in_file(filepath, std::ifstream::binary);
+
+    if (!in_file.is_open())
+        FATAL_ERROR("Cannot open file %s for reading.\n", filepath.c_str());
+
+    string data;
+    in_file.seekg(0, std::ios::end);
+    data.resize(in_file.tellg());
+    in_file.seekg(0, std::ios::beg);
+    in_file.read(&data[0], data.size());
+
+    return data;
+}
+
+// LZ77UnCompWram and RLUnCompWram. Both return the size from the header.
+size_t bios_lz_decompress(const unsigned char *src, unsigned char *dest) {
+    size_t size = (src[1] | (src[2] << 8) | (src[3] << 16));
+    size_t pos = 0;
+
+    src += 4;
+    while (pos < size) {
+        unsigned flags = *src++;
+        for (int i = 0; i < 8 && pos < size; i++, flags <<= 1) {
+            if (flags & 0x80) {
+                size_t length = (src[0] >> 4) + 3;
+                size_t distance = (((src[0] & 0xF) << 8) | src[1]) + 1;
+                src += 2;
+                for (; length > 0 && pos < size; length--, pos++)
+                    dest[pos] = dest[pos - distance];
+            } else {
+                dest[pos++] = *src++;
+            }
+        }
+    }
+
+    return size;
+}
+
+size_t bios_rl_decompress(const unsigned char *src, unsigned char *dest) {
+    size_t size = (src[1] | (src[2] << 8) | (src[3] << 16));
+    size_t pos = 0;
+
+    src += 4;
+    while (pos < size) {
+        unsigned flag = *src++;
+        if (flag & 0x80) {
+            size_t length = (flag & 0x7F) + 3;
+            memset(dest + pos, *src++, length);
+            pos += length;
+        } else {
+            size_t length = (flag & 0x7F) + 1;
+            memcpy(dest + pos, src, length);
+            src += length;
+            pos += length;
+        }
+    }
+
+    return size;
+}
+
+struct LoadCostLayout {
+    string name;
+    int width;
+    int height;
+    string blockdata;
+};
+
+struct LoadCostConnection {
+    int direction;
+    int offset;
+    const LoadCostLayout *layout;
+};
+
+enum { CONNECTION_SOUTH = 1, CONNECTION_NORTH, CONNECTION_WEST, CONNECTION_EAST };
+
+struct LoadCostMap {
+    string name;
+    const LoadCostLayout *layout;
+    vector<LoadCostConnection> connections;
+};
+
+// The work of one map load, summed over however many are added.
+struct LoadCost {
+    size_t decompressions = 0;
+    size_t reused = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+    size_t blocks_copied = 0;
+};
+
+// Replays InitMapLayoutData: fill the map buffer, get the map's blockdata, copy it in,
+// then copy a strip of each connected map in through FillConnection.
+class MapLoader {
+public:
+    MapLoader(bool compressed) : compressed(compressed), vmap(virtual_map_size), buffer(decompression_buffer_size) {}
+
+    void load(const LoadCostMap &map, LoadCost &cost) {
+        const LoadCostLayout &layout = *map.layout;
+
+        std::fill(vmap.begin(), vmap.end(), 0x3FF);
+        xsize = layout.width + map_offset * 2 + 1;
+        ysize = layout.height + map_offset * 2;
+
+        const uint16_t *src = blockdata(layout, cost);
+        uint16_t *dest = &vmap[xsize * map_offset + map_offset];
+        for (int y = 0; y < layout.height; y++) {
+            memcpy(dest, src, layout.width * 2);
+            dest += xsize;
+            src += layout.width;
+        }
+        cost.blocks_copied += layout.width * layout.height;
+
+        // Connections start from a buffer that holds the map itself.
+        connected = &layout;
+        for (const LoadCostConnection &connection : map.connections)
+            fill_connection(layout, connection, cost);
+    }
+
+private:
+    const uint16_t *blockdata(const LoadCostLayout &layout, LoadCost &cost) {
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(layout.blockdata.data());
+
+        if (!compressed)
+            return reinterpret_cast<const uint16_t *>(data);
+
+        cost.decompressions++;
+        cost.bytes_read += layout.blockdata.size();
+        if ((data[0] & 0xF0) == 0x30)
+            cost.bytes_written += bios_rl_decompress(data, buffer.data());
+        else
+            cost.bytes_written += bios_lz_decompress(data, buffer.data());
+        return reinterpret_cast<const uint16_t *>(buffer.data());
+    }
+
+    const uint16_t *connected_blockdata(const LoadCostLayout &layout, LoadCost &cost) {
+        if (compressed && connected == &layout) {
+            cost.reused++;
+            return reinterpret_cast<const uint16_t *>(buffer.data());
+        }
+        connected = &layout;
+        return blockdata(layout, cost);
+    }
+
+    void fill_connection(const LoadCostLayout &layout, const LoadCostConnection &connection, LoadCost &cost) {
+        int c_width = connection.layout->width;
+        int c_height = connection.layout->height;
+        int x = 0, y = 0, x2 = 0, y2 = 0, width = 0, height = 0;
+
+        switch (connection.direction) {
+        case CONNECTION_SOUTH:
+        case CONNECTION_NORTH:
+            x = connection.offset + map_offset;
+            y = connection.direction == CONNECTION_SOUTH ? layout.height + map_offset : 0;
+            y2 = connection.direction == CONNECTION_SOUTH ? 0 : c_height - map_offset;
+            if (x < 0) {
+                x2 = -x;
+                x += c_width;
+                width = x < xsize ? x : xsize;
+                x = 0;
+            } else {
+                width = x + c_width < xsize ? c_width : xsize - x;
+            }
+            height = map_offset;
+            break;
+        case CONNECTION_WEST:
+        case CONNECTION_EAST:
+            x = connection.direction == CONNECTION_EAST ? layout.width + map_offset : 0;
+            x2 = connection.direction == CONNECTION_EAST ? 0 : c_width - map_offset;
+            y = connection.offset + map_offset;
+            if (y < 0) {
+                y2 = -y;
+                height = y + c_height < ysize ? y + c_height : ysize;
+                y = 0;
+            } else {
+                height = y + c_height < ysize ? c_height : ysize - y;
+            }
+            width = connection.direction == CONNECTION_EAST ? map_offset + 1 : map_offset;
+            break;
+        }
+
+        const uint16_t *src = connected_blockdata(*connection.layout, cost) + c_width * y2 + x2;
+        uint16_t *dest = &vmap[xsize * y + x];
+        for (int i = 0; i < height; i++) {
+            memcpy(dest, src, width * 2);
+            dest += xsize;
+            src += c_width;
+        }
+        cost.blocks_copied += width * height;
+    }
+
+    bool compressed;
+    vector<uint16_t> vmap;
+    vector<unsigned char> buffer;
+    const LoadCostLayout *connected = nullptr;
+    int xsize = 0;
+    int ysize = 0;
+};
+
+// A host-side harness for MAP_BLOCKDATA_COMPRESSION. For every map in map_groups.json
+// it replays the loader's blockdata work with raw, LZ and RL blockdata (the .lz and
+// .rl copies gbagfx makes next to each map.bin), and prints the ROM they take, the
+// decompression work per load and the host time per load. Each map's time is the
+// fastest of several runs.
+void process_load_cost(string groups_filepath, string layouts_filepath) {
+    typedef std::chrono::steady_clock Clock;
+    static const char *const codecs[] = { "none", "lz", "rl" };
+    const int runs = 20;
+
+    JsonDocument layouts_doc;
+    read_json_file(layouts_doc, layouts_filepath);
+    JsonDocument groups_doc;
+    read_json_file(groups_doc, groups_filepath);
+    string file_dir = file_parent(groups_filepath);
+
+    vector<MapEntry> entries;
+    for (auto &group : json_field(groups_doc.root(), "group_order").array_items()) {
+        for (auto &map_name : json_field(groups_doc.root(), json_text(group)).array_items()) {
+            MapEntry entry;
+            entry.name = json_text(map_name).to_string();
+            entry.filepath = file_dir + entry.name + sep + "map.json";
+            entry.doc.reset(new JsonDocument);
+            read_json_file(*entry.doc, entry.filepath);
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    const LayoutIndex layout_index = build_layout_index(layouts_doc.root());
+    unordered_map<string, const MapEntry *> maps_by_id;
+    for (const MapEntry &entry : entries)
+        maps_by_id[json_text(entry.doc->root(), "id").to_string()] = &entry;
+
+    cout << "mapjson: load cost of " << entries.size() << " maps (blockdata work in fieldmap.c, host time)\n"
+         << "codec\trom_bytes\tdecompressions/load\treused/load\tbytes_decompressed/load\tmean_us/load\tmax_us\tslowest_map\n";
+
+    for (const char *codec : codecs) {
+        bool compressed = strcmp(codec, "none") != 0;
+        unordered_map<const JsonValue *, unique_ptr<LoadCostLayout>> layouts;
+        size_t rom_bytes = 0;
+
+        auto get_layout = [&](const JsonValue &map_data) {
+            const JsonValue &layout_data = find_map_layout(map_data, layout_index);
+            unique_ptr<LoadCostLayout> &layout = layouts[&layout_data];
+            if (!layout) {
+                layout.reset(new LoadCostLayout);
+                layout->name = json_text(layout_data, "name").to_string();
+                layout->width = json_field(layout_data, "width").int_value();
+                layout->height = json_field(layout_data, "height").int_value();
+                string filepath = json_field(layout_data, "blockdata_filepath").string_value().str();
+                if (compressed)
+                    filepath += string(".") + codec;
+                layout->blockdata = read_binary_file(filepath);
+                if (static_cast<size_t>(layout->width * layout->height * 2) > decompression_buffer_size
+                 || static_cast<size_t>((layout->width + map_offset * 2 + 1) * (layout->height + map_offset * 2)) > virtual_map_size)
+                    FATAL_ERROR("%s is too large for the map loader.\n", layout->name.c_str());
+                rom_bytes += (layout->blockdata.size() + 3) & ~static_cast<size_t>(3);
+            }
+            return layout.get();
+        };
+
+        vector<LoadCostMap> maps;
+        for (const MapEntry &entry : entries) {
+            const JsonValue &map_data = entry.doc->root();
+            LoadCostMap map;
+            map.name = entry.name;
+            map.layout = get_layout(map_data);
+            if (json_text(map_data, "connections_no_include", true) != "TRUE") {
+                for (auto &connection_data : json_field(map_data, "connections").array_items()) {
+                    static const char *const directions[] = { "down", "up", "left", "right" };
+                    JsonText direction = json_text(connection_data, "direction");
+                    LoadCostConnection connection;
+                    connection.direction = 0;
+                    for (int i = 0; i < 4; i++)
+                        if (direction == directions[i])
+                            connection.direction = CONNECTION_SOUTH + i;
+                    auto connected = maps_by_id.find(json_text(connection_data, "map").to_string());
+                    // Dive and emerge connections aren't loaded with the map.
+                    if (connection.direction == 0 || connected == maps_by_id.end())
+                        continue;
+                    connection.offset = json_field(connection_data, "offset").int_value();
+                    connection.layout = get_layout(connected->second->doc->root());
+                    map.connections.push_back(connection);
+                }
+            }
+            maps.push_back(std::move(map));
+        }
+
+        MapLoader loader(compressed);
+        LoadCost total;
+        double total_us = 0, max_us = 0;
+        const LoadCostMap *slowest = nullptr;
+
+        for (const LoadCostMap &map : maps) {
+            double best_us = 0;
+            for (int run = 0; run < runs; run++) {
+                LoadCost cost;
+                Clock::time_point start = Clock::now();
+                loader.load(map, cost);
+                double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                if (run == 0 || us < best_us)
+                    best_us = us;
+                if (run == 0) {
+                    total.decompressions += cost.decompressions;
+                    total.reused += cost.reused;
+                    total.bytes_read += cost.bytes_read;
+                    total.bytes_written += cost.bytes_written;
+                    total.blocks_copied += cost.blocks_copied;
+                }
+            }
+            total_us += best_us;
+            if (best_us > max_us) {
+                max_us = best_us;
+                slowest = &map;
+            }
+        }
+
+        double num_maps = maps.size();
+        printf("%s\t%lu\t%.2f\t%.3f\t%.0f\t%.2f\t%.2f\t%s\n", codec, static_cast<unsigned long>(rom_bytes),
+               total.decompressions / num_maps, total.reused / num_maps, total.bytes_written / num_maps,
+               total_us / num_maps, max_us, slowest ? slowest->name.c_str() : "");
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -627,8 +1697,8 @@ int main(int argc, char *argv[]) {
 
     char *mode_arg = argv[1];
     string mode(mode_arg);
-    if (mode != "layouts" && mode != "map" && mode != "groups")
-        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', or 'groups'.\n");
+    if (mode != "layouts" && mode != "map" && mode != "maps" && mode != "groups" && mode != "validate" && mode != "all" && mode != "loadcost")
+        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', 'maps', 'groups', 'validate', 'all', or 'loadcost'.\n");
 
     if (mode == "map") {
         if (argc != 6)
@@ -641,6 +1711,16 @@ int main(int argc, char *argv[]) {
 
         process_map(filepath, layouts_filepath, output_dir);
     }
+    else if (mode == "maps") {
+        if (argc < 5)
+            FATAL_ERROR("USAGE: mapjson maps <game-version> <layouts_file> <map_file>...\n");
+
+        infer_separator(argv[3]);
+        string layouts_filepath(argv[3]);
+        vector<string> map_filepaths(argv + 4, argv + argc);
+
+        process_maps(layouts_filepath, map_filepaths);
+    }
     else if (mode == "groups") {
         if (argc != 6)
             FATAL_ERROR("USAGE: mapjson groups <game-version> <groups_file> <output_asm_dir> <output_c_dir>\n");
@@ -653,18 +1733,55 @@ int main(int argc, char *argv[]) {
         process_groups(filepath, output_asm, output_c);
     }
     else if (mode == "layouts") {
-        if (argc != 6)
-            FATAL_ERROR("USAGE: mapjson layouts <game-version> <layouts_file> <output_asm_dir> <output_c_dir>\n");
+        if (argc != 6 && argc != 7)
+            FATAL_ERROR("USAGE: mapjson layouts <game-version> <layouts_file> <output_asm_dir> <output_c_dir> [lz | rl]\n");
 
         infer_separator(argv[3]);
         string filepath(argv[3]);
         string output_asm(argv[4]);
         string output_c(argv[5]);
+        string compression(argc == 7 ? argv[6] : "");
+
+        if (!compression.empty() && compression != "lz" && compression != "rl")
+            FATAL_ERROR("ERROR: blockdata compression must be 'lz' or 'rl'.\n");
+
+        process_layouts(filepath, output_asm, output_c, compression);
+    }
+    else if (mode == "validate") {
+        if (argc != 5)
+            FATAL_ERROR("USAGE: mapjson validate <game-version> <groups_file> <layouts_file>\n");
+
+        infer_separator(argv[3]);
+        string groups_filepath(argv[3]);
+        string layouts_filepath(argv[4]);
 
-        process_layouts(filepath, output_asm, output_c);
+        size_t num_errors = validate_map_data(groups_filepath, layouts_filepath);
+        if (num_errors != 0)
+            FATAL_ERROR("mapjson: %lu problems found in map data.\n", static_cast<unsigned long>(num_errors));
+    }
+    else if (mode == "all") {
+        if (argc != 8 && argc != 9)
+            FATAL_ERROR("USAGE: mapjson all <game-version> <groups_file> <layouts_file> <maps_asm_dir> <layouts_asm_dir> <output_c_dir> [lz | rl]\n");
+
+        infer_separator(argv[3]);
+        string groups_filepath(argv[3]);
+        string layouts_filepath(argv[4]);
+        string compression(argc == 9 ? argv[8] : "");
+
+        if (!compression.empty() && compression != "lz" && compression != "rl")
+            FATAL_ERROR("ERROR: blockdata compression must be 'lz' or 'rl'.\n");
+
+        process_all(groups_filepath, layouts_filepath, argv[5], argv[6], argv[7], compression);
+    }
+    else if (mode == "loadcost") {
+        if (argc != 5)
+            FATAL_ERROR("USAGE: mapjson loadcost <game-version> <groups_file> <layouts_file>\n");
+
+        infer_separator(argv[3]);
+        process_load_cost(argv[3], argv[4]);
     }
     else {
-        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', or 'groups'.\n");
+        FATAL_ERROR("ERROR: <mode> must be 'layouts', 'map', 'maps', 'groups', 'validate', 'all', or 'loadcost'.\n");
     }
 
     return 0;
@@ -22,128 +22,286 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
+#include <unordered_map>
 #include <vector>
 #include "agb.h"
 #include "main.h"
 #include "midi.h"
+#include "error.h"
 #include "tables.h"
 
-int g_agbTrack;
-
-static std::string s_lastOpName;
-static int s_blockNum;
-static bool s_keepLastOpName;
-static int s_lastNote;
-static int s_lastVelocity;
-static bool s_noteChanged;
-static bool s_velocityChanged;
-static bool s_inPattern;
-static int s_extendedCommand;
-static int s_memaccOp;
-static int s_memaccParam1;
-static int s_memaccParam2;
-
-void PrintAgbHeader()
+// Values of the MPlayDef.s symbols that the song data is written with.
+enum
 {
-    std::fprintf(g_outputFile, "\t.include \"MPlayDef.s\"\n\n");
-    std::fprintf(g_outputFile, "\t.equ\t%s_grp, voicegroup%03u\n", g_asmLabel.c_str(), g_voiceGroup);
-    std::fprintf(g_outputFile, "\t.equ\t%s_pri, %u\n", g_asmLabel.c_str(), g_priority);
+    W00 = 0x80,
+    FINE = 0xB1,
+    GOTO = 0xB2,
+    PATT = 0xB3,
+    PEND = 0xB4,
+    MEMACC = 0xB9,
+    PRIO = 0xBA,
+    TEMPO = 0xBB,
+    KEYSH = 0xBC,
+    VOICE = 0xBD,
+    VOL = 0xBE,
+    PAN = 0xBF,
+    BEND = 0xC0,
+    BENDR = 0xC1,
+    LFOS = 0xC2,
+    LFODL = 0xC3,
+    MOD = 0xC4,
+    MODT = 0xC5,
+    TUNE = 0xC8,
+    XCMD = 0xCD,
+    EOT = 0xCE,
+    TIE = 0xCF,
+    xIECV = 0x08,
+    xIECL = 0x09,
+    mxv = 0x7F,
+    reverb_set = 0x80,
+};
+
+static std::string FormatString(const char* format, std::va_list args)
+{
+    char buffer[256];
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+
+    if (length < 0 || (std::size_t)length >= sizeof(buffer))
+        RaiseError("symbol name is too long");
+
+    return std::string(buffer, length);
+}
+
+// Returns the index of the W?? or N?? command for a length.
+static int LengthIndex(int length)
+{
+    if (length < 0 || length > 96 || g_lengthIndexLUT[length] < 0)
+        RaiseError("no command for a length of %d", length);
+
+    return g_lengthIndexLUT[length];
+}
+
+void AgbWriter::Printf(const char* format, ...)
+{
+    std::va_list args;
+    va_start(args, format);
+    VPrintf(format, args);
+    va_end(args);
+}
+
+void AgbWriter::VPrintf(const char* format, std::va_list args)
+{
+    if (m_objectOutput)
+        return;
+
+    char buffer[256];
+    std::va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, argsCopy);
+    va_end(argsCopy);
+
+    if (length < 0)
+        return;
+
+    if ((std::size_t)length < sizeof(buffer))
+    {
+        m_output.append(buffer, length);
+    }
+    else
+    {
+        std::size_t start = m_output.size();
+        m_output.resize(start + length + 1);
+        std::vsnprintf(&m_output[start], length + 1, format, args);
+        m_output.resize(start + length);
+    }
+}
+
+void AgbWriter::EmitBytes(std::initializer_list<int> bytes)
+{
+    if (m_objectOutput)
+    {
+        for (int byte : bytes)
+            m_data.push_back(byte);
+    }
+}
+
+void AgbWriter::EmitWord(const std::string& symbol)
+{
+    if (m_objectOutput)
+    {
+        m_wordSymbols.emplace_back(m_data.size(), symbol);
+        m_data.resize(m_data.size() + 4);
+    }
+}
+
+// Words referring to the song's own labels are relocated against the section with
+// the label's offset stored in place, as as does. Anything else (the voicegroup)
+// is left to the linker as an undefined symbol.
+void AgbWriter::WriteObject()
+{
+    std::vector<ElfSymbol> symbols = m_labels;
+    std::vector<ElfRelocation> relocations;
+    std::unordered_map<std::string, std::uint32_t> labelOffsets;
+    std::unordered_map<std::string, int> externalSymbols;
+
+    for (const ElfSymbol& label : m_labels)
+        labelOffsets[label.name] = label.value;
+
+    for (const auto& word : m_wordSymbols)
+    {
+        std::uint32_t offset = word.first;
+        auto label = labelOffsets.find(word.second);
 
-    if (g_reverb >= 0)
-        std::fprintf(g_outputFile, "\t.equ\t%s_rev, reverb_set+%u\n", g_asmLabel.c_str(), g_reverb);
+        if (label != labelOffsets.end())
+        {
+            for (int i = 0; i < 4; i++)
+                m_data[offset + i] = label->second >> (8 * i);
+
+            relocations.push_back({ offset, -1 });
+        }
+        else
+        {
+            auto external = externalSymbols.find(word.second);
+
+            if (external == externalSymbols.end())
+            {
+                external = externalSymbols.emplace(word.second, symbols.size()).first;
+                symbols.push_back({ word.second, 0, true, false });
+            }
+
+            relocations.push_back({ offset, external->second });
+        }
+    }
+
+    m_output = BuildRodataObject(m_data, symbols, relocations);
+}
+
+void AgbWriter::PrintHeader()
+{
+    Printf("\t.include \"MPlayDef.s\"\n\n");
+    Printf("\t.equ\t%s_grp, voicegroup%03u\n", m_options.asmLabel.c_str(), m_options.voiceGroup);
+    Printf("\t.equ\t%s_pri, %u\n", m_options.asmLabel.c_str(), m_options.priority);
+
+    if (m_options.reverb >= 0)
+        Printf("\t.equ\t%s_rev, reverb_set+%u\n", m_options.asmLabel.c_str(), m_options.reverb);
     else
-        std::fprintf(g_outputFile, "\t.equ\t%s_rev, 0\n", g_asmLabel.c_str());
+        Printf("\t.equ\t%s_rev, 0\n", m_options.asmLabel.c_str());
 
-    std::fprintf(g_outputFile, "\t.equ\t%s_mvl, %u\n", g_asmLabel.c_str(), g_masterVolume);
-    std::fprintf(g_outputFile, "\t.equ\t%s_key, %u\n", g_asmLabel.c_str(), 0);
-    std::fprintf(g_outputFile, "\t.equ\t%s_tbs, %u\n", g_asmLabel.c_str(), g_clocksPerBeat);
-    std::fprintf(g_outputFile, "\t.equ\t%s_exg, %u\n", g_asmLabel.c_str(), g_exactGateTime);
-    std::fprintf(g_outputFile, "\t.equ\t%s_cmp, %u\n", g_asmLabel.c_str(), g_compressionEnabled);
+    Printf("\t.equ\t%s_mvl, %u\n", m_options.asmLabel.c_str(), m_options.masterVolume);
+    Printf("\t.equ\t%s_key, %u\n", m_options.asmLabel.c_str(), 0);
+    Printf("\t.equ\t%s_tbs, %u\n", m_options.asmLabel.c_str(), m_options.clocksPerBeat);
+    Printf("\t.equ\t%s_exg, %u\n", m_options.asmLabel.c_str(), m_options.exactGateTime);
+    Printf("\t.equ\t%s_cmp, %u\n", m_options.asmLabel.c_str(), m_options.compressionEnabled);
 
-    std::fprintf(g_outputFile, "\n\t.section .rodata\n");
-    std::fprintf(g_outputFile, "\t.global\t%s\n", g_asmLabel.c_str());
+    Printf("\n\t.section .rodata\n");
+    Printf("\t.global\t%s\n", m_options.asmLabel.c_str());
 
-    std::fprintf(g_outputFile, "\t.align\t2\n");
+    Printf("\t.align\t2\n");
 }
 
-void ResetTrackVars()
+void AgbWriter::ResetTrackVars()
 {
-    s_lastVelocity = -1;
-    s_lastNote = -1;
-    s_velocityChanged = false;
-    s_noteChanged = false;
-    s_keepLastOpName = false;
-    s_lastOpName = "";
-    s_inPattern = false;
+    m_lastVelocity = -1;
+    m_lastNote = -1;
+    m_velocityChanged = false;
+    m_noteChanged = false;
+    m_keepLastOpName = false;
+    m_lastOpName = "";
+    m_inPattern = false;
+}
+
+void AgbWriter::PrintLabel(const char *format, ...)
+{
+    std::va_list args;
+    va_start(args, format);
+    std::string name = FormatString(format, args);
+    va_end(args);
+
+    Printf("%s:\n", name.c_str());
+
+    if (m_objectOutput)
+        m_labels.push_back({ name, (std::uint32_t)m_data.size(), name == m_options.asmLabel, true });
 }
 
-void PrintWait(int wait)
+void AgbWriter::PrintWait(int wait)
 {
     if (wait > 0)
     {
-        std::fprintf(g_outputFile, "\t.byte\tW%02d\n", wait);
-        s_velocityChanged = true;
-        s_noteChanged = true;
-        s_keepLastOpName = true;
+        Printf("\t.byte\tW%02d\n", wait);
+
+        if (m_objectOutput)
+            EmitBytes({ W00 + LengthIndex(wait) });
+
+        m_velocityChanged = true;
+        m_noteChanged = true;
+        m_keepLastOpName = true;
     }
 }
 
-void PrintOp(int wait, std::string name, const char *format, ...)
+// Prints an op with its params. When compression is on, the command byte is left
+// out if it's the same as the last op's, as the sound engine repeats it.
+void AgbWriter::PrintOp(int wait, std::string name, int command, std::initializer_list<int> params, const char *format, ...)
 {
     std::va_list args;
     va_start(args, format);
-    std::fprintf(g_outputFile, "\t.byte\t\t");
+    Printf("\t.byte\t\t");
 
     if (format != nullptr)
     {
-        if (!g_compressionEnabled || s_lastOpName != name)
+        if (!m_options.compressionEnabled || m_lastOpName != name)
         {
-            std::fprintf(g_outputFile, "%s, ", name.c_str());
-            s_lastOpName = name;
+            Printf("%s, ", name.c_str());
+            EmitBytes({ command });
+            m_lastOpName = name;
         }
         else
         {
-            std::fprintf(g_outputFile, "        ");
+            Printf("        ");
         }
-        std::vfprintf(g_outputFile, format, args);
+        VPrintf(format, args);
+        EmitBytes(params);
     }
     else
     {
-        std::fputs(name.c_str(), g_outputFile);
-        s_lastOpName = name;
+        if (!m_objectOutput)
+            m_output += name;
+        EmitBytes({ command });
+        m_lastOpName = name;
     }
 
-    std::fprintf(g_outputFile, "\n");
+    Printf("\n");
 
     va_end(args);
 
     PrintWait(wait);
 }
 
-void PrintByte(const char *format, ...)
+void AgbWriter::PrintByte(std::initializer_list<int> bytes, const char *format, ...)
 {
     std::va_list args;
     va_start(args, format);
-    std::fprintf(g_outputFile, "\t.byte\t");
-    std::vfprintf(g_outputFile, format, args);
-    std::fprintf(g_outputFile, "\n");
-    s_velocityChanged = true;
-    s_noteChanged = true;
-    s_keepLastOpName = true;
+    Printf("\t.byte\t");
+    VPrintf(format, args);
+    Printf("\n");
+    EmitBytes(bytes);
+    m_velocityChanged = true;
+    m_noteChanged = true;
+    m_keepLastOpName = true;
     va_end(args);
 }
 
-void PrintWord(const char *format, ...)
+void AgbWriter::PrintWord(const char *format, ...)
 {
     std::va_list args;
     va_start(args, format);
-    std::fprintf(g_outputFile, "\t .word\t");
-    std::vfprintf(g_outputFile, format, args);
-    std::fprintf(g_outputFile, "\n");
+    std::string symbol = FormatString(format, args);
     va_end(args);
+
+    Printf("\t .word\t%s\n", symbol.c_str());
+    EmitWord(symbol);
 }
 
-void PrintNote(const Event& event)
+void AgbWriter::PrintNote(const Event& event)
 {
     int note = event.note;
     int velocity = g_noteVelocityLUT[event.param1];
@@ -154,7 +312,7 @@ void PrintNote(const Event& event)
 
     int gateTimeParam = 0;
 
-    if (g_exactGateTime && duration != -1)
+    if (m_options.exactGateTime && duration != -1)
         gateTimeParam = event.param2 - duration;
 
     char gtpBuf[16];
@@ -165,29 +323,36 @@ void PrintNote(const Event& event)
         gtpBuf[0] = 0;
 
     char opName[16];
+    int command;
 
     if (duration == -1)
+    {
         std::strcpy(opName, "TIE   ");
+        command = TIE;
+    }
     else
+    {
         std::snprintf(opName, sizeof(opName), "N%02u   ", duration);
+        command = TIE + LengthIndex(duration);
+    }
 
     bool noteChanged = true;
     bool velocityChanged = true;
 
-    if (g_compressionEnabled)
+    if (m_options.compressionEnabled)
     {
-        noteChanged = (note != s_lastNote);
-        velocityChanged = (velocity != s_lastVelocity);
+        noteChanged = (note != m_lastNote);
+        velocityChanged = (velocity != m_lastVelocity);
     }
 
-    if (s_keepLastOpName)
-        s_keepLastOpName = false;
+    if (m_keepLastOpName)
+        m_keepLastOpName = false;
     else
-        s_lastOpName = "";
+        m_lastOpName = "";
 
     if (noteChanged || velocityChanged || (gateTimeParam > 0))
     {
-        s_lastNote = note;
+        m_lastNote = note;
 
         char noteBuf[16];
 
@@ -200,7 +365,7 @@ void PrintNote(const Event& event)
 
         if (velocityChanged || (gateTimeParam > 0))
         {
-            s_lastVelocity = velocity;
+            m_lastVelocity = velocity;
             std::snprintf(velocityBuf, sizeof(velocityBuf), ", v%03u", velocity);
         }
         else
@@ -208,70 +373,75 @@ void PrintNote(const Event& event)
             velocityBuf[0] = 0;
         }
 
-        PrintOp(event.time, opName, "%s%s%s", noteBuf, velocityBuf, gtpBuf);
+        if (gateTimeParam > 0)
+            PrintOp(event.time, opName, command, { note, velocity, gateTimeParam }, "%s%s%s", noteBuf, velocityBuf, gtpBuf);
+        else if (velocityChanged)
+            PrintOp(event.time, opName, command, { note, velocity }, "%s%s%s", noteBuf, velocityBuf, gtpBuf);
+        else
+            PrintOp(event.time, opName, command, { note }, "%s%s%s", noteBuf, velocityBuf, gtpBuf);
     }
     else
     {
-        PrintOp(event.time, opName, 0);
+        PrintOp(event.time, opName, command, {}, 0);
     }
 
-    s_noteChanged = noteChanged;
-    s_velocityChanged = velocityChanged;
+    m_noteChanged = noteChanged;
+    m_velocityChanged = velocityChanged;
 }
 
-void PrintEndOfTieOp(const Event& event)
+void AgbWriter::PrintEndOfTieOp(const Event& event)
 {
     int note = event.note;
-    bool noteChanged = (note != s_lastNote);
+    bool noteChanged = (note != m_lastNote);
 
-    if (!noteChanged || !s_noteChanged)
-        s_lastOpName = "";
+    if (!noteChanged || !m_noteChanged)
+        m_lastOpName = "";
 
-    if (!noteChanged && g_compressionEnabled)
+    if (!noteChanged && m_options.compressionEnabled)
     {
-        PrintOp(event.time, "EOT   ", nullptr);
+        PrintOp(event.time, "EOT   ", EOT, {}, nullptr);
     }
     else
     {
-        s_lastNote = note;
+        m_lastNote = note;
         if (note >= 24)
-            PrintOp(event.time, "EOT   ", g_noteTable[note % 12], note / 12 - 2);
+            PrintOp(event.time, "EOT   ", EOT, { note }, g_noteTable[note % 12], note / 12 - 2);
         else
-            PrintOp(event.time, "EOT   ", g_minusNoteTable[note % 12], note / -12 + 2);
+            PrintOp(event.time, "EOT   ", EOT, { note }, g_minusNoteTable[note % 12], note / -12 + 2);
     }
 
-    s_noteChanged = noteChanged;
+    m_noteChanged = noteChanged;
 }
 
-void PrintSeqLoopLabel(const Event& event)
+void AgbWriter::PrintSeqLoopLabel(const Event& event)
 {
-    s_blockNum = event.param1 + 1;
-    std::fprintf(g_outputFile, "%s_%u_B%u:\n", g_asmLabel.c_str(), g_agbTrack, s_blockNum);
+    m_blockNum = event.param1 + 1;
+    PrintLabel("%s_%u_B%u", m_options.asmLabel.c_str(), m_song.agbTrack, m_blockNum);
     PrintWait(event.time);
     ResetTrackVars();
 }
 
-void PrintMemAcc(const Event& event)
+void AgbWriter::PrintMemAcc(const Event& event)
 {
-    switch (s_memaccOp)
+    switch (m_memaccOp)
     {
     case 0x00:
-        PrintByte("MEMACC, mem_set, 0x%02X, %u", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x00, m_memaccParam1, event.param2 }, "MEMACC, mem_set, 0x%02X, %u", m_memaccParam1, event.param2);
         break;
     case 0x01:
-        PrintByte("MEMACC, mem_add, 0x%02X, %u", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x01, m_memaccParam1, event.param2 }, "MEMACC, mem_add, 0x%02X, %u", m_memaccParam1, event.param2);
         break;
     case 0x02:
-        PrintByte("MEMACC, mem_sub, 0x%02X, %u", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x02, m_memaccParam1, event.param2 }, "MEMACC, mem_sub, 0x%02X, %u", m_memaccParam1, event.param2);
         break;
     case 0x03:
-        PrintByte("MEMACC, mem_mem_set, 0x%02X, 0x%02X", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x03, m_memaccParam1, event.param2 }, "MEMACC, mem_mem_set, 0x%02X, 0x%02X", m_memaccParam1, event.param2);
         break;
     case 0x04:
-        PrintByte("MEMACC, mem_mem_add, 0x%02X, 0x%02X", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x04, m_memaccParam1, event.param2 }, "MEMACC, mem_mem_add, 0x%02X, 0x%02X", m_memaccParam1, event.param2);
         break;
     case 0x05:
-        PrintByte("MEMACC, mem_mem_sub, 0x%02X, 0x%02X", s_memaccParam1, event.param2);
+        PrintByte({ MEMACC, 0x05, m_memaccParam1, event.param2 }, "MEMACC, mem_mem_sub, 0x%02X, 0x%02X", m_memaccParam1, event.param2);
         break;
     // TODO: everything else
     case 0x06:
@@ -329,17 +499,17 @@ void PrintMemAcc(const Event& event)
     PrintWait(event.time);
 }
 
-void PrintExtendedOp(const Event& event)
+void AgbWriter::PrintExtendedOp(const Event& event)
 {
     // TODO: support for other extended commands
 
-    switch (s_extendedCommand)
+    switch (m_extendedCommand)
     {
     case 0x08:
-        PrintOp(event.time, "XCMD  ", "xIECV , %u", event.param2);
+        PrintOp(event.time, "XCMD  ", XCMD, { xIECV, event.param2 }, "xIECV , %u", event.param2);
         break;
     case 0x09:
-        PrintOp(event.time, "XCMD  ", "xIECL , %u", event.param2);
+        PrintOp(event.time, "XCMD  ", XCMD, { xIECL, event.param2 }, "xIECL , %u", event.param2);
         break;
     default:
         PrintWait(event.time);
@@ -347,66 +517,66 @@ void PrintExtendedOp(const Event& event)
     }
 }
 
-void PrintControllerOp(const Event& event)
+void AgbWriter::PrintControllerOp(const Event& event)
 {
     switch (event.param1)
     {
     case 0x01:
-        PrintOp(event.time, "MOD   ", "%u", event.param2);
+        PrintOp(event.time, "MOD   ", MOD, { event.param2 }, "%u", event.param2);
         break;
     case 0x07:
-        PrintOp(event.time, "VOL   ", "%u*%s_mvl/mxv", event.param2, g_asmLabel.c_str());
+        PrintOp(event.time, "VOL   ", VOL, { event.param2 * m_options.masterVolume / mxv }, "%u*%s_mvl/mxv", event.param2, m_options.asmLabel.c_str());
         break;
     case 0x0A:
-        PrintOp(event.time, "PAN   ", "c_v%+d", event.param2 - 64);
+        PrintOp(event.time, "PAN   ", PAN, { event.param2 }, "c_v%+d", event.param2 - 64);
         break;
     case 0x0C:
     case 0x10:
         PrintMemAcc(event);
         break;
     case 0x0D:
-        s_memaccOp = event.param2;
+        m_memaccOp = event.param2;
         PrintWait(event.time);
         break;
     case 0x0E:
-        s_memaccParam1 = event.param2;
+        m_memaccParam1 = event.param2;
         PrintWait(event.time);
         break;
     case 0x0F:
-        s_memaccParam2 = event.param2;
+        m_memaccParam2 = event.param2;
         PrintWait(event.time);
         break;
     case 0x11:
-        std::fprintf(g_outputFile, "%s_%u_L%u:\n", g_asmLabel.c_str(), g_agbTrack, event.param2);
+        PrintLabel("%s_%u_L%u", m_options.asmLabel.c_str(), m_song.agbTrack, event.param2);
         PrintWait(event.time);
         ResetTrackVars();
         break;
     case 0x14:
-        PrintOp(event.time, "BENDR ", "%u", event.param2);
+        PrintOp(event.time, "BENDR ", BENDR, { event.param2 }, "%u", event.param2);
         break;
     case 0x15:
-        PrintOp(event.time, "LFOS  ", "%u", event.param2);
+        PrintOp(event.time, "LFOS  ", LFOS, { event.param2 }, "%u", event.param2);
         break;
     case 0x16:
-        PrintOp(event.time, "MODT  ", "%u", event.param2);
+        PrintOp(event.time, "MODT  ", MODT, { event.param2 }, "%u", event.param2);
         break;
     case 0x18:
-        PrintOp(event.time, "TUNE  ", "c_v%+d", event.param2 - 64);
+        PrintOp(event.time, "TUNE  ", TUNE, { event.param2 }, "c_v%+d", event.param2 - 64);
         break;
     case 0x1A:
-        PrintOp(event.time, "LFODL ", "%u", event.param2);
+        PrintOp(event.time, "LFODL ", LFODL, { event.param2 }, "%u", event.param2);
         break;
     case 0x1D:
     case 0x1F:
         PrintExtendedOp(event);
         break;
     case 0x1E:
-        s_extendedCommand = event.param2;
+        m_extendedCommand = event.param2;
         // TODO: loop op
         break;
     case 0x21:
     case 0x27:
-        PrintByte("PRIO  , %u", event.param2);
+        PrintByte({ PRIO, event.param2 }, "PRIO  , %u", event.param2);
         PrintWait(event.time);
         break;
     default:
@@ -415,10 +585,10 @@ void PrintControllerOp(const Event& event)
     }
 }
 
-void PrintAgbTrack(std::vector<Event>& events)
+void AgbWriter::PrintTrack(std::vector<Event>& events)
 {
-    std::fprintf(g_outputFile, "\n@**************** Track %u (Midi-Chn.%u) ****************@\n\n", g_agbTrack, g_midiChan + 1);
-    std::fprintf(g_outputFile, "%s_%u:\n", g_asmLabel.c_str(), g_agbTrack);
+    Printf("\n@**************** Track %u (Midi-Chn.%u) ****************@\n\n", m_song.agbTrack, m_song.midiChan + 1);
+    PrintLabel("%s_%u", m_options.asmLabel.c_str(), m_song.agbTrack);
 
     int wholeNoteCount = 0;
     int loopEndBlockNum = 0;
@@ -440,10 +610,10 @@ void PrintAgbTrack(std::vector<Event>& events)
     }
 
     if (!foundVolBeforeNote)
-        PrintByte("\tVOL   , 127*%s_mvl/mxv", g_asmLabel.c_str());
+        PrintByte({ VOL, 127 * m_options.masterVolume / mxv }, "\tVOL   , 127*%s_mvl/mxv", m_options.asmLabel.c_str());
 
-    PrintWait(g_initialWait);
-    PrintByte("KEYSH , %s_key%+d", g_asmLabel.c_str(), 0);
+    PrintWait(m_song.initialWait);
+    PrintByte({ KEYSH, 0 }, "KEYSH , %s_key%+d", m_options.asmLabel.c_str(), 0);
 
     for (unsigned i = 0; events[i].type != EventType::EndOfTrack; i++)
     {
@@ -451,13 +621,13 @@ void PrintAgbTrack(std::vector<Event>& events)
 
         if (IsPatternBoundary(event.type))
         {
-            if (s_inPattern)
-                PrintByte("PEND");
-            s_inPattern = false;
+            if (m_inPattern)
+                PrintByte({ PEND }, "PEND");
+            m_inPattern = false;
         }
 
         if (event.type == EventType::WholeNoteMark || event.type == EventType::Pattern)
-            std::fprintf(g_outputFile, "@ %03d   ----------------------------------------\n", wholeNoteCount++);
+            Printf("@ %03d   ----------------------------------------\n", wholeNoteCount++);
 
         switch (event.type)
         {
@@ -471,32 +641,32 @@ void PrintAgbTrack(std::vector<Event>& events)
             PrintSeqLoopLabel(event);
             break;
         case EventType::LoopEnd:
-            PrintByte("GOTO");
-            PrintWord("%s_%u_B%u", g_asmLabel.c_str(), g_agbTrack, loopEndBlockNum);
+            PrintByte({ GOTO }, "GOTO");
+            PrintWord("%s_%u_B%u", m_options.asmLabel.c_str(), m_song.agbTrack, loopEndBlockNum);
             PrintSeqLoopLabel(event);
             break;
         case EventType::LoopEndBegin:
-            PrintByte("GOTO");
-            PrintWord("%s_%u_B%u", g_asmLabel.c_str(), g_agbTrack, loopEndBlockNum);
+            PrintByte({ GOTO }, "GOTO");
+            PrintWord("%s_%u_B%u", m_options.asmLabel.c_str(), m_song.agbTrack, loopEndBlockNum);
             PrintSeqLoopLabel(event);
-            loopEndBlockNum = s_blockNum;
+            loopEndBlockNum = m_blockNum;
             break;
         case EventType::LoopBegin:
             PrintSeqLoopLabel(event);
-            loopEndBlockNum = s_blockNum;
+            loopEndBlockNum = m_blockNum;
             break;
         case EventType::WholeNoteMark:
             if (event.param2 & 0x80000000)
             {
-                std::fprintf(g_outputFile, "%s_%u_%03lu:\n", g_asmLabel.c_str(), g_agbTrack, (unsigned long)(event.param2 & 0x7FFFFFFF));
+                PrintLabel("%s_%u_%03lu", m_options.asmLabel.c_str(), m_song.agbTrack, (unsigned long)(event.param2 & 0x7FFFFFFF));
                 ResetTrackVars();
-                s_inPattern = true;
+                m_inPattern = true;
             }
             PrintWait(event.time);
             break;
         case EventType::Pattern:
-            PrintByte("PATT");
-            PrintWord("%s_%u_%03lu", g_asmLabel.c_str(), g_agbTrack, event.param2);
+            PrintByte({ PATT }, "PATT");
+            PrintWord("%s_%u_%03lu", m_options.asmLabel.c_str(), m_song.agbTrack, event.param2);
 
             while (!IsPatternBoundary(events[i + 1].type))
                 i++;
@@ -504,14 +674,17 @@ void PrintAgbTrack(std::vector<Event>& events)
             ResetTrackVars();
             break;
         case EventType::Tempo:
-            PrintByte("TEMPO , %u*%s_tbs/2", static_cast<int>(round(60000000.0f / static_cast<float>(event.param2))), g_asmLabel.c_str());
+        {
+            int tempo = static_cast<int>(round(60000000.0f / static_cast<float>(event.param2)));
+            PrintByte({ TEMPO, tempo * m_options.clocksPerBeat / 2 }, "TEMPO , %u*%s_tbs/2", tempo, m_options.asmLabel.c_str());
             PrintWait(event.time);
             break;
+        }
         case EventType::InstrumentChange:
-            PrintOp(event.time, "VOICE ", "%u", event.param1);
+            PrintOp(event.time, "VOICE ", VOICE, { event.param1 }, "%u", event.param1);
             break;
         case EventType::PitchBend:
-            PrintOp(event.time, "BEND  ", "c_v%+d", event.param2 - 64);
+            PrintOp(event.time, "BEND  ", BEND, { event.param2 }, "c_v%+d", event.param2 - 64);
             break;
         case EventType::Controller:
             PrintControllerOp(event);
@@ -522,27 +695,48 @@ void PrintAgbTrack(std::vector<Event>& events)
         }
     }
 
-    PrintByte("FINE");
+    PrintByte({ FINE }, "FINE");
 }
 
-void PrintAgbFooter()
+void AgbWriter::PrintFooter()
 {
-    int trackCount = g_agbTrack - 1;
-
-    std::fprintf(g_outputFile, "\n@******************************************************@\n");
-    std::fprintf(g_outputFile, "\t.align\t2\n");
-    std::fprintf(g_outputFile, "\n%s:\n", g_asmLabel.c_str());
-    std::fprintf(g_outputFile, "\t.byte\t%u\t@ NumTrks\n", trackCount);
-    std::fprintf(g_outputFile, "\t.byte\t%u\t@ NumBlks\n", 0);
-    std::fprintf(g_outputFile, "\t.byte\t%s_pri\t@ Priority\n", g_asmLabel.c_str());
-    std::fprintf(g_outputFile, "\t.byte\t%s_rev\t@ Reverb.\n", g_asmLabel.c_str());
-    std::fprintf(g_outputFile, "\n");
-    std::fprintf(g_outputFile, "\t.word\t%s_grp\n", g_asmLabel.c_str());
-    std::fprintf(g_outputFile, "\n");
+    int trackCount = m_song.agbTrack - 1;
+
+    Printf("\n@******************************************************@\n");
+    Printf("\t.align\t2\n");
+
+    if (m_objectOutput)
+        m_data.resize((m_data.size() + 3) & ~3);
+
+    Printf("\n");
+    PrintLabel("%s", m_options.asmLabel.c_str());
+    Printf("\t.byte\t%u\t@ NumTrks\n", trackCount);
+    Printf("\t.byte\t%u\t@ NumBlks\n", 0);
+    Printf("\t.byte\t%s_pri\t@ Priority\n", m_options.asmLabel.c_str());
+    Printf("\t.byte\t%s_rev\t@ Reverb.\n", m_options.asmLabel.c_str());
+    EmitBytes({ trackCount, 0, m_options.priority, m_options.reverb >= 0 ? reverb_set + m_options.reverb : 0 });
+    Printf("\n");
+    Printf("\t.word\t%s_grp\n", m_options.asmLabel.c_str());
+    Printf("\n");
+
+    if (m_objectOutput)
+    {
+        char voiceGroup[32];
+        std::snprintf(voiceGroup, sizeof(voiceGroup), "voicegroup%03u", m_options.voiceGroup);
+        EmitWord(voiceGroup);
+    }
 
     // track pointers
     for (int i = 1; i <= trackCount; i++)
-        std::fprintf(g_outputFile, "\t.word\t%s_%u\n", g_asmLabel.c_str(), i);
+    {
+        Printf("\t.word\t%s_%u\n", m_options.asmLabel.c_str(), i);
+
+        if (m_objectOutput)
+            EmitWord(m_options.asmLabel + "_" + std::to_string(i));
+    }
+
+    Printf("\n\t.end\n");
 
-    std::fprintf(g_outputFile, "\n\t.end\n");
+    if (m_objectOutput)
+        WriteObject();
 }
@@ -21,13 +21,72 @@
 #ifndef AGB_H
 #define AGB_H
 
+#include <cstdarg>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
 #include <vector>
 #include "midi.h"
+#include "elf.h"
 
-void PrintAgbHeader();
-void PrintAgbTrack(std::vector<Event>& events);
-void PrintAgbFooter();
+// Prints one song's AGB assembly into a string, keeping the state that carries
+// over from one printed op to the next. With objectOutput set, it encodes the
+// bytes the assembly stands for instead and Output() is an ELF object file.
+class AgbWriter
+{
+public:
+    AgbWriter(const MidiSong& song, bool objectOutput)
+        : m_song(song), m_options(song.options), m_objectOutput(objectOutput) {}
 
-extern int g_agbTrack;
+    void PrintHeader();
+    void PrintTrack(std::vector<Event>& events);
+    void PrintFooter();
+
+    const std::string& Output() const { return m_output; }
+
+private:
+    void Printf(const char* format, ...);
+    void VPrintf(const char* format, std::va_list args);
+
+    void EmitBytes(std::initializer_list<int> bytes);
+    void EmitWord(const std::string& symbol);
+    void WriteObject();
+
+    void ResetTrackVars();
+    void PrintLabel(const char *format, ...);
+    void PrintWait(int wait);
+    void PrintOp(int wait, std::string name, int command, std::initializer_list<int> params, const char *format, ...);
+    void PrintByte(std::initializer_list<int> bytes, const char *format, ...);
+    void PrintWord(const char *format, ...);
+    void PrintNote(const Event& event);
+    void PrintEndOfTieOp(const Event& event);
+    void PrintSeqLoopLabel(const Event& event);
+    void PrintMemAcc(const Event& event);
+    void PrintExtendedOp(const Event& event);
+    void PrintControllerOp(const Event& event);
+
+    const MidiSong& m_song;
+    const SongOptions& m_options;
+    const bool m_objectOutput;
+    std::string m_output;
+
+    std::vector<std::uint8_t> m_data;
+    std::vector<ElfSymbol> m_labels;
+    std::vector<std::pair<std::uint32_t, std::string>> m_wordSymbols;
+
+    std::string m_lastOpName;
+    int m_blockNum = 0;
+    bool m_keepLastOpName = false;
+    int m_lastNote = 0;
+    int m_lastVelocity = 0;
+    bool m_noteChanged = false;
+    bool m_velocityChanged = false;
+    bool m_inPattern = false;
+    int m_extendedCommand = 0;
+    int m_memaccOp = 0;
+    int m_memaccParam1 = 0;
+    int m_memaccParam2 = 0;
+};
 
 #endif // AGB_H
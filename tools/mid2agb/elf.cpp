@@ -0,0 +1,248 @@
+// Copyright(c) 2016 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "elf.h"
+
+namespace
+{
+
+const int kElfHeaderSize = 52;
+const int kSectionHeaderSize = 40;
+const int kSymbolSize = 16;
+const int kRelocationSize = 8;
+
+const std::uint16_t ET_REL = 1;
+const std::uint16_t EM_ARM = 40;
+const std::uint32_t EF_ARM_EABI_VER5 = 0x05000000;
+
+const std::uint32_t SHT_PROGBITS = 1;
+const std::uint32_t SHT_SYMTAB = 2;
+const std::uint32_t SHT_STRTAB = 3;
+const std::uint32_t SHT_REL = 9;
+
+const std::uint32_t SHF_ALLOC = 0x2;
+const std::uint32_t SHF_INFO_LINK = 0x40;
+
+const std::uint8_t STB_LOCAL = 0;
+const std::uint8_t STB_GLOBAL = 1;
+const std::uint8_t STT_NOTYPE = 0;
+const std::uint8_t STT_SECTION = 3;
+
+const std::uint32_t R_ARM_ABS32 = 2;
+
+enum Section
+{
+    SECTION_NULL,
+    SECTION_RODATA,
+    SECTION_REL_RODATA,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_COUNT
+};
+
+void Put16(std::string& out, std::uint16_t value)
+{
+    out += (char)value;
+    out += (char)(value >> 8);
+}
+
+void Put32(std::string& out, std::uint32_t value)
+{
+    Put16(out, value);
+    Put16(out, value >> 16);
+}
+
+void Align(std::string& out, std::size_t alignment)
+{
+    while (out.size() % alignment)
+        out += '\0';
+}
+
+std::uint32_t AddString(std::string& table, const std::string& s)
+{
+    std::uint32_t offset = table.size();
+    table += s;
+    table += '\0';
+    return offset;
+}
+
+void PutSymbol(std::string& out, std::uint32_t name, std::uint32_t value, std::uint8_t info, std::uint16_t section)
+{
+    Put32(out, name);
+    Put32(out, value);
+    Put32(out, 0); // size
+    out += (char)info;
+    out += '\0'; // other
+    Put16(out, section);
+}
+
+struct SectionHeader
+{
+    std::uint32_t name = 0;
+    std::uint32_t type = 0;
+    std::uint32_t flags = 0;
+    std::uint32_t offset = 0;
+    std::uint32_t size = 0;
+    std::uint32_t link = 0;
+    std::uint32_t info = 0;
+    std::uint32_t addralign = 0;
+    std::uint32_t entsize = 0;
+};
+
+} // namespace
+
+std::string BuildRodataObject(const std::vector<std::uint8_t>& data,
+                              const std::vector<ElfSymbol>& symbols,
+                              const std::vector<ElfRelocation>& relocations)
+{
+    SectionHeader sections[SECTION_COUNT];
+    std::string shstrtab(1, '\0');
+
+    sections[SECTION_RODATA].name = AddString(shstrtab, ".rodata");
+    sections[SECTION_REL_RODATA].name = AddString(shstrtab, ".rel.rodata");
+    sections[SECTION_SYMTAB].name = AddString(shstrtab, ".symtab");
+    sections[SECTION_STRTAB].name = AddString(shstrtab, ".strtab");
+    sections[SECTION_SHSTRTAB].name = AddString(shstrtab, ".shstrtab");
+
+    // The symbol table starts with the null symbol and the section symbol, and
+    // all local symbols have to come before the global ones.
+    std::string symtab;
+    std::string strtab(1, '\0');
+    std::vector<std::uint32_t> symbolIndices(symbols.size());
+
+    PutSymbol(symtab, 0, 0, 0, 0);
+    PutSymbol(symtab, 0, 0, (STB_LOCAL << 4) | STT_SECTION, SECTION_RODATA);
+
+    std::uint32_t symbolCount = 2;
+    std::uint32_t firstGlobal = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool global = (pass == 1);
+
+        if (global)
+            firstGlobal = symbolCount;
+
+        for (std::size_t i = 0; i < symbols.size(); i++)
+        {
+            const ElfSymbol& symbol = symbols[i];
+
+            if (symbol.global != global)
+                continue;
+
+            std::uint8_t info = ((global ? STB_GLOBAL : STB_LOCAL) << 4) | STT_NOTYPE;
+            PutSymbol(symtab, AddString(strtab, symbol.name), symbol.value, info, symbol.defined ? SECTION_RODATA : 0);
+            symbolIndices[i] = symbolCount++;
+        }
+    }
+
+    std::string rel;
+
+    for (const ElfRelocation& relocation : relocations)
+    {
+        std::uint32_t symbol = relocation.symbol < 0 ? 1 : symbolIndices[relocation.symbol];
+        Put32(rel, relocation.offset);
+        Put32(rel, (symbol << 8) | R_ARM_ABS32);
+    }
+
+    std::string out(kElfHeaderSize, '\0');
+
+    sections[SECTION_RODATA].type = SHT_PROGBITS;
+    sections[SECTION_RODATA].flags = SHF_ALLOC;
+    sections[SECTION_RODATA].offset = out.size();
+    sections[SECTION_RODATA].size = data.size();
+    sections[SECTION_RODATA].addralign = 4;
+    out.append(data.begin(), data.end());
+    Align(out, 4);
+
+    sections[SECTION_REL_RODATA].type = SHT_REL;
+    sections[SECTION_REL_RODATA].flags = SHF_INFO_LINK;
+    sections[SECTION_REL_RODATA].offset = out.size();
+    sections[SECTION_REL_RODATA].size = rel.size();
+    sections[SECTION_REL_RODATA].link = SECTION_SYMTAB;
+    sections[SECTION_REL_RODATA].info = SECTION_RODATA;
+    sections[SECTION_REL_RODATA].addralign = 4;
+    sections[SECTION_REL_RODATA].entsize = kRelocationSize;
+    out += rel;
+
+    sections[SECTION_SYMTAB].type = SHT_SYMTAB;
+    sections[SECTION_SYMTAB].offset = out.size();
+    sections[SECTION_SYMTAB].size = symtab.size();
+    sections[SECTION_SYMTAB].link = SECTION_STRTAB;
+    sections[SECTION_SYMTAB].info = firstGlobal;
+    sections[SECTION_SYMTAB].addralign = 4;
+    sections[SECTION_SYMTAB].entsize = kSymbolSize;
+    out += symtab;
+
+    sections[SECTION_STRTAB].type = SHT_STRTAB;
+    sections[SECTION_STRTAB].offset = out.size();
+    sections[SECTION_STRTAB].size = strtab.size();
+    sections[SECTION_STRTAB].addralign = 1;
+    out += strtab;
+
+    sections[SECTION_SHSTRTAB].type = SHT_STRTAB;
+    sections[SECTION_SHSTRTAB].offset = out.size();
+    sections[SECTION_SHSTRTAB].size = shstrtab.size();
+    sections[SECTION_SHSTRTAB].addralign = 1;
+    out += shstrtab;
+
+    Align(out, 4);
+    std::uint32_t sectionHeadersOffset = out.size();
+
+    for (const SectionHeader& section : sections)
+    {
+        Put32(out, section.name);
+        Put32(out, section.type);
+        Put32(out, section.flags);
+        Put32(out, 0); // addr
+        Put32(out, section.offset);
+        Put32(out, section.size);
+        Put32(out, section.link);
+        Put32(out, section.info);
+        Put32(out, section.addralign);
+        Put32(out, section.entsize);
+    }
+
+    std::string header("\x7F" "ELF", 4);
+    header += (char)1; // ELFCLASS32
+    header += (char)1; // ELFDATA2LSB
+    header += (char)1; // EV_CURRENT
+    header.resize(16, '\0');
+    Put16(header, ET_REL);
+    Put16(header, EM_ARM);
+    Put32(header, 1); // version
+    Put32(header, 0); // entry
+    Put32(header, 0); // program headers
+    Put32(header, sectionHeadersOffset);
+    Put32(header, EF_ARM_EABI_VER5);
+    Put16(header, kElfHeaderSize);
+    Put16(header, 0); // program header size
+    Put16(header, 0); // program header count
+    Put16(header, kSectionHeaderSize);
+    Put16(header, SECTION_COUNT);
+    Put16(header, SECTION_SHSTRTAB);
+    out.replace(0, kElfHeaderSize, header);
+
+    return out;
+}
@@ -0,0 +1,49 @@
+// Copyright(c) 2016 YamaArashi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ELF_H
+#define ELF_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ElfSymbol
+{
+    std::string name;
+    std::uint32_t value;
+    bool global;
+    bool defined;
+};
+
+struct ElfRelocation
+{
+    std::uint32_t offset;
+    int symbol; // index into the symbols, or -1 for the .rodata section itself
+};
+
+// Builds an ARM ELF relocatable object with a single .rodata section holding data,
+// like the one as produces from a song's .s file. Each relocation is an R_ARM_ABS32
+// word whose addend is already stored in data.
+std::string BuildRodataObject(const std::vector<std::uint8_t>& data,
+                              const std::vector<ElfSymbol>& symbols,
+                              const std::vector<ElfRelocation>& relocations);
+
+#endif // ELF_H
@@ -21,6 +21,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <string>
+#include "error.h"
+
+static thread_local std::string s_errorContext;
 
 // Reports an error diagnostic and terminates the program.
 [[noreturn]] void RaiseError(const char* format, ...)
@@ -30,7 +34,15 @@
     std::va_list args;
     va_start(args, format);
     std::vsnprintf(buffer, bufferSize, format, args);
-    std::fprintf(stderr, "error: %s\n", buffer);
+    if (s_errorContext.empty())
+        std::fprintf(stderr, "error: %s\n", buffer);
+    else
+        std::fprintf(stderr, "error: %s: %s\n", s_errorContext.c_str(), buffer);
     va_end(args);
     std::exit(1);
 }
+
+void SetErrorContext(const std::string& context)
+{
+    s_errorContext = context;
+}
@@ -21,6 +21,11 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <string>
+
 [[noreturn]] void RaiseError(const char* format, ...);
 
+// Names the file that errors raised on the calling thread are about.
+void SetErrorContext(const std::string& context);
+
 #endif // ERROR_H
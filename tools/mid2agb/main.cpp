@@ -24,31 +24,26 @@
 #include <cctype>
 #include <cassert>
 #include <string>
-#include <set>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sys/stat.h>
 #include "main.h"
 #include "error.h"
 #include "midi.h"
 #include "agb.h"
 
-FILE* g_inputFile = nullptr;
-FILE* g_outputFile = nullptr;
-
-std::string g_asmLabel;
-int g_masterVolume = 127;
-int g_voiceGroup = 0;
-int g_priority = 0;
-int g_reverb = -1;
-int g_clocksPerBeat = 1;
-bool g_exactGateTime = false;
-bool g_compressionEnabled = true;
-
 [[noreturn]] static void PrintUsage()
 {
     std::printf(
         "Usage: MID2AGB name [options]\n"
+        "       MID2AGB -C midi.cfg [-D output_dir] [-U [-S stamp_file]] [-T]\n"
         "\n"
         "    input_file  filename(.mid) of MIDI file\n"
         "   output_file  filename(.s) for AGB file (default:input_file)\n"
+        "                or filename(.o) to write the song as an ELF object\n"
         "\n"
         "options  -L???  label for assembler (default:output_file)\n"
         "         -V???  master volume (default:127)\n"
@@ -58,6 +53,13 @@ bool g_compressionEnabled = true;
         "            -X  48 clocks/beat (default:24 clocks/beat)\n"
         "            -E  exact gate-time\n"
         "            -N  no compression\n"
+        "\n"
+        "batch    -C???  convert each song listed in a midi.cfg with the options on its line\n"
+        "         -D???  directory for the .s files (default:the midi.cfg's directory)\n"
+        "            -O  write .o files instead of .s files\n"
+        "            -U  only convert songs whose .s is older than their .mid or the midi.cfg\n"
+        "         -S???  with -U, compare against this file's time instead of each .s file's\n"
+        "            -T  print how long each song took\n"
     );
     std::exit(1);
 }
@@ -102,6 +104,16 @@ static std::string BaseName(std::string s)
     return s;
 }
 
+static std::string DirName(const std::string& s)
+{
+    std::size_t posAfterSlash = s.find_last_of("/\\");
+
+    if (posAfterSlash == std::string::npos)
+        return "";
+
+    return s.substr(0, posAfterSlash + 1);
+}
+
 static const char *GetArgument(int argc, char **argv, int& index)
 {
     assert(index >= 0 && index < argc);
@@ -127,10 +139,308 @@ static const char *GetArgument(int argc, char **argv, int& index)
     }
 }
 
+// Handles the option at argv[index] if it's one of the per-song conversion options.
+static bool ParseSongOption(int argc, char **argv, int& index, SongOptions& options)
+{
+    const char *arg;
+
+    switch (std::toupper(argv[index][1]))
+    {
+    case 'E':
+        options.exactGateTime = true;
+        break;
+    case 'G':
+        arg = GetArgument(argc, argv, index);
+        if (arg == nullptr)
+            PrintUsage();
+        options.voiceGroup = std::stoi(arg);
+        break;
+    case 'L':
+        arg = GetArgument(argc, argv, index);
+        if (arg == nullptr)
+            PrintUsage();
+        options.asmLabel = arg;
+        break;
+    case 'N':
+        options.compressionEnabled = false;
+        break;
+    case 'P':
+        arg = GetArgument(argc, argv, index);
+        if (arg == nullptr)
+            PrintUsage();
+        options.priority = std::stoi(arg);
+        break;
+    case 'R':
+        arg = GetArgument(argc, argv, index);
+        if (arg == nullptr)
+            PrintUsage();
+        options.reverb = std::stoi(arg);
+        break;
+    case 'V':
+        arg = GetArgument(argc, argv, index);
+        if (arg == nullptr)
+            PrintUsage();
+        options.masterVolume = std::stoi(arg);
+        break;
+    case 'X':
+        options.clocksPerBeat = 2;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+static std::string ConvertSong(const std::string& inputFilename, const SongOptions& options, bool objectOutput)
+{
+    MidiSong song;
+    song.options = options;
+    song.reader.Load(inputFilename);
+
+    AgbWriter writer(song, objectOutput);
+
+    ReadMidiFileHeader(song);
+    writer.PrintHeader();
+    ReadMidiTracks(song, writer);
+    writer.PrintFooter();
+
+    return writer.Output();
+}
+
+static void WriteFile(const std::string& filename, const std::string& text, bool binary)
+{
+    FILE* file = std::fopen(filename.c_str(), binary ? "wb" : "w");
+
+    if (file == nullptr)
+        RaiseError("failed to open \"%s\" for writing", filename.c_str());
+
+    if (std::fwrite(text.data(), 1, text.size(), file) != text.size())
+        RaiseError("failed to write \"%s\"", filename.c_str());
+
+    std::fclose(file);
+}
+
+static bool FileHoldsText(const std::string& filename, const std::string& text, bool binary)
+{
+    FILE* file = std::fopen(filename.c_str(), binary ? "rb" : "r");
+
+    if (file == nullptr)
+        return false;
+
+    std::string existing;
+    char buffer[0x4000];
+    std::size_t count;
+
+    while (existing.size() <= text.size() && (count = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        existing.append(buffer, count);
+
+    std::fclose(file);
+
+    return existing == text;
+}
+
+// Gets the time in nanoseconds, where the file system keeps them. Returns false if the file
+// doesn't exist.
+static bool GetModificationTime(const std::string& filename, long long& time)
+{
+    struct stat status;
+
+    if (stat(filename.c_str(), &status) != 0)
+        return false;
+
+    time = status.st_mtime * 1000000000LL;
+#if defined(__APPLE__)
+    time += status.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    time += status.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+struct CfgSong
+{
+    std::string inputFilename;
+    std::string outputFilename;
+    SongOptions options;
+    bool converted = false;
+    bool changed = false;
+    double milliseconds = 0;
+};
+
+// Reads the songs from a midi.cfg, where each line is a .mid file's name, a colon
+// and the options to convert it with. Songs whose .mid doesn't exist are left out,
+// as make never asks for them.
+static std::vector<CfgSong> ReadMidiCfg(const std::string& cfgFilename, const std::string& outputDir, const char* outputExtension)
+{
+    FILE* file = std::fopen(cfgFilename.c_str(), "r");
+
+    if (file == nullptr)
+        RaiseError("failed to open \"%s\" for reading", cfgFilename.c_str());
+
+    std::vector<CfgSong> songs;
+    std::string inputDir = DirName(cfgFilename);
+    char line[1024];
+    int lineNum = 0;
+
+    while (std::fgets(line, sizeof(line), file) != nullptr)
+    {
+        lineNum++;
+
+        std::vector<char*> args;
+        args.push_back(nullptr); // argv[0]
+
+        for (char* token = std::strtok(line, " \t\r\n"); token != nullptr; token = std::strtok(nullptr, " \t\r\n"))
+            args.push_back(token);
+
+        if (args.size() == 1)
+            continue;
+
+        std::string name = args[1];
+
+        if (name.back() != ':')
+            RaiseError("%s:%d: expected a .mid file name followed by a colon", cfgFilename.c_str(), lineNum);
+
+        name.pop_back();
+
+        CfgSong song;
+        song.inputFilename = inputDir + name;
+        song.outputFilename = outputDir + StripExtension(name) + outputExtension;
+
+        int argc = args.size();
+        for (int i = 2; i < argc; i++)
+        {
+            if (args[i][0] != '-' || !ParseSongOption(argc, args.data(), i, song.options))
+                RaiseError("%s:%d: unknown option \"%s\"", cfgFilename.c_str(), lineNum, args[i]);
+        }
+
+        if (song.options.asmLabel.empty())
+            song.options.asmLabel = BaseName(song.outputFilename);
+
+        long long time;
+        if (GetModificationTime(song.inputFilename, time))
+            songs.push_back(song);
+    }
+
+    std::fclose(file);
+
+    return songs;
+}
+
+// Converts the songs of a midi.cfg on one thread per core, rewriting only the .s
+// files whose contents changed so that make doesn't reassemble the others.
+// Unchanged files keep their old times, so once the .mid or midi.cfg is edited without changing
+// a song's output, -U alone would convert that song on every later run. A stamp file touched
+// after each run records when the outputs were last brought up to date instead.
+static void ConvertMidiCfg(const std::string& cfgFilename, std::string outputDir, const std::string& stampFilename, bool objectOutput, bool onlyOutOfDate, bool printTimes)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (outputDir.empty())
+        outputDir = DirName(cfgFilename);
+    else if (outputDir.back() != '/' && outputDir.back() != '\\')
+        outputDir += '/';
+
+    std::vector<CfgSong> songs = ReadMidiCfg(cfgFilename, outputDir, objectOutput ? ".o" : ".s");
+
+    long long cfgTime = 0;
+    GetModificationTime(cfgFilename, cfgTime);
+
+    long long stampTime = 0;
+    bool haveStamp = !stampFilename.empty() && GetModificationTime(stampFilename, stampTime);
+
+    std::atomic<std::size_t> nextSong(0);
+
+    auto worker = [&]() {
+        std::size_t i;
+
+        while ((i = nextSong++) < songs.size())
+        {
+            CfgSong& song = songs[i];
+            long long inputTime = 0;
+            long long outputTime = 0;
+
+            if (onlyOutOfDate && GetModificationTime(song.outputFilename, outputTime))
+            {
+                // An edit at the same time as the stamp counts as newer.
+                if (haveStamp)
+                    outputTime = stampTime - 1;
+
+                if (GetModificationTime(song.inputFilename, inputTime)
+                 && outputTime >= inputTime && outputTime >= cfgTime)
+                    continue;
+            }
+
+            auto songStart = std::chrono::steady_clock::now();
+
+            SetErrorContext(song.inputFilename);
+            std::string text = ConvertSong(song.inputFilename, song.options, objectOutput);
+
+            if (!FileHoldsText(song.outputFilename, text, objectOutput))
+            {
+                WriteFile(song.outputFilename, text, objectOutput);
+                song.changed = true;
+            }
+
+            song.converted = true;
+            song.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - songStart).count();
+        }
+    };
+
+    std::size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    if (threadCount > songs.size())
+        threadCount = songs.size();
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    int convertedCount = 0;
+    int changedCount = 0;
+    std::vector<const CfgSong*> convertedSongs;
+
+    for (const CfgSong& song : songs)
+    {
+        if (song.converted)
+        {
+            convertedCount++;
+            convertedSongs.push_back(&song);
+        }
+        if (song.changed)
+            changedCount++;
+    }
+
+    if (printTimes)
+    {
+        std::stable_sort(convertedSongs.begin(), convertedSongs.end(), [](const CfgSong* a, const CfgSong* b) {
+            return a->milliseconds > b->milliseconds;
+        });
+
+        for (const CfgSong* song : convertedSongs)
+            std::printf("%9.3f ms  %s%s\n", song->milliseconds, song->inputFilename.c_str(), song->changed ? "" : " (unchanged)");
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::printf("mid2agb: %d of %d songs converted, %d files updated in %.1f ms\n",
+                convertedCount, (int)songs.size(), changedCount, milliseconds);
+}
+
 int main(int argc, char** argv)
 {
     std::string inputFilename;
     std::string outputFilename;
+    std::string cfgFilename;
+    std::string outputDir;
+    std::string stampFilename;
+    bool objectOutput = false;
+    bool onlyOutOfDate = false;
+    bool printTimes = false;
+    SongOptions options;
 
     for (int i = 1; i < argc; i++)
     {
@@ -140,46 +450,37 @@ int main(int argc, char** argv)
         {
             const char *arg;
 
+            if (ParseSongOption(argc, argv, i, options))
+                continue;
+
             switch (std::toupper(option[1]))
             {
-            case 'E':
-                g_exactGateTime = true;
-                break;
-            case 'G':
+            case 'C':
                 arg = GetArgument(argc, argv, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_voiceGroup = std::stoi(arg);
+                cfgFilename = arg;
                 break;
-            case 'L':
+            case 'D':
                 arg = GetArgument(argc, argv, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_asmLabel = arg;
-                break;
-            case 'N':
-                g_compressionEnabled = false;
+                outputDir = arg;
                 break;
-            case 'P':
+            case 'S':
                 arg = GetArgument(argc, argv, i);
                 if (arg == nullptr)
                     PrintUsage();
-                g_priority = std::stoi(arg);
+                stampFilename = arg;
                 break;
-            case 'R':
-                arg = GetArgument(argc, argv, i);
-                if (arg == nullptr)
-                    PrintUsage();
-                g_reverb = std::stoi(arg);
+            case 'O':
+                objectOutput = true;
                 break;
-            case 'V':
-                arg = GetArgument(argc, argv, i);
-                if (arg == nullptr)
-                    PrintUsage();
-                g_masterVolume = std::stoi(arg);
+            case 'T':
+                printTimes = true;
                 break;
-            case 'X':
-                g_clocksPerBeat = 2;
+            case 'U':
+                onlyOutOfDate = true;
                 break;
             default:
                 PrintUsage();
@@ -196,6 +497,15 @@ int main(int argc, char** argv)
         }
     }
 
+    if (!cfgFilename.empty())
+    {
+        if (!inputFilename.empty())
+            PrintUsage();
+
+        ConvertMidiCfg(cfgFilename, outputDir, stampFilename, objectOutput, onlyOutOfDate, printTimes);
+        return 0;
+    }
+
     if (inputFilename.empty())
         PrintUsage();
 
@@ -203,31 +513,19 @@ int main(int argc, char** argv)
         RaiseError("input filename extension is not \"mid\"");
 
     if (outputFilename.empty())
-        outputFilename = StripExtension(inputFilename) + ".s";
-
-    if (GetExtension(outputFilename) != "s")
-        RaiseError("output filename extension is not \"s\"");
-
-    if (g_asmLabel.empty())
-        g_asmLabel = BaseName(outputFilename);
-
-    g_inputFile = std::fopen(inputFilename.c_str(), "rb");
-
-    if (g_inputFile == nullptr)
-        RaiseError("failed to open \"%s\" for reading", inputFilename.c_str());
+        outputFilename = StripExtension(inputFilename) + (objectOutput ? ".o" : ".s");
 
-    g_outputFile = std::fopen(outputFilename.c_str(), "w");
+    if (GetExtension(outputFilename) == "o")
+        objectOutput = true;
+    else if (GetExtension(outputFilename) != "s")
+        RaiseError("output filename extension is not \"s\" or \"o\"");
 
-    if (g_outputFile == nullptr)
-        RaiseError("failed to open \"%s\" for writing", outputFilename.c_str());
+    if (options.asmLabel.empty())
+        options.asmLabel = BaseName(outputFilename);
 
-    ReadMidiFileHeader();
-    PrintAgbHeader();
-    ReadMidiTracks();
-    PrintAgbFooter();
+    std::string text = ConvertSong(inputFilename, options, objectOutput);
 
-    std::fclose(g_inputFile);
-    std::fclose(g_outputFile);
+    WriteFile(outputFilename, text, objectOutput);
 
     return 0;
 }
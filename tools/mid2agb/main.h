@@ -21,19 +21,19 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#include <cstdio>
 #include <string>
 
-extern FILE* g_inputFile;
-extern FILE* g_outputFile;
-
-extern std::string g_asmLabel;
-extern int g_masterVolume;
-extern int g_voiceGroup;
-extern int g_priority;
-extern int g_reverb;
-extern int g_clocksPerBeat;
-extern bool g_exactGateTime;
-extern bool g_compressionEnabled;
+// The options a song is converted with, from the command line or its line in midi.cfg.
+struct SongOptions
+{
+    std::string asmLabel;
+    int masterVolume = 127;
+    int voiceGroup = 0;
+    int priority = 0;
+    int reverb = -1;
+    int clocksPerBeat = 1;
+    bool exactGateTime = false;
+    bool compressionEnabled = true;
+};
 
 #endif // MAIN_H
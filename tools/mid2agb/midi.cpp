@@ -24,6 +24,7 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <unordered_map>
 #include "midi.h"
 #include "main.h"
 #include "error.h"
@@ -38,55 +39,74 @@ enum class MidiEventCategory
     Invalid,
 };
 
-MidiFormat g_midiFormat;
-std::int_fast32_t g_midiTrackCount;
-std::int16_t g_midiTimeDiv;
+void MidiReader::Load(const std::string& filename)
+{
+    FILE* file = std::fopen(filename.c_str(), "rb");
 
-int g_midiChan;
-std::int32_t g_initialWait;
+    if (file == nullptr)
+        RaiseError("failed to open \"%s\" for reading", filename.c_str());
 
-static long s_trackDataStart;
-static std::vector<Event> s_seqEvents;
-static std::vector<Event> s_trackEvents;
-static std::int32_t s_absoluteTime;
-static int s_blockCount = 0;
-static int s_minNote;
-static int s_maxNote;
-static int s_runningStatus;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
 
-void Seek(long offset)
-{
-    if (std::fseek(g_inputFile, offset, SEEK_SET) != 0)
-        RaiseError("failed to seek to %l", offset);
+    if (size < 0)
+        RaiseError("failed to get the size of \"%s\"", filename.c_str());
+
+    m_data.resize(size);
+
+    if (size > 0 && std::fread(m_data.data(), size, 1, file) != 1)
+        RaiseError("failed to read \"%s\"", filename.c_str());
+
+    std::fclose(file);
+    m_pos = 0;
 }
 
-void Skip(long offset)
+void MidiReader::Seek(std::size_t offset)
 {
-    if (std::fseek(g_inputFile, offset, SEEK_CUR) != 0)
-        RaiseError("failed to skip %l bytes", offset);
+    if (offset > m_data.size())
+        RaiseError("failed to seek to %lu", (unsigned long)offset);
+
+    m_pos = offset;
 }
 
-std::string ReadSignature()
+void MidiReader::Skip(std::size_t count)
 {
-    char signature[4];
+    if (count > m_data.size() - m_pos)
+        RaiseError("failed to skip %lu bytes", (unsigned long)count);
 
-    if (std::fread(signature, 4, 1, g_inputFile) != 1)
+    m_pos += count;
+}
+
+std::string MidiReader::ReadSignature()
+{
+    if (m_data.size() - m_pos < 4)
         RaiseError("failed to read signature");
 
-    return std::string(signature, 4);
+    std::string signature((const char*)&m_data[m_pos], 4);
+    m_pos += 4;
+    return signature;
 }
 
-std::uint32_t ReadInt8()
+std::string MidiReader::ReadText(std::size_t length)
 {
-    int c = std::fgetc(g_inputFile);
+    if (length > m_data.size() - m_pos)
+        RaiseError("failed to read event text");
+
+    std::string text((const char*)m_data.data() + m_pos, length);
+    m_pos += length;
+    return text;
+}
 
-    if (c < 0)
+std::uint32_t MidiReader::ReadInt8()
+{
+    if (m_pos >= m_data.size())
         RaiseError("unexpected EOF");
 
-    return c;
+    return m_data[m_pos++];
 }
 
-std::uint32_t ReadInt16()
+std::uint32_t MidiReader::ReadInt16()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 8;
@@ -94,7 +114,7 @@ std::uint32_t ReadInt16()
     return val;
 }
 
-std::uint32_t ReadInt24()
+std::uint32_t MidiReader::ReadInt24()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 16;
@@ -103,7 +123,7 @@ std::uint32_t ReadInt24()
     return val;
 }
 
-std::uint32_t ReadInt32()
+std::uint32_t MidiReader::ReadInt32()
 {
     std::uint32_t val = 0;
     val |= ReadInt8() << 24;
@@ -113,7 +133,7 @@ std::uint32_t ReadInt32()
     return val;
 }
 
-std::uint32_t ReadVLQ()
+std::uint32_t MidiReader::ReadVLQ()
 {
     std::uint32_t val = 0;
     std::uint32_t c;
@@ -128,79 +148,81 @@ std::uint32_t ReadVLQ()
     return val;
 }
 
-void ReadMidiFileHeader()
+void ReadMidiFileHeader(MidiSong& song)
 {
-    Seek(0);
+    MidiReader& reader = song.reader;
+
+    reader.Seek(0);
 
-    if (ReadSignature() != "MThd")
+    if (reader.ReadSignature() != "MThd")
         RaiseError("MIDI file header signature didn't match \"MThd\"");
 
-    std::uint32_t headerLength = ReadInt32();
+    std::uint32_t headerLength = reader.ReadInt32();
 
     if (headerLength != 6)
         RaiseError("MIDI file header length isn't 6");
 
-    std::uint16_t midiFormat = ReadInt16();
+    std::uint16_t midiFormat = reader.ReadInt16();
 
     if (midiFormat >= 2)
         RaiseError("unsupported MIDI format (%u)", midiFormat);
 
-    g_midiFormat = (MidiFormat)midiFormat;
-    g_midiTrackCount = ReadInt16();
-    g_midiTimeDiv = ReadInt16();
+    song.format = (MidiFormat)midiFormat;
+    song.trackCount = reader.ReadInt16();
+    song.timeDiv = reader.ReadInt16();
 
-    if (g_midiTimeDiv < 0)
-        RaiseError("unsupported MIDI time division (%d)", g_midiTimeDiv);
+    if (song.timeDiv < 0)
+        RaiseError("unsupported MIDI time division (%d)", song.timeDiv);
 }
 
-long ReadMidiTrackHeader(long offset)
+long ReadMidiTrackHeader(MidiSong& song, long offset)
 {
-    Seek(offset);
+    song.reader.Seek(offset);
 
-    if (ReadSignature() != "MTrk")
+    if (song.reader.ReadSignature() != "MTrk")
         RaiseError("MIDI track header signature didn't match \"MTrk\"");
 
-    long size = ReadInt32();
+    long size = song.reader.ReadInt32();
 
-    s_trackDataStart = std::ftell(g_inputFile);
+    song.trackDataStart = song.reader.Tell();
 
     return size + 8;
 }
 
-void StartTrack()
+void StartTrack(MidiSong& song)
 {
-    Seek(s_trackDataStart);
-    s_absoluteTime = 0;
-    s_runningStatus = 0;
+    song.reader.Seek(song.trackDataStart);
+    song.absoluteTime = 0;
+    song.runningStatus = 0;
 }
 
-void SkipEventData()
+void SkipEventData(MidiSong& song)
 {
-    Skip(ReadVLQ());
+    song.reader.Skip(song.reader.ReadVLQ());
 }
 
-void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& size)
+void DetermineEventCategory(MidiSong& song, MidiEventCategory& category, int& typeChan, int& size)
 {
-    typeChan = ReadInt8();
+    typeChan = song.reader.ReadInt8();
 
     if (typeChan < 0x80)
     {
         // If data byte was found, use the running status.
-        ungetc(typeChan, g_inputFile);
-        typeChan = s_runningStatus;
+        song.reader.Unread();
+        typeChan = song.runningStatus;
     }
 
     if (typeChan == 0xFF)
     {
         category = MidiEventCategory::Meta;
         size = 0;
-        s_runningStatus = 0;
+        song.runningStatus = 0;
     }
     else if (typeChan >= 0xF0)
     {
         category = MidiEventCategory::SysEx;
         size = 0;
-        s_runningStatus = 0;
+        song.runningStatus = 0;
     }
     else if (typeChan >= 0x80)
     {
@@ -216,7 +238,7 @@ void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& siz
             size = 2;
             break;
         }
-        s_runningStatus = typeChan;
+        song.runningStatus = typeChan;
     }
     else
     {
@@ -224,52 +246,47 @@ void DetermineEventCategory(MidiEventCategory& category, int& typeChan, int& siz
     }
 }
 
-void MakeBlockEvent(Event& event, EventType type)
+void MakeBlockEvent(MidiSong& song, Event& event, EventType type)
 {
     event.type = type;
-    event.param1 = s_blockCount++;
+    event.param1 = song.blockCount++;
     event.param2 = 0;
 }
 
-std::string ReadEventText()
+std::string ReadEventText(MidiSong& song)
 {
-    char buffer[2];
-    std::uint32_t length = ReadVLQ();
+    std::uint32_t length = song.reader.ReadVLQ();
 
+    // Only the loop and label markers matter, and none are longer than 2.
     if (length <= 2)
-    {
-        if (fread(buffer, length, 1, g_inputFile) != 1)
-            RaiseError("failed to read event text");
-    }
-    else
-    {
-        Skip(length);
-        length = 0;
-    }
+        return song.reader.ReadText(length);
 
-    return std::string(buffer, length);
+    song.reader.Skip(length);
+    return std::string();
 }
 
-bool ReadSeqEvent(Event& event)
+bool ReadSeqEvent(MidiSong& song, Event& event)
 {
-    s_absoluteTime += ReadVLQ();
-    event.time = s_absoluteTime;
+    MidiReader& reader = song.reader;
+
+    song.absoluteTime += reader.ReadVLQ();
+    event.time = song.absoluteTime;
 
     MidiEventCategory category;
     int typeChan;
     int size;
 
-    DetermineEventCategory(category, typeChan, size);
+    DetermineEventCategory(song, category, typeChan, size);
 
     if (category == MidiEventCategory::Control)
     {
-        Skip(size);
+        reader.Skip(size);
         return false;
     }
 
     if (category == MidiEventCategory::SysEx)
     {
-        SkipEventData();
+        SkipEventData(song);
         return false;
     }
 
@@ -277,21 +294,21 @@ bool ReadSeqEvent(Event& event)
         RaiseError("invalid event");
 
     // meta event
-    int metaEventType = ReadInt8();
+    int metaEventType = reader.ReadInt8();
 
     if (metaEventType >= 1 && metaEventType <= 7)
     {
         // text event
-        std::string text = ReadEventText();
+        std::string text = ReadEventText(song);
 
         if (text == "[")
-            MakeBlockEvent(event, EventType::LoopBegin);
+            MakeBlockEvent(song, event, EventType::LoopBegin);
         else if (text == "][")
-            MakeBlockEvent(event, EventType::LoopEndBegin);
+            MakeBlockEvent(song, event, EventType::LoopEndBegin);
         else if (text == "]")
-            MakeBlockEvent(event, EventType::LoopEnd);
+            MakeBlockEvent(song, event, EventType::LoopEnd);
         else if (text == ":")
-            MakeBlockEvent(event, EventType::Label);
+            MakeBlockEvent(song, event, EventType::Label);
         else
             return false;
     }
@@ -300,33 +317,33 @@ bool ReadSeqEvent(Event& event)
         switch (metaEventType)
         {
         case 0x2F: // end of track
-            SkipEventData();
+            SkipEventData(song);
             event.type = EventType::EndOfTrack;
             event.param1 = 0;
             event.param2 = 0;
             break;
         case 0x51: // tempo
-            if (ReadVLQ() != 3)
+            if (reader.ReadVLQ() != 3)
                 RaiseError("invalid tempo size");
 
             event.type = EventType::Tempo;
             event.param1 = 0;
-            event.param2 = ReadInt24();
+            event.param2 = reader.ReadInt24();
             break;
         case 0x58: // time signature
         {
-            if (ReadVLQ() != 4)
+            if (reader.ReadVLQ() != 4)
                 RaiseError("invalid time signature size");
 
-            int numerator = ReadInt8();
-            int denominatorExponent = ReadInt8();
+            int numerator = reader.ReadInt8();
+            int denominatorExponent = reader.ReadInt8();
 
             if (denominatorExponent >= 16)
                 RaiseError("invalid time signature denominator");
 
-            Skip(2); // ignore other values
+            reader.Skip(2); // ignore other values
 
-            int clockTicks = 96 * numerator * g_clocksPerBeat;
+            int clockTicks = 96 * numerator * song.options.clocksPerBeat;
             int denominator = 1 << denominatorExponent;
             int timeSig = clockTicks / denominator;
 
@@ -339,7 +356,7 @@ bool ReadSeqEvent(Event& event)
             break;
         }
         default:
-            SkipEventData();
+            SkipEventData(song);
             return false;
         }
     }
@@ -347,17 +364,17 @@ bool ReadSeqEvent(Event& event)
     return true;
 }
 
-void ReadSeqEvents()
+void ReadSeqEvents(MidiSong& song)
 {
-    StartTrack();
+    StartTrack(song);
 
     for (;;)
     {
         Event event = {};
 
-        if (ReadSeqEvent(event))
+        if (ReadSeqEvent(song, event))
         {
-            s_seqEvents.push_back(event);
+            song.seqEvents.push_back(event);
 
             if (event.type == EventType::EndOfTrack)
                 return;
@@ -365,23 +382,25 @@ void ReadSeqEvents()
     }
 }
 
-bool CheckNoteEnd(Event& event)
+bool CheckNoteEnd(MidiSong& song, Event& event)
 {
-    event.param2 += ReadVLQ();
+    MidiReader& reader = song.reader;
+
+    event.param2 += reader.ReadVLQ();
 
     MidiEventCategory category;
     int typeChan;
     int size;
 
-    DetermineEventCategory(category, typeChan, size);
+    DetermineEventCategory(song, category, typeChan, size);
 
     if (category == MidiEventCategory::Control)
     {
         int chan = typeChan & 0xF;
 
-        if (chan != g_midiChan)
+        if (chan != song.midiChan)
         {
-            Skip(size);
+            reader.Skip(size);
             return false;
         }
 
@@ -389,22 +408,22 @@ bool CheckNoteEnd(Event& event)
         {
         case 0x80: // note off
         {
-            int note = ReadInt8();
-            ReadInt8(); // ignore velocity
+            int note = reader.ReadInt8();
+            reader.ReadInt8(); // ignore velocity
             if (note == event.note)
                 return true;
             break;
         }
         case 0x90: // note on
         {
-            int note = ReadInt8();
-            int velocity = ReadInt8();
+            int note = reader.ReadInt8();
+            int velocity = reader.ReadInt8();
             if (velocity == 0 && note == event.note)
                 return true;
             break;
         }
         default:
-            Skip(size);
+            reader.Skip(size);
             break;
         }
 
@@ -413,14 +432,14 @@ bool CheckNoteEnd(Event& event)
 
     if (category == MidiEventCategory::SysEx)
     {
-        SkipEventData();
+        SkipEventData(song);
         return false;
     }
 
     if (category == MidiEventCategory::Meta)
     {
-        int metaEventType = ReadInt8();
-        SkipEventData();
+        int metaEventType = reader.ReadInt8();
+        SkipEventData(song);
 
         if (metaEventType == 0x2F)
             RaiseError("note doesn't end");
@@ -431,40 +450,42 @@ bool CheckNoteEnd(Event& event)
     RaiseError("invalid event");
 }
 
-void FindNoteEnd(Event& event)
+void FindNoteEnd(MidiSong& song, Event& event)
 {
-    // Save the current file position and running status
+    // Save the current position and running status
     // which get modified by CheckNoteEnd.
-    long startPos = ftell(g_inputFile);
-    int savedRunningStatus = s_runningStatus;
+    std::size_t startPos = song.reader.Tell();
+    int savedRunningStatus = song.runningStatus;
 
     event.param2 = 0;
 
-    while (!CheckNoteEnd(event))
+    while (!CheckNoteEnd(song, event))
         ;
 
-    Seek(startPos);
-    s_runningStatus = savedRunningStatus;
+    song.reader.Seek(startPos);
+    song.runningStatus = savedRunningStatus;
 }
 
-bool ReadTrackEvent(Event& event)
+bool ReadTrackEvent(MidiSong& song, Event& event)
 {
-    s_absoluteTime += ReadVLQ();
-    event.time = s_absoluteTime;
+    MidiReader& reader = song.reader;
+
+    song.absoluteTime += reader.ReadVLQ();
+    event.time = song.absoluteTime;
 
     MidiEventCategory category;
     int typeChan;
     int size;
 
-    DetermineEventCategory(category, typeChan, size);
+    DetermineEventCategory(song, category, typeChan, size);
 
     if (category == MidiEventCategory::Control)
     {
         int chan = typeChan & 0xF;
 
-        if (chan != g_midiChan)
+        if (chan != song.midiChan)
         {
-            Skip(size);
+            reader.Skip(size);
             return false;
         }
 
@@ -472,42 +493,42 @@ bool ReadTrackEvent(Event& event)
         {
         case 0x90: // note on
         {
-            int note = ReadInt8();
-            int velocity = ReadInt8();
+            int note = reader.ReadInt8();
+            int velocity = reader.ReadInt8();
 
             if (velocity != 0)
             {
                 event.type = EventType::Note;
                 event.note = note;
                 event.param1 = velocity;
-                FindNoteEnd(event);
+                FindNoteEnd(song, event);
                 if (event.param2 > 0)
                 {
-                    if (note < s_minNote)
-                        s_minNote = note;
-                    if (note > s_maxNote)
-                        s_maxNote = note;
+                    if (note < song.minNote)
+                        song.minNote = note;
+                    if (note > song.maxNote)
+                        song.maxNote = note;
                 }
             }
             break;
         }
         case 0xB0: // controller event
             event.type = EventType::Controller;
-            event.param1 = ReadInt8(); // controller index
-            event.param2 = ReadInt8(); // value
+            event.param1 = reader.ReadInt8(); // controller index
+            event.param2 = reader.ReadInt8(); // value
             break;
         case 0xC0: // instrument change
             event.type = EventType::InstrumentChange;
-            event.param1 = ReadInt8(); // instrument
+            event.param1 = reader.ReadInt8(); // instrument
             event.param2 = 0;
             break;
         case 0xE0: // pitch bend
             event.type = EventType::PitchBend;
-            event.param1 = ReadInt8();
-            event.param2 = ReadInt8();
+            event.param1 = reader.ReadInt8();
+            event.param2 = reader.ReadInt8();
             break;
         default:
-            Skip(size);
+            reader.Skip(size);
             return false;
         }
 
@@ -516,14 +537,14 @@ bool ReadTrackEvent(Event& event)
 
     if (category == MidiEventCategory::SysEx)
     {
-        SkipEventData();
+        SkipEventData(song);
         return false;
     }
 
     if (category == MidiEventCategory::Meta)
     {
-        int metaEventType = ReadInt8();
-        SkipEventData();
+        int metaEventType = reader.ReadInt8();
+        SkipEventData(song);
 
         if (metaEventType == 0x2F)
         {
@@ -539,22 +560,22 @@ bool ReadTrackEvent(Event& event)
     RaiseError("invalid event");
 }
 
-void ReadTrackEvents()
+void ReadTrackEvents(MidiSong& song)
 {
-    StartTrack();
+    StartTrack(song);
 
-    s_trackEvents.clear();
+    song.trackEvents.clear();
 
-    s_minNote = 0xFF;
-    s_maxNote = 0;
+    song.minNote = 0xFF;
+    song.maxNote = 0;
 
     for (;;)
     {
         Event event = {};
 
-        if (ReadTrackEvent(event))
+        if (ReadTrackEvent(song, event))
         {
-            s_trackEvents.push_back(event);
+            song.trackEvents.push_back(event);
 
             if (event.type == EventType::EndOfTrack)
                 return;
@@ -597,53 +618,53 @@ bool EventCompare(const Event& event1, const Event& event2)
     return false;
 }
 
-std::unique_ptr<std::vector<Event>> MergeEvents()
+std::unique_ptr<std::vector<Event>> MergeEvents(const MidiSong& song)
 {
     std::unique_ptr<std::vector<Event>> events(new std::vector<Event>());
 
     unsigned trackEventPos = 0;
     unsigned seqEventPos = 0;
 
-    while (s_trackEvents[trackEventPos].type != EventType::EndOfTrack
-        && s_seqEvents[seqEventPos].type != EventType::EndOfTrack)
+    while (song.trackEvents[trackEventPos].type != EventType::EndOfTrack
+        && song.seqEvents[seqEventPos].type != EventType::EndOfTrack)
     {
-        if (EventCompare(s_trackEvents[trackEventPos], s_seqEvents[seqEventPos]))
-            events->push_back(s_trackEvents[trackEventPos++]);
+        if (EventCompare(song.trackEvents[trackEventPos], song.seqEvents[seqEventPos]))
+            events->push_back(song.trackEvents[trackEventPos++]);
         else
-            events->push_back(s_seqEvents[seqEventPos++]);
+            events->push_back(song.seqEvents[seqEventPos++]);
     }
 
-    while (s_trackEvents[trackEventPos].type != EventType::EndOfTrack)
-        events->push_back(s_trackEvents[trackEventPos++]);
+    while (song.trackEvents[trackEventPos].type != EventType::EndOfTrack)
+        events->push_back(song.trackEvents[trackEventPos++]);
 
-    while (s_seqEvents[seqEventPos].type != EventType::EndOfTrack)
-        events->push_back(s_seqEvents[seqEventPos++]);
+    while (song.seqEvents[seqEventPos].type != EventType::EndOfTrack)
+        events->push_back(song.seqEvents[seqEventPos++]);
 
     // Push the EndOfTrack event with the larger time.
-    if (EventCompare(s_trackEvents[trackEventPos], s_seqEvents[seqEventPos]))
-        events->push_back(s_seqEvents[seqEventPos]);
+    if (EventCompare(song.trackEvents[trackEventPos], song.seqEvents[seqEventPos]))
+        events->push_back(song.seqEvents[seqEventPos]);
     else
-        events->push_back(s_trackEvents[trackEventPos]);
+        events->push_back(song.trackEvents[trackEventPos]);
 
     return events;
 }
 
-void ConvertTimes(std::vector<Event>& events)
+void ConvertTimes(const MidiSong& song, std::vector<Event>& events)
 {
     for (Event& event : events)
     {
-        event.time = (24 * g_clocksPerBeat * event.time) / g_midiTimeDiv;
+        event.time = (24 * song.options.clocksPerBeat * event.time) / song.timeDiv;
 
         if (event.type == EventType::Note)
         {
             event.param1 = g_noteVelocityLUT[event.param1];
 
-            std::uint32_t duration = (24 * g_clocksPerBeat * event.param2) / g_midiTimeDiv;
+            std::uint32_t duration = (24 * song.options.clocksPerBeat * event.param2) / song.timeDiv;
 
             if (duration == 0)
                 duration = 1;
 
-            if (!g_exactGateTime && duration < 96)
+            if (!song.options.exactGateTime && duration < 96)
                 duration = g_noteDurationLUT[duration];
 
             event.param2 = duration;
@@ -651,14 +672,14 @@ void ConvertTimes(std::vector<Event>& events)
     }
 }
 
-std::unique_ptr<std::vector<Event>> InsertTimingEvents(std::vector<Event>& inEvents)
+std::unique_ptr<std::vector<Event>> InsertTimingEvents(const MidiSong& song, std::vector<Event>& inEvents)
 {
     std::unique_ptr<std::vector<Event>> outEvents(new std::vector<Event>());
 
     Event timingEvent = {};
     timingEvent.time = 0;
     timingEvent.type = EventType::TimeSignature;
-    timingEvent.param2 = 96 * g_clocksPerBeat;
+    timingEvent.param2 = 96 * song.options.clocksPerBeat;
 
     for (const Event& event : inEvents)
     {
@@ -670,7 +691,7 @@ std::unique_ptr<std::vector<Event>> InsertTimingEvents(std::vector<Event>& inEve
 
         if (event.type == EventType::TimeSignature)
         {
-            if (g_agbTrack == 1 && event.param2 != timingEvent.param2)
+            if (song.agbTrack == 1 && event.param2 != timingEvent.param2)
             {
                 Event originalTimingEvent = event;
                 originalTimingEvent.type = EventType::OriginalTimeSignature;
@@ -756,9 +777,9 @@ std::unique_ptr<std::vector<Event>> CreateTies(std::vector<Event>& inEvents)
     return outEvents;
 }
 
-void CalculateWaits(std::vector<Event>& events)
+void CalculateWaits(MidiSong& song, std::vector<Event>& events)
 {
-    g_initialWait = events[0].time;
+    song.initialWait = events[0].time;
     int wholeNoteCount = 0;
 
     for (unsigned i = 0; i < events.size() && events[i].type != EventType::EndOfTrack; i++)
@@ -873,17 +894,40 @@ bool IsCompressionMatch(std::vector<Event>& events, int index1, int index2)
     return IsPatternBoundary(events[index2].type);
 }
 
-void CompressWholeNote(std::vector<Event>& events, int index)
+// Hashes the fields of a whole-note block that IsCompressionMatch requires to be
+// equal: the mark's note, param1 and time and every event up to the next pattern
+// boundary. None of these change while compressing, as only the boundary events
+// (marks becoming patterns) are modified.
+std::uint64_t HashWholeNote(const std::vector<Event>& events, int index)
 {
-    for (int j = index + 1; events[j].type != EventType::EndOfTrack; j++)
+    std::uint64_t hash = 0xCBF29CE484222325u;
+
+    auto mix = [&hash](std::uint32_t value) {
+        hash = (hash ^ value) * 0x100000001B3u;
+    };
+
+    mix(events[index].note | (events[index].param1 << 8));
+    mix(events[index].time);
+
+    for (int i = index + 1; !IsPatternBoundary(events[i].type); i++)
     {
-        while (events[j].type != EventType::WholeNoteMark)
-        {
-            j++;
+        mix((int)events[i].type | (events[i].note << 8) | (events[i].param1 << 16));
+        mix(events[i].time);
+        mix(events[i].param2);
+    }
 
-            if (events[j].type == EventType::EndOfTrack)
-                return;
-        }
+    return hash;
+}
+
+// Marks each later whole-note block that repeats the one at index as a pattern
+// call to it. Only blocks whose hashes match are compared event by event, so
+// the blocks that end up compressed are the same as comparing against all of them.
+void CompressWholeNote(std::vector<Event>& events, int index, const std::vector<int>& candidates)
+{
+    for (int j : candidates)
+    {
+        if (j <= index || events[j].type != EventType::WholeNoteMark)
+            continue;
 
         if (IsCompressionMatch(events, index, j))
         {
@@ -896,68 +940,81 @@ void CompressWholeNote(std::vector<Event>& events, int index)
 
 void Compress(std::vector<Event>& events)
 {
+    std::vector<int> wholeNotes;
+    std::vector<std::uint64_t> hashes;
+    std::unordered_map<std::uint64_t, std::vector<int>> blocksByHash;
+
     for (int i = 0; events[i].type != EventType::EndOfTrack; i++)
     {
-        while (events[i].type != EventType::WholeNoteMark)
+        if (events[i].type == EventType::WholeNoteMark)
         {
-            i++;
-
-            if (events[i].type == EventType::EndOfTrack)
-                return;
+            wholeNotes.push_back(i);
+            hashes.push_back(HashWholeNote(events, i));
+            blocksByHash[hashes.back()].push_back(i);
         }
+    }
+
+    for (std::size_t k = 0; k < wholeNotes.size(); k++)
+    {
+        int i = wholeNotes[k];
+
+        if (events[i].type != EventType::WholeNoteMark)
+            continue;
+
+        const std::vector<int>& candidates = blocksByHash[hashes[k]];
 
-        if (CalculateCompressionScore(events, i) >= 6)
+        if (candidates.size() > 1 && CalculateCompressionScore(events, i) >= 6)
         {
-            CompressWholeNote(events, i);
+            CompressWholeNote(events, i, candidates);
         }
     }
 }
 
-void ReadMidiTracks()
+void ReadMidiTracks(MidiSong& song, AgbWriter& writer)
 {
     long trackHeaderStart = 14;
 
-    ReadMidiTrackHeader(trackHeaderStart);
-    ReadSeqEvents();
+    ReadMidiTrackHeader(song, trackHeaderStart);
+    ReadSeqEvents(song);
 
-    g_agbTrack = 1;
+    song.agbTrack = 1;
 
-    for (int midiTrack = 0; midiTrack < g_midiTrackCount; midiTrack++)
+    for (int midiTrack = 0; midiTrack < song.trackCount; midiTrack++)
     {
-        trackHeaderStart += ReadMidiTrackHeader(trackHeaderStart);
+        trackHeaderStart += ReadMidiTrackHeader(song, trackHeaderStart);
 
-        for (g_midiChan = 0; g_midiChan < 16; g_midiChan++)
+        for (song.midiChan = 0; song.midiChan < 16; song.midiChan++)
         {
-            ReadTrackEvents();
+            ReadTrackEvents(song);
 
-            if (s_minNote != 0xFF)
+            if (song.minNote != 0xFF)
             {
 #ifdef DEBUG
-                printf("Track%d = Midi-Ch.%d\n", g_agbTrack, g_midiChan + 1);
+                printf("Track%d = Midi-Ch.%d\n", song.agbTrack, song.midiChan + 1);
 #endif
 
-                std::unique_ptr<std::vector<Event>> events(MergeEvents());
+                std::unique_ptr<std::vector<Event>> events(MergeEvents(song));
 
                 // We don't need TEMPO in anything but track 1.
-                if (g_agbTrack == 1)
+                if (song.agbTrack == 1)
                 {
-                    auto it = std::remove_if(s_seqEvents.begin(), s_seqEvents.end(), [](const Event& event) { return event.type == EventType::Tempo; });
-                    s_seqEvents.erase(it, s_seqEvents.end());
+                    auto it = std::remove_if(song.seqEvents.begin(), song.seqEvents.end(), [](const Event& event) { return event.type == EventType::Tempo; });
+                    song.seqEvents.erase(it, song.seqEvents.end());
                 }
 
-                ConvertTimes(*events);
-                events = InsertTimingEvents(*events);
+                ConvertTimes(song, *events);
+                events = InsertTimingEvents(song, *events);
                 events = CreateTies(*events);
                 std::stable_sort(events->begin(), events->end(), EventCompare);
                 events = SplitTime(*events);
-                CalculateWaits(*events);
+                CalculateWaits(song, *events);
 
-                if (g_compressionEnabled)
+                if (song.options.compressionEnabled)
                     Compress(*events);
 
-                PrintAgbTrack(*events);
+                writer.PrintTrack(*events);
 
-                g_agbTrack++;
+                song.agbTrack++;
             }
         }
     }
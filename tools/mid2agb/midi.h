@@ -21,7 +21,11 @@
 #ifndef MIDI_H
 #define MIDI_H
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <vector>
+#include "main.h"
 
 enum class MidiFormat
 {
@@ -73,11 +77,60 @@ struct Event
     }
 };
 
-void ReadMidiFileHeader();
-void ReadMidiTracks();
+// A bounds-checked cursor over a MIDI file that has been read into memory whole.
+class MidiReader
+{
+public:
+    void Load(const std::string& filename);
+
+    std::size_t Tell() const { return m_pos; }
+    void Seek(std::size_t offset);
+    void Skip(std::size_t count);
+    void Unread() { m_pos--; }
+
+    std::string ReadSignature();
+    std::string ReadText(std::size_t length);
+    std::uint32_t ReadInt8();
+    std::uint32_t ReadInt16();
+    std::uint32_t ReadInt24();
+    std::uint32_t ReadInt32();
+    std::uint32_t ReadVLQ();
+
+private:
+    std::vector<std::uint8_t> m_data;
+    std::size_t m_pos = 0;
+};
+
+// Everything the converter keeps while reading one MIDI file.
+struct MidiSong
+{
+    SongOptions options;
+    MidiReader reader;
+
+    MidiFormat format;
+    std::int_fast32_t trackCount;
+    std::int16_t timeDiv;
+
+    int midiChan;
+    std::int32_t initialWait;
+
+    std::size_t trackDataStart;
+    std::vector<Event> seqEvents;
+    std::vector<Event> trackEvents;
+    std::int32_t absoluteTime;
+    int blockCount = 0;
+    int minNote;
+    int maxNote;
+    int runningStatus;
+
+    // The number of the AGB track being converted, counting from 1.
+    int agbTrack;
+};
+
+class AgbWriter;
 
-extern int g_midiChan;
-extern std::int32_t g_initialWait;
+void ReadMidiFileHeader(MidiSong& song);
+void ReadMidiTracks(MidiSong& song, AgbWriter& writer);
 
 inline bool IsPatternBoundary(EventType type)
 {
@@ -121,6 +121,109 @@ const int g_noteDurationLUT[] =
     96, // 96
 };
 
+// The index of each length's W?? and N?? command in MPlayDef.s, counting from
+// W00 and TIE. Lengths without a command are -1.
+const int g_lengthIndexLUT[] =
+{
+    0, // 0
+    1, // 1
+    2, // 2
+    3, // 3
+    4, // 4
+    5, // 5
+    6, // 6
+    7, // 7
+    8, // 8
+    9, // 9
+    10, // 10
+    11, // 11
+    12, // 12
+    13, // 13
+    14, // 14
+    15, // 15
+    16, // 16
+    17, // 17
+    18, // 18
+    19, // 19
+    20, // 20
+    21, // 21
+    22, // 22
+    23, // 23
+    24, // 24
+    -1, // 25
+    -1, // 26
+    -1, // 27
+    25, // 28
+    -1, // 29
+    26, // 30
+    -1, // 31
+    27, // 32
+    -1, // 33
+    -1, // 34
+    -1, // 35
+    28, // 36
+    -1, // 37
+    -1, // 38
+    -1, // 39
+    29, // 40
+    -1, // 41
+    30, // 42
+    -1, // 43
+    31, // 44
+    -1, // 45
+    -1, // 46
+    -1, // 47
+    32, // 48
+    -1, // 49
+    -1, // 50
+    -1, // 51
+    33, // 52
+    -1, // 53
+    34, // 54
+    -1, // 55
+    35, // 56
+    -1, // 57
+    -1, // 58
+    -1, // 59
+    36, // 60
+    -1, // 61
+    -1, // 62
+    -1, // 63
+    37, // 64
+    -1, // 65
+    38, // 66
+    -1, // 67
+    39, // 68
+    -1, // 69
+    -1, // 70
+    -1, // 71
+    40, // 72
+    -1, // 73
+    -1, // 74
+    -1, // 75
+    41, // 76
+    -1, // 77
+    42, // 78
+    -1, // 79
+    43, // 80
+    -1, // 81
+    -1, // 82
+    -1, // 83
+    44, // 84
+    -1, // 85
+    -1, // 86
+    -1, // 87
+    45, // 88
+    -1, // 89
+    46, // 90
+    -1, // 91
+    47, // 92
+    -1, // 93
+    -1, // 94
+    -1, // 95
+    48, // 96
+};
+
 const int g_noteVelocityLUT[] =
 {
     0, // 0
@@ -22,6 +22,7 @@
 #define TABLES_H
 
 extern const int g_noteDurationLUT[];
+extern const int g_lengthIndexLUT[];
 extern const int g_noteVelocityLUT[];
 extern const char* g_noteTable[];
 extern const char* g_minusNoteTable[];
@@ -3,215 +3,427 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sys/stat.h>
 #include "ramscrgen.h"
 #include "elf.h"
 
-#define SHN_COMMON 0xFFF2
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-static std::string s_elfPath;
-static std::string s_archiveFilePath;
-static std::string s_archiveObjectPath;
+#define SHN_COMMON 0xFFF2
 
-static FILE *s_file;
+#define CACHE_VERSION "ramscrgen-common 1"
 
-static std::uint32_t s_sectionHeaderOffset;
-static int s_sectionHeaderEntrySize;
-static int s_sectionCount;
-static int s_shstrtabIndex;
+// An object file mapped read-only into memory, or read into a buffer where mmap isn't
+// available.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
 
-static std::uint32_t s_symtabOffset;
-static std::uint32_t s_strtabOffset;
-static std::uint32_t s_pseudoCommonSectionIndex;
+    const unsigned char *Data() const { return m_data; }
+    std::size_t Size() const { return m_size; }
 
-static std::uint32_t s_symbolCount;
-static std::uint32_t s_elfFileOffset;
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
 
-struct Symbol
-{
-    std::uint32_t nameOffset;
-    std::uint32_t size;
+    const unsigned char *m_data;
+    std::size_t m_size;
+    std::vector<unsigned char> m_buffer;
 };
 
-static void Seek(long offset)
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
 {
-    if (std::fseek(s_file, s_elfFileOffset + offset, SEEK_SET) != 0)
-        FATAL_ERROR("error: failed to seek to %ld in \"%s\"", offset, s_elfPath.c_str());
+    FILE *file = std::fopen(path.c_str(), "rb");
+
+    if (file == NULL)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", path.c_str());
+
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::rewind(file);
+
+    m_buffer.resize(size > 0 ? size : 0);
+
+    if (size > 0 && std::fread(m_buffer.data(), size, 1, file) != 1)
+        FATAL_ERROR("error: failed to read \"%s\"\n", path.c_str());
+
+    std::fclose(file);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
 }
 
-static void Skip(long offset)
+MappedFile::~MappedFile()
 {
-    if (std::fseek(s_file, offset, SEEK_CUR) != 0)
-        FATAL_ERROR("error: failed to skip %ld bytes in \"%s\"", offset, s_elfPath.c_str());
 }
 
-static std::uint32_t ReadInt8()
+#else
+
+MappedFile::MappedFile(const std::string& path)
 {
-    int c = std::fgetc(s_file);
+    int fd = open(path.c_str(), O_RDONLY);
 
-    if (c < 0)
-        FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", s_elfPath.c_str());
+    if (fd < 0)
+        FATAL_ERROR("error: failed to open \"%s\" for reading\n", path.c_str());
 
-    return c;
-}
+    struct stat st;
 
-static std::uint32_t ReadInt16()
-{
-    std::uint32_t val = 0;
-    val |= ReadInt8();
-    val |= ReadInt8() << 8;
-    return val;
+    if (fstat(fd, &st) != 0)
+        FATAL_ERROR("error: failed to read \"%s\"\n", path.c_str());
+
+    m_data = NULL;
+    m_size = st.st_size;
+
+    if (m_size != 0)
+    {
+        void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+            FATAL_ERROR("error: failed to map \"%s\"\n", path.c_str());
+
+        m_data = static_cast<const unsigned char *>(data);
+    }
+
+    close(fd);
 }
 
-static std::uint32_t ReadInt32()
+MappedFile::~MappedFile()
 {
-    std::uint32_t val = 0;
-    val |= ReadInt8();
-    val |= ReadInt8() << 8;
-    val |= ReadInt8() << 16;
-    val |= ReadInt8() << 24;
-    return val;
+    if (m_data != NULL)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
 }
 
-static std::string ReadString()
+#endif // _WIN32
+
+// Bounds-checked little-endian reads from an ELF file in memory
+struct ElfView
 {
-    std::string s;
-    char c;
+    const std::string& path;
+    const unsigned char *data;
+    std::size_t size;
 
-    while ((c = ReadInt8()) != 0)
-        s += c;
+    const unsigned char *At(std::uint32_t offset, std::uint32_t length) const
+    {
+        if (offset > size || length > size - offset)
+            FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", path.c_str());
 
-    return s;
-}
+        return data + offset;
+    }
 
-static void VerifyElfIdent()
-{
-    char expectedMagic[4] = { 0x7F, 'E', 'L', 'F' };
-    char magic[4];
+    std::uint32_t ReadInt16(std::uint32_t offset) const
+    {
+        const unsigned char *p = At(offset, 2);
+        return p[0] | (p[1] << 8);
+    }
 
-    if (std::fread(magic, 4, 1, s_file) != 1)
-        FATAL_ERROR("error: failed to read ELF magic from \"%s\"\n", s_elfPath.c_str());
+    std::uint32_t ReadInt32(std::uint32_t offset) const
+    {
+        const unsigned char *p = At(offset, 4);
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    }
 
-    if (std::memcmp(magic, expectedMagic, 4) != 0)
-        FATAL_ERROR("error: ELF magic did not match in \"%s\"\n", s_elfPath.c_str());
+    // Returns the NUL-terminated string at offset, which must end inside the file.
+    const char *ReadString(std::uint32_t offset) const
+    {
+        const unsigned char *p = At(offset, 0);
 
-    if (std::fgetc(s_file) != 1)
-        FATAL_ERROR("error: \"%s\" not 32-bit ELF\n", s_elfPath.c_str());
+        if (std::memchr(p, 0, size - offset) == NULL)
+            FATAL_ERROR("error: unexpected EOF when reading ELF file \"%s\"\n", path.c_str());
 
-    if (std::fgetc(s_file) != 1)
-        FATAL_ERROR("error: \"%s\" not little-endian ELF\n", s_elfPath.c_str());
-}
+        return reinterpret_cast<const char *>(p);
+    }
+};
 
-static void ReadElfHeader()
+static void VerifyElfIdent(const ElfView& elf)
 {
-    Seek(0x20);
-    s_sectionHeaderOffset = ReadInt32();
-    Seek(0x2E);
-    s_sectionHeaderEntrySize = ReadInt16();
-    s_sectionCount = ReadInt16();
-    s_shstrtabIndex = ReadInt16();
-}
+    const char expectedMagic[4] = { 0x7F, 'E', 'L', 'F' };
 
-static std::string GetSectionName(std::uint32_t shstrtabOffset, int index)
-{
-    Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * index);
-    std::uint32_t nameOffset = ReadInt32();
-    Seek(shstrtabOffset + nameOffset);
-    return ReadString();
+    if (elf.size < 6)
+        FATAL_ERROR("error: failed to read ELF magic from \"%s\"\n", elf.path.c_str());
+
+    if (std::memcmp(elf.data, expectedMagic, 4) != 0)
+        FATAL_ERROR("error: ELF magic did not match in \"%s\"\n", elf.path.c_str());
+
+    if (elf.data[4] != 1)
+        FATAL_ERROR("error: \"%s\" not 32-bit ELF\n", elf.path.c_str());
+
+    if (elf.data[5] != 1)
+        FATAL_ERROR("error: \"%s\" not little-endian ELF\n", elf.path.c_str());
 }
 
-static void FindTableOffsets()
+// Walks the section headers and the symbol table where they lie in the file.
+static CommonSymbols GetCommonSymbols_Shared(const ElfView& elf)
 {
-    s_symtabOffset = 0;
-    s_strtabOffset = 0;
-    s_pseudoCommonSectionIndex = 0;
+    VerifyElfIdent(elf);
 
-    Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * s_shstrtabIndex + 0x10);
-    std::uint32_t shstrtabOffset = ReadInt32();
+    std::uint32_t sectionHeaderOffset = elf.ReadInt32(0x20);
+    std::uint32_t sectionHeaderEntrySize = elf.ReadInt16(0x2E);
+    std::uint32_t sectionCount = elf.ReadInt16(0x30);
+    std::uint32_t shstrtabIndex = elf.ReadInt16(0x32);
 
-    for (int i = 0; i < s_sectionCount; i++)
+    std::uint32_t shstrtabOffset = elf.ReadInt32(sectionHeaderOffset + sectionHeaderEntrySize * shstrtabIndex + 0x10);
+    std::uint32_t symtabOffset = 0;
+    std::uint32_t symbolCount = 0;
+    std::uint32_t strtabOffset = 0;
+    std::uint32_t pseudoCommonSectionIndex = 0;
+
+    for (std::uint32_t i = 0; i < sectionCount; i++)
     {
-        std::string name = GetSectionName(shstrtabOffset, i);
+        std::uint32_t header = sectionHeaderOffset + sectionHeaderEntrySize * i;
+        const char *name = elf.ReadString(shstrtabOffset + elf.ReadInt32(header));
 
-        if (name == ".symtab")
+        if (std::strcmp(name, ".symtab") == 0)
+        {
+            if (symtabOffset)
+                FATAL_ERROR("error: mutiple .symtab sections found in \"%s\"\n", elf.path.c_str());
+            symtabOffset = elf.ReadInt32(header + 0x10);
+            symbolCount = elf.ReadInt32(header + 0x14) / 16;
+        }
+        else if (std::strcmp(name, ".strtab") == 0)
         {
-            if (s_symtabOffset)
-                FATAL_ERROR("error: mutiple .symtab sections found in \"%s\"\n", s_elfPath.c_str());
-            Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * i + 0x10);
-            s_symtabOffset = ReadInt32();
-            std::uint32_t size = ReadInt32();
-            s_symbolCount = size / 16;
+            if (strtabOffset)
+                FATAL_ERROR("error: mutiple .strtab sections found in \"%s\"\n", elf.path.c_str());
+            strtabOffset = elf.ReadInt32(header + 0x10);
         }
-        else if (name == ".strtab")
+        else if (std::strcmp(name, "common_data") == 0)
         {
-            if (s_strtabOffset)
-                FATAL_ERROR("error: mutiple .strtab sections found in \"%s\"\n", s_elfPath.c_str());
-            Seek(s_sectionHeaderOffset + s_sectionHeaderEntrySize * i + 0x10);
-            s_strtabOffset = ReadInt32();
-        } else if (name == "common_data") {
-            if (s_pseudoCommonSectionIndex) {
-                FATAL_ERROR("error: mutiple common_data sections found in \"%s\"\n", s_elfPath.c_str());
-            }
-            s_pseudoCommonSectionIndex = i;
+            if (pseudoCommonSectionIndex)
+                FATAL_ERROR("error: mutiple common_data sections found in \"%s\"\n", elf.path.c_str());
+            pseudoCommonSectionIndex = i;
         }
     }
 
-    if (!s_symtabOffset)
-        FATAL_ERROR("error: couldn't find .symtab section in \"%s\"\n", s_elfPath.c_str());
+    if (!symtabOffset)
+        FATAL_ERROR("error: couldn't find .symtab section in \"%s\"\n", elf.path.c_str());
 
-    if (!s_strtabOffset)
-        FATAL_ERROR("error: couldn't find .strtab section in \"%s\"\n", s_elfPath.c_str());
-}
+    if (!strtabOffset)
+        FATAL_ERROR("error: couldn't find .strtab section in \"%s\"\n", elf.path.c_str());
 
-static std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols_Shared()
-{
-    VerifyElfIdent();
-    ReadElfHeader();
-    FindTableOffsets();
+    CommonSymbols commonSymbols;
 
-    std::vector<std::pair<std::string, std::uint32_t>> commonSymbols;
+    if (pseudoCommonSectionIndex)
+    {
+        elf.At(symtabOffset, symbolCount * 16);
 
-    if (s_pseudoCommonSectionIndex) {
-        std::vector<Symbol> commonSymbolVec;
-    
-        Seek(s_symtabOffset);
-    
-        for (std::uint32_t i = 0; i < s_symbolCount; i++)
-        {
-            Symbol sym;
-            sym.nameOffset = ReadInt32();
-            Skip(4);
-            sym.size = ReadInt32();
-            Skip(2);
-            std::uint16_t sectionIndex = ReadInt16();
-            if (sectionIndex == s_pseudoCommonSectionIndex)
-                commonSymbolVec.push_back(sym);
-        }
-    
-        for (const Symbol& sym : commonSymbolVec)
+        for (std::uint32_t i = 0; i < symbolCount; i++)
         {
-            Seek(s_strtabOffset + sym.nameOffset);
-            std::string name = ReadString();
-            if (name == "$d" || name == "") {
+            std::uint32_t symbol = symtabOffset + i * 16;
+
+            if (elf.ReadInt16(symbol + 14) != pseudoCommonSectionIndex)
+                continue;
+
+            const char *name = elf.ReadString(strtabOffset + elf.ReadInt32(symbol));
+
+            if (std::strcmp(name, "$d") == 0 || name[0] == 0)
                 continue;
-            }
-            commonSymbols.emplace_back(name, sym.size);
+
+            commonSymbols.emplace_back(name, elf.ReadInt32(symbol + 8));
         }
     }
 
     return commonSymbols;
 }
 
-std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols(std::string sourcePath, std::string path)
+static std::string ObjectPath(const std::string& sourcePath, const std::string& path)
 {
-    s_elfFileOffset = 0;
     if (path[0] == '*')
         FATAL_ERROR("error: library common syms are unsupported (filename: \"%s\")\n", path.c_str());
 
-    s_elfPath = sourcePath + "/" + path;
-    s_file = std::fopen(s_elfPath.c_str(), "rb");
+    return sourcePath + "/" + path;
+}
+
+static CommonSymbols ReadCommonSymbols(const std::string& elfPath)
+{
+    MappedFile file(elfPath);
+    ElfView elf = { elfPath, file.Data(), file.Size() };
+
+    return GetCommonSymbols_Shared(elf);
+}
+
+CommonSymbols GetCommonSymbols(std::string sourcePath, std::string path)
+{
+    return ReadCommonSymbols(ObjectPath(sourcePath, path));
+}
+
+// What an object looked like when its common symbols were read
+struct ObjectStamp
+{
+    long long mtime;
+    long long mtimeNsec;
+    long long size;
 
-    if (s_file == NULL)
+    bool operator==(const ObjectStamp& other) const
+    {
+        return mtime == other.mtime && mtimeNsec == other.mtimeNsec && size == other.size;
+    }
+};
+
+struct CacheEntry
+{
+    ObjectStamp stamp;
+    CommonSymbols symbols;
+};
+
+static ObjectStamp GetObjectStamp(const std::string& path)
+{
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0)
         FATAL_ERROR("error: failed to open \"%s\" for reading\n", path.c_str());
 
-    return GetCommonSymbols_Shared();
+    ObjectStamp stamp;
+    stamp.mtime = st.st_mtime;
+#if defined(__APPLE__)
+    stamp.mtimeNsec = st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp.mtimeNsec = 0;
+#else
+    stamp.mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+    stamp.size = st.st_size;
+    return stamp;
+}
+
+// The cache holds, for each object, its stamp and common symbols. A cache that can't be
+// read is ignored.
+static std::map<std::string, CacheEntry> ReadCache(const std::string& cachePath)
+{
+    std::map<std::string, CacheEntry> cache;
+    std::ifstream file(cachePath);
+    std::string line;
+
+    if (!std::getline(file, line) || line != CACHE_VERSION)
+        return cache;
+
+    std::string path;
+
+    while (std::getline(file, path))
+    {
+        CacheEntry entry;
+        std::size_t count;
+
+        if (!(file >> entry.stamp.mtime >> entry.stamp.mtimeNsec >> entry.stamp.size >> count))
+            return std::map<std::string, CacheEntry>();
+
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::string name;
+            std::uint32_t size;
+
+            if (!(file >> name >> size))
+                return std::map<std::string, CacheEntry>();
+
+            entry.symbols.emplace_back(name, size);
+        }
+
+        file.ignore(1);
+        cache[path] = entry;
+    }
+
+    return cache;
+}
+
+static void WriteCache(const std::string& cachePath, const std::map<std::string, CacheEntry>& cache)
+{
+    std::string tempPath = cachePath + ".tmp";
+    FILE *file = std::fopen(tempPath.c_str(), "w");
+
+    // The cache only saves time, so go without it if it can't be written.
+    if (file == NULL)
+        return;
+
+    std::fprintf(file, "%s\n", CACHE_VERSION);
+
+    for (const auto& it : cache)
+    {
+        const CacheEntry& entry = it.second;
+
+        std::fprintf(file, "%s\n%lld %lld %lld %lu\n", it.first.c_str(),
+            entry.stamp.mtime, entry.stamp.mtimeNsec, entry.stamp.size, (unsigned long)entry.symbols.size());
+
+        for (const auto& symbol : entry.symbols)
+            std::fprintf(file, "%s %u\n", symbol.first.c_str(), (unsigned)symbol.second);
+    }
+
+    bool ok = std::ferror(file) == 0;
+
+    if (std::fclose(file) != 0 || !ok || std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+        std::remove(tempPath.c_str());
+}
+
+std::vector<CommonSymbols> GetCommonSymbols(std::string sourcePath, const std::vector<std::string>& paths, std::string cachePath)
+{
+    std::vector<std::string> elfPaths;
+    std::vector<ObjectStamp> stamps;
+
+    for (const std::string& path : paths)
+    {
+        elfPaths.push_back(ObjectPath(sourcePath, path));
+        stamps.push_back(GetObjectStamp(elfPaths.back()));
+    }
+
+    std::map<std::string, CacheEntry> cache;
+
+    if (!cachePath.empty())
+        cache = ReadCache(cachePath);
+
+    std::vector<CommonSymbols> results(paths.size());
+    std::vector<std::size_t> stale;
+
+    for (std::size_t i = 0; i < paths.size(); i++)
+    {
+        auto it = cache.find(elfPaths[i]);
+
+        if (it != cache.end() && it->second.stamp == stamps[i])
+            results[i] = it->second.symbols;
+        else
+            stale.push_back(i);
+    }
+
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&]() {
+        std::size_t i;
+
+        while ((i = next++) < stale.size())
+            results[stale[i]] = ReadCommonSymbols(elfPaths[stale[i]]);
+    };
+
+    std::size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    if (threadCount > stale.size())
+        threadCount = stale.size();
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (!cachePath.empty() && !stale.empty())
+    {
+        for (std::size_t i : stale)
+        {
+            CacheEntry& entry = cache[elfPaths[i]];
+            entry.stamp = stamps[i];
+            entry.symbols = results[i];
+        }
+
+        WriteCache(cachePath, cache);
+    }
+
+    return results;
 }
@@ -25,6 +25,13 @@
 #include <vector>
 #include <string>
 
-std::vector<std::pair<std::string, std::uint32_t>> GetCommonSymbols(std::string sourcePath, std::string path);
+typedef std::vector<std::pair<std::string, std::uint32_t>> CommonSymbols;
+
+CommonSymbols GetCommonSymbols(std::string sourcePath, std::string path);
+
+// Reads the common symbols of each object in paths, in parallel. Objects whose modification
+// time and size match an entry in the cache file at cachePath are not read again. An empty
+// cachePath disables the cache.
+std::vector<CommonSymbols> GetCommonSymbols(std::string sourcePath, const std::vector<std::string>& paths, std::string cachePath);
 
 #endif // ELF_H
@@ -20,15 +20,60 @@
 
 #include <cstdio>
 #include <cstring>
+#include <cstdarg>
 #include <string>
+#include <vector>
 #include "ramscrgen.h"
 #include "sym_file.h"
 #include "elf.h"
 
-void HandleCommonInclude(std::string filename, std::string sourcePath, std::string symOrderPath, std::string lang)
+// Output is held back until the common symbols of every included object have been read.
+static std::string s_output;
+
+// An object included in common mode, and where its symbols go in the output
+struct CommonInclude
+{
+    std::size_t outputOffset;
+    std::string filename;
+};
+
+static std::vector<CommonInclude> s_commonIncludes;
+
+static void Emit(const char *format, ...)
+{
+    char buffer[1024];
+    std::va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0)
+        FATAL_ERROR("error: failed to format output\n");
+
+    if ((std::size_t)length < sizeof(buffer))
+    {
+        s_output.append(buffer, length);
+    }
+    else
+    {
+        std::vector<char> longBuffer(length + 1);
+        va_start(args, format);
+        std::vsnprintf(longBuffer.data(), longBuffer.size(), format, args);
+        va_end(args);
+        s_output.append(longBuffer.data(), length);
+    }
+}
+
+void HandleCommonInclude(std::string filename)
 {
-    auto commonSymbols = GetCommonSymbols(sourcePath, filename);
+    CommonInclude include;
+    include.outputOffset = s_output.size();
+    include.filename = filename;
+    s_commonIncludes.push_back(include);
+}
 
+void EmitCommonSymbols(const CommonSymbols& commonSymbols)
+{
     for (const auto& commonSym : commonSymbols)
     {
         unsigned long size = commonSym.second;
@@ -38,12 +83,38 @@ void HandleCommonInclude(std::string filename, std::string sourcePath, std::stri
             alignment = 8;
         if (size > 8)
             alignment = 16;
-        printf(". = ALIGN(%d);\n", alignment);
-        printf("%s = .;\n", commonSym.first.c_str());
-        printf(". += 0x%lX;\n", size);
+        Emit(". = ALIGN(%d);\n", alignment);
+        Emit("%s = .;\n", commonSym.first.c_str());
+        Emit(". += 0x%lX;\n", size);
     }
 }
 
+// Reads the common symbols of all included objects at once and writes them out in place.
+void WriteOutput(std::string sourcePath)
+{
+    std::vector<std::string> filenames;
+
+    for (const CommonInclude& include : s_commonIncludes)
+        filenames.push_back(include.filename);
+
+    std::vector<CommonSymbols> commonSymbols = GetCommonSymbols(sourcePath, filenames, filenames.empty() ? "" : sourcePath + "/sym_common.cache");
+
+    std::string output;
+    output.swap(s_output);
+
+    std::size_t offset = 0;
+
+    for (std::size_t i = 0; i < s_commonIncludes.size(); i++)
+    {
+        s_output.append(output, offset, s_commonIncludes[i].outputOffset - offset);
+        offset = s_commonIncludes[i].outputOffset;
+        EmitCommonSymbols(commonSymbols[i]);
+    }
+
+    s_output.append(output, offset, std::string::npos);
+    std::fwrite(s_output.data(), 1, s_output.size(), stdout);
+}
+
 void ConvertSymFile(std::string filename, std::string sectionName, std::string lang, bool common, std::string sourcePath, std::string commonSymPath, std::string libSourcePath)
 {
     SymFile symFile(filename);
@@ -60,11 +131,11 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
         {
             std::string incFilename = symFile.ReadPath();
             symFile.ExpectEmptyRestOfLine();
-            printf(". = ALIGN(4);\n");
+            Emit(". = ALIGN(4);\n");
             if (common)
-                HandleCommonInclude(incFilename, incFilename[0] == '*' ? libSourcePath : sourcePath, commonSymPath, lang);
+                HandleCommonInclude(incFilename);
             else
-                printf("%s(%s);\n", incFilename.c_str(), sectionName.c_str());
+                Emit("%s(%s);\n", incFilename.c_str(), sectionName.c_str());
             break;
         }
         case Directive::Space:
@@ -73,7 +144,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
             if (!symFile.ReadInteger(length))
                 symFile.RaiseError("expected integer after .space directive");
             symFile.ExpectEmptyRestOfLine();
-            printf(". += 0x%lX;\n", length);
+            Emit(". += 0x%lX;\n", length);
             break;
         }
         case Directive::Align:
@@ -85,7 +156,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
                 symFile.RaiseError("max alignment amount is 4");
             amount = 1UL << amount;
             symFile.ExpectEmptyRestOfLine();
-            printf(". = ALIGN(%lu);\n", amount);
+            Emit(". = ALIGN(%lu);\n", amount);
             break;
         }
         case Directive::Unknown:
@@ -94,7 +165,7 @@ void ConvertSymFile(std::string filename, std::string sectionName, std::string l
 
             if (label.length() != 0)
             {
-                printf("%s = .;\n", label.c_str());
+                Emit("%s = .;\n", label.c_str());
             }
 
             symFile.ExpectEmptyRestOfLine();
@@ -148,5 +219,6 @@ int main(int argc, char **argv)
     }
 
     ConvertSymFile(symFileName, sectionName, lang, common, sourcePath, commonSymPath, libSourcePath);
+    WriteOutput(sourcePath);
     return 0;
 }